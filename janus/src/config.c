@@ -24,7 +24,7 @@
 
 
 static char *_get_value(janus_config *jcfg, const char *section, const char *option);
-// static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def);
+static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def);
 
 
 us_config_s *us_config_init(const char *config_dir_path) {
@@ -51,6 +51,7 @@ us_config_s *us_config_init(const char *config_dir_path) {
 		US_JLOG_ERROR("config", "Missing config value: video.sink (ex. memsink.object)");
 		goto error;
 	}
+	config->video_hugepages = _get_bool(jcfg, "memsink", "hugepages", false);
 	if ((config->audio_dev_name = _get_value(jcfg, "audio", "device")) != NULL) {
 		if ((config->tc358743_dev_path = _get_value(jcfg, "audio", "tc358743")) == NULL) {
 			US_JLOG_INFO("config", "Missing config value: audio.tc358743");
@@ -84,7 +85,7 @@ static char *_get_value(janus_config *jcfg, const char *section, const char *opt
 	return us_strdup(option_obj->value);
 }
 
-/*static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def) {
+static bool _get_bool(janus_config *jcfg, const char *section, const char *option, bool def) {
 	char *const tmp = _get_value(jcfg, section, option);
 	bool value = def;
 	if (tmp != NULL) {
@@ -92,4 +93,4 @@ static char *_get_value(janus_config *jcfg, const char *section, const char *opt
 		free(tmp);
 	}
 	return value;
-}*/
+}
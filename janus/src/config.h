@@ -36,6 +36,7 @@
 
 typedef struct {
 	char	*video_sink_name;
+	bool	video_hugepages;
 
 	char	*audio_dev_name;
 	char	*tc358743_dev_path;
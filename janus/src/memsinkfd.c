@@ -46,8 +46,8 @@ int us_memsink_fd_wait_frame(int fd, us_memsink_shared_s* mem, uint64_t last_id)
 	return -2;
 }
 
-us_frame_s *us_memsink_fd_get_frame(int fd, us_memsink_shared_s *mem, uint64_t *frame_id, bool key_required) {
-	us_frame_s *frame = us_frame_init();
+us_frame_s *us_memsink_fd_get_frame(int fd, us_memsink_shared_s *mem, us_frame_pool_s *pool, uint64_t *frame_id, bool key_required) {
+	us_frame_s *frame = us_frame_pool_acquire(pool, mem->used);
 	us_frame_set_data(frame, mem->data, mem->used);
 	US_FRAME_COPY_META(mem, frame);
 	*frame_id = mem->id;
@@ -66,7 +66,7 @@ us_frame_s *us_memsink_fd_get_frame(int fd, us_memsink_shared_s *mem, uint64_t *
 		ok = false;
 	}
 	if (!ok) {
-		us_frame_destroy(frame);
+		us_frame_pool_release(pool, frame);
 		frame = NULL;
 	}
 	return frame;
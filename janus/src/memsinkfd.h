@@ -36,4 +36,4 @@
 
 
 int us_memsink_fd_wait_frame(int fd, us_memsink_shared_s* mem, uint64_t last_id);
-us_frame_s *us_memsink_fd_get_frame(int fd, us_memsink_shared_s *mem, uint64_t *frame_id, bool key_required);
+us_frame_s *us_memsink_fd_get_frame(int fd, us_memsink_shared_s *mem, us_frame_pool_s *pool, uint64_t *frame_id, bool key_required);
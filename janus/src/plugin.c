@@ -40,6 +40,7 @@
 #include "uslibs/const.h"
 #include "uslibs/tools.h"
 #include "uslibs/threading.h"
+#include "uslibs/frame.h"
 #include "uslibs/list.h"
 #include "uslibs/memsinksh.h"
 
@@ -62,6 +63,7 @@ const useconds_t	_g_watchers_polling = 100000;
 static us_janus_client_s	*_g_clients = NULL;
 static janus_callbacks		*_g_gw = NULL;
 static us_queue_s			*_g_video_queue = NULL;
+static us_frame_pool_s		*_g_video_frames = NULL;
 static us_rtpv_s			*_g_rtpv = NULL;
 static us_rtpa_s			*_g_rtpa = NULL;
 
@@ -109,7 +111,7 @@ static void *_video_rtp_thread(UNUSED void *arg) {
 			_LOCK_VIDEO;
 			us_rtpv_wrap(_g_rtpv, frame);
 			_UNLOCK_VIDEO;
-			us_frame_destroy(frame);
+			us_frame_pool_release(_g_video_frames, frame);
 		}
 	}
 	return NULL;
@@ -148,7 +150,7 @@ static void *_video_sink_thread(UNUSED void *arg) {
 		while (!_STOP && _HAS_WATCHERS) {
 			const int result = us_memsink_fd_wait_frame(fd, mem, frame_id);
 			if (result == 0) {
-				us_frame_s *const frame = us_memsink_fd_get_frame(fd, mem, &frame_id, atomic_load(&_g_key_required));
+				us_frame_s *const frame = us_memsink_fd_get_frame(fd, mem, _g_video_frames, &frame_id, atomic_load(&_g_key_required));
 				if (frame == NULL) {
 					goto close_memsink;
 				}
@@ -157,7 +159,7 @@ static void *_video_sink_thread(UNUSED void *arg) {
 				}
 				if (us_queue_put(_g_video_queue, frame, 0) != 0) {
 					US_ONCE({ US_JLOG_PERROR("video", "Video queue is full"); });
-					us_frame_destroy(frame);
+					us_frame_pool_release(_g_video_frames, frame);
 				}
 			} else if (result == -1) {
 				goto close_memsink;
@@ -257,6 +259,7 @@ static int _plugin_init(janus_callbacks *gw, const char *config_dir_path) {
 	_g_gw = gw;
 
 	_g_video_queue = us_queue_init(1024);
+	_g_video_frames = us_frame_pool_init("video", 16, _g_config->video_hugepages);
 	_g_rtpv = us_rtpv_init(_relay_rtp_clients);
 	if (_g_config->audio_dev_name != NULL && us_audio_probe(_g_config->audio_dev_name)) {
 		_g_rtpa = us_rtpa_init(_relay_rtp_clients);
@@ -285,6 +288,7 @@ static void _plugin_destroy(void) {
 	});
 
 	US_QUEUE_DELETE_WITH_ITEMS(_g_video_queue, us_frame_destroy);
+	US_DELETE(_g_video_frames, us_frame_pool_destroy);
 
 	US_DELETE(_g_rtpa, us_rtpa_destroy);
 	US_DELETE(_g_rtpv, us_rtpv_destroy);
@@ -23,6 +23,20 @@
 #include "frame.h"
 
 
+#define _HUGEPAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+static const size_t _POOL_CLASS_SIZES[US_FRAME_POOL_N_CLASSES] = {
+	64 * 1024,
+	256 * 1024,
+	1024 * 1024,
+	4 * 1024 * 1024,
+	16 * 1024 * 1024,
+};
+
+
+static void _frame_pool_alloc_data(const us_frame_pool_s *pool, us_frame_s *frame, size_t size);
+
+
 us_frame_s *us_frame_init(void) {
 	us_frame_s *frame;
 	US_CALLOC(frame, 1);
@@ -36,6 +50,110 @@ void us_frame_destroy(us_frame_s *frame) {
 	free(frame);
 }
 
+us_frame_pool_s *us_frame_pool_init(const char *name, unsigned max_free, bool hugepages) {
+	us_frame_pool_s *pool;
+	US_CALLOC(pool, 1);
+	pool->name = name;
+	pool->max_free = max_free;
+	pool->hugepages = hugepages;
+	for (unsigned index = 0; index < US_FRAME_POOL_N_CLASSES; ++index) {
+		pool->classes[index].size = _POOL_CLASS_SIZES[index];
+		US_CALLOC(pool->classes[index].frames, max_free);
+	}
+	US_MUTEX_INIT(pool->mutex);
+	return pool;
+}
+
+void us_frame_pool_destroy(us_frame_pool_s *pool) {
+	for (unsigned index = 0; index < US_FRAME_POOL_N_CLASSES; ++index) {
+		us_frame_pool_class_s *const cls = &pool->classes[index];
+		for (unsigned number = 0; number < cls->n_frames; ++number) {
+			us_frame_destroy(cls->frames[number]);
+		}
+		free(cls->frames);
+	}
+	US_MUTEX_DESTROY(pool->mutex);
+	free(pool);
+}
+
+us_frame_s *us_frame_pool_acquire(us_frame_pool_s *pool, size_t size) {
+	us_frame_s *frame = NULL;
+	size_t alloc_size = size;
+
+	US_MUTEX_LOCK(pool->mutex);
+	for (unsigned index = 0; index < US_FRAME_POOL_N_CLASSES; ++index) {
+		us_frame_pool_class_s *const cls = &pool->classes[index];
+		if (cls->size < size) {
+			continue;
+		}
+		if (alloc_size == size) {
+			alloc_size = cls->size; // Новый кадр выделяем по размеру наименьшего подходящего класса
+		}
+		if (cls->n_frames > 0) {
+			cls->n_frames -= 1;
+			frame = cls->frames[cls->n_frames];
+			break;
+		}
+	}
+	US_MUTEX_UNLOCK(pool->mutex);
+
+	if (frame != NULL) {
+		uint8_t *const data = frame->data;
+		const size_t allocated = frame->allocated;
+		memset(frame, 0, sizeof(*frame));
+		frame->data = data;
+		frame->allocated = allocated;
+	} else {
+		// Больше самого крупного класса - такой кадр в пул не вернется, но выделить его все равно надо
+		US_CALLOC(frame, 1);
+		_frame_pool_alloc_data(pool, frame, alloc_size);
+	}
+	frame->dma_fd = -1;
+	return frame;
+}
+
+void us_frame_pool_release(us_frame_pool_s *pool, us_frame_s *frame) {
+	// Кадр мог вырасти через us_frame_realloc_data(), поэтому класс определяется заново
+	us_frame_pool_class_s *cls = NULL;
+	for (unsigned index = 0; index < US_FRAME_POOL_N_CLASSES; ++index) {
+		if (pool->classes[index].size <= frame->allocated) {
+			cls = &pool->classes[index];
+		}
+	}
+	if (frame->allocated > pool->classes[US_FRAME_POOL_N_CLASSES - 1].size) {
+		cls = NULL; // Больше самого крупного класса не держим, иначе такой кадр надолго застрянет в пуле
+	}
+
+	bool pooled = false;
+	if (cls != NULL) {
+		US_MUTEX_LOCK(pool->mutex);
+		if (cls->n_frames < pool->max_free) {
+			cls->frames[cls->n_frames] = frame;
+			cls->n_frames += 1;
+			pooled = true;
+		}
+		US_MUTEX_UNLOCK(pool->mutex);
+	}
+	if (!pooled) {
+		us_frame_destroy(frame);
+	}
+}
+
+static void _frame_pool_alloc_data(const us_frame_pool_s *pool, us_frame_s *frame, size_t size) {
+	// Выровненный блок остается обычной кучей, так что realloc() и free() для него работают как раньше
+	if (pool->hugepages && size >= _HUGEPAGE_SIZE) {
+		size = (size + _HUGEPAGE_SIZE - 1) / _HUGEPAGE_SIZE * _HUGEPAGE_SIZE;
+		void *data = NULL;
+		if (posix_memalign(&data, _HUGEPAGE_SIZE, size) == 0) {
+			madvise(data, size, MADV_HUGEPAGE); // Best effort, THP may be disabled
+			frame->data = data;
+			frame->allocated = size;
+			return;
+		}
+	}
+	us_frame_realloc_data(frame, size);
+}
+
 void us_frame_realloc_data(us_frame_s *frame, size_t size) {
 	if (frame->allocated < size) {
 		US_REALLOC(frame->data, size);
@@ -29,9 +29,13 @@
 #include <string.h>
 #include <assert.h>
 
+#include <sys/mman.h>
+
+#include <pthread.h>
 #include <linux/videodev2.h>
 
 #include "tools.h"
+#include "threading.h"
 
 
 typedef struct {
@@ -57,6 +61,22 @@ typedef struct {
 	long double	encode_end_ts;
 } us_frame_s;
 
+#define US_FRAME_POOL_N_CLASSES 5
+
+typedef struct {
+	size_t		size;
+	us_frame_s	**frames; // Free frames with at least size bytes allocated
+	unsigned	n_frames;
+} us_frame_pool_class_s;
+
+typedef struct {
+	const char				*name;
+	unsigned				max_free; // Per class
+	bool					hugepages;
+	us_frame_pool_class_s	classes[US_FRAME_POOL_N_CLASSES];
+	pthread_mutex_t			mutex;
+} us_frame_pool_s;
+
 
 #define US_FRAME_COPY_META(x_src, x_dest) { \
 		x_dest->width = x_src->width; \
@@ -105,6 +125,11 @@ static inline void us_frame_encoding_end(us_frame_s *dest) {
 us_frame_s *us_frame_init(void);
 void us_frame_destroy(us_frame_s *frame);
 
+us_frame_pool_s *us_frame_pool_init(const char *name, unsigned max_free, bool hugepages);
+void us_frame_pool_destroy(us_frame_pool_s *pool);
+us_frame_s *us_frame_pool_acquire(us_frame_pool_s *pool, size_t size);
+void us_frame_pool_release(us_frame_pool_s *pool, us_frame_s *frame);
+
 void us_frame_realloc_data(us_frame_s *frame, size_t size);
 void us_frame_set_data(us_frame_s *frame, const uint8_t *data, size_t size);
 void us_frame_append_data(us_frame_s *frame, const uint8_t *data, size_t size);
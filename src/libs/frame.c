@@ -23,6 +23,20 @@
 #include "frame.h"
 
 
+#define _HUGEPAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+static const size_t _POOL_CLASS_SIZES[US_FRAME_POOL_N_CLASSES] = {
+	64 * 1024,
+	256 * 1024,
+	1024 * 1024,
+	4 * 1024 * 1024,
+	16 * 1024 * 1024,
+};
+
+
+static void _frame_pool_alloc_data(const us_frame_pool_s *pool, us_frame_s *frame, size_t size);
+
+
 us_frame_s *us_frame_init(void) {
 	us_frame_s *frame;
 	US_CALLOC(frame, 1);
@@ -36,6 +50,110 @@ void us_frame_destroy(us_frame_s *frame) {
 	free(frame);
 }
 
+us_frame_pool_s *us_frame_pool_init(const char *name, unsigned max_free, bool hugepages) {
+	us_frame_pool_s *pool;
+	US_CALLOC(pool, 1);
+	pool->name = name;
+	pool->max_free = max_free;
+	pool->hugepages = hugepages;
+	for (unsigned index = 0; index < US_FRAME_POOL_N_CLASSES; ++index) {
+		pool->classes[index].size = _POOL_CLASS_SIZES[index];
+		US_CALLOC(pool->classes[index].frames, max_free);
+	}
+	US_MUTEX_INIT(pool->mutex);
+	return pool;
+}
+
+void us_frame_pool_destroy(us_frame_pool_s *pool) {
+	for (unsigned index = 0; index < US_FRAME_POOL_N_CLASSES; ++index) {
+		us_frame_pool_class_s *const cls = &pool->classes[index];
+		for (unsigned number = 0; number < cls->n_frames; ++number) {
+			us_frame_destroy(cls->frames[number]);
+		}
+		free(cls->frames);
+	}
+	US_MUTEX_DESTROY(pool->mutex);
+	free(pool);
+}
+
+us_frame_s *us_frame_pool_acquire(us_frame_pool_s *pool, size_t size) {
+	us_frame_s *frame = NULL;
+	size_t alloc_size = size;
+
+	US_MUTEX_LOCK(pool->mutex);
+	for (unsigned index = 0; index < US_FRAME_POOL_N_CLASSES; ++index) {
+		us_frame_pool_class_s *const cls = &pool->classes[index];
+		if (cls->size < size) {
+			continue;
+		}
+		if (alloc_size == size) {
+			alloc_size = cls->size; // Новый кадр выделяем по размеру наименьшего подходящего класса
+		}
+		if (cls->n_frames > 0) {
+			cls->n_frames -= 1;
+			frame = cls->frames[cls->n_frames];
+			break;
+		}
+	}
+	US_MUTEX_UNLOCK(pool->mutex);
+
+	if (frame != NULL) {
+		uint8_t *const data = frame->data;
+		const size_t allocated = frame->allocated;
+		memset(frame, 0, sizeof(*frame));
+		frame->data = data;
+		frame->allocated = allocated;
+	} else {
+		// Больше самого крупного класса - такой кадр в пул не вернется, но выделить его все равно надо
+		US_CALLOC(frame, 1);
+		_frame_pool_alloc_data(pool, frame, alloc_size);
+	}
+	frame->dma_fd = -1;
+	return frame;
+}
+
+void us_frame_pool_release(us_frame_pool_s *pool, us_frame_s *frame) {
+	// Кадр мог вырасти через us_frame_realloc_data(), поэтому класс определяется заново
+	us_frame_pool_class_s *cls = NULL;
+	for (unsigned index = 0; index < US_FRAME_POOL_N_CLASSES; ++index) {
+		if (pool->classes[index].size <= frame->allocated) {
+			cls = &pool->classes[index];
+		}
+	}
+	if (frame->allocated > pool->classes[US_FRAME_POOL_N_CLASSES - 1].size) {
+		cls = NULL; // Больше самого крупного класса не держим, иначе такой кадр надолго застрянет в пуле
+	}
+
+	bool pooled = false;
+	if (cls != NULL) {
+		US_MUTEX_LOCK(pool->mutex);
+		if (cls->n_frames < pool->max_free) {
+			cls->frames[cls->n_frames] = frame;
+			cls->n_frames += 1;
+			pooled = true;
+		}
+		US_MUTEX_UNLOCK(pool->mutex);
+	}
+	if (!pooled) {
+		us_frame_destroy(frame);
+	}
+}
+
+static void _frame_pool_alloc_data(const us_frame_pool_s *pool, us_frame_s *frame, size_t size) {
+	// Выровненный блок остается обычной кучей, так что realloc() и free() для него работают как раньше
+	if (pool->hugepages && size >= _HUGEPAGE_SIZE) {
+		size = (size + _HUGEPAGE_SIZE - 1) / _HUGEPAGE_SIZE * _HUGEPAGE_SIZE;
+		void *data = NULL;
+		if (posix_memalign(&data, _HUGEPAGE_SIZE, size) == 0) {
+			madvise(data, size, MADV_HUGEPAGE); // Best effort, THP may be disabled
+			frame->data = data;
+			frame->allocated = size;
+			return;
+		}
+	}
+	us_frame_realloc_data(frame, size);
+}
+
 void us_frame_realloc_data(us_frame_s *frame, size_t size) {
 	if (frame->allocated < size) {
 		US_REALLOC(frame->data, size);
@@ -47,23 +165,44 @@ void us_frame_set_data(us_frame_s *frame, const uint8_t *data, size_t size) {
 	us_frame_realloc_data(frame, size);
 	memcpy(frame->data, data, size);
 	frame->used = size;
+	frame->n_iov = 0;
 }
 
 void us_frame_append_data(us_frame_s *frame, const uint8_t *data, size_t size) {
+	assert(frame->n_iov == 0);
 	const size_t new_used = frame->used + size;
 	us_frame_realloc_data(frame, new_used);
 	memcpy(frame->data + frame->used, data, size);
 	frame->used = new_used;
 }
 
+void us_frame_read_data(const us_frame_s *frame, uint8_t *dest) {
+	if (frame->n_iov == 0) {
+		memcpy(dest, frame->data, frame->used);
+		return;
+	}
+	for (unsigned index = 0; index < frame->n_iov; ++index) {
+		memcpy(dest, frame->iov[index].iov_base, frame->iov[index].iov_len);
+		dest += frame->iov[index].iov_len;
+	}
+}
+
 void us_frame_copy(const us_frame_s *src, us_frame_s *dest) {
-	us_frame_set_data(dest, src->data, src->used);
-	US_FRAME_COPY_META(src, dest);
+	us_frame_realloc_data(dest, src->used);
+	us_frame_read_data(src, dest->data);
+	dest->used = src->used;
+	dest->n_iov = 0;
+	us_frame_copy_meta(src, dest);
 }
 
 bool us_frame_compare(const us_frame_s *a, const us_frame_s *b) {
+	if (a->hash != 0 && b->hash != 0) {
+		// Оба кадра получены из захваченных и уже посчитанных, данные можно не сравнивать
+		return (US_FRAME_COMPARE_META_USED_NOTS(a, b) && a->hash == b->hash);
+	}
 	return (
 		a->allocated && b->allocated
+		&& a->n_iov == 0 && b->n_iov == 0 // Без хешей собирать разрозненный кадр ради сравнения не стоит
 		&& US_FRAME_COMPARE_META_USED_NOTS(a, b)
 		&& !memcmp(a->data, b->data, b->used)
 	);
@@ -76,6 +215,9 @@ unsigned us_frame_get_padding(const us_frame_s *frame) {
 		case V4L2_PIX_FMT_UYVY:
 		case V4L2_PIX_FMT_RGB565: bytes_per_pixel = 2; break;
 		case V4L2_PIX_FMT_RGB24: bytes_per_pixel = 3; break;
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV24: bytes_per_pixel = 1; break; // Luma plane
 		// case V4L2_PIX_FMT_H264:
 		case V4L2_PIX_FMT_MJPEG:
 		case V4L2_PIX_FMT_JPEG: bytes_per_pixel = 0; break;
@@ -87,6 +229,42 @@ unsigned us_frame_get_padding(const us_frame_s *frame) {
 	return 0;
 }
 
+unsigned us_frame_get_planes_layout(unsigned format, unsigned stride, unsigned height, us_frame_plane_s *planes) {
+	// Раскладка плоскостей, идущих в памяти одна за другой, как это делает V4L2 для не-M форматов
+	unsigned chroma_stride = stride;
+	unsigned chroma_height = height;
+	switch (format) {
+		case V4L2_PIX_FMT_NV12: chroma_height = height / 2; break;
+		case V4L2_PIX_FMT_NV16: break;
+		case V4L2_PIX_FMT_NV24: chroma_stride = stride * 2; break;
+		default: return 0;
+	}
+	planes[0].offset = 0;
+	planes[0].stride = stride;
+	planes[0].size = (size_t)stride * height;
+	planes[1].offset = planes[0].size;
+	planes[1].stride = chroma_stride;
+	planes[1].size = (size_t)chroma_stride * chroma_height;
+	return 2;
+}
+
+const uint8_t *us_frame_get_plane(const us_frame_s *frame, unsigned index, unsigned *stride) {
+	if (frame->n_planes == 0) {
+		us_frame_plane_s planes[US_FRAME_MAX_PLANES];
+		const unsigned n_planes = us_frame_get_planes_layout(frame->format, frame->stride, frame->height, planes);
+		if (index >= n_planes) {
+			assert(index == 0);
+			*stride = frame->stride;
+			return frame->data;
+		}
+		*stride = planes[index].stride;
+		return frame->data + planes[index].offset;
+	}
+	assert(index < frame->n_planes);
+	*stride = frame->planes[index].stride;
+	return frame->data + frame->planes[index].offset;
+}
+
 const char *us_fourcc_to_string(unsigned format, char *buf, size_t size) {
 	assert(size >= 8);
 	buf[0] = format & 0x7F;
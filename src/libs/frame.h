@@ -29,10 +29,24 @@
 #include <string.h>
 #include <assert.h>
 
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#include <pthread.h>
 #include <linux/videodev2.h>
 
 #include "tools.h"
+#include "threading.h"
+
 
+#define US_FRAME_MAX_PLANES 3
+#define US_FRAME_MAX_IOV 3
+
+typedef struct {
+	size_t		offset; // From the frame data
+	size_t		size;
+	unsigned	stride;
+} us_frame_plane_s;
 
 typedef struct {
 	uint8_t		*data;
@@ -48,15 +62,46 @@ typedef struct {
 	// https://www.kernel.org/doc/html/v4.14/media/uapi/v4l/pixfmt-v4l2.html
 	// https://medium.com/@oleg.shipitko/what-does-stride-mean-in-image-processing-bba158a72bcd
 
+	// Layout of the semi-planar formats. Zero means the contiguous planes
+	// computed from the stride and the height (see us_frame_get_plane()).
+	unsigned	n_planes;
+	us_frame_plane_s	planes[US_FRAME_MAX_PLANES];
+
+	// Zero-copy passthrough: the frame content is scattered over the foreign memory
+	// described by iov instead of data, the used field still contains the total size.
+	// Use us_frame_read_data() if a contiguous copy is needed.
+	unsigned		n_iov;
+	struct iovec	iov[US_FRAME_MAX_IOV];
+
 	bool		online;
 	bool		key;
 	unsigned	gop;
 
+	// Content hash of the raw source frame (see --drop-same-frames), zero if unknown.
+	// Encoded frames inherit it from the source in us_frame_encoding_begin().
+	uint64_t	hash;
+
 	long double	grab_ts;
 	long double	encode_begin_ts;
 	long double	encode_end_ts;
 } us_frame_s;
 
+#define US_FRAME_POOL_N_CLASSES 5
+
+typedef struct {
+	size_t		size;
+	us_frame_s	**frames; // Free frames with at least size bytes allocated
+	unsigned	n_frames;
+} us_frame_pool_class_s;
+
+typedef struct {
+	const char				*name;
+	unsigned				max_free; // Per class
+	bool					hugepages;
+	us_frame_pool_class_s	classes[US_FRAME_POOL_N_CLASSES];
+	pthread_mutex_t			mutex;
+} us_frame_pool_s;
+
 
 #define US_FRAME_COPY_META(x_src, x_dest) { \
 		x_dest->width = x_src->width; \
@@ -73,6 +118,10 @@ typedef struct {
 
 static inline void us_frame_copy_meta(const us_frame_s *src, us_frame_s *dest) {
 	US_FRAME_COPY_META(src, dest);
+	// Плоскости не входят в US_FRAME_COPY_META, потому что в memsink их нет
+	dest->n_planes = src->n_planes;
+	memcpy(dest->planes, src->planes, sizeof(src->planes));
+	dest->hash = src->hash;
 }
 
 #define US_FRAME_COMPARE_META_USED_NOTS(x_a, x_b) ( \
@@ -93,6 +142,8 @@ static inline void us_frame_encoding_begin(const us_frame_s *src, us_frame_s *de
 	dest->encode_begin_ts = us_get_now_monotonic();
 	dest->format = format;
 	dest->stride = 0;
+	dest->n_planes = 0;
+	dest->n_iov = 0;
 	dest->used = 0;
 }
 
@@ -105,17 +156,29 @@ static inline void us_frame_encoding_end(us_frame_s *dest) {
 us_frame_s *us_frame_init(void);
 void us_frame_destroy(us_frame_s *frame);
 
+us_frame_pool_s *us_frame_pool_init(const char *name, unsigned max_free, bool hugepages);
+void us_frame_pool_destroy(us_frame_pool_s *pool);
+us_frame_s *us_frame_pool_acquire(us_frame_pool_s *pool, size_t size);
+void us_frame_pool_release(us_frame_pool_s *pool, us_frame_s *frame);
+
 void us_frame_realloc_data(us_frame_s *frame, size_t size);
 void us_frame_set_data(us_frame_s *frame, const uint8_t *data, size_t size);
 void us_frame_append_data(us_frame_s *frame, const uint8_t *data, size_t size);
+void us_frame_read_data(const us_frame_s *frame, uint8_t *dest);
 
 void us_frame_copy(const us_frame_s *src, us_frame_s *dest);
 bool us_frame_compare(const us_frame_s *a, const us_frame_s *b);
 
 unsigned us_frame_get_padding(const us_frame_s *frame);
+unsigned us_frame_get_planes_layout(unsigned format, unsigned stride, unsigned height, us_frame_plane_s *planes);
+const uint8_t *us_frame_get_plane(const us_frame_s *frame, unsigned index, unsigned *stride);
 
 const char *us_fourcc_to_string(unsigned format, char *buf, size_t size);
 
 static inline bool us_is_jpeg(unsigned format) {
 	return (format == V4L2_PIX_FMT_JPEG || format == V4L2_PIX_FMT_MJPEG);
 }
+
+static inline bool us_is_semiplanar(unsigned format) {
+	return (format == V4L2_PIX_FMT_NV12 || format == V4L2_PIX_FMT_NV16 || format == V4L2_PIX_FMT_NV24);
+}
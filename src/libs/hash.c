@@ -0,0 +1,117 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "hash.h"
+
+
+// XXH64: https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+// Четыре независимые полосы по 8 байт, компилятор сам раскладывает их по регистрам
+
+#define _PRIME_1 0x9E3779B185EBCA87ULL
+#define _PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define _PRIME_3 0x165667B19E3779F9ULL
+#define _PRIME_4 0x85EBCA77C2B2AE63ULL
+#define _PRIME_5 0x27D4EB2F165667C5ULL
+
+
+static inline uint64_t _rotl(uint64_t value, unsigned bits);
+static inline uint64_t _read64(const uint8_t *ptr);
+static inline uint32_t _read32(const uint8_t *ptr);
+static inline uint64_t _round(uint64_t acc, uint64_t input);
+static inline uint64_t _merge_round(uint64_t acc, uint64_t value);
+
+
+uint64_t us_hash64(const uint8_t *data, size_t size) {
+	const uint8_t *ptr = data;
+	const uint8_t *const end = data + size;
+	uint64_t hash;
+
+	if (size >= 32) {
+		uint64_t v1 = _PRIME_1 + _PRIME_2;
+		uint64_t v2 = _PRIME_2;
+		uint64_t v3 = 0;
+		uint64_t v4 = -_PRIME_1;
+		for (const uint8_t *const limit = end - 32; ptr <= limit; ptr += 32) {
+			v1 = _round(v1, _read64(ptr));
+			v2 = _round(v2, _read64(ptr + 8));
+			v3 = _round(v3, _read64(ptr + 16));
+			v4 = _round(v4, _read64(ptr + 24));
+		}
+		hash = _rotl(v1, 1) + _rotl(v2, 7) + _rotl(v3, 12) + _rotl(v4, 18);
+		hash = _merge_round(hash, v1);
+		hash = _merge_round(hash, v2);
+		hash = _merge_round(hash, v3);
+		hash = _merge_round(hash, v4);
+	} else {
+		hash = _PRIME_5;
+	}
+	hash += (uint64_t)size;
+
+	for (; ptr + 8 <= end; ptr += 8) {
+		hash ^= _round(0, _read64(ptr));
+		hash = _rotl(hash, 27) * _PRIME_1 + _PRIME_4;
+	}
+	if (ptr + 4 <= end) {
+		hash ^= (uint64_t)_read32(ptr) * _PRIME_1;
+		hash = _rotl(hash, 23) * _PRIME_2 + _PRIME_3;
+		ptr += 4;
+	}
+	for (; ptr < end; ++ptr) {
+		hash ^= (*ptr) * _PRIME_5;
+		hash = _rotl(hash, 11) * _PRIME_1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= _PRIME_2;
+	hash ^= hash >> 29;
+	hash *= _PRIME_3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+static inline uint64_t _rotl(uint64_t value, unsigned bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t _read64(const uint8_t *ptr) {
+	uint64_t value;
+	memcpy(&value, ptr, sizeof(value)); // Little-endian only, like the rest of V4L2 stuff here
+	return value;
+}
+
+static inline uint32_t _read32(const uint8_t *ptr) {
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+static inline uint64_t _round(uint64_t acc, uint64_t input) {
+	acc += input * _PRIME_2;
+	acc = _rotl(acc, 31);
+	return acc * _PRIME_1;
+}
+
+static inline uint64_t _merge_round(uint64_t acc, uint64_t value) {
+	acc ^= _round(0, value);
+	return acc * _PRIME_1 + _PRIME_4;
+}
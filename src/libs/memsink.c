@@ -32,6 +32,7 @@ us_memsink_s *us_memsink_init(
 	sink->name = name;
 	sink->obj = obj;
 	sink->server = server;
+	sink->mode = mode;
 	sink->rm = rm;
 	sink->client_ttl = client_ttl;
 	sink->timeout = timeout;
@@ -138,7 +139,7 @@ int us_memsink_server_put(us_memsink_s *sink, const us_frame_s *frame, bool *con
 		}
 		*key_requested = sink->mem->key_requested;
 
-		memcpy(sink->mem->data, frame->data, frame->used);
+		us_frame_read_data(frame, sink->mem->data);
 		sink->mem->used = frame->used;
 		US_FRAME_COPY_META(frame, sink->mem);
 
@@ -45,6 +45,7 @@ typedef struct {
 	const char			*name;
 	const char			*obj;
 	bool				server;
+	mode_t				mode;
 	bool				rm;
 	unsigned			client_ttl; // Only for server
 	unsigned			timeout;
@@ -0,0 +1,119 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "nal.h"
+
+
+static const uint8_t _START_CODE[] = {0, 0, 0, 1};
+
+
+static const uint8_t *_find_nal(const uint8_t *data, const uint8_t *end, const uint8_t **next);
+static void _remember(uint8_t **param, size_t *param_size, const uint8_t *nal, size_t size);
+static void _append_nal(us_frame_s *frame, const uint8_t *nal, size_t size);
+
+
+us_nal_cache_s *us_nal_cache_init(void) {
+	us_nal_cache_s *cache;
+	US_CALLOC(cache, 1);
+	cache->tmp = us_frame_init();
+	return cache;
+}
+
+void us_nal_cache_destroy(us_nal_cache_s *cache) {
+	us_frame_destroy(cache->tmp);
+	free(cache->sps);
+	free(cache->pps);
+	free(cache);
+}
+
+void us_nal_cache_process(us_nal_cache_s *cache, us_frame_s *frame) {
+	assert(frame->n_iov == 0);
+
+	bool has_sps = false;
+	bool has_pps = false;
+	bool has_idr = false;
+	size_t head_size = 0; // AUD должен остаться первым в кадре
+
+	const uint8_t *const end = frame->data + frame->used;
+	const uint8_t *next = frame->data;
+	const uint8_t *nal;
+	for (bool first = true; (nal = _find_nal(next, end, &next)) != NULL; first = false) {
+		const size_t size = next - nal;
+		switch (nal[0] & 0x1F) {
+			case US_NAL_AUD: head_size = (first ? (size_t)(next - frame->data) : head_size); break;
+			case US_NAL_SPS: has_sps = true; _remember(&cache->sps, &cache->sps_size, nal, size); break;
+			case US_NAL_PPS: has_pps = true; _remember(&cache->pps, &cache->pps_size, nal, size); break;
+			case US_NAL_IDR: has_idr = true; break;
+		}
+	}
+
+	frame->key = has_idr;
+	if (has_idr && (!has_sps || !has_pps)) {
+		if (cache->sps == NULL || cache->pps == NULL) {
+			US_LOG_VERBOSE("NAL: IDR without SPS/PPS, nothing to prepend yet");
+			return;
+		}
+		// Без параметров декодер не начнет с этого кадра, а ждать следующего IDR - это лишний битрейт
+		us_frame_s *const tmp = cache->tmp;
+		us_frame_set_data(tmp, frame->data, head_size);
+		if (!has_sps) {
+			_append_nal(tmp, cache->sps, cache->sps_size);
+		}
+		if (!has_pps) {
+			_append_nal(tmp, cache->pps, cache->pps_size);
+		}
+		us_frame_append_data(tmp, frame->data + head_size, frame->used - head_size);
+		us_frame_set_data(frame, tmp->data, tmp->used);
+		US_LOG_VERBOSE("NAL: Prepended cached SPS/PPS to IDR: size=%zu", frame->used);
+	}
+}
+
+static const uint8_t *_find_nal(const uint8_t *data, const uint8_t *end, const uint8_t **next) {
+	// Возвращает начало NAL после стартового кода, next указывает на следующий стартовый код или конец
+	const uint8_t *nal = NULL;
+	for (const uint8_t *ptr = data; ptr + 3 <= end; ++ptr) {
+		if (ptr[0] == 0 && ptr[1] == 0 && ptr[2] == 1) {
+			if (nal == NULL) {
+				nal = ptr + 3;
+				ptr += 2;
+			} else {
+				*next = (ptr[-1] == 0 ? ptr - 1 : ptr);
+				return nal;
+			}
+		}
+	}
+	*next = end;
+	return (nal != NULL && end > nal ? nal : NULL);
+}
+
+static void _remember(uint8_t **param, size_t *param_size, const uint8_t *nal, size_t size) {
+	if (*param_size != size || memcmp(*param, nal, size)) {
+		US_REALLOC(*param, size);
+		memcpy(*param, nal, size);
+		*param_size = size;
+	}
+}
+
+static void _append_nal(us_frame_s *frame, const uint8_t *nal, size_t size) {
+	us_frame_append_data(frame, _START_CODE, sizeof(_START_CODE));
+	us_frame_append_data(frame, nal, size);
+}
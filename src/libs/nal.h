@@ -0,0 +1,59 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <sys/types.h>
+
+#include "tools.h"
+#include "logging.h"
+#include "frame.h"
+
+
+#define US_NAL_SLICE	1
+#define US_NAL_IDR		5
+#define US_NAL_SEI		6
+#define US_NAL_SPS		7
+#define US_NAL_PPS		8
+#define US_NAL_AUD		9
+
+typedef struct {
+	uint8_t	*sps; // Without the start code
+	size_t	sps_size;
+	uint8_t	*pps;
+	size_t	pps_size;
+	us_frame_s	*tmp;
+} us_nal_cache_s;
+
+
+us_nal_cache_s *us_nal_cache_init(void);
+void us_nal_cache_destroy(us_nal_cache_s *cache);
+
+// Sets the key flag by the slice types of the H264 Annex B frame,
+// remembers the latest SPS/PPS and prepends them to an IDR frame which doesn't have them.
+void us_nal_cache_process(us_nal_cache_s *cache, us_frame_s *frame);
@@ -0,0 +1,88 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "ring.h"
+
+
+static us_ring_frame_s *_ring_add_item(us_ring_s *ring);
+
+
+us_ring_s *us_ring_init(const char *name, unsigned capacity) {
+	us_ring_s *ring;
+	US_CALLOC(ring, 1);
+	ring->name = name;
+	for (unsigned index = 0; index < capacity; ++index) {
+		_ring_add_item(ring);
+	}
+	return ring;
+}
+
+void us_ring_destroy(us_ring_s *ring) {
+	for (unsigned index = 0; index < ring->n_items; ++index) {
+		us_frame_destroy(ring->items[index]->frame);
+		free(ring->items[index]);
+	}
+	free(ring->items);
+	free(ring);
+}
+
+us_ring_frame_s *us_ring_acquire(us_ring_s *ring) {
+	// Свободные кадры ищет только один поток-владелец, а ссылки отпускать можно из любого.
+	// Кадр с нулевым счетчиком больше никто не читает, поэтому его можно перезаписывать.
+	for (unsigned count = 0; count < ring->n_items; ++count) {
+		us_ring_frame_s *const item = ring->items[ring->cursor];
+		ring->cursor = (ring->cursor + 1) % ring->n_items;
+		unsigned free_refs = 0;
+		if (atomic_compare_exchange_strong(&item->refs, &free_refs, 1)) {
+			return item;
+		}
+	}
+
+	// Все кадры заняты медленными клиентами: расширяемся, элементы при этом не двигаются
+	us_ring_frame_s *const item = _ring_add_item(ring);
+	atomic_store(&item->refs, 1);
+	US_LOG_VERBOSE("%s ring: All frames are busy, extended to %u", ring->name, ring->n_items);
+	return item;
+}
+
+us_ring_frame_s *us_ring_frame_ref(us_ring_frame_s *item) {
+	atomic_fetch_add(&item->refs, 1);
+	return item;
+}
+
+void us_ring_frame_unref(us_ring_frame_s *item) {
+	const unsigned refs = atomic_fetch_sub(&item->refs, 1);
+	assert(refs > 0);
+}
+
+static us_ring_frame_s *_ring_add_item(us_ring_s *ring) {
+	us_ring_frame_s *item;
+	US_CALLOC(item, 1);
+	item->frame = us_frame_init();
+	atomic_init(&item->refs, 0);
+
+	US_REALLOC(ring->items, ring->n_items + 1);
+	ring->items[ring->n_items] = item;
+	ring->n_items += 1;
+	return item;
+}
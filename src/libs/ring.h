@@ -0,0 +1,55 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <assert.h>
+
+#include "tools.h"
+#include "logging.h"
+#include "frame.h"
+
+
+typedef struct {
+	us_frame_s	*frame;
+	atomic_uint	refs; // Zero means the frame is free and can be written again
+	void		*opaque; // Owner's resource which the frame refers to, managed by the owner only
+} us_ring_frame_s;
+
+typedef struct {
+	const char		*name;
+	us_ring_frame_s	**items;
+	unsigned		n_items;
+	unsigned		cursor;
+} us_ring_s;
+
+
+us_ring_s *us_ring_init(const char *name, unsigned capacity);
+void us_ring_destroy(us_ring_s *ring);
+
+us_ring_frame_s *us_ring_acquire(us_ring_s *ring);
+
+us_ring_frame_s *us_ring_frame_ref(us_ring_frame_s *item);
+void us_ring_frame_unref(us_ring_frame_s *item);
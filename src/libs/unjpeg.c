@@ -23,13 +23,21 @@
 #include "unjpeg.h"
 
 
-typedef struct {
-	struct jpeg_error_mgr	mgr; // Default manager
-	jmp_buf					jmp;
-	const us_frame_s		*frame;
-} _jpeg_error_manager_s;
+#if JPEG_LIB_VERSION >= 70
+#	define _H_SCALED(x_comp)	(x_comp)->DCT_h_scaled_size
+#	define _V_SCALED(x_comp)	(x_comp)->DCT_v_scaled_size
+#	define _MIN_V_SCALED(x_jpeg)	(x_jpeg)->min_DCT_v_scaled_size
+#else
+#	define _H_SCALED(x_comp)	(x_comp)->DCT_scaled_size
+#	define _V_SCALED(x_comp)	(x_comp)->DCT_scaled_size
+#	define _MIN_V_SCALED(x_jpeg)	(x_jpeg)->min_DCT_scaled_size
+#endif
 
 
+static void _read_chroma_row(
+	const struct jpeg_decompress_struct *jpeg, JSAMPIMAGE planes,
+	unsigned row, unsigned width, uint8_t *uv);
+
 static void _jpeg_error_handler(j_common_ptr jpeg);
 
 
@@ -42,7 +50,7 @@ int us_unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode) {
 	jpeg_create_decompress(&jpeg);
 
 	// https://stackoverflow.com/questions/19857766/error-handling-in-libjpeg
-	_jpeg_error_manager_s jpeg_error;
+	us_unjpeg_error_s jpeg_error;
 	jpeg.err = jpeg_std_error((struct jpeg_error_mgr *)&jpeg_error);
 	jpeg_error.mgr.error_exit = _jpeg_error_handler;
 	jpeg_error.frame = src;
@@ -82,8 +90,122 @@ int us_unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode) {
 		return retval;
 }
 
+us_unjpeg_s *us_unjpeg_init(void) {
+	us_unjpeg_s *unjpeg;
+	US_CALLOC(unjpeg, 1);
+	unjpeg->jpeg.err = jpeg_std_error(&unjpeg->error.mgr);
+	unjpeg->error.mgr.error_exit = _jpeg_error_handler;
+	jpeg_create_decompress(&unjpeg->jpeg);
+	return unjpeg;
+}
+
+void us_unjpeg_destroy(us_unjpeg_s *unjpeg) {
+	jpeg_destroy_decompress(&unjpeg->jpeg);
+	free(unjpeg);
+}
+
+int us_unjpeg_to_nv12(us_unjpeg_s *unjpeg, const us_frame_s *src, us_frame_s *dest, unsigned scale) {
+	// Декомпрессор живет между кадрами, а YCbCr забирается из libjpeg как есть, без перевода в RGB.
+	// При уменьшении масштабирует сам IDCT, что дешевле полного декодирования.
+	assert(us_is_jpeg(src->format));
+	assert(scale == 1 || scale == 2 || scale == 4);
+
+	struct jpeg_decompress_struct *const jpeg = &unjpeg->jpeg;
+	unjpeg->error.frame = src;
+	if (setjmp(unjpeg->error.jmp) < 0) {
+		jpeg_abort_decompress(jpeg);
+		return -1;
+	}
+
+	jpeg_mem_src(jpeg, src->data, src->used);
+	jpeg_read_header(jpeg, TRUE);
+	if (jpeg->jpeg_color_space != JCS_YCbCr && jpeg->jpeg_color_space != JCS_GRAYSCALE) {
+		US_LOG_ERROR("Can't decompress JPEG to NV12: unsupported colorspace");
+		jpeg_abort_decompress(jpeg);
+		return -1;
+	}
+	jpeg->raw_data_out = TRUE;
+	jpeg->out_color_space = jpeg->jpeg_color_space;
+	jpeg->scale_num = 1;
+	jpeg->scale_denom = scale;
+	jpeg_start_decompress(jpeg);
+
+	// NV12 требует четных размеров
+	const unsigned width = jpeg->output_width & ~1U;
+	const unsigned height = jpeg->output_height & ~1U;
+
+	us_frame_copy_meta(src, dest);
+	dest->format = V4L2_PIX_FMT_NV12;
+	dest->width = width;
+	dest->height = height;
+	dest->stride = width;
+	dest->n_planes = 0;
+	dest->used = (size_t)width * height * 3 / 2;
+	us_frame_realloc_data(dest, dest->used);
+
+	// За один вызов libjpeg отдает целую строку MCU, у каждой компоненты своя высота и ширина
+	JSAMPARRAY rows[MAX_COMPONENTS];
+	for (int ci = 0; ci < jpeg->num_components; ++ci) {
+		const jpeg_component_info *const comp = &jpeg->comp_info[ci];
+		rows[ci] = (*jpeg->mem->alloc_sarray)(
+			(j_common_ptr)jpeg, JPOOL_IMAGE,
+			comp->width_in_blocks * _H_SCALED(comp),
+			comp->v_samp_factor * _V_SCALED(comp));
+	}
+	const unsigned band = jpeg->max_v_samp_factor * _MIN_V_SCALED(jpeg);
+
+	uint8_t *const luma = dest->data;
+	uint8_t *const chroma = dest->data + (size_t)width * height;
+	while (jpeg->output_scanline < jpeg->output_height) {
+		const unsigned top = jpeg->output_scanline;
+		jpeg_read_raw_data(jpeg, rows, band);
+		for (unsigned index = 0; index < band && top + index < height; ++index) {
+			memcpy(luma + (size_t)width * (top + index), rows[0][index], width);
+		}
+		for (unsigned index = 0; index < band / 2 && top + index * 2 < height; ++index) {
+			_read_chroma_row(jpeg, rows, index * 2, width, chroma + (size_t)width * (top / 2 + index));
+		}
+	}
+	jpeg_finish_decompress(jpeg);
+	return 0;
+}
+
+static void _read_chroma_row(
+	const struct jpeg_decompress_struct *jpeg, JSAMPIMAGE planes,
+	unsigned row, unsigned width, uint8_t *uv) {
+
+	// row - четная строка яркости внутри полосы. Во сколько раз компонента меньше яркости,
+	// зависит от сэмплинга и от того, растянул ли ее IDCT при масштабировании.
+	if (jpeg->num_components < 3) {
+		memset(uv, 128, width);
+		return;
+	}
+	for (unsigned ci = 1; ci <= 2; ++ci) {
+		const jpeg_component_info *const comp = &jpeg->comp_info[ci];
+		const unsigned h_ratio = (jpeg->max_h_samp_factor * _H_SCALED(&jpeg->comp_info[0])) / (comp->h_samp_factor * _H_SCALED(comp));
+		const unsigned v_ratio = (jpeg->max_v_samp_factor * _MIN_V_SCALED(jpeg)) / (comp->v_samp_factor * _V_SCALED(comp));
+		const uint8_t *const a = planes[ci][row / v_ratio];
+		const uint8_t *const b = (v_ratio == 1 ? planes[ci][row + 1] : a);
+		uint8_t *const out = uv + (ci - 1);
+		const unsigned c_width = width / 2;
+		if (h_ratio == 1) {
+			for (unsigned x = 0; x < c_width; ++x) {
+				out[x * 2] = (a[x * 2] + a[x * 2 + 1] + b[x * 2] + b[x * 2 + 1] + 2) >> 2;
+			}
+		} else if (h_ratio == 2) { // Типичный 4:2:x с камер
+			for (unsigned x = 0; x < c_width; ++x) {
+				out[x * 2] = (a[x] + b[x] + 1) >> 1;
+			}
+		} else {
+			for (unsigned x = 0; x < c_width; ++x) {
+				out[x * 2] = (a[x * 2 / h_ratio] + b[x * 2 / h_ratio] + 1) >> 1;
+			}
+		}
+	}
+}
+
 static void _jpeg_error_handler(j_common_ptr jpeg) {
-	_jpeg_error_manager_s *jpeg_error = (_jpeg_error_manager_s *)jpeg->err;
+	us_unjpeg_error_s *jpeg_error = (us_unjpeg_error_s *)jpeg->err;
 	char msg[JMSG_LENGTH_MAX];
 
 	(*jpeg_error->mgr.format_message)(jpeg, msg);
@@ -23,8 +23,10 @@
 #pragma once
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 #include <setjmp.h>
 #include <assert.h>
 
@@ -33,8 +35,25 @@
 #include <jpeglib.h>
 #include <linux/videodev2.h>
 
+#include "tools.h"
 #include "logging.h"
 #include "frame.h"
 
 
+typedef struct {
+	struct jpeg_error_mgr	mgr; // Default manager
+	jmp_buf					jmp;
+	const us_frame_s		*frame;
+} us_unjpeg_error_s;
+
+typedef struct {
+	struct jpeg_decompress_struct	jpeg;
+	us_unjpeg_error_s				error;
+} us_unjpeg_s;
+
+
 int us_unjpeg(const us_frame_s *src, us_frame_s *dest, bool decode);
+
+us_unjpeg_s *us_unjpeg_init(void);
+void us_unjpeg_destroy(us_unjpeg_s *unjpeg);
+int us_unjpeg_to_nv12(us_unjpeg_s *unjpeg, const us_frame_s *src, us_frame_s *dest, unsigned scale);
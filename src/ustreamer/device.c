@@ -41,6 +41,11 @@ static const struct {
 	{"UYVY",	V4L2_PIX_FMT_UYVY},
 	{"RGB565",	V4L2_PIX_FMT_RGB565},
 	{"RGB24",	V4L2_PIX_FMT_RGB24},
+	{"NV12",	V4L2_PIX_FMT_NV12},
+	{"NV16",	V4L2_PIX_FMT_NV16},
+	{"NV24",	V4L2_PIX_FMT_NV24},
+	{"NV12M",	V4L2_PIX_FMT_NV12M},
+	{"NV16M",	V4L2_PIX_FMT_NV16M},
 	{"MJPEG",	V4L2_PIX_FMT_MJPEG},
 	{"JPEG",	V4L2_PIX_FMT_JPEG},
 };
@@ -51,9 +56,19 @@ static const struct {
 } _IO_METHODS[] = {
 	{"MMAP",	V4L2_MEMORY_MMAP},
 	{"USERPTR",	V4L2_MEMORY_USERPTR},
+	{"DMABUF",	V4L2_MEMORY_DMABUF},
 };
 
 
+static int _device_watch_fd(us_device_s *dev);
+static void _device_close_buffers(us_device_s *dev);
+static int _device_free_driver_buffers(us_device_s *dev);
+static unsigned _device_get_n_bufs(us_device_s *dev);
+static void _device_adapt_n_bufs(us_device_s *dev);
+static void _device_account_grab(us_device_s *dev, const us_hw_buffer_s *hw);
+static int _device_open_synth(us_device_s *dev);
+static int _device_grab_synth_buffer(us_device_s *dev, us_hw_buffer_s **hw);
+
 static int _device_open_check_cap(us_device_s *dev);
 static int _device_open_dv_timings(us_device_s *dev);
 static int _device_apply_dv_timings(us_device_s *dev);
@@ -63,7 +78,13 @@ static void _device_open_jpeg_quality(us_device_s *dev);
 static int _device_open_io_method(us_device_s *dev);
 static int _device_open_io_method_mmap(us_device_s *dev);
 static int _device_open_io_method_userptr(us_device_s *dev);
+static int _device_open_io_method_dmabuf(us_device_s *dev);
+static int _device_alloc_dmabuf(int heap_fd, size_t size);
+static void _device_sync_dmabuf(us_hw_buffer_s *hw, bool start);
 static int _device_open_queue_buffers(us_device_s *dev);
+static void _device_init_v4l2_buffer(us_device_s *dev, struct v4l2_buffer *buf, struct v4l2_plane *planes, unsigned index);
+static void _device_init_frame_planes(us_device_s *dev, us_frame_s *raw, const us_frame_plane_s *mem_planes);
+static size_t _device_get_bytesused(us_device_s *dev, const struct v4l2_buffer *buf, const us_hw_buffer_s *hw);
 static int _device_apply_resolution(us_device_s *dev, unsigned width, unsigned height);
 
 static void _device_apply_controls(us_device_s *dev);
@@ -82,6 +103,7 @@ static const char *_io_method_to_string_supported(enum v4l2_memory io_method);
 
 #define _RUN(x_next)	dev->run->x_next
 #define _D_XIOCTL(...)	us_xioctl(_RUN(fd), __VA_ARGS__)
+#define _D_MPLANE		(_RUN(capture_type) == V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE)
 
 
 us_device_s *us_device_init(void) {
@@ -89,6 +111,14 @@ us_device_s *us_device_init(void) {
 	US_CALLOC(run, 1);
 	run->fd = -1;
 
+	// Эти дескрипторы живут дольше открытого устройства: будить нас можно и между переподключениями
+	assert((run->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) >= 0);
+	assert((run->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) >= 0);
+	struct epoll_event event = {0};
+	event.events = EPOLLIN;
+	event.data.fd = run->wakeup_fd;
+	assert(!epoll_ctl(run->epoll_fd, EPOLL_CTL_ADD, run->wakeup_fd, &event));
+
 	us_device_s *dev;
 	US_CALLOC(dev, 1);
 	dev->path = "/dev/video0";
@@ -109,6 +139,8 @@ us_device_s *us_device_init(void) {
 }
 
 void us_device_destroy(us_device_s *dev) {
+	close(_RUN(epoll_fd));
+	close(_RUN(wakeup_fd));
 	free(dev->run);
 	free(dev);
 }
@@ -141,11 +173,18 @@ int us_device_parse_io_method(const char *str) {
 }
 
 int us_device_open(us_device_s *dev) {
+	if (dev->test_pattern || dev->replay_path != NULL) {
+		return _device_open_synth(dev);
+	}
+
 	if ((_RUN(fd) = open(dev->path, O_RDWR|O_NONBLOCK)) < 0) {
 		US_LOG_PERROR("Can't open device");
 		goto error;
 	}
 	US_LOG_INFO("Device fd=%d opened", _RUN(fd));
+	if (_device_watch_fd(dev) < 0) {
+		goto error;
+	}
 
 	if (_device_open_check_cap(dev) < 0) {
 		goto error;
@@ -174,54 +213,137 @@ int us_device_open(us_device_s *dev) {
 		return -1;
 }
 
+int us_device_reconfigure(us_device_s *dev) {
+	// Дескриптор устройства, epoll и подписка на события остаются,
+	// пересогласовываются только тайминги, формат и буферы
+	if (_RUN(synth) != NULL || _RUN(fd) < 0) {
+		return -1;
+	}
+
+	US_LOG_INFO("Reconfiguring device fd=%d on the fly ...", _RUN(fd));
+
+	if (us_device_switch_capturing(dev, false) < 0) {
+		return -1;
+	}
+	_device_close_buffers(dev);
+	if (_device_free_driver_buffers(dev) < 0) {
+		return -1;
+	}
+
+	_device_apply_resolution(dev, dev->width, dev->height);
+	if (dev->dv_timings && _device_apply_dv_timings(dev) < 0) {
+		return -1;
+	}
+	if (_device_open_format(dev, true) < 0) {
+		return -1;
+	}
+	_device_open_hw_fps(dev);
+	_device_open_jpeg_quality(dev);
+	if (_device_open_io_method(dev) < 0) {
+		return -1;
+	}
+	if (_device_open_queue_buffers(dev) < 0) {
+		return -1;
+	}
+
+	US_LOG_INFO("Device fd=%d reconfigured: %ux%u, %u buffers", _RUN(fd), _RUN(width), _RUN(height), _RUN(n_bufs));
+	return 0;
+}
+
 void us_device_close(us_device_s *dev) {
 	_RUN(persistent_timeout_reported) = false;
 
+	if (_RUN(fd) >= 0) {
+		epoll_ctl(_RUN(epoll_fd), EPOLL_CTL_DEL, _RUN(fd), NULL);
+	}
+
+	_device_close_buffers(dev);
+
+	if (_RUN(synth) != NULL) {
+		us_synth_destroy(_RUN(synth));
+		_RUN(synth) = NULL;
+		_RUN(fd) = -1; // Owned by the synth
+		US_LOG_INFO("Synthetic source closed");
+	}
+
+	if (_RUN(fd) >= 0) {
+		US_LOG_DEBUG("Closing device ...");
+		if (close(_RUN(fd)) < 0) {
+			US_LOG_PERROR("Can't close device fd=%d", _RUN(fd));
+		} else {
+			US_LOG_INFO("Device fd=%d closed", _RUN(fd));
+		}
+		_RUN(fd) = -1;
+	}
+}
+
+static void _device_close_buffers(us_device_s *dev) {
 	if (_RUN(hw_bufs) != NULL) {
+		if (dev->adaptive_bufs) {
+			_device_adapt_n_bufs(dev);
+		}
 		US_LOG_DEBUG("Releasing device buffers ...");
 		for (unsigned index = 0; index < _RUN(n_bufs); ++index) {
 #			define HW(x_next) _RUN(hw_bufs)[index].x_next
 
-			if (HW(dma_fd) >= 0) {
-				close(HW(dma_fd));
-				HW(dma_fd) = -1;
-			}
-
-			if (dev->io_method == V4L2_MEMORY_MMAP) {
+			if (_RUN(synth) == NULL && (dev->io_method == V4L2_MEMORY_MMAP || dev->io_method == V4L2_MEMORY_DMABUF)) {
 				if (HW(raw.allocated) > 0 && HW(raw.data) != NULL) {
 					if (munmap(HW(raw.data), HW(raw.allocated)) < 0) {
 						US_LOG_PERROR("Can't unmap device buffer=%u", index);
 					}
 				}
-			} else { // V4L2_MEMORY_USERPTR
+			} else { // V4L2_MEMORY_USERPTR or synthetic source
 				US_DELETE(HW(raw.data), free);
 			}
 
+			if (HW(dma_fd) >= 0) {
+				close(HW(dma_fd));
+				HW(dma_fd) = -1;
+			}
+
+			US_DELETE(HW(pbuf).planes_buffer, free);
+
 #			undef HW
 		}
 		_RUN(n_bufs) = 0;
 		free(_RUN(hw_bufs));
 		_RUN(hw_bufs) = NULL;
 	}
+}
 
-	if (_RUN(fd) >= 0) {
-		US_LOG_DEBUG("Closing device ...");
-		if (close(_RUN(fd)) < 0) {
-			US_LOG_PERROR("Can't close device fd=%d", _RUN(fd));
-		} else {
-			US_LOG_INFO("Device fd=%d closed", _RUN(fd));
-		}
-		_RUN(fd) = -1;
+static int _device_free_driver_buffers(us_device_s *dev) {
+	// Без этого драйвер не даст сменить формат: VIDIOC_S_FMT вернет EBUSY
+	struct v4l2_requestbuffers req = {0};
+	req.count = 0;
+	req.type = _RUN(capture_type);
+	req.memory = dev->io_method;
+
+	US_LOG_DEBUG("Releasing driver buffers ...");
+	if (_D_XIOCTL(VIDIOC_REQBUFS, &req) < 0) {
+		US_LOG_PERROR("Can't release driver buffers");
+		return -1;
 	}
+	return 0;
 }
 
 int us_device_export_to_dma(us_device_s *dev) {
 #	define DMA_FD		_RUN(hw_bufs[index].dma_fd)
 
+	if (_RUN(synth) != NULL) {
+		US_LOG_INFO("Synthetic source buffers can't be exported to DMA");
+		return -1;
+	}
+	if (dev->io_method == V4L2_MEMORY_DMABUF) {
+		return 0; // Буферы наши собственные, их fd уже есть
+	}
+	if (_RUN(n_planes) > 1) {
+		US_LOG_INFO("Buffers with %u memory planes can't be exported to DMA", _RUN(n_planes));
+		return -1;
+	}
+
 	for (unsigned index = 0; index < _RUN(n_bufs); ++index) {
 		struct v4l2_exportbuffer exp = {0};
-		//exp.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		exp.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+		exp.type = _RUN(capture_type);
 		exp.index = index;
 
 		US_LOG_DEBUG("Exporting device buffer=%u to DMA ...", index);
@@ -247,9 +369,15 @@ int us_device_export_to_dma(us_device_s *dev) {
 }
 
 int us_device_switch_capturing(us_device_s *dev, bool enable) {
-	if (enable != _RUN(capturing)) {
-		// enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	if (enable != _RUN(capturing) && _RUN(synth) != NULL) {
+		if (enable && us_synth_start(_RUN(synth)) < 0) {
+			return -1;
+		}
+		_RUN(capturing) = enable;
+		US_LOG_INFO("Capturing %s", (enable ? "started" : "stopped"));
+
+	} else if (enable != _RUN(capturing)) {
+		enum v4l2_buf_type type = _RUN(capture_type);
 
 		US_LOG_DEBUG("%s device capturing ...", (enable ? "Starting" : "Stopping"));
 		if (_D_XIOCTL((enable ? VIDIOC_STREAMON : VIDIOC_STREAMOFF), &type) < 0) {
@@ -266,34 +394,37 @@ int us_device_switch_capturing(us_device_s *dev, bool enable) {
 }
 
 int us_device_select(us_device_s *dev, bool *has_read, bool *has_write, bool *has_error) {
-	int retval;
-
-#	define INIT_FD_SET(x_set) \
-		fd_set x_set; FD_ZERO(&x_set); FD_SET(_RUN(fd), &x_set);
-
-	INIT_FD_SET(read_fds);
-	INIT_FD_SET(write_fds);
-	INIT_FD_SET(error_fds);
-
-#	undef INIT_FD_SET
+	struct epoll_event events[2];
 
-	struct timeval timeout;
-	timeout.tv_sec = dev->timeout;
-	timeout.tv_usec = 0;
+	*has_read = false;
+	*has_write = false;
+	*has_error = false;
 
-	US_LOG_DEBUG("Calling select() on video device ...");
+	US_LOG_DEBUG("Calling epoll_wait() on video device ...");
 
-	retval = select(_RUN(fd) + 1, &read_fds, &write_fds, &error_fds, &timeout);
+	int retval = epoll_wait(_RUN(epoll_fd), events, 2, dev->timeout * 1000);
 	if (retval > 0) {
-		*has_read = FD_ISSET(_RUN(fd), &read_fds);
-		*has_write = FD_ISSET(_RUN(fd), &write_fds);
-		*has_error = FD_ISSET(_RUN(fd), &error_fds);
-	} else {
-		*has_read = false;
-		*has_write = false;
-		*has_error = false;
+		bool woken = false;
+		for (int index = 0; index < retval; ++index) {
+			const uint32_t ev = events[index].events;
+			if (events[index].data.fd == _RUN(wakeup_fd)) {
+				uint64_t value;
+				if (read(_RUN(wakeup_fd), &value, sizeof(value)) < 0 && errno != EAGAIN) {
+					US_LOG_PERROR("Can't read wakeup event");
+				}
+				woken = true;
+			} else {
+				// Те же условия, что и у select(): POLLIN_SET, POLLOUT_SET и POLLEX_SET
+				*has_read = (ev & (EPOLLIN | EPOLLRDNORM | EPOLLHUP | EPOLLERR));
+				*has_write = (ev & (EPOLLOUT | EPOLLWRNORM | EPOLLERR));
+				*has_error = (ev & EPOLLPRI);
+			}
+		}
+		if (woken) {
+			US_LOG_DEBUG("Device epoll_wait() was interrupted by wakeup");
+		}
 	}
-	US_LOG_DEBUG("Device select() --> %d", retval);
+	US_LOG_DEBUG("Device epoll_wait() --> %d", retval);
 
 	if (retval > 0) {
 		_RUN(persistent_timeout_reported) = false;
@@ -311,16 +442,90 @@ int us_device_select(us_device_s *dev, bool *has_read, bool *has_write, bool *ha
 	return retval;
 }
 
+void us_device_wakeup(us_device_s *dev) {
+	// Может вызываться из обработчика сигнала, поэтому только write()
+	const uint64_t value = 1;
+	const ssize_t written = write(_RUN(wakeup_fd), &value, sizeof(value));
+	(void)written;
+}
+
+bool us_device_sleep(us_device_s *dev, long double timeout) {
+	struct pollfd pfd = {0};
+	pfd.fd = _RUN(wakeup_fd);
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, timeout * 1000) > 0 && (pfd.revents & POLLIN)) {
+		uint64_t value;
+		if (read(_RUN(wakeup_fd), &value, sizeof(value)) < 0 && errno != EAGAIN) {
+			US_LOG_PERROR("Can't read wakeup event");
+		}
+		return true;
+	}
+	return false;
+}
+
+bool us_device_wait_path(us_device_s *dev, const char *path, int mode, long double timeout) {
+	// Ждем появления узла по inotify вместо периодического access(). Следим за ближайшим
+	// существующим каталогом: /dev/v4l/by-id и подобные удаляются вместе с последним устройством.
+	// IN_ATTRIB нужен потому, что udev выставляет права уже после создания узла.
+	const int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		US_LOG_PERROR("Can't create inotify for %s", path);
+		return us_device_sleep(dev, timeout);
+	}
+
+	char *const dir_path = us_strdup(path);
+	char *dir = dirname(dir_path);
+	while (inotify_add_watch(inotify_fd, dir, IN_CREATE | IN_ATTRIB | IN_MOVED_TO | IN_ONLYDIR) < 0) {
+		if (errno != ENOENT || !strcmp(dir, "/") || !strcmp(dir, ".")) {
+			US_LOG_PERROR("Can't watch %s for %s", dir, path);
+			free(dir_path);
+			close(inotify_fd);
+			return us_device_sleep(dev, timeout);
+		}
+		dir = dirname(dir);
+	}
+	US_LOG_DEBUG("Watching %s for %s ...", dir, path);
+	free(dir_path);
+
+	bool ready = (access(path, mode) == 0); // Узел мог появиться, пока ставили watch
+	if (!ready) {
+		struct pollfd pfds[2] = {0};
+		pfds[0].fd = inotify_fd;
+		pfds[0].events = POLLIN;
+		pfds[1].fd = _RUN(wakeup_fd);
+		pfds[1].events = POLLIN;
+
+		if (poll(pfds, 2, timeout * 1000) > 0) {
+			if (pfds[1].revents & POLLIN) {
+				uint64_t value;
+				if (read(_RUN(wakeup_fd), &value, sizeof(value)) < 0 && errno != EAGAIN) {
+					US_LOG_PERROR("Can't read wakeup event");
+				}
+			}
+			// Содержимое событий не важно: вызывающий все равно перепроверит доступ к устройству
+			ready = true;
+		}
+	}
+
+	close(inotify_fd);
+	return ready;
+}
+
 int us_device_grab_buffer(us_device_s *dev, us_hw_buffer_s **hw) {
 	*hw = NULL;
 
+	if (_RUN(synth) != NULL) {
+		const int buf_index = _device_grab_synth_buffer(dev, hw);
+		if (buf_index >= 0) {
+			_device_account_grab(dev, *hw);
+		}
+		return buf_index;
+	}
+
 	struct v4l2_buffer buf = {0};
-	struct v4l2_plane tmp_plane[4];
-	// buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	buf.memory = dev->io_method;
-	buf.m.planes = &tmp_plane;
-	buf.length = _RUN(n_planes);
+	struct v4l2_plane planes[VIDEO_MAX_PLANES] = {0};
+	_device_init_v4l2_buffer(dev, &buf, planes, 0);
 
 	US_LOG_DEBUG("Grabbing device buffer ...");
 	if (_D_XIOCTL(VIDIOC_DQBUF, &buf) < 0) {
@@ -328,23 +533,22 @@ int us_device_grab_buffer(us_device_s *dev, us_hw_buffer_s **hw) {
 		return -1;
 	}
 
-	// US_LOG_DEBUG("Grabbed new frame: buffer=%u, bytesused=%u", buf.index, buf.bytesused);
-	US_LOG_DEBUG("Grabbed new frame: buffer=%u, bytesused=%u", buf.index, tmp_plane->bytesused);
-
 	if (buf.index >= _RUN(n_bufs)) {
 		US_LOG_ERROR("V4L2 error: grabbed invalid device buffer=%u, n_bufs=%u", buf.index, _RUN(n_bufs));
 		return -1;
 	}
 
+	const size_t used = _device_get_bytesused(dev, &buf, &_RUN(hw_bufs)[buf.index]);
+	US_LOG_DEBUG("Grabbed new frame: buffer=%u, bytesused=%zu", buf.index, used);
+
 	// Workaround for broken, corrupted frames:
 	// Under low light conditions corrupted frames may get captured.
 	// The good thing is such frames are quite small compared to the regular frames.
 	// For example a VGA (640x480) webcam frame is normally >= 8kByte large,
 	// corrupted frames are smaller.
-	// if (buf.bytesused < dev->min_frame_size) {
-	if (tmp_plane->bytesused < dev->min_frame_size) {
-		US_LOG_DEBUG("Dropped too small frame, assuming it was broken: buffer=%u, bytesused=%u",
-			buf.index, buf.bytesused);
+	if (used < dev->min_frame_size) {
+		US_LOG_DEBUG("Dropped too small frame, assuming it was broken: buffer=%u, bytesused=%zu",
+			buf.index, used);
 		US_LOG_DEBUG("Releasing device buffer=%u (broken frame) ...", buf.index);
 		if (_D_XIOCTL(VIDIOC_QBUF, &buf) < 0) {
 			US_LOG_PERROR("Can't release device buffer=%u (broken frame)", buf.index);
@@ -361,34 +565,138 @@ int us_device_grab_buffer(us_device_s *dev, us_hw_buffer_s **hw) {
 	}
 	HW(grabbed) = true;
 
+	if (dev->io_method == V4L2_MEMORY_DMABUF) {
+		_device_sync_dmabuf(&_RUN(hw_bufs)[buf.index], true);
+	}
+
 	HW(raw.dma_fd) = HW(dma_fd);
-	// HW(raw.used) = buf.bytesused;
-	HW(raw.used) = tmp_plane->bytesused;
+	HW(raw.used) = used;
 	HW(raw.width) = _RUN(width);
 	HW(raw.height) = _RUN(height);
 	HW(raw.format) = _RUN(format);
 	HW(raw.stride) = _RUN(stride);
 	HW(raw.online) = true;
 	memcpy(&HW(buf), &buf, sizeof(struct v4l2_buffer));
+	if (_D_MPLANE) {
+		// Плоскости лежат на стеке, для последующего QBUF нужна своя копия
+		memcpy(HW(pbuf).planes_buffer, planes, sizeof(struct v4l2_plane) * _RUN(n_planes));
+		HW(buf).m.planes = HW(pbuf).planes_buffer;
+	}
 	HW(raw.grab_ts) = us_get_now_monotonic();
 
 #	undef HW
 	*hw = &_RUN(hw_bufs[buf.index]);
+	_device_account_grab(dev, *hw);
 	return buf.index;
 }
 
+int us_device_grab_latest_buffer(us_device_s *dev, us_hw_buffer_s **hw, unsigned *n_stale) {
+	// Забираем все готовые буферы, оставляем самый свежий, а остальные сразу возвращаем устройству
+	*n_stale = 0;
+	int buf_index = us_device_grab_buffer(dev, hw);
+	while (buf_index >= 0 || buf_index == -2) {
+		struct pollfd pfd = {0};
+		pfd.fd = _RUN(fd);
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & POLLIN)) {
+			break;
+		}
+
+		us_hw_buffer_s *next;
+		const int next_index = us_device_grab_buffer(dev, &next);
+		if (next_index == -2) {
+			continue; // Broken frame, already requeued
+		} else if (next_index < 0) {
+			if (buf_index >= 0) {
+				us_device_release_buffer(dev, *hw);
+			}
+			*hw = NULL;
+			return -1;
+		}
+
+		if (buf_index >= 0) {
+			US_LOG_VERBOSE("Dropped stale device buffer=%d in favor of buffer=%d", buf_index, next_index);
+			if (us_device_release_buffer(dev, *hw) < 0) {
+				us_device_release_buffer(dev, next);
+				*hw = NULL;
+				return -1;
+			}
+			++*n_stale;
+		}
+		*hw = next;
+		buf_index = next_index;
+	}
+	return buf_index;
+}
+
 int us_device_release_buffer(us_device_s *dev, us_hw_buffer_s *hw) {
 	const unsigned index = hw->buf.index;
 	US_LOG_DEBUG("Releasing device buffer=%u ...", index);
 
-	if (_D_XIOCTL(VIDIOC_QBUF, &hw->buf) < 0) {
+	if (_RUN(synth) == NULL && dev->io_method == V4L2_MEMORY_DMABUF) {
+		_device_sync_dmabuf(hw, false);
+	}
+	if (_RUN(synth) == NULL && _D_XIOCTL(VIDIOC_QBUF, &hw->buf) < 0) {
 		US_LOG_PERROR("Can't release device buffer=%u", index);
 		return -1;
 	}
 	hw->grabbed = false;
+
+	if (_RUN(n_grabbed) > 0) {
+		--_RUN(n_grabbed);
+	}
+	const long double hold = us_get_now_monotonic() - hw->raw.grab_ts;
+	if (hold > _RUN(hold_max)) {
+		_RUN(hold_max) = hold;
+	}
 	return 0;
 }
 
+int us_device_detach_buffer(us_device_s *dev, us_hw_buffer_s *hw, us_hw_orphan_s *orphan) {
+	// Память кадра вместе с содержимым переходит к вызывающему, а сам буфер в очередь уже не вернется.
+	// Поэтому это годится только перед закрытием буферов, см. us_device_close() и us_device_reconfigure().
+	const unsigned index = hw->buf.index;
+	assert(hw->grabbed);
+	US_LOG_DEBUG("Detaching device buffer=%u ...", index);
+
+	if (_RUN(synth) == NULL && (dev->io_method == V4L2_MEMORY_MMAP || dev->io_method == V4L2_MEMORY_DMABUF)) {
+		// Отображение устройства атомарно подменяется копией по тому же адресу,
+		// так что уже розданные указатели на кадр остаются валидными
+		uint8_t *const copy = mmap(NULL, hw->raw.allocated, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (copy == MAP_FAILED) {
+			US_LOG_PERROR("Can't allocate memory to detach device buffer=%u", index);
+			return -1;
+		}
+		memcpy(copy, hw->raw.data, hw->raw.used);
+		if (mremap(copy, hw->raw.allocated, hw->raw.allocated, MREMAP_MAYMOVE | MREMAP_FIXED, hw->raw.data) == MAP_FAILED) {
+			US_LOG_PERROR("Can't replace the mapping of device buffer=%u", index);
+			munmap(copy, hw->raw.allocated);
+			return -1;
+		}
+		orphan->mapped = hw->raw.allocated;
+	} else { // V4L2_MEMORY_USERPTR or synthetic source
+		orphan->mapped = 0;
+	}
+	orphan->data = hw->raw.data;
+	hw->raw.data = NULL;
+	hw->raw.allocated = 0;
+	hw->grabbed = false;
+
+	if (_RUN(n_grabbed) > 0) {
+		--_RUN(n_grabbed);
+	}
+	return 0;
+}
+
+void us_device_free_orphan(us_hw_orphan_s *orphan) {
+	if (orphan->mapped > 0) {
+		munmap(orphan->data, orphan->mapped);
+	} else {
+		free(orphan->data);
+	}
+	orphan->data = NULL;
+}
+
 int us_device_consume_event(us_device_s *dev) {
 	struct v4l2_event event;
 
@@ -397,7 +705,7 @@ int us_device_consume_event(us_device_s *dev) {
 		switch (event.type) {
 			case V4L2_EVENT_SOURCE_CHANGE:
 				US_LOG_INFO("Got V4L2_EVENT_SOURCE_CHANGE: source changed");
-				return -1;
+				return 1;
 			case V4L2_EVENT_EOS:
 				US_LOG_INFO("Got V4L2_EVENT_EOS: end of stream (ignored)");
 				return 0;
@@ -408,6 +716,140 @@ int us_device_consume_event(us_device_s *dev) {
 	return 0;
 }
 
+static int _device_watch_fd(us_device_s *dev) {
+	struct epoll_event event = {0};
+	event.events = EPOLLIN | EPOLLOUT | EPOLLPRI;
+	event.data.fd = _RUN(fd);
+	if (epoll_ctl(_RUN(epoll_fd), EPOLL_CTL_ADD, _RUN(fd), &event) < 0) {
+		US_LOG_PERROR("Can't add device fd=%d to epoll", _RUN(fd));
+		return -1;
+	}
+	return 0;
+}
+
+static unsigned _device_get_n_bufs(us_device_s *dev) {
+	return (dev->adaptive_bufs && _RUN(n_bufs_wanted) > 0 ? _RUN(n_bufs_wanted) : dev->n_bufs);
+}
+
+static void _device_adapt_n_bufs(us_device_s *dev) {
+	// Устройству всегда нужен хотя бы один свободный буфер под заполнение и один про запас,
+	// остальные держит конвейер: примерно столько кадров, сколько приходит за время удержания.
+	if (_RUN(n_bufs) == 0 || _RUN(frame_interval) <= 0 || _RUN(hold_max) <= 0) {
+		return;
+	}
+
+	unsigned needed = ceill(_RUN(hold_max) / _RUN(frame_interval)) + 2;
+	if (_RUN(n_starved) > 0) {
+		needed = us_max_u(needed, _RUN(n_bufs) + 1);
+	}
+
+	unsigned wanted = _RUN(n_bufs);
+	if (needed > wanted) {
+		wanted = needed;
+	} else if (needed < wanted) {
+		--wanted; // Уменьшаем плавно, чтобы единичный удачный прогон не сбросил очередь
+	}
+	wanted = us_min_u(us_max_u(wanted, US_VIDEO_MIN_BUFS), US_VIDEO_MAX_BUFS);
+
+	US_LOG_INFO("Buffers: hold_max=%.3Lf, frame_interval=%.3Lf, starved=%u; next init will use %u -> %u",
+		_RUN(hold_max), _RUN(frame_interval), _RUN(n_starved), _RUN(n_bufs), wanted);
+
+	_RUN(n_bufs_wanted) = wanted;
+	_RUN(n_starved) = 0;
+	_RUN(hold_max) = 0;
+	_RUN(frame_interval) = 0;
+	_RUN(last_grab_ts) = 0;
+	_RUN(n_grabbed) = 0;
+}
+
+static void _device_account_grab(us_device_s *dev, const us_hw_buffer_s *hw) {
+	++_RUN(n_grabbed);
+	if (_RUN(n_grabbed) >= _RUN(n_bufs)) {
+		// Все буферы у нас, устройству некуда писать следующий кадр
+		++_RUN(n_starved);
+	}
+	if (_RUN(last_grab_ts) > 0) {
+		const long double interval = hw->raw.grab_ts - _RUN(last_grab_ts);
+		_RUN(frame_interval) = (_RUN(frame_interval) > 0 ? _RUN(frame_interval) * 0.9 + interval * 0.1 : interval);
+	}
+	_RUN(last_grab_ts) = hw->raw.grab_ts;
+}
+
+static int _device_open_synth(us_device_s *dev) {
+	if (_device_apply_resolution(dev, dev->width, dev->height) < 0) {
+		goto error;
+	}
+	_RUN(synth) = us_synth_init(dev->replay_path, dev->format, _RUN(width), _RUN(height), dev->desired_fps);
+	if (_RUN(synth) == NULL) {
+		goto error;
+	}
+	_RUN(fd) = _RUN(synth)->fd;
+	if (_device_watch_fd(dev) < 0) {
+		goto error;
+	}
+	_RUN(format) = _RUN(synth)->format;
+	_RUN(stride) = _RUN(synth)->stride;
+	_RUN(hw_fps) = _RUN(synth)->fps;
+	_RUN(jpeg_quality) = 0;
+	_RUN(raw_size) = _RUN(synth)->max_frame_size;
+	_RUN(n_planes) = 1;
+	US_LOG_INFO("Using format: %s", _format_to_string_supported(_RUN(format)));
+
+	const unsigned n_bufs = _device_get_n_bufs(dev);
+	US_LOG_DEBUG("Allocating %u synthetic buffers ...", n_bufs);
+	US_CALLOC(_RUN(hw_bufs), n_bufs);
+	for (_RUN(n_bufs) = 0; _RUN(n_bufs) < n_bufs; ++_RUN(n_bufs)) {
+#		define HW(x_next) _RUN(hw_bufs)[_RUN(n_bufs)].x_next
+		HW(dma_fd) = -1;
+		HW(buf.index) = _RUN(n_bufs);
+		US_CALLOC(HW(raw.data), _RUN(raw_size));
+		HW(raw.allocated) = _RUN(raw_size);
+#		undef HW
+	}
+	return 0;
+
+	error:
+		us_device_close(dev);
+		return -1;
+}
+
+static int _device_grab_synth_buffer(us_device_s *dev, us_hw_buffer_s **hw) {
+	uint64_t number;
+	unsigned skipped;
+	const int retval = us_synth_consume(_RUN(synth), &number, &skipped);
+	if (retval < 0) {
+		return retval;
+	}
+	if (skipped > 0) {
+		US_LOG_VERBOSE("Synthetic source skipped %u late frames", skipped);
+	}
+
+	// Как и настоящее устройство, при нехватке свободных буферов теряем кадр
+	unsigned index = 0;
+	for (; index < _RUN(n_bufs) && _RUN(hw_bufs)[index].grabbed; ++index);
+	if (index == _RUN(n_bufs)) {
+		US_LOG_VERBOSE("All synthetic buffers are busy; frame dropped");
+		return -2;
+	}
+
+#	define HW(x_next) _RUN(hw_bufs)[index].x_next
+
+	HW(grabbed) = true;
+	us_synth_fill(_RUN(synth), number, &HW(raw));
+	HW(raw.dma_fd) = HW(dma_fd);
+	HW(raw.width) = _RUN(width);
+	HW(raw.height) = _RUN(height);
+	HW(raw.format) = _RUN(format);
+	HW(raw.stride) = _RUN(stride);
+	HW(raw.online) = true;
+	HW(raw.grab_ts) = us_get_now_monotonic();
+
+#	undef HW
+	US_LOG_DEBUG("Grabbed new synthetic frame=%ju: buffer=%u", (uintmax_t)number, index);
+	*hw = &_RUN(hw_bufs[index]);
+	return index;
+}
+
 static int _device_open_check_cap(us_device_s *dev) {
 	struct v4l2_capability cap = {0};
 
@@ -417,12 +859,19 @@ static int _device_open_check_cap(us_device_s *dev) {
 		return -1;
 	}
 
-	if (!(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE)) {
-		US_LOG_ERROR("~~~Video capture is not supported by device");
+	const uint32_t caps = ((cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities);
+
+	if (caps & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+		_RUN(capture_type) = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	} else if (caps & V4L2_CAP_VIDEO_CAPTURE) {
+		_RUN(capture_type) = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	} else {
+		US_LOG_ERROR("Video capture is not supported by device");
 		return -1;
 	}
+	US_LOG_INFO("Using %s capture API", (_D_MPLANE ? "multi-planar" : "single-planar"));
 
-	if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
+	if (!(caps & V4L2_CAP_STREAMING)) {
 		US_LOG_ERROR("Device doesn't support streaming IO");
 		return -1;
 	}
@@ -510,33 +959,45 @@ static int _device_apply_dv_timings(us_device_s *dev) {
 }
 
 static int _device_open_format(us_device_s *dev, bool first) {
-	const unsigned stride = us_align_size(_RUN(width), 32) << 1;
+	// Для полупланарных форматов stride подбирает драйвер
+	const unsigned stride = (us_is_semiplanar(dev->format) ? 0 : us_align_size(_RUN(width), 32) << 1);
 
 	struct v4l2_format fmt = {0};
-	// ydy
-	//fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-	fmt.fmt.pix.width = _RUN(width);
-	fmt.fmt.pix.height = _RUN(height);
-	fmt.fmt.pix.pixelformat = dev->format;
-	fmt.fmt.pix.field = V4L2_FIELD_ANY;
-	fmt.fmt.pix.bytesperline = stride;
+	fmt.type = _RUN(capture_type);
+	if (_D_MPLANE) {
+		fmt.fmt.pix_mp.width = _RUN(width);
+		fmt.fmt.pix_mp.height = _RUN(height);
+		fmt.fmt.pix_mp.pixelformat = dev->format;
+		fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+		fmt.fmt.pix_mp.num_planes = 1;
+		fmt.fmt.pix_mp.plane_fmt[0].bytesperline = stride;
+	} else {
+		fmt.fmt.pix.width = _RUN(width);
+		fmt.fmt.pix.height = _RUN(height);
+		fmt.fmt.pix.pixelformat = dev->format;
+		fmt.fmt.pix.field = V4L2_FIELD_ANY;
+		fmt.fmt.pix.bytesperline = stride;
+	}
 
 	// Set format
-	US_LOG_DEBUG("~~~ Probing device format=%s, stride=%u, resolution=%ux%u ...",
+	US_LOG_DEBUG("Probing device format=%s, stride=%u, resolution=%ux%u ...",
 		_format_to_string_supported(dev->format), stride, _RUN(width), _RUN(height));
 	if (_D_XIOCTL(VIDIOC_S_FMT, &fmt) < 0) {
-		US_LOG_PERROR("~~~ Can't set device format");
+		US_LOG_PERROR("Can't set device format");
 		return -1;
 	}
 
+	const unsigned width = (_D_MPLANE ? fmt.fmt.pix_mp.width : fmt.fmt.pix.width);
+	const unsigned height = (_D_MPLANE ? fmt.fmt.pix_mp.height : fmt.fmt.pix.height);
+	const unsigned format = (_D_MPLANE ? fmt.fmt.pix_mp.pixelformat : fmt.fmt.pix.pixelformat);
+
 	// Check resolution
 	bool retry = false;
-	if (fmt.fmt.pix.width != _RUN(width) || fmt.fmt.pix.height != _RUN(height)) {
+	if (width != _RUN(width) || height != _RUN(height)) {
 		US_LOG_ERROR("Requested resolution=%ux%u is unavailable", _RUN(width), _RUN(height));
 		retry = true;
 	}
-	if (_device_apply_resolution(dev, fmt.fmt.pix.width, fmt.fmt.pix.height) < 0) {
+	if (_device_apply_resolution(dev, width, height) < 0) {
 		return -1;
 	}
 	if (first && retry) {
@@ -545,31 +1006,58 @@ static int _device_open_format(us_device_s *dev, bool first) {
 	US_LOG_INFO("Using resolution: %ux%u", _RUN(width), _RUN(height));
 
 	// Check format
-	if (fmt.fmt.pix.pixelformat != dev->format) {
+	if (format != dev->format) {
 		US_LOG_ERROR("Could not obtain the requested format=%s; driver gave us %s",
 			_format_to_string_supported(dev->format),
-			_format_to_string_supported(fmt.fmt.pix.pixelformat));
+			_format_to_string_supported(format));
 
 		char *format_str;
-		if ((format_str = (char *)_format_to_string_nullable(fmt.fmt.pix.pixelformat)) != NULL) {
+		if ((format_str = (char *)_format_to_string_nullable(format)) != NULL) {
 			US_LOG_INFO("Falling back to format=%s", format_str);
 		} else {
 			char fourcc_str[8];
 			US_LOG_ERROR("Unsupported format=%s (fourcc)",
-				us_fourcc_to_string(fmt.fmt.pix.pixelformat, fourcc_str, 8));
+				us_fourcc_to_string(format, fourcc_str, 8));
 			return -1;
 		}
 	}
+	US_LOG_INFO("Using format: %s", _format_to_string_supported(format));
 
-	_RUN(format) = fmt.fmt.pix.pixelformat;
-	US_LOG_INFO("Using format: %s", _format_to_string_supported(_RUN(format)));
-
-	_RUN(stride) = fmt.fmt.pix.bytesperline;
-	_RUN(raw_size) = fmt.fmt.pix.sizeimage; // Only for userptr
-	_RUN(n_planes) = fmt.fmt.pix_mp.num_planes;
+	// M-форматы отличаются только раскладкой буфера, дальше по конвейеру идет обычный формат
+	switch (format) {
+		case V4L2_PIX_FMT_NV12M: _RUN(format) = V4L2_PIX_FMT_NV12; break;
+		case V4L2_PIX_FMT_NV16M: _RUN(format) = V4L2_PIX_FMT_NV16; break;
+		default: _RUN(format) = format;
+	}
 
-	US_LOG_DEBUG("~~~nmplane = %d", _RUN(n_planes)); //fmt.fmt.pix_mp.num_planes);
+	if (_D_MPLANE) {
+		_RUN(n_planes) = fmt.fmt.pix_mp.num_planes;
+		if (_RUN(n_planes) < 1 || _RUN(n_planes) > US_FRAME_MAX_PLANES) {
+			US_LOG_ERROR("Unsupported number of memory planes: %u", _RUN(n_planes));
+			return -1;
+		}
+	} else {
+		_RUN(n_planes) = 1;
+	}
 
+	// Плоскости кладутся в буфер одна за другой с выравниванием на страницу
+	const unsigned page_size = getpagesize();
+	_RUN(raw_size) = 0;
+	for (unsigned plane = 0; plane < _RUN(n_planes); ++plane) {
+#		define MP(x_next) _RUN(mem_planes[plane].x_next)
+		MP(offset) = us_align_size(_RUN(raw_size), page_size);
+		if (_D_MPLANE) {
+			MP(size) = fmt.fmt.pix_mp.plane_fmt[plane].sizeimage;
+			MP(stride) = fmt.fmt.pix_mp.plane_fmt[plane].bytesperline;
+		} else {
+			MP(size) = fmt.fmt.pix.sizeimage;
+			MP(stride) = fmt.fmt.pix.bytesperline;
+		}
+		_RUN(raw_size) = MP(offset) + MP(size);
+		US_LOG_DEBUG("Using memory plane=%u: stride=%u, size=%zu", plane, MP(stride), MP(size));
+#		undef MP
+	}
+	_RUN(stride) = _RUN(mem_planes[0].stride);
 	return 0;
 }
 
@@ -577,7 +1065,7 @@ static void _device_open_hw_fps(us_device_s *dev) {
 	_RUN(hw_fps) = 0;
 
 	struct v4l2_streamparm setfps = {0};
-	setfps.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	setfps.type = _RUN(capture_type);
 
 	US_LOG_DEBUG("Querying HW FPS ...");
 	if (_D_XIOCTL(VIDIOC_G_PARM, &setfps) < 0) {
@@ -597,7 +1085,7 @@ static void _device_open_hw_fps(us_device_s *dev) {
 #	define SETFPS_TPF(x_next) setfps.parm.capture.timeperframe.x_next
 
 	US_MEMSET_ZERO(setfps);
-	setfps.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	setfps.type = _RUN(capture_type);
 	SETFPS_TPF(numerator) = 1;
 	SETFPS_TPF(denominator) = (dev->desired_fps == 0 ? 255 : dev->desired_fps);
 
@@ -652,6 +1140,7 @@ static int _device_open_io_method(us_device_s *dev) {
 	switch (dev->io_method) {
 		case V4L2_MEMORY_MMAP: return _device_open_io_method_mmap(dev);
 		case V4L2_MEMORY_USERPTR: return _device_open_io_method_userptr(dev);
+		case V4L2_MEMORY_DMABUF: return _device_open_io_method_dmabuf(dev);
 		default: assert(0 && "Unsupported IO method");
 	}
 	return -1;
@@ -659,14 +1148,8 @@ static int _device_open_io_method(us_device_s *dev) {
 
 static int _device_open_io_method_mmap(us_device_s *dev) {
 	struct v4l2_requestbuffers req = {0};
-	// ydy
-	struct v4l2_plane *planes_buffer;
-	// wucw 20230619
-	// struct plane_start *plane_start;
-
-	req.count = dev->n_bufs;
-	//~~~req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+	req.count = _device_get_n_bufs(dev);
+	req.type = _RUN(capture_type);
 	req.memory = V4L2_MEMORY_MMAP;
 
 	US_LOG_DEBUG("Requesting %u device buffers for MMAP ...", req.count);
@@ -679,68 +1162,79 @@ static int _device_open_io_method_mmap(us_device_s *dev) {
 		US_LOG_ERROR("Insufficient buffer memory: %u", req.count);
 		return -1;
 	} else {
-		US_LOG_INFO("Requested %u device buffers, got %u", dev->n_bufs, req.count);
+		US_LOG_INFO("Requested %u device buffers, got %u", _device_get_n_bufs(dev), req.count);
 	}
 
 	US_LOG_DEBUG("Allocating device buffers ...");
 
 	US_CALLOC(_RUN(hw_bufs), req.count);
+
+	const unsigned page_size = getpagesize();
+
 	for (_RUN(n_bufs) = 0; _RUN(n_bufs) < req.count; ++_RUN(n_bufs)) {
-		// ydy 20221129
-		planes_buffer = calloc(_RUN(n_planes), sizeof(*planes_buffer));
-		// wucw 20230619
-		// plane_start = calloc(_RUN(n_planes), sizeof(*plane_start));
-		memset(planes_buffer, 0, sizeof(*planes_buffer));
+#		define HW(x_next) _RUN(hw_bufs)[_RUN(n_bufs)].x_next
+
+		HW(dma_fd) = -1;
+		US_CALLOC(HW(pbuf).planes_buffer, _RUN(n_planes));
 
 		struct v4l2_buffer buf = {0};
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-		buf.memory = V4L2_MEMORY_MMAP;
-		buf.m.planes = planes_buffer;
-		buf.length = _RUN(n_planes);
-		buf.index = _RUN(n_bufs);
+		_device_init_v4l2_buffer(dev, &buf, HW(pbuf).planes_buffer, _RUN(n_bufs));
 
 		US_LOG_DEBUG("Calling us_xioctl(VIDIOC_QUERYBUF) for device buffer=%u ...", _RUN(n_bufs));
 		if (_D_XIOCTL(VIDIOC_QUERYBUF, &buf) < 0) {
 			US_LOG_PERROR("Can't VIDIOC_QUERYBUF");
-			return -1;
+			goto error;
 		}
 
-#		define HW(x_next) _RUN(hw_bufs)[_RUN(n_bufs)].x_next
-
-		HW(dma_fd) = -1;
-
-		HW(pbuf).planes_buffer = planes_buffer;
-		// wucw 20230619
-		// HW(pbuf).plane_start = plane_start;
+		// Все плоскости отображаются в одну непрерывную область,
+		// чтобы кадр можно было отдать дальше одним указателем
+		us_frame_plane_s mem_planes[US_FRAME_MAX_PLANES] = {0};
+		size_t total = 0;
+		for (unsigned plane = 0; plane < _RUN(n_planes); ++plane) {
+			mem_planes[plane].offset = total;
+			mem_planes[plane].size = (_D_MPLANE ? buf.m.planes[plane].length : buf.length);
+			mem_planes[plane].stride = _RUN(mem_planes[plane].stride);
+			total = us_align_size(total + mem_planes[plane].size, page_size);
+		}
 
 		US_LOG_DEBUG("Mapping device buffer=%u ...", _RUN(n_bufs));
-		for (unsigned int plane = 0; plane < _RUN(n_planes); plane++)
-		{
-			US_LOG_DEBUG("buf: %d: plane: %d: length = %d", _RUN(n_bufs), plane, (planes_buffer + plane)->length);
-			if ((HW(raw.data) = mmap(
-				NULL,
-				(planes_buffer + plane)->length,
+		if ((HW(raw.data) = mmap(NULL, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+			US_LOG_PERROR("Can't reserve memory for device buffer=%u", _RUN(n_bufs));
+			HW(raw.data) = NULL;
+			goto error;
+		}
+		HW(raw.allocated) = total;
+
+		for (unsigned plane = 0; plane < _RUN(n_planes); ++plane) {
+			US_LOG_DEBUG("Mapping device buffer=%u, plane=%u, length=%zu ...",
+				_RUN(n_bufs), plane, mem_planes[plane].size);
+			if (mmap(
+				HW(raw.data) + mem_planes[plane].offset,
+				mem_planes[plane].size,
 				PROT_READ | PROT_WRITE,
-				MAP_SHARED,
+				MAP_SHARED | MAP_FIXED,
 				_RUN(fd),
-				(planes_buffer + plane)->m.mem_offset
-			)) == MAP_FAILED) {
-				US_LOG_PERROR("Can't map device buffer=%u", _RUN(n_bufs));
-				return -1;
+				(_D_MPLANE ? buf.m.planes[plane].m.mem_offset : buf.m.offset)
+			) == MAP_FAILED) {
+				US_LOG_PERROR("Can't map device buffer=%u, plane=%u", _RUN(n_bufs), plane);
+				goto error;
 			}
 		}
-		assert(HW(raw.data) != NULL);
-		HW(raw.allocated) = planes_buffer->length;
+		_device_init_frame_planes(dev, &HW(raw), mem_planes);
 
 #		undef HW
 	}
 	return 0;
+
+	error:
+		++_RUN(n_bufs); // Чтобы us_device_close() освободил и этот буфер
+		return -1;
 }
 
 static int _device_open_io_method_userptr(us_device_s *dev) {
 	struct v4l2_requestbuffers req = {0};
-	req.count = dev->n_bufs;
-	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.count = _device_get_n_bufs(dev);
+	req.type = _RUN(capture_type);
 	req.memory = V4L2_MEMORY_USERPTR;
 
 	US_LOG_DEBUG("Requesting %u device buffers for USERPTR ...", req.count);
@@ -753,7 +1247,7 @@ static int _device_open_io_method_userptr(us_device_s *dev) {
 		US_LOG_ERROR("Insufficient buffer memory: %u", req.count);
 		return -1;
 	} else {
-		US_LOG_INFO("Requested %u device buffers, got %u", dev->n_bufs, req.count);
+		US_LOG_INFO("Requested %u device buffers, got %u", _device_get_n_bufs(dev), req.count);
 	}
 
 	US_LOG_DEBUG("Allocating device buffers ...");
@@ -765,26 +1259,177 @@ static int _device_open_io_method_userptr(us_device_s *dev) {
 
 	for (_RUN(n_bufs) = 0; _RUN(n_bufs) < req.count; ++_RUN(n_bufs)) {
 #       define HW(x_next) _RUN(hw_bufs)[_RUN(n_bufs)].x_next
+		HW(dma_fd) = -1;
+		US_CALLOC(HW(pbuf).planes_buffer, _RUN(n_planes));
 		assert((HW(raw.data) = aligned_alloc(page_size, buf_size)) != NULL);
 		memset(HW(raw.data), 0, buf_size);
 		HW(raw.allocated) = buf_size;
+		_device_init_frame_planes(dev, &HW(raw), _RUN(mem_planes));
 #		undef HW
 	}
 	return 0;
 }
 
+static int _device_open_io_method_dmabuf(us_device_s *dev) {
+	if (_RUN(n_planes) != 1) {
+		US_LOG_ERROR("DMABUF method supports only single memory plane, got n_planes=%u", _RUN(n_planes));
+		return -1;
+	}
+
+	struct v4l2_requestbuffers req = {0};
+	req.count = _device_get_n_bufs(dev);
+	req.type = _RUN(capture_type);
+	req.memory = V4L2_MEMORY_DMABUF;
+
+	US_LOG_DEBUG("Requesting %u device buffers for DMABUF ...", req.count);
+	if (_D_XIOCTL(VIDIOC_REQBUFS, &req) < 0) {
+		US_LOG_PERROR("Device '%s' doesn't support DMABUF method", dev->path);
+		return -1;
+	}
+
+	if (req.count < 1) {
+		US_LOG_ERROR("Insufficient buffer memory: %u", req.count);
+		return -1;
+	} else {
+		US_LOG_INFO("Requested %u device buffers, got %u", _device_get_n_bufs(dev), req.count);
+	}
+
+	// Если dma-heap нет, то остается udmabuf поверх memfd
+	const int heap_fd = open("/dev/dma_heap/system", O_RDONLY | O_CLOEXEC);
+	if (heap_fd < 0) {
+		US_LOG_INFO("DMA heap is unavailable, falling back to udmabuf");
+	}
+
+	US_LOG_DEBUG("Allocating DMA buffers ...");
+
+	US_CALLOC(_RUN(hw_bufs), req.count);
+
+	const unsigned page_size = getpagesize();
+	const size_t buf_size = us_align_size(_RUN(raw_size), page_size);
+
+	for (_RUN(n_bufs) = 0; _RUN(n_bufs) < req.count; ++_RUN(n_bufs)) {
+#		define HW(x_next) _RUN(hw_bufs)[_RUN(n_bufs)].x_next
+		US_CALLOC(HW(pbuf).planes_buffer, 1);
+		if ((HW(dma_fd) = _device_alloc_dmabuf(heap_fd, buf_size)) < 0) {
+			US_LOG_ERROR("Can't allocate DMA buffer=%u", _RUN(n_bufs));
+			US_DELETE(HW(pbuf).planes_buffer, free); // us_device_close() не доберется до незасчитанного буфера
+			goto error;
+		}
+		if ((HW(raw.data) = mmap(NULL, buf_size, PROT_READ | PROT_WRITE, MAP_SHARED, HW(dma_fd), 0)) == MAP_FAILED) {
+			US_LOG_PERROR("Can't map DMA buffer=%u", _RUN(n_bufs));
+			HW(raw.data) = NULL;
+			++_RUN(n_bufs); // Чтобы us_device_close() закрыл и этот fd
+			goto error;
+		}
+		HW(raw.allocated) = buf_size;
+		_device_init_frame_planes(dev, &HW(raw), _RUN(mem_planes));
+#		undef HW
+	}
+
+	if (heap_fd >= 0) {
+		close(heap_fd);
+	}
+	return 0;
+
+	error:
+		if (heap_fd >= 0) {
+			close(heap_fd);
+		}
+		return -1;
+}
+
+static int _device_alloc_dmabuf(int heap_fd, size_t size) {
+	if (heap_fd >= 0) {
+		struct dma_heap_allocation_data alloc = {0};
+		alloc.len = size;
+		alloc.fd_flags = O_RDWR | O_CLOEXEC;
+		if (us_xioctl(heap_fd, DMA_HEAP_IOCTL_ALLOC, &alloc) < 0) {
+			US_LOG_PERROR("Can't allocate DMA heap buffer");
+			return -1;
+		}
+		return alloc.fd;
+	}
+
+	int mem_fd = -1;
+	int udma_fd = -1;
+	int buf_fd = -1;
+
+	if ((mem_fd = memfd_create("ustreamer-dmabuf", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+		US_LOG_PERROR("Can't create memfd");
+		goto error;
+	}
+	if (ftruncate(mem_fd, size) < 0) {
+		US_LOG_PERROR("Can't truncate memfd");
+		goto error;
+	}
+	// udmabuf требует, чтобы память нельзя было уменьшить
+	if (fcntl(mem_fd, F_ADD_SEALS, F_SEAL_SHRINK) < 0) {
+		US_LOG_PERROR("Can't seal memfd");
+		goto error;
+	}
+	if ((udma_fd = open("/dev/udmabuf", O_RDWR | O_CLOEXEC)) < 0) {
+		US_LOG_PERROR("Can't open /dev/udmabuf");
+		goto error;
+	}
+
+	struct udmabuf_create create = {0};
+	create.memfd = mem_fd;
+	create.flags = UDMABUF_FLAGS_CLOEXEC;
+	create.offset = 0;
+	create.size = size;
+	if ((buf_fd = us_xioctl(udma_fd, UDMABUF_CREATE, &create)) < 0) {
+		US_LOG_PERROR("Can't create udmabuf");
+		goto error;
+	}
+
+	error:
+		if (udma_fd >= 0) {
+			close(udma_fd);
+		}
+		if (mem_fd >= 0) {
+			close(mem_fd); // Буфер держит ссылку на memfd сам
+		}
+		return buf_fd;
+}
+
+static void _device_sync_dmabuf(us_hw_buffer_s *hw, bool start) {
+	// Кеш CPU нужно синхронизировать вокруг доступа к памяти, в которую писало устройство
+	struct dma_buf_sync sync = {0};
+	sync.flags = (start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END) | DMA_BUF_SYNC_READ;
+	if (us_xioctl(hw->dma_fd, DMA_BUF_IOCTL_SYNC, &sync) < 0) {
+		US_LOG_PERROR("Can't sync DMA buffer=%u", hw->buf.index);
+	}
+}
+
 static int _device_open_queue_buffers(us_device_s *dev) {
 	for (unsigned index = 0; index < _RUN(n_bufs); ++index) {
+#		define HW(x_next) _RUN(hw_bufs)[index].x_next
+
 		struct v4l2_buffer buf = {0};
-		//buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-		buf.memory = dev->io_method;
-		buf.length = _RUN(n_planes);
-		buf.index = index;
-		buf.m.planes = _RUN(hw_bufs)[index].pbuf.planes_buffer;
+		_device_init_v4l2_buffer(dev, &buf, HW(pbuf).planes_buffer, index);
+
 		if (dev->io_method == V4L2_MEMORY_USERPTR) {
-			buf.m.userptr = (unsigned long)_RUN(hw_bufs)[index].raw.data;
-			buf.length = _RUN(hw_bufs)[index].raw.allocated;
+			for (unsigned plane = 0; plane < _RUN(n_planes); ++plane) {
+				const unsigned long ptr = (unsigned long)(HW(raw.data) + _RUN(mem_planes[plane].offset));
+				const size_t length = (plane + 1 < _RUN(n_planes)
+					? _RUN(mem_planes[plane + 1].offset) - _RUN(mem_planes[plane].offset)
+					: HW(raw.allocated) - _RUN(mem_planes[plane].offset));
+				if (_D_MPLANE) {
+					buf.m.planes[plane].m.userptr = ptr;
+					buf.m.planes[plane].length = length;
+				} else {
+					buf.m.userptr = ptr;
+					buf.length = length;
+				}
+			}
+		} else if (dev->io_method == V4L2_MEMORY_DMABUF) {
+			if (_D_MPLANE) {
+				buf.m.planes[0].m.fd = HW(dma_fd);
+				buf.m.planes[0].length = HW(raw.allocated);
+			} else {
+				buf.m.fd = HW(dma_fd);
+				buf.length = HW(raw.allocated);
+			}
 		}
 
 		US_LOG_DEBUG("Calling us_xioctl(VIDIOC_QBUF) for buffer=%u ...", index);
@@ -792,10 +1437,44 @@ static int _device_open_queue_buffers(us_device_s *dev) {
 			US_LOG_PERROR("Can't VIDIOC_QBUF");
 			return -1;
 		}
+
+#		undef HW
 	}
 	return 0;
 }
 
+static void _device_init_v4l2_buffer(us_device_s *dev, struct v4l2_buffer *buf, struct v4l2_plane *planes, unsigned index) {
+	buf->type = _RUN(capture_type);
+	buf->memory = dev->io_method;
+	buf->index = index;
+	if (_D_MPLANE) {
+		buf->m.planes = planes;
+		buf->length = _RUN(n_planes);
+	}
+}
+
+static void _device_init_frame_planes(us_device_s *dev, us_frame_s *raw, const us_frame_plane_s *mem_planes) {
+	if (_RUN(n_planes) == 1) {
+		// Все плоскости формата в одном буфере V4L2 (NV12 и т.п.)
+		raw->n_planes = us_frame_get_planes_layout(_RUN(format), _RUN(stride), _RUN(height), raw->planes);
+	} else {
+		// Каждая плоскость в отдельном буфере V4L2 (NV12M и т.п.)
+		raw->n_planes = _RUN(n_planes);
+		memcpy(raw->planes, mem_planes, sizeof(us_frame_plane_s) * _RUN(n_planes));
+	}
+}
+
+static size_t _device_get_bytesused(us_device_s *dev, const struct v4l2_buffer *buf, const us_hw_buffer_s *hw) {
+	if (!_D_MPLANE) {
+		return buf->bytesused;
+	} else if (_RUN(n_planes) == 1) {
+		return buf->m.planes[0].bytesused;
+	}
+	// Кадр занимает всю непрерывную область вплоть до конца последней плоскости
+	const unsigned last = _RUN(n_planes) - 1;
+	return hw->raw.planes[last].offset + buf->m.planes[last].bytesused;
+}
+
 static int _device_apply_resolution(us_device_s *dev, unsigned width, unsigned height) {
 	// Тут VIDEO_MIN_* не используются из-за странностей минимального разрешения при отсутствии сигнала
 	// у некоторых устройств, например TC358743
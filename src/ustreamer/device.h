@@ -32,14 +32,21 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <assert.h>
+#include <libgen.h>
 
-#include <sys/select.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include <sys/mman.h>
 #include <sys/time.h>
 
 #include <pthread.h>
 #include <linux/videodev2.h>
 #include <linux/v4l2-controls.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <linux/udmabuf.h>
 
 #include "../libs/tools.h"
 #include "../libs/array.h"
@@ -48,6 +55,8 @@
 #include "../libs/frame.h"
 #include "../libs/xioctl.h"
 
+#include "synth.h"
+
 
 #define US_VIDEO_MIN_WIDTH		((unsigned)160)
 #define US_VIDEO_MAX_WIDTH		((unsigned)10240)
@@ -57,14 +66,17 @@
 
 #define US_VIDEO_MAX_FPS		((unsigned)120)
 
+#define US_VIDEO_MIN_BUFS		((unsigned)2)
+#define US_VIDEO_MAX_BUFS		((unsigned)VIDEO_MAX_FRAME)
+
 #define US_STANDARD_UNKNOWN		V4L2_STD_UNKNOWN
 #define US_STANDARDS_STR		"PAL, NTSC, SECAM"
 
 #define US_FORMAT_UNKNOWN		-1
-#define US_FORMATS_STR			"YUYV, UYVY, RGB565, RGB24, MJPEG, JPEG"
+#define US_FORMATS_STR			"YUYV, UYVY, RGB565, RGB24, NV12, NV16, NV24, NV12M, NV16M, MJPEG, JPEG"
 
 #define US_IO_METHOD_UNKNOWN	-1
-#define US_IO_METHODS_STR		"MMAP, USERPTR"
+#define US_IO_METHODS_STR		"MMAP, USERPTR, DMABUF"
 
 
 
@@ -87,19 +99,37 @@ typedef struct {
 } us_hw_buffer_s;
 
 typedef struct {
-	int				fd;
-	unsigned		width;
-	unsigned		height;
-	unsigned		format;
-	unsigned		stride;
-	unsigned		hw_fps;
-	unsigned		jpeg_quality;
-	size_t			raw_size;
-	unsigned		n_bufs;
-	unsigned		n_planes;
-	us_hw_buffer_s	*hw_bufs;
-	bool			capturing;
-	bool			persistent_timeout_reported;
+	uint8_t	*data;
+	size_t	mapped; // Size of the anonymous mapping, zero for the heap memory
+} us_hw_orphan_s;
+
+typedef struct {
+	int					fd;
+	int					epoll_fd;
+	int					wakeup_fd;
+	enum v4l2_buf_type	capture_type;
+	unsigned			width;
+	unsigned			height;
+	unsigned			format;
+	unsigned			stride;
+	unsigned			hw_fps;
+	unsigned			jpeg_quality;
+	size_t				raw_size;
+	unsigned			n_bufs;
+	unsigned			n_planes; // V4L2 memory planes
+	us_frame_plane_s	mem_planes[US_FRAME_MAX_PLANES];
+	us_hw_buffer_s		*hw_bufs;
+	us_synth_s			*synth;
+	bool				capturing;
+	bool				persistent_timeout_reported;
+
+	// Статистика удержания буферов для --adaptive-buffers
+	unsigned			n_bufs_wanted;
+	unsigned			n_grabbed;
+	unsigned			n_starved;
+	long double			last_grab_ts;
+	long double			frame_interval;
+	long double			hold_max;
 } us_device_runtime_s;
 
 typedef enum {
@@ -132,6 +162,8 @@ typedef struct {
 
 typedef struct {
 	char				*path;
+	bool				test_pattern;
+	char				*replay_path;
 	unsigned			input;
 	unsigned			width;
 	unsigned			height;
@@ -141,6 +173,7 @@ typedef struct {
 	enum v4l2_memory	io_method;
 	bool				dv_timings;
 	unsigned			n_bufs;
+	bool				adaptive_bufs;
 	// unsigned			n_planes;
 	unsigned			desired_fps;
 	size_t				min_frame_size;
@@ -161,11 +194,18 @@ v4l2_std_id us_device_parse_standard(const char *str);
 int us_device_parse_io_method(const char *str);
 
 int us_device_open(us_device_s *dev);
+int us_device_reconfigure(us_device_s *dev);
 void us_device_close(us_device_s *dev);
 
 int us_device_export_to_dma(us_device_s *dev);
 int us_device_switch_capturing(us_device_s *dev, bool enable);
 int us_device_select(us_device_s *dev, bool *has_read, bool *has_write, bool *has_error);
+void us_device_wakeup(us_device_s *dev);
+bool us_device_sleep(us_device_s *dev, long double timeout);
+bool us_device_wait_path(us_device_s *dev, const char *path, int mode, long double timeout);
 int us_device_grab_buffer(us_device_s *dev, us_hw_buffer_s **hw);
+int us_device_grab_latest_buffer(us_device_s *dev, us_hw_buffer_s **hw, unsigned *n_stale);
 int us_device_release_buffer(us_device_s *dev, us_hw_buffer_s *hw);
+int us_device_detach_buffer(us_device_s *dev, us_hw_buffer_s *hw, us_hw_orphan_s *orphan);
+void us_device_free_orphan(us_hw_orphan_s *orphan);
 int us_device_consume_event(us_device_s *dev);
@@ -39,6 +39,74 @@ static const struct {
 };
 
 
+static void *_cpu_ctx_init(us_encoder_s *enc);
+static void _cpu_ctx_destroy(void *ctx);
+static int _cpu_compress(us_worker_s *wr, const us_frame_s *src, us_frame_s *dest);
+
+static int _hw_compress(us_worker_s *wr, const us_frame_s *src, us_frame_s *dest);
+
+static int _m2m_prepare(us_encoder_s *enc, us_device_s *dev, unsigned *n_workers, unsigned quality);
+static void _m2m_destroy(us_encoder_s *enc);
+static int _m2m_compress(us_worker_s *wr, const us_frame_s *src, us_frame_s *dest);
+
+static int _noop_compress(us_worker_s *wr, const us_frame_s *src, us_frame_s *dest);
+
+static int _mpp_prepare(us_encoder_s *enc, us_device_s *dev, unsigned *n_workers, unsigned quality);
+static int _mpp_resize(us_encoder_s *enc, us_device_s *dev);
+static void _mpp_destroy(us_encoder_s *enc);
+static int _mpp_compress(us_worker_s *wr, const us_frame_s *src, us_frame_s *dest);
+
+
+static const us_encoder_backend_s _BACKENDS[] = {
+	{
+		.type = US_ENCODER_TYPE_CPU,
+		.raw_input = true,
+		.ctx_init = _cpu_ctx_init,
+		.ctx_destroy = _cpu_ctx_destroy,
+		.compress = _cpu_compress,
+	},
+	{
+		.type = US_ENCODER_TYPE_HW,
+		.jpeg_input = true,
+		.zero_copy = true,
+		.device_quality = true,
+		.max_workers = 1,
+		.compress = _hw_compress,
+	},
+	{
+		.type = US_ENCODER_TYPE_M2M_VIDEO,
+		.raw_input = true,
+		.need_dma = true,
+		.prepare = _m2m_prepare,
+		.destroy = _m2m_destroy,
+		.compress = _m2m_compress,
+	},
+	{
+		.type = US_ENCODER_TYPE_M2M_IMAGE,
+		.raw_input = true,
+		.need_dma = true,
+		.prepare = _m2m_prepare,
+		.destroy = _m2m_destroy,
+		.compress = _m2m_compress,
+	},
+	{
+		.type = US_ENCODER_TYPE_NOOP,
+		.raw_input = true,
+		.dummy = true,
+		.max_workers = 1,
+		.compress = _noop_compress,
+	},
+	{
+		.type = US_ENCODER_TYPE_MPP,
+		.raw_input = true,
+		.prepare = _mpp_prepare,
+		.resize = _mpp_resize,
+		.destroy = _mpp_destroy,
+		.compress = _mpp_compress,
+	},
+};
+
+
 static void *_worker_job_init(void *v_enc);
 static void _worker_job_destroy(void *v_job);
 static bool _worker_run_job(us_worker_s *wr);
@@ -58,22 +126,18 @@ us_encoder_s *us_encoder_init(void) {
 	US_CALLOC(enc, 1);
 	enc->type = run->type;
 	enc->n_workers = us_get_cores_available();
+	enc->n_strips = 1;
 	enc->run = run;
 	return enc;
 }
 
 void us_encoder_destroy(us_encoder_s *enc) {
-	if (_ER(m2ms) != NULL) {
-		for (unsigned index = 0; index < _ER(n_m2ms); ++index) {
-			US_DELETE(_ER(m2ms[index]), us_m2m_encoder_destroy)
+	// Общие контексты бэкенды создают лениво, поэтому их может быть несколько после фолбэков
+	US_ARRAY_ITERATE(_BACKENDS, 0, backend, {
+		if (backend->destroy != NULL) {
+			backend->destroy(enc);
 		}
-		free(_ER(m2ms));
-	}
-
-	if (_ER(mpp) != NULL) {
-		us_mpp_encoder_destory(_ER(mpp));
-	}
-
+	});
 	US_MUTEX_DESTROY(_ER(mutex));
 	free(enc->run);
 	free(enc);
@@ -97,92 +161,80 @@ const char *us_encoder_type_to_string(us_encoder_type_e type) {
 	return _ENCODER_TYPES[0].name;
 }
 
+const us_encoder_backend_s *us_encoder_get_backend(us_encoder_type_e type) {
+	US_ARRAY_ITERATE(_BACKENDS, 0, backend, {
+		if (backend->type == type) {
+			return backend;
+		}
+	});
+	return &_BACKENDS[0]; // CPU
+}
+
 us_workers_pool_s *us_encoder_workers_pool_init(us_encoder_s *enc, us_device_s *dev) {
 #	define DR(x_next) dev->run->x_next
 
-	us_encoder_type_e type = (_ER(cpu_forced) ? US_ENCODER_TYPE_CPU : enc->type);
-	unsigned quality = dev->jpeg_quality;
-	unsigned n_workers = us_min_u(enc->n_workers, DR(n_bufs));
-	bool cpu_forced = false;
+	const us_encoder_backend_s *backend = us_encoder_get_backend(_ER(cpu_forced) ? US_ENCODER_TYPE_CPU : enc->type);
+	const bool jpeg = us_is_jpeg(DR(format));
 
-	if (us_is_jpeg(DR(format)) && type != US_ENCODER_TYPE_HW) {
+	if (jpeg && !backend->jpeg_input) {
 		US_LOG_INFO("Switching to HW encoder: the input is (M)JPEG ...");
-		type = US_ENCODER_TYPE_HW;
+		backend = us_encoder_get_backend(US_ENCODER_TYPE_HW);
+	} else if (!jpeg && !backend->raw_input) {
+		US_LOG_INFO("Switching to CPU encoder: the input format is not (M)JPEG ...");
+		backend = us_encoder_get_backend(US_ENCODER_TYPE_CPU);
 	}
 
-	if (type == US_ENCODER_TYPE_MPP) {
-		US_LOG_INFO("Switching to MPP encoder ...");
-		if (_ER(mpp) == NULL) {
-			_ER(mpp) = us_mpp_jpeg_encoder_init(dev->width, dev->height, MPP_FMT_YUV422_UYVY, 30, quality);
-		}
-		n_workers = 1;
+	unsigned n_workers = us_min_u(enc->n_workers, DR(n_bufs));
+	if (backend->max_workers > 0) {
+		n_workers = us_min_u(n_workers, backend->max_workers);
+	}
 
-	} else if (type == US_ENCODER_TYPE_HW) {
-		if (!us_is_jpeg(DR(format))) {
-			US_LOG_INFO("Switching to CPU encoder: the input format is not (M)JPEG ...");
-			goto use_cpu;
-		}
+	unsigned quality = dev->jpeg_quality;
+	if (backend->device_quality) {
 		quality = DR(jpeg_quality);
-		n_workers = 1;
-
-	} else if (type == US_ENCODER_TYPE_M2M_VIDEO || type == US_ENCODER_TYPE_M2M_IMAGE) {
-		US_LOG_DEBUG("Preparing M2M-%s encoder ...", (type == US_ENCODER_TYPE_M2M_VIDEO ? "VIDEO" : "IMAGE"));
-		if (_ER(m2ms) == NULL) {
-			US_CALLOC(_ER(m2ms), n_workers);
-		}
-		for (; _ER(n_m2ms) < n_workers; ++_ER(n_m2ms)) {
-			// Начинаем с нуля и доинициализируем на следующих заходах при необходимости
-			char name[32];
-			snprintf(name, 32, "JPEG-%u", _ER(n_m2ms));
-			if (type == US_ENCODER_TYPE_M2M_VIDEO) {
-				_ER(m2ms[_ER(n_m2ms)]) = us_m2m_mjpeg_encoder_init(name, enc->m2m_path, quality);
-			} else {
-				_ER(m2ms[_ER(n_m2ms)]) = us_m2m_jpeg_encoder_init(name, enc->m2m_path, quality);
-			}
-		}
-	} else if (type == US_ENCODER_TYPE_NOOP) {
-		n_workers = 1;
+	} else if (backend->dummy) {
 		quality = 0;
 	}
 
-	goto ok;
-
-	use_cpu:
-		type = US_ENCODER_TYPE_CPU;
+	US_LOG_DEBUG("Preparing %s encoder ...", us_encoder_type_to_string(backend->type));
+	if (backend->prepare != NULL && backend->prepare(enc, dev, &n_workers, quality) < 0) {
+		US_LOG_ERROR("Can't prepare %s encoder, falling back to CPU", us_encoder_type_to_string(backend->type));
+		backend = us_encoder_get_backend(US_ENCODER_TYPE_CPU);
+		n_workers = us_min_u(enc->n_workers, DR(n_bufs));
 		quality = dev->jpeg_quality;
+	}
 
-	ok:
-		if (type == US_ENCODER_TYPE_NOOP) {
-			US_LOG_INFO("Using JPEG NOOP encoder");
-		} else if (quality == 0) {
-			US_LOG_INFO("Using JPEG quality: encoder default");
-		} else {
-			US_LOG_INFO("Using JPEG quality: %u%%", quality);
-		}
-
-		US_MUTEX_LOCK(_ER(mutex));
-		_ER(type) = type;
-		_ER(quality) = quality;
-		if (cpu_forced) {
-			_ER(cpu_forced) = true;
-		}
-		US_MUTEX_UNLOCK(_ER(mutex));
+	if (backend->dummy) {
+		US_LOG_INFO("Using JPEG NOOP encoder");
+	} else if (quality == 0) {
+		US_LOG_INFO("Using JPEG quality: encoder default");
+	} else {
+		US_LOG_INFO("Using JPEG quality: %u%%", quality);
+	}
 
-		const long double desired_interval = (
-			dev->desired_fps > 0 && (dev->desired_fps < dev->run->hw_fps || dev->run->hw_fps == 0)
-			? (long double)1 / dev->desired_fps
-			: 0
-		);
+	US_MUTEX_LOCK(_ER(mutex));
+	_ER(type) = backend->type;
+	_ER(quality) = quality;
+	_ER(backend) = backend;
+	US_MUTEX_UNLOCK(_ER(mutex));
 
-		return us_workers_pool_init(
-			"JPEG", "jw", n_workers, desired_interval,
-			_worker_job_init, (void *)enc,
-			_worker_job_destroy,
-			_worker_run_job);
+	return us_workers_pool_init(
+		"JPEG", "jw", n_workers,
+		_worker_job_init, (void *)enc,
+		_worker_job_destroy,
+		_worker_run_job);
 
 #	undef DR
 }
 
+int us_encoder_resize(us_encoder_s *enc, us_device_s *dev) {
+	// CPU, HW и M2M подстраиваются под размер кадра сами, им хук не нужен
+	if (_ER(backend) == NULL || _ER(backend)->resize == NULL) {
+		return 0;
+	}
+	return _ER(backend)->resize(enc, dev);
+}
+
 void us_encoder_get_runtime_params(us_encoder_s *enc, us_encoder_type_e *type, unsigned *quality) {
 	US_MUTEX_LOCK(_ER(mutex));
 	*type = _ER(type);
@@ -191,58 +243,46 @@ void us_encoder_get_runtime_params(us_encoder_s *enc, us_encoder_type_e *type, u
 }
 
 static void *_worker_job_init(void *v_enc) {
+	us_encoder_s *const enc = (us_encoder_s *)v_enc;
 	us_encoder_job_s *job;
 	US_CALLOC(job, 1);
-	job->enc = (us_encoder_s *)v_enc;
-	job->dest = us_frame_init();
+	job->enc = enc;
+	job->backend = _ER(backend);
 	return (void *)job;
 }
 
 static void _worker_job_destroy(void *v_job) {
 	us_encoder_job_s *job = (us_encoder_job_s *)v_job;
-	us_frame_destroy(job->dest);
+	if (job->dest_ref != NULL) {
+		us_ring_frame_unref(job->dest_ref);
+	}
+	if (job->ctx != NULL) {
+		job->backend->ctx_destroy(job->ctx);
+	}
 	free(job);
 }
 
 static bool _worker_run_job(us_worker_s *wr) {
 	us_encoder_job_s *job = (us_encoder_job_s *)wr->job;
 	us_encoder_s *enc = job->enc; // Just for _ER()
-	us_frame_s *src = &job->hw->raw;
+	const us_encoder_backend_s *const backend = job->backend;
+	const us_frame_s *src = &job->hw->raw;
 	us_frame_s *dest = job->dest;
 
-	assert(_ER(type) != US_ENCODER_TYPE_UNKNOWN);
-
-	if (_ER(type) == US_ENCODER_TYPE_CPU) {
-		US_LOG_VERBOSE("Compressing JPEG using CPU: worker=%s, buffer=%u",
-			wr->name, job->hw->buf.index);
-		us_cpu_encoder_compress(src, dest, _ER(quality));
+	assert(backend != NULL);
 
-	} else if (_ER(type) == US_ENCODER_TYPE_HW) {
-		US_LOG_VERBOSE("Compressing JPEG using HW (just copying): worker=%s, buffer=%u",
-			wr->name, job->hw->buf.index);
-		us_hw_encoder_compress(src, dest);
+	US_LOG_VERBOSE("Compressing JPEG using %s: worker=%s, buffer=%u",
+		us_encoder_type_to_string(backend->type), wr->name, job->hw->buf.index);
 
-	} else if (_ER(type) == US_ENCODER_TYPE_M2M_VIDEO || _ER(type) == US_ENCODER_TYPE_M2M_IMAGE) {
-		US_LOG_VERBOSE("Compressing JPEG using M2M-%s: worker=%s, buffer=%u",
-			(_ER(type) == US_ENCODER_TYPE_M2M_VIDEO ? "VIDEO" : "IMAGE"), wr->name, job->hw->buf.index);
-		if (us_m2m_encoder_compress(_ER(m2ms[wr->number]), src, dest, false) < 0) {
+	if (job->ctx == NULL && backend->ctx_init != NULL) {
+		job->ctx = backend->ctx_init(enc);
+	}
+	if (backend->compress != NULL) {
+		if (backend->compress(wr, src, dest) < 0) {
 			goto error;
 		}
-
-	} else if (_ER(type) == US_ENCODER_TYPE_NOOP) {
-		US_LOG_VERBOSE("Compressing JPEG using NOOP (do nothing): worker=%s, buffer=%u",
-			wr->name, job->hw->buf.index);
-		us_frame_encoding_begin(src, dest, V4L2_PIX_FMT_JPEG);
-		usleep(5000); // Просто чтобы работала логика desired_fps
-		dest->encode_end_ts = us_get_now_monotonic(); // us_frame_encoding_end()
-	} else if (_ER(type) == US_ENCODER_TYPE_MPP) {
-		US_LOG_VERBOSE("Compressing JPEG using MPP: worker=%s, buffer=%u",
-			wr->name, job->hw->buf.index);
-		if(us_mpp_jpeg_encoder_compress(_ER(mpp), src, dest) < 0) {
-			// wr->job_failed = true;
-			// US_LOG_ERROR("Compression failed: worker=%s, buffer=%u", wr->name, job->hw->buf.index);
-			// US_LOG_ERROR("Error while compressing buffer, falling back to MPP");
-			// return false;
+	} else {
+		if (backend->submit(wr, src) < 0 || backend->collect(wr, dest) < 0) {
 			goto error;
 		}
 	}
@@ -263,3 +303,146 @@ static bool _worker_run_job(us_worker_s *wr) {
 		US_MUTEX_UNLOCK(_ER(mutex));
 		return false;
 }
+
+static void *_cpu_ctx_init(us_encoder_s *enc) {
+	return (void *)us_cpu_encoder_init(enc->n_strips);
+}
+
+static void _cpu_ctx_destroy(void *ctx) {
+	us_cpu_encoder_destroy((us_cpu_encoder_s *)ctx);
+}
+
+static int _cpu_compress(us_worker_s *wr, const us_frame_s *src, us_frame_s *dest) {
+	us_encoder_job_s *const job = (us_encoder_job_s *)wr->job;
+	us_encoder_s *const enc = job->enc;
+	us_cpu_encoder_compress((us_cpu_encoder_s *)job->ctx, src, dest, _ER(quality));
+	return 0;
+}
+
+static int _hw_compress(us_worker_s *wr, const us_frame_s *src, us_frame_s *dest) {
+	const us_encoder_job_s *const job = (us_encoder_job_s *)wr->job;
+	US_LOG_VERBOSE("HW encoder mode: %s", (job->zero_copy ? "passthrough" : "just copying"));
+	us_hw_encoder_compress(src, dest, job->zero_copy);
+	return 0;
+}
+
+static int _m2m_prepare(us_encoder_s *enc, UNUSED us_device_s *dev, unsigned *n_workers, unsigned quality) {
+	if (_ER(m2ms) == NULL) {
+		US_CALLOC(_ER(m2ms), *n_workers);
+	} else if (_ER(n_m2ms) < *n_workers) {
+		US_REALLOC(_ER(m2ms), *n_workers);
+	}
+	const bool video = (enc->type == US_ENCODER_TYPE_M2M_VIDEO);
+	for (; _ER(n_m2ms) < *n_workers; ++_ER(n_m2ms)) {
+		// Начинаем с нуля и доинициализируем на следующих заходах при необходимости
+		char name[32];
+		snprintf(name, 32, "JPEG-%u", _ER(n_m2ms));
+		if (video) {
+			_ER(m2ms[_ER(n_m2ms)]) = us_m2m_mjpeg_encoder_init(name, enc->m2m_path, quality);
+		} else {
+			_ER(m2ms[_ER(n_m2ms)]) = us_m2m_jpeg_encoder_init(name, enc->m2m_path, quality);
+		}
+	}
+	return 0;
+}
+
+static void _m2m_destroy(us_encoder_s *enc) {
+	if (_ER(m2ms) != NULL) {
+		for (unsigned index = 0; index < _ER(n_m2ms); ++index) {
+			US_DELETE(_ER(m2ms[index]), us_m2m_encoder_destroy)
+		}
+		free(_ER(m2ms));
+		_ER(m2ms) = NULL;
+		_ER(n_m2ms) = 0;
+	}
+}
+
+static int _m2m_compress(us_worker_s *wr, const us_frame_s *src, us_frame_s *dest) {
+	us_encoder_s *const enc = ((us_encoder_job_s *)wr->job)->enc;
+	return us_m2m_encoder_compress(_ER(m2ms[wr->number]), src, dest, false);
+}
+
+static int _noop_compress(UNUSED us_worker_s *wr, const us_frame_s *src, us_frame_s *dest) {
+	us_frame_encoding_begin(src, dest, V4L2_PIX_FMT_JPEG);
+	usleep(5000); // Просто чтобы работала логика desired_fps
+	dest->encode_end_ts = us_get_now_monotonic(); // us_frame_encoding_end()
+	return 0;
+}
+
+static int _mpp_prepare(us_encoder_s *enc, us_device_s *dev, unsigned *n_workers, unsigned quality) {
+	if (
+		_ER(n_mpps) > 0 && (
+			_ER(mpps_width) != dev->run->width
+			|| _ER(mpps_height) != dev->run->height
+			|| _ER(mpps_format) != dev->run->format
+		)
+	) {
+		// Устройство перезапустилось с другой геометрией: старые контексты читали бы мимо кадра
+		if (_mpp_resize(enc, dev) < 0) {
+			US_LOG_INFO("Reopening MPP encoders from scratch ...");
+		}
+	}
+	if (_ER(mpps) == NULL) {
+		US_CALLOC(_ER(mpps), *n_workers);
+	} else if (_ER(n_mpps) < *n_workers) {
+		US_REALLOC(_ER(mpps), *n_workers);
+	}
+	// Каждому воркеру свой контекст, чтобы в VPU одновременно было несколько кадров.
+	// Контексты открываются по одному, пока их принимает MPP: это и есть емкость VPU.
+	for (; _ER(n_mpps) < *n_workers; ++_ER(n_mpps)) {
+		us_mpp_encoder_s *const mpp = us_mpp_jpeg_encoder_init(
+			dev->run->width, dev->run->height,
+			us_mpp_format_from_v4l2(dev->run->format), 30, quality);
+		if (mpp == NULL) {
+			break;
+		}
+		_ER(mpps[_ER(n_mpps)]) = mpp;
+	}
+	if (_ER(n_mpps) == 0) {
+		return -1;
+	}
+	_ER(mpps_width) = dev->run->width;
+	_ER(mpps_height) = dev->run->height;
+	_ER(mpps_format) = dev->run->format;
+	if (_ER(n_mpps) < *n_workers) {
+		US_LOG_INFO("MPP has accepted only %u encoding contexts, using %u workers instead of %u",
+			_ER(n_mpps), _ER(n_mpps), *n_workers);
+		*n_workers = _ER(n_mpps);
+	}
+	return 0;
+}
+
+static int _mpp_resize(us_encoder_s *enc, us_device_s *dev) {
+	// Контексты MPP создаются под конкретную геометрию
+	US_LOG_INFO("Resizing %u MPP encoders to %ux%u ...", _ER(n_mpps), dev->run->width, dev->run->height);
+	for (unsigned index = 0; index < _ER(n_mpps); ++index) {
+		us_mpp_encoder_destory(_ER(mpps[index]));
+		_ER(mpps[index]) = us_mpp_jpeg_encoder_init(
+			dev->run->width, dev->run->height,
+			us_mpp_format_from_v4l2(dev->run->format), 30, _ER(quality));
+		if (_ER(mpps[index]) == NULL) {
+			_mpp_destroy(enc); // Будут открыты заново при перезапуске пула
+			return -1;
+		}
+	}
+	_ER(mpps_width) = dev->run->width;
+	_ER(mpps_height) = dev->run->height;
+	_ER(mpps_format) = dev->run->format;
+	return 0;
+}
+
+static void _mpp_destroy(us_encoder_s *enc) {
+	if (_ER(mpps) != NULL) {
+		for (unsigned index = 0; index < _ER(n_mpps); ++index) {
+			US_DELETE(_ER(mpps[index]), us_mpp_encoder_destory)
+		}
+		free(_ER(mpps));
+		_ER(mpps) = NULL;
+		_ER(n_mpps) = 0;
+	}
+}
+
+static int _mpp_compress(us_worker_s *wr, const us_frame_s *src, us_frame_s *dest) {
+	us_encoder_s *const enc = ((us_encoder_job_s *)wr->job)->enc;
+	return us_mpp_jpeg_encoder_compress(_ER(mpps[wr->number]), src, dest);
+}
@@ -35,6 +35,7 @@
 #include "../libs/threading.h"
 #include "../libs/logging.h"
 #include "../libs/frame.h"
+#include "../libs/ring.h"
 
 #include "device.h"
 #include "workers.h"
@@ -63,14 +64,21 @@ typedef struct {
 	bool				cpu_forced;
 	pthread_mutex_t		mutex;
 
+	const struct us_encoder_backend_sx *backend; // Chosen by us_encoder_workers_pool_init()
+
 	unsigned			n_m2ms;
 	us_m2m_encoder_s	**m2ms;
-	us_mpp_encoder_s 	*mpp;
+	unsigned			n_mpps;
+	us_mpp_encoder_s 	**mpps;
+	unsigned			mpps_width; // Geometry the MPP contexts were created for
+	unsigned			mpps_height;
+	unsigned			mpps_format;
 } us_encoder_runtime_s;
 
 typedef struct {
 	us_encoder_type_e	type;
 	unsigned			n_workers;
+	unsigned			n_strips;
 	char				*m2m_path;
 
 	us_encoder_runtime_s *run;
@@ -80,16 +88,55 @@ typedef struct {
 	us_encoder_s	*enc;
 	us_hw_buffer_s	*hw;
 	us_frame_s		*dest;
+	us_ring_frame_s	*dest_ref; // The stream gives it before each job, dest points to its frame
+	bool			zero_copy; // Allowed if the backend supports it: dest may refer to the hw buffer
+
+	const struct us_encoder_backend_sx *backend; // The pool is recreated if the backend changes
+	void			*ctx; // Backend's per-worker context, created by the first job
 } us_encoder_job_s;
 
+typedef int (*us_encoder_prepare_f)(us_encoder_s *enc, us_device_s *dev, unsigned *n_workers, unsigned quality);
+typedef int (*us_encoder_resize_f)(us_encoder_s *enc, us_device_s *dev);
+typedef void (*us_encoder_destroy_f)(us_encoder_s *enc);
+typedef void *(*us_encoder_ctx_init_f)(us_encoder_s *enc);
+typedef void (*us_encoder_ctx_destroy_f)(void *ctx);
+typedef int (*us_encoder_compress_f)(us_worker_s *wr, const us_frame_s *src, us_frame_s *dest);
+typedef int (*us_encoder_submit_f)(us_worker_s *wr, const us_frame_s *src);
+typedef int (*us_encoder_collect_f)(us_worker_s *wr, us_frame_s *dest);
+
+typedef struct us_encoder_backend_sx {
+	us_encoder_type_e	type;
+
+	// Capabilities, the pool is scheduled against them
+	bool		raw_input; // Can encode raw formats
+	bool		jpeg_input; // Can handle (M)JPEG input
+	bool		zero_copy; // Can refer to the input buffer, see us_encoder_job_s.zero_copy
+	bool		need_dma; // The device buffers should be exported to DMA
+	bool		device_quality; // JPEG quality is set by the device, not by the encoder
+	bool		dummy; // Doesn't produce any data, just for benchmarking
+	unsigned	max_workers; // Zero for any
+
+	// Everything except compress() or submit() + collect() is optional
+	us_encoder_prepare_f		prepare; // Called on each pool init, creates the shared contexts, may reduce n_workers
+	us_encoder_resize_f			resize; // Called if the device has changed the geometry on the fly
+	us_encoder_destroy_f		destroy; // Frees the shared contexts
+	us_encoder_ctx_init_f		ctx_init;
+	us_encoder_ctx_destroy_f	ctx_destroy;
+	us_encoder_compress_f		compress;
+	us_encoder_submit_f			submit; // Async backends: the worker waits for collect() right after submit()
+	us_encoder_collect_f		collect;
+} us_encoder_backend_s;
+
 
 us_encoder_s *us_encoder_init(void);
 void us_encoder_destroy(us_encoder_s *enc);
 
 us_encoder_type_e us_encoder_parse_type(const char *str);
 const char *us_encoder_type_to_string(us_encoder_type_e type);
+const us_encoder_backend_s *us_encoder_get_backend(us_encoder_type_e type);
 
 us_workers_pool_s *us_encoder_workers_pool_init(us_encoder_s *enc, us_device_s *dev);
+int us_encoder_resize(us_encoder_s *enc, us_device_s *dev);
 void us_encoder_get_runtime_params(us_encoder_s *enc, us_encoder_type_e *type, unsigned *quality);
 
 int us_encoder_compress(us_encoder_s *enc, unsigned worker_number, us_frame_s *src, us_frame_s *dest);
@@ -28,66 +28,299 @@
 #include "encoder.h"
 
 
+#define _MAX_RESTART_INTERVAL 0xFFFF
+
+
 typedef struct {
 	struct	jpeg_destination_mgr mgr; // Default manager
-	JOCTET	*buf; // Start of buffer
 	us_frame_s	*frame;
 } _jpeg_dest_manager_s;
 
 
+static void _compress_rows(
+	us_cpu_encoder_s *enc, const us_frame_s *src, us_frame_s *dest,
+	unsigned first_row, unsigned n_rows, unsigned quality, unsigned restart_interval);
+static void _compress_strips(us_cpu_encoder_s *enc, const us_frame_s *src, us_frame_s *dest, unsigned quality, unsigned strip_rows);
+static unsigned _get_strip_rows(const us_frame_s *src, unsigned n_strips);
+static unsigned _get_strip_mcus(const us_frame_s *src, unsigned strip_rows);
+static size_t _find_scan_data(const us_frame_s *frame, size_t *sof_offset);
+
+static us_cpu_executor_s *_executor_ref(void);
+static void _executor_unref(us_cpu_executor_s *ex);
+static void *_executor_thread(void *v_ex);
+
 static void _jpeg_set_dest_frame(j_compress_ptr jpeg, us_frame_s *frame);
+static void _jpeg_set_params(
+	us_cpu_encoder_s *enc, const us_frame_s *src,
+	unsigned n_rows, unsigned quality, unsigned restart_interval);
+static uint8_t *_get_scratch(us_cpu_encoder_s *enc, size_t size);
 
-static void _jpeg_write_scanlines_yuyv(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
-static void _jpeg_write_scanlines_uyvy(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
-static void _jpeg_write_scanlines_rgb565(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
-static void _jpeg_write_scanlines_rgb24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame);
+static bool _is_raw_yuv(unsigned format);
+static void _jpeg_write_raw_yuv(us_cpu_encoder_s *enc, const us_frame_s *frame, unsigned first_row);
+static void _read_raw_luma(const us_frame_s *frame, unsigned row, uint8_t *y);
+static void _read_raw_chroma(const us_frame_s *frame, unsigned row, uint8_t *cb, uint8_t *cr);
+
+static void _jpeg_write_scanlines_rgb565(us_cpu_encoder_s *enc, const us_frame_s *frame, unsigned first_row);
+static void _jpeg_write_scanlines_rgb24(us_cpu_encoder_s *enc, const us_frame_s *frame, unsigned first_row);
 
 static void _jpeg_init_destination(j_compress_ptr jpeg);
 static boolean _jpeg_empty_output_buffer(j_compress_ptr jpeg);
 static void _jpeg_term_destination(j_compress_ptr jpeg);
 
 
-void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, unsigned quality) {
+static pthread_mutex_t _g_executor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static us_cpu_executor_s *_g_executor = NULL;
+
+
+us_cpu_encoder_s *us_cpu_encoder_init(unsigned n_strips) {
+	assert(n_strips >= 1 && n_strips <= US_CPU_ENCODER_MAX_STRIPS);
+	us_cpu_encoder_s *enc;
+	US_CALLOC(enc, 1);
+	enc->n_strips = n_strips;
+	enc->jpeg.err = jpeg_std_error(&enc->jpeg_error);
+	jpeg_create_compress(&enc->jpeg);
+	if (n_strips > 1) {
+		enc->executor = _executor_ref();
+		for (unsigned index = 1; index < US_CPU_ENCODER_MAX_STRIPS; ++index) {
+			enc->strips[index].owner = enc; // Буферы создаются по мере надобности, см. _compress_strips()
+		}
+		US_COND_INIT(enc->pending_cond);
+	}
+	return enc;
+}
+
+void us_cpu_encoder_destroy(us_cpu_encoder_s *enc) {
+	if (enc->executor != NULL) {
+		US_COND_DESTROY(enc->pending_cond);
+		for (unsigned index = 1; index < US_CPU_ENCODER_MAX_STRIPS; ++index) {
+			US_DELETE(enc->strips[index].dest, us_frame_destroy);
+		}
+		_executor_unref(enc->executor);
+	}
+	jpeg_destroy_compress(&enc->jpeg);
+	US_DELETE(enc->buf, free);
+	free(enc);
+}
+
+void us_cpu_encoder_compress(us_cpu_encoder_s *enc, const us_frame_s *src, us_frame_s *dest, unsigned quality) {
 	// This function based on compress_image_to_jpeg() from mjpg-streamer
 
 	us_frame_encoding_begin(src, dest, V4L2_PIX_FMT_JPEG);
 
-	struct jpeg_compress_struct jpeg;
-	struct jpeg_error_mgr jpeg_error;
-
-	jpeg.err = jpeg_std_error(&jpeg_error);
-	jpeg_create_compress(&jpeg);
+	unsigned n_strips = enc->n_strips;
+	unsigned strip_rows = _get_strip_rows(src, n_strips);
+	if (n_strips > 1) {
+		// DRI 16-битный, libjpeg молча обрежет больший интервал, и JPEG будет битым.
+		// Поэтому на огромных кадрах режем на большее число полос, чем просили.
+		while (n_strips < US_CPU_ENCODER_MAX_STRIPS && _get_strip_mcus(src, strip_rows) > _MAX_RESTART_INTERVAL) {
+			++n_strips;
+			strip_rows = _get_strip_rows(src, n_strips);
+		}
+		if (_get_strip_mcus(src, strip_rows) > _MAX_RESTART_INTERVAL) {
+			n_strips = 1;
+		}
+	}
+	if (n_strips > 1 && strip_rows < src->height) {
+		_compress_strips(enc, src, dest, quality, strip_rows);
+	} else {
+		_compress_rows(enc, src, dest, 0, src->height, quality, 0);
+	}
 
-	_jpeg_set_dest_frame(&jpeg, dest);
+	us_frame_encoding_end(dest);
+}
 
-	jpeg.image_width = src->width;
-	jpeg.image_height = src->height;
-	jpeg.input_components = 3;
-	jpeg.in_color_space = JCS_RGB;
+static void _compress_rows(
+	us_cpu_encoder_s *enc, const us_frame_s *src, us_frame_s *dest,
+	unsigned first_row, unsigned n_rows, unsigned quality, unsigned restart_interval) {
 
-	jpeg_set_defaults(&jpeg);
-	jpeg_set_quality(&jpeg, quality, TRUE);
+	_jpeg_set_dest_frame(&enc->jpeg, dest);
+	_jpeg_set_params(enc, src, n_rows, quality, restart_interval);
 
-	jpeg_start_compress(&jpeg, TRUE);
+	jpeg_start_compress(&enc->jpeg, TRUE);
 
 #	define WRITE_SCANLINES(x_format, x_func) \
-		case x_format: { x_func(&jpeg, src); break; }
+		case x_format: { x_func(enc, src, first_row); break; }
 
 	switch (src->format) {
 		// https://www.fourcc.org/yuv.php
-		WRITE_SCANLINES(V4L2_PIX_FMT_YUYV, _jpeg_write_scanlines_yuyv);
-		WRITE_SCANLINES(V4L2_PIX_FMT_UYVY, _jpeg_write_scanlines_uyvy);
+		WRITE_SCANLINES(V4L2_PIX_FMT_YUYV, _jpeg_write_raw_yuv);
+		WRITE_SCANLINES(V4L2_PIX_FMT_UYVY, _jpeg_write_raw_yuv);
 		WRITE_SCANLINES(V4L2_PIX_FMT_RGB565, _jpeg_write_scanlines_rgb565);
 		WRITE_SCANLINES(V4L2_PIX_FMT_RGB24, _jpeg_write_scanlines_rgb24);
+		WRITE_SCANLINES(V4L2_PIX_FMT_NV12, _jpeg_write_raw_yuv);
+		WRITE_SCANLINES(V4L2_PIX_FMT_NV16, _jpeg_write_raw_yuv);
+		WRITE_SCANLINES(V4L2_PIX_FMT_NV24, _jpeg_write_raw_yuv);
 		default: assert(0 && "Unsupported input format for CPU encoder");
 	}
 
 #	undef WRITE_SCANLINES
 
-	jpeg_finish_compress(&jpeg);
-	jpeg_destroy_compress(&jpeg);
+	jpeg_finish_compress(&enc->jpeg);
+}
 
-	us_frame_encoding_end(dest);
+static void _compress_strips(us_cpu_encoder_s *enc, const us_frame_s *src, us_frame_s *dest, unsigned quality, unsigned strip_rows) {
+	// Каждая полоса кодируется отдельным JPEG с интервалом рестарта, равным числу MCU в полосе.
+	// Таблицы у всех полос одинаковые, поэтому из энтропийных данных полос, разделенных маркерами RSTn,
+	// и заголовка первой получается обычный baseline JPEG на весь кадр.
+	us_cpu_executor_s *const ex = enc->executor;
+	const unsigned n_strips = (src->height + strip_rows - 1) / strip_rows;
+	const unsigned restart_interval = _get_strip_mcus(src, strip_rows);
+
+	US_MUTEX_LOCK(ex->mutex);
+	for (unsigned index = 1; index < n_strips; ++index) {
+		us_cpu_strip_s *const strip = &enc->strips[index];
+		if (strip->dest == NULL) {
+			strip->dest = us_frame_init();
+		}
+		strip->src = src;
+		strip->first_row = strip_rows * index;
+		strip->n_rows = us_min_u(strip_rows, src->height - strip->first_row);
+		strip->quality = quality;
+		strip->restart_interval = restart_interval;
+		strip->next = NULL;
+		if (ex->tail == NULL) {
+			ex->head = strip;
+		} else {
+			ex->tail->next = strip;
+		}
+		ex->tail = strip;
+	}
+	enc->n_pending = n_strips - 1;
+	US_MUTEX_UNLOCK(ex->mutex);
+	US_COND_BROADCAST(ex->has_strips_cond);
+
+	// Первую полосу кодируем сами прямо в dest, пока остальные делает экзекутор
+	_compress_rows(enc, src, dest, 0, strip_rows, quality, restart_interval);
+	size_t sof_offset = 0;
+	_find_scan_data(dest, &sof_offset);
+	dest->data[sof_offset + 5] = (src->height >> 8) & 0xFF;
+	dest->data[sof_offset + 6] = src->height & 0xFF;
+	dest->used -= 2; // Without EOI
+
+	US_MUTEX_LOCK(ex->mutex);
+	US_COND_WAIT_FOR(enc->n_pending == 0, enc->pending_cond, ex->mutex);
+	US_MUTEX_UNLOCK(ex->mutex);
+
+	for (unsigned index = 1; index < n_strips; ++index) {
+		const us_frame_s *const part = enc->strips[index].dest;
+		size_t part_sof_offset = 0;
+		const size_t data_offset = _find_scan_data(part, &part_sof_offset);
+		const uint8_t rst[2] = {0xFF, 0xD0 + ((index - 1) & 7)};
+		us_frame_append_data(dest, rst, 2);
+		us_frame_append_data(dest, part->data + data_offset, part->used - data_offset - 2); // Without EOI
+	}
+	const uint8_t eoi[2] = {0xFF, 0xD9};
+	us_frame_append_data(dest, eoi, 2);
+}
+
+static unsigned _get_strip_rows(const us_frame_s *src, unsigned n_strips) {
+	// Полосы кратны строке MCU (16 пикселей для 4:2:0), чтобы их можно было склеить
+	return ((src->height + n_strips - 1) / n_strips + 15) & ~15U;
+}
+
+static unsigned _get_strip_mcus(const us_frame_s *src, unsigned strip_rows) {
+	return ((src->width + 15) / 16) * (strip_rows / 16);
+}
+
+static size_t _find_scan_data(const us_frame_s *frame, size_t *sof_offset) {
+	// Заголовок пишет наш же libjpeg, поэтому маркеры идут подряд без мусора между ними
+	const uint8_t *const data = frame->data;
+	size_t pos = 2; // SOI
+	while (pos + 4 <= frame->used) {
+		assert(data[pos] == 0xFF);
+		const uint8_t marker = data[pos + 1];
+		if (marker == 0xC0) { // SOF0
+			*sof_offset = pos;
+		}
+		pos += 2 + (((size_t)data[pos + 2] << 8) | data[pos + 3]);
+		if (marker == 0xDA) { // SOS
+			return pos;
+		}
+	}
+	assert(0 && "No SOS in the JPEG strip");
+	return 0;
+}
+
+static us_cpu_executor_s *_executor_ref(void) {
+	US_MUTEX_LOCK(_g_executor_mutex);
+	if (_g_executor == NULL) {
+		us_cpu_executor_s *ex;
+		US_CALLOC(ex, 1);
+		US_MUTEX_INIT(ex->mutex);
+		US_COND_INIT(ex->has_strips_cond);
+		ex->n_threads = us_get_cores_available();
+		US_CALLOC(ex->tids, ex->n_threads);
+		US_LOG_INFO("Creating JPEG strips executor with %u threads ...", ex->n_threads);
+		for (unsigned number = 0; number < ex->n_threads; ++number) {
+			US_THREAD_CREATE(ex->tids[number], _executor_thread, (void *)ex);
+		}
+		_g_executor = ex;
+	}
+	us_cpu_executor_s *const ex = _g_executor;
+	ex->refs += 1;
+	US_MUTEX_UNLOCK(_g_executor_mutex);
+	return ex;
+}
+
+static void _executor_unref(us_cpu_executor_s *ex) {
+	US_MUTEX_LOCK(_g_executor_mutex);
+	ex->refs -= 1;
+	const bool last = (ex->refs == 0);
+	if (last) {
+		_g_executor = NULL; // Следующий энкодер создаст новый, а этот остановим уже без глобального мьютекса
+	}
+	US_MUTEX_UNLOCK(_g_executor_mutex);
+	if (!last) {
+		return;
+	}
+
+	US_LOG_INFO("Destroying JPEG strips executor ...");
+	US_MUTEX_LOCK(ex->mutex);
+	ex->stop = true;
+	US_MUTEX_UNLOCK(ex->mutex);
+	US_COND_BROADCAST(ex->has_strips_cond);
+	for (unsigned number = 0; number < ex->n_threads; ++number) {
+		US_THREAD_JOIN(ex->tids[number]);
+	}
+	US_MUTEX_DESTROY(ex->mutex);
+	US_COND_DESTROY(ex->has_strips_cond);
+	free(ex->tids);
+	free(ex);
+}
+
+static void *_executor_thread(void *v_ex) {
+	us_cpu_executor_s *const ex = (us_cpu_executor_s *)v_ex;
+	US_THREAD_RENAME("jpeg-strips");
+
+	us_cpu_encoder_s *const enc = us_cpu_encoder_init(1);
+	while (true) {
+		US_MUTEX_LOCK(ex->mutex);
+		US_COND_WAIT_FOR(ex->head != NULL || ex->stop, ex->has_strips_cond, ex->mutex);
+		us_cpu_strip_s *const strip = ex->head;
+		if (strip != NULL) {
+			ex->head = strip->next;
+			if (ex->head == NULL) {
+				ex->tail = NULL;
+			}
+		}
+		US_MUTEX_UNLOCK(ex->mutex);
+		if (strip == NULL) {
+			break;
+		}
+
+		_compress_rows(enc, strip->src, strip->dest, strip->first_row, strip->n_rows, strip->quality, strip->restart_interval);
+
+		US_MUTEX_LOCK(ex->mutex);
+		us_cpu_encoder_s *const owner = strip->owner;
+		owner->n_pending -= 1;
+		if (owner->n_pending == 0) {
+			// Под мьютексом: проснувшись, владелец может сразу уничтожить свой cond
+			US_COND_SIGNAL(owner->pending_cond);
+		}
+		US_MUTEX_UNLOCK(ex->mutex);
+	}
+	us_cpu_encoder_destroy(enc);
+	return NULL;
 }
 
 static void _jpeg_set_dest_frame(j_compress_ptr jpeg, us_frame_s *frame) {
@@ -106,100 +339,193 @@ static void _jpeg_set_dest_frame(j_compress_ptr jpeg, us_frame_s *frame) {
 	frame->used = 0;
 }
 
-#define YUV_R(_y, _, _v)	(((_y) + (359 * (_v))) >> 8)
-#define YUV_G(_y, _u, _v)	(((_y) - (88 * (_u)) - (183 * (_v))) >> 8)
-#define YUV_B(_y, _u, _)	(((_y) + (454 * (_u))) >> 8)
-#define NORM_COMPONENT(_x)	(((_x) > 255) ? 255 : (((_x) < 0) ? 0 : (_x)))
+static void _jpeg_set_params(
+	us_cpu_encoder_s *enc, const us_frame_s *src,
+	unsigned n_rows, unsigned quality, unsigned restart_interval) {
+
+	// Параметры и таблицы квантования переживают jpeg_finish_compress(),
+	// так что пересчитываем их, только если поменялся сам поток
+	if (
+		enc->width == src->width
+		&& enc->height == n_rows
+		&& enc->format == src->format
+		&& enc->quality == quality
+		&& enc->restart_interval == restart_interval
+	) {
+		return;
+	}
 
-static void _jpeg_write_scanlines_yuyv(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	uint8_t *line_buf;
-	US_CALLOC(line_buf, frame->width * 3);
+	struct jpeg_compress_struct *const jpeg = &enc->jpeg;
+	const bool raw = _is_raw_yuv(src->format);
+
+	jpeg->image_width = src->width;
+	jpeg->image_height = n_rows;
+	jpeg->input_components = 3;
+	jpeg->in_color_space = (raw ? JCS_YCbCr : JCS_RGB);
+
+	jpeg_set_defaults(jpeg);
+	jpeg_set_quality(jpeg, quality, TRUE);
+	jpeg->restart_interval = restart_interval;
+
+	if (raw) {
+		// YUV отдается libjpeg как есть, без конвертации в RGB и обратно.
+		// Семплинг 4:2:0, как у jpeg_set_defaults() для RGB, поэтому размер JPEG не меняется.
+		jpeg->raw_data_in = TRUE;
+		jpeg->comp_info[0].h_samp_factor = 2;
+		jpeg->comp_info[0].v_samp_factor = 2;
+		jpeg->comp_info[1].h_samp_factor = 1;
+		jpeg->comp_info[1].v_samp_factor = 1;
+		jpeg->comp_info[2].h_samp_factor = 1;
+		jpeg->comp_info[2].v_samp_factor = 1;
+	}
 
-	const unsigned padding = us_frame_get_padding(frame);
-	const uint8_t *data = frame->data;
-	unsigned z = 0;
+	enc->width = src->width;
+	enc->height = n_rows;
+	enc->format = src->format;
+	enc->quality = quality;
+	enc->restart_interval = restart_interval;
+}
 
-	while (jpeg->next_scanline < frame->height) {
-		uint8_t *ptr = line_buf;
+static uint8_t *_get_scratch(us_cpu_encoder_s *enc, size_t size) {
+	if (enc->buf_size < size) {
+		US_REALLOC(enc->buf, size);
+		enc->buf_size = size;
+	}
+	return enc->buf;
+}
 
-		for (unsigned x = 0; x < frame->width; ++x) {
-			const int y = (!z ? data[0] << 8 : data[2] << 8);
-			const int u = data[1] - 128;
-			const int v = data[3] - 128;
+static bool _is_raw_yuv(unsigned format) {
+	switch (format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV24: return true;
+	}
+	return false;
+}
 
-			const int r = YUV_R(y, u, v);
-			const int g = YUV_G(y, u, v);
-			const int b = YUV_B(y, u, v);
+static void _jpeg_write_raw_yuv(us_cpu_encoder_s *enc, const us_frame_s *frame, unsigned first_row) {
+	// jpeg_write_raw_data() принимает по одной строке MCU: 16 строк яркости и по 8 строк хромы.
+	// Строки выравниваются до целого MCU повтором последнего пикселя, по высоте - последней строки.
+	const unsigned y_width = (frame->width + 15) & ~15U;
+	const unsigned c_width = y_width / 2;
 
-			*(ptr++) = NORM_COMPONENT(r);
-			*(ptr++) = NORM_COMPONENT(g);
-			*(ptr++) = NORM_COMPONENT(b);
+	uint8_t *const buf = _get_scratch(enc, (size_t)y_width * 16 + (size_t)c_width * 8 * 2);
 
-			if (z++) {
-				z = 0;
-				data += 4;
-			}
+	JSAMPROW y_rows[16];
+	JSAMPROW cb_rows[8];
+	JSAMPROW cr_rows[8];
+	for (unsigned index = 0; index < 16; ++index) {
+		y_rows[index] = buf + (size_t)y_width * index;
+	}
+	for (unsigned index = 0; index < 8; ++index) {
+		cb_rows[index] = buf + (size_t)y_width * 16 + (size_t)c_width * index;
+		cr_rows[index] = cb_rows[index] + (size_t)c_width * 8;
+	}
+	JSAMPARRAY planes[3] = {y_rows, cb_rows, cr_rows};
+
+	const unsigned last_row = first_row + enc->jpeg.image_height - 1;
+	while (enc->jpeg.next_scanline < enc->jpeg.image_height) {
+		const unsigned top = first_row + enc->jpeg.next_scanline;
+		for (unsigned index = 0; index < 16; ++index) {
+			_read_raw_luma(frame, us_min_u(top + index, last_row), y_rows[index]);
+			memset(y_rows[index] + frame->width, y_rows[index][frame->width - 1], y_width - frame->width);
 		}
-		data += padding;
-
-		JSAMPROW scanlines[1] = {line_buf};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
+		for (unsigned index = 0; index < 8; ++index) {
+			const unsigned c_used = (frame->width + 1) / 2;
+			_read_raw_chroma(frame, us_min_u(top + index * 2, last_row & ~1U), cb_rows[index], cr_rows[index]);
+			memset(cb_rows[index] + c_used, cb_rows[index][c_used - 1], c_width - c_used);
+			memset(cr_rows[index] + c_used, cr_rows[index][c_used - 1], c_width - c_used);
+		}
+		jpeg_write_raw_data(&enc->jpeg, planes, 16);
 	}
-
-	free(line_buf);
 }
 
-static void _jpeg_write_scanlines_uyvy(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	uint8_t *line_buf;
-	US_CALLOC(line_buf, frame->width * 3);
-
-	const unsigned padding = us_frame_get_padding(frame);
-	const uint8_t *data = frame->data;
-	unsigned z = 0;
-
-	while (jpeg->next_scanline < frame->height) {
-		uint8_t *ptr = line_buf;
-
-		for (unsigned x = 0; x < frame->width; ++x) {
-			const int y = (!z ? data[1] << 8 : data[3] << 8);
-			const int u = data[0] - 128;
-			const int v = data[2] - 128;
-
-			const int r = YUV_R(y, u, v);
-			const int g = YUV_G(y, u, v);
-			const int b = YUV_B(y, u, v);
+static void _read_raw_luma(const us_frame_s *frame, unsigned row, uint8_t *y) {
+	if (us_is_semiplanar(frame->format)) {
+		unsigned stride;
+		const uint8_t *const plane = us_frame_get_plane(frame, 0, &stride);
+		memcpy(y, plane + (size_t)stride * row, frame->width);
+		return;
+	}
 
-			*(ptr++) = NORM_COMPONENT(r);
-			*(ptr++) = NORM_COMPONENT(g);
-			*(ptr++) = NORM_COMPONENT(b);
+	const unsigned offset = (frame->format == V4L2_PIX_FMT_YUYV ? 0 : 1);
+	const uint8_t *const src = frame->data + (size_t)(frame->width * 2 + us_frame_get_padding(frame)) * row;
+	unsigned x = 0;
+#	ifdef __ARM_NEON
+	for (; x + 32 <= frame->width; x += 32) {
+		// YUYV: val[0]=Y0 val[1]=U val[2]=Y1 val[3]=V, у UYVY все сдвинуто на один байт
+		const uint8x16x4_t px = vld4q_u8(src + x * 2);
+		const uint8x16x2_t luma = {{px.val[offset], px.val[offset + 2]}};
+		vst2q_u8(y + x, luma);
+	}
+#	endif
+	for (; x < frame->width; ++x) {
+		y[x] = src[x * 2 + offset];
+	}
+}
 
-			if (z++) {
-				z = 0;
-				data += 4;
+static void _read_raw_chroma(const us_frame_s *frame, unsigned row, uint8_t *cb, uint8_t *cr) {
+	// Хрома для 4:2:0 берется по двум соседним строкам (row и row + 1), как это делал бы libjpeg
+	const unsigned c_used = (frame->width + 1) / 2;
+	const unsigned next = (row + 1 < frame->height ? 1 : 0);
+
+	if (us_is_semiplanar(frame->format)) {
+		unsigned stride;
+		const uint8_t *const plane = us_frame_get_plane(frame, 1, &stride);
+		if (frame->format == V4L2_PIX_FMT_NV12) { // Уже 4:2:0
+			const uint8_t *const uv = plane + (size_t)stride * (row / 2);
+			for (unsigned x = 0; x < c_used; ++x) {
+				cb[x] = uv[x * 2];
+				cr[x] = uv[x * 2 + 1];
+			}
+		} else if (frame->format == V4L2_PIX_FMT_NV16) {
+			const uint8_t *const a = plane + (size_t)stride * row;
+			const uint8_t *const b = a + (size_t)stride * next;
+			for (unsigned x = 0; x < c_used; ++x) {
+				cb[x] = (a[x * 2] + b[x * 2] + 1) >> 1;
+				cr[x] = (a[x * 2 + 1] + b[x * 2 + 1] + 1) >> 1;
+			}
+		} else { // NV24
+			const uint8_t *const a = plane + (size_t)stride * row;
+			const uint8_t *const b = a + (size_t)stride * next;
+			for (unsigned x = 0; x < c_used; ++x) {
+				const unsigned right = (x * 2 + 1 < frame->width ? 2 : 0);
+				cb[x] = (a[x * 4] + a[x * 4 + right] + b[x * 4] + b[x * 4 + right] + 2) >> 2;
+				cr[x] = (a[x * 4 + 1] + a[x * 4 + right + 1] + b[x * 4 + 1] + b[x * 4 + right + 1] + 2) >> 2;
 			}
 		}
-		data += padding;
-
-		JSAMPROW scanlines[1] = {line_buf};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
+		return;
 	}
 
-	free(line_buf);
+	const unsigned u_offset = (frame->format == V4L2_PIX_FMT_YUYV ? 1 : 0);
+	const unsigned v_offset = u_offset + 2;
+	const size_t line = frame->width * 2 + us_frame_get_padding(frame);
+	const uint8_t *const a = frame->data + line * row;
+	const uint8_t *const b = a + line * next;
+	unsigned x = 0;
+#	ifdef __ARM_NEON
+	for (; x + 16 <= frame->width / 2; x += 16) {
+		const uint8x16x4_t pa = vld4q_u8(a + x * 4);
+		const uint8x16x4_t pb = vld4q_u8(b + x * 4);
+		vst1q_u8(cb + x, vrhaddq_u8(pa.val[u_offset], pb.val[u_offset]));
+		vst1q_u8(cr + x, vrhaddq_u8(pa.val[v_offset], pb.val[v_offset]));
+	}
+#	endif
+	for (; x < c_used; ++x) {
+		cb[x] = (a[x * 4 + u_offset] + b[x * 4 + u_offset] + 1) >> 1;
+		cr[x] = (a[x * 4 + v_offset] + b[x * 4 + v_offset] + 1) >> 1;
+	}
 }
 
-#undef NORM_COMPONENT
-#undef YUV_B
-#undef YUV_G
-#undef YUV_R
-
-static void _jpeg_write_scanlines_rgb565(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
-	uint8_t *line_buf;
-	US_CALLOC(line_buf, frame->width * 3);
+static void _jpeg_write_scanlines_rgb565(us_cpu_encoder_s *enc, const us_frame_s *frame, unsigned first_row) {
+	uint8_t *const line_buf = _get_scratch(enc, frame->width * 3);
 
 	const unsigned padding = us_frame_get_padding(frame);
-	const uint8_t *data = frame->data;
+	const uint8_t *data = frame->data + (size_t)(frame->width * 2 + padding) * first_row;
 
-	while (jpeg->next_scanline < frame->height) {
+	while (enc->jpeg.next_scanline < enc->jpeg.image_height) {
 		uint8_t *ptr = line_buf;
 
 		for (unsigned x = 0; x < frame->width; ++x) {
@@ -214,60 +540,52 @@ static void _jpeg_write_scanlines_rgb565(struct jpeg_compress_struct *jpeg, cons
 		data += padding;
 
 		JSAMPROW scanlines[1] = {line_buf};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
+		jpeg_write_scanlines(&enc->jpeg, scanlines, 1);
 	}
-
-	free(line_buf);
 }
 
-static void _jpeg_write_scanlines_rgb24(struct jpeg_compress_struct *jpeg, const us_frame_s *frame) {
+static void _jpeg_write_scanlines_rgb24(us_cpu_encoder_s *enc, const us_frame_s *frame, unsigned first_row) {
 	const unsigned padding = us_frame_get_padding(frame);
-	uint8_t *data = frame->data;
+	uint8_t *data = frame->data + (size_t)(frame->width * 3 + padding) * first_row;
 
-	while (jpeg->next_scanline < frame->height) {
+	while (enc->jpeg.next_scanline < enc->jpeg.image_height) {
 		JSAMPROW scanlines[1] = {data};
-		jpeg_write_scanlines(jpeg, scanlines, 1);
+		jpeg_write_scanlines(&enc->jpeg, scanlines, 1);
 
 		data += (frame->width * 3) + padding;
 	}
 }
 
-#define JPEG_OUTPUT_BUFFER_SIZE ((size_t)4096)
-
 static void _jpeg_init_destination(j_compress_ptr jpeg) {
+	// JPEG пишется прямо в кадр, без промежуточного буфера
 	_jpeg_dest_manager_s *const dest = (_jpeg_dest_manager_s *)jpeg->dest;
+	us_frame_s *const frame = dest->frame;
 
-	// Allocate the output buffer - it will be released when done with image
-	assert((dest->buf = (JOCTET *)(*jpeg->mem->alloc_small)(
-		(j_common_ptr) jpeg, JPOOL_IMAGE, JPEG_OUTPUT_BUFFER_SIZE * sizeof(JOCTET)
-	)) != NULL);
-
-	dest->mgr.next_output_byte = dest->buf;
-	dest->mgr.free_in_buffer = JPEG_OUTPUT_BUFFER_SIZE;
+	if (frame->allocated == 0) {
+		us_frame_realloc_data(frame, 64 * 1024);
+	}
+	dest->mgr.next_output_byte = frame->data;
+	dest->mgr.free_in_buffer = frame->allocated;
 }
 
 static boolean _jpeg_empty_output_buffer(j_compress_ptr jpeg) {
-	// Called whenever local jpeg buffer fills up
+	// Called whenever the frame is full: grow it and continue after the written data
 
 	_jpeg_dest_manager_s *const dest = (_jpeg_dest_manager_s *)jpeg->dest;
+	us_frame_s *const frame = dest->frame;
+	const size_t written = frame->allocated;
 
-	us_frame_append_data(dest->frame, dest->buf, JPEG_OUTPUT_BUFFER_SIZE);
+	us_frame_realloc_data(frame, written * 2);
 
-	dest->mgr.next_output_byte = dest->buf;
-	dest->mgr.free_in_buffer = JPEG_OUTPUT_BUFFER_SIZE;
+	dest->mgr.next_output_byte = frame->data + written;
+	dest->mgr.free_in_buffer = frame->allocated - written;
 
 	return TRUE;
 }
 
 static void _jpeg_term_destination(j_compress_ptr jpeg) {
-	// Called by jpeg_finish_compress after all data has been written.
-	// Usually needs to flush buffer.
+	// Called by jpeg_finish_compress after all data has been written
 
 	_jpeg_dest_manager_s *const dest = (_jpeg_dest_manager_s *)jpeg->dest;
-	const size_t final = JPEG_OUTPUT_BUFFER_SIZE - dest->mgr.free_in_buffer;
-
-	// Write any data remaining in the buffer.
-	us_frame_append_data(dest->frame, dest->buf, final);
+	dest->frame->used = dest->frame->allocated - dest->mgr.free_in_buffer;
 }
-
-#undef JPEG_OUTPUT_BUFFER_SIZE
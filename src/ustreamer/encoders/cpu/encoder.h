@@ -25,14 +25,76 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 #include <assert.h>
 
+#include <pthread.h>
 #include <jpeglib.h>
 
 #include <linux/videodev2.h>
 
+#ifdef __ARM_NEON
+#	include <arm_neon.h>
+#endif
+
 #include "../../../libs/tools.h"
+#include "../../../libs/logging.h"
+#include "../../../libs/threading.h"
 #include "../../../libs/frame.h"
 
 
-void us_cpu_encoder_compress(const us_frame_s *src, us_frame_s *dest, unsigned quality);
+#define US_CPU_ENCODER_MAX_STRIPS 16
+
+struct us_cpu_encoder_sx;
+
+typedef struct us_cpu_strip_sx {
+	struct us_cpu_encoder_sx	*owner;
+	us_frame_s					*dest;
+	const us_frame_s			*src;
+	unsigned					first_row;
+	unsigned					n_rows;
+	unsigned					quality;
+	unsigned					restart_interval;
+	struct us_cpu_strip_sx		*next;
+} us_cpu_strip_s;
+
+// Один на процесс, потоков по числу ядер, чтобы воркеры с полосами не плодили лишние потоки
+typedef struct {
+	unsigned		refs; // Guarded by the global executor mutex
+	unsigned		n_threads;
+	pthread_t		*tids;
+
+	pthread_mutex_t	mutex;
+	pthread_cond_t	has_strips_cond;
+	us_cpu_strip_s	*head;
+	us_cpu_strip_s	*tail;
+	bool			stop;
+} us_cpu_executor_s;
+
+typedef struct us_cpu_encoder_sx {
+	struct jpeg_compress_struct	jpeg;
+	struct jpeg_error_mgr		jpeg_error;
+
+	uint8_t		*buf; // Scratch rows for the raw YUV and RGB565 input
+	size_t		buf_size;
+
+	unsigned			n_strips;
+	us_cpu_executor_s	*executor;
+	us_cpu_strip_s		strips[US_CPU_ENCODER_MAX_STRIPS]; // The first one is encoded by the calling thread
+	unsigned			n_pending; // Guarded by the executor mutex
+	pthread_cond_t		pending_cond;
+
+	// Parameters of the last frame, see _jpeg_set_params()
+	unsigned	width;
+	unsigned	height;
+	unsigned	format;
+	unsigned	quality;
+	unsigned	restart_interval;
+} us_cpu_encoder_s;
+
+
+us_cpu_encoder_s *us_cpu_encoder_init(unsigned n_strips);
+void us_cpu_encoder_destroy(us_cpu_encoder_s *enc);
+
+void us_cpu_encoder_compress(us_cpu_encoder_s *enc, const us_frame_s *src, us_frame_s *dest, unsigned quality);
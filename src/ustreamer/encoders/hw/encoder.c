@@ -28,35 +28,38 @@
 #include "encoder.h"
 
 
-void _copy_plus_huffman(const us_frame_s *src, us_frame_s *dest);
-static bool _is_huffman(const uint8_t *data);
+static ssize_t _find_sof(const us_frame_s *src, bool *has_huffman);
 
 
-void us_hw_encoder_compress(const us_frame_s *src, us_frame_s *dest) {
+void us_hw_encoder_compress(const us_frame_s *src, us_frame_s *dest, bool zero_copy) {
 	assert(us_is_jpeg(src->format));
-	_copy_plus_huffman(src, dest);
-}
 
-void _copy_plus_huffman(const us_frame_s *src, us_frame_s *dest) {
 	us_frame_encoding_begin(src, dest, V4L2_PIX_FMT_JPEG);
 
-	if (!_is_huffman(src->data)) {
-		const uint8_t *src_ptr = src->data;
-		const uint8_t *const src_end = src->data + src->used;
+	bool has_huffman = false;
+	const ssize_t sof = _find_sof(src, &has_huffman);
+	if (!has_huffman && sof < 0) {
+		dest->used = 0; // Error
+		return;
+	}
 
-		while ((((src_ptr[0] << 8) | src_ptr[1]) != 0xFFC0) && (src_ptr < src_end)) {
-			src_ptr += 1;
-		}
-		if (src_ptr >= src_end) {
-			dest->used = 0; // Error
-			return;
+	if (zero_copy) {
+		// Кадр ссылается на буфер устройства, а недостающая таблица Хаффмана вставляется отдельным куском
+		if (has_huffman) {
+			dest->iov[0] = (struct iovec){(void *)src->data, src->used};
+			dest->n_iov = 1;
+		} else {
+			dest->iov[0] = (struct iovec){(void *)src->data, sof};
+			dest->iov[1] = (struct iovec){(void *)US_HUFFMAN_TABLE, sizeof(US_HUFFMAN_TABLE)};
+			dest->iov[2] = (struct iovec){(void *)(src->data + sof), src->used - sof};
+			dest->n_iov = 3;
 		}
+		dest->used = src->used + (has_huffman ? 0 : sizeof(US_HUFFMAN_TABLE));
 
-		const size_t paste = src_ptr - src->data;
-
-		us_frame_set_data(dest, src->data, paste);
+	} else if (!has_huffman) {
+		us_frame_set_data(dest, src->data, sof);
 		us_frame_append_data(dest, US_HUFFMAN_TABLE, sizeof(US_HUFFMAN_TABLE));
-		us_frame_append_data(dest, src_ptr, src->used - paste);
+		us_frame_append_data(dest, src->data + sof, src->used - sof);
 
 	} else {
 		us_frame_set_data(dest, src->data, src->used);
@@ -65,17 +68,40 @@ void _copy_plus_huffman(const us_frame_s *src, us_frame_s *dest) {
 	us_frame_encoding_end(dest);
 }
 
-static bool _is_huffman(const uint8_t *data) {
-	unsigned count = 0;
+static ssize_t _find_sof(const us_frame_s *src, bool *has_huffman) {
+	// Ищем маркеры только в заголовке, до SOS, перепрыгивая сегменты по их длине.
+	// Если камера напихала мусора между сегментами, ищем следующий 0xFF через memchr().
+	const uint8_t *const data = src->data;
+	const size_t size = src->used;
+	ssize_t sof = -1;
+	size_t pos = 2; // SOI
 
-	while ((((uint16_t)data[0] << 8) | data[1]) != 0xFFDA) {
-		if (count++ > 2048) {
-			return false;
+	while (pos + 4 <= size) {
+		if (data[pos] != 0xFF) {
+			const uint8_t *const next = memchr(data + pos, 0xFF, size - pos);
+			if (next == NULL) {
+				break;
+			}
+			pos = next - data;
+			continue;
+		}
+		const uint8_t marker = data[pos + 1];
+		if (marker == 0xFF) { // Fill byte
+			pos += 1;
+			continue;
+		}
+		if (marker == 0xC0) { // SOF0
+			sof = pos;
+		} else if (marker == 0xC4) { // DHT
+			*has_huffman = true;
+		} else if (marker == 0xDA) { // SOS
+			break;
 		}
-		if ((((uint16_t)data[0] << 8) | data[1]) == 0xFFC4) {
-			return true;
+		if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD8)) { // Standalone
+			pos += 2;
+		} else {
+			pos += 2 + (((size_t)data[pos + 2] << 8) | data[pos + 3]);
 		}
-		data += 1;
 	}
-	return false;
+	return sof;
 }
@@ -27,6 +27,9 @@
 #include <string.h>
 #include <assert.h>
 
+#include <sys/types.h>
+#include <sys/uio.h>
+
 #include <linux/videodev2.h>
 
 #include "../../../libs/frame.h"
@@ -34,4 +37,4 @@
 #include "huffman.h"
 
 
-void us_hw_encoder_compress(const us_frame_s *src, us_frame_s *dest);
+void us_hw_encoder_compress(const us_frame_s *src, us_frame_s *dest, bool zero_copy);
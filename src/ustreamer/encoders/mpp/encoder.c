@@ -28,6 +28,8 @@
 
 #define _RUN(x_next) enc->x_next
 
+#define _MAX_EMPTY_POLLS 3
+
 static MppCodingType enc_parse_type(unsigned format) {
     switch (format) {
         case V4L2_PIX_FMT_MJPEG:
@@ -42,6 +44,54 @@ static MppCodingType enc_parse_type(unsigned format) {
     }
 }
 
+MppFrameFormat us_mpp_format_from_v4l2(unsigned format) {
+    switch (format) {
+        case V4L2_PIX_FMT_YUYV: return MPP_FMT_YUV422_YUYV;
+        case V4L2_PIX_FMT_UYVY: return MPP_FMT_YUV422_UYVY;
+        case V4L2_PIX_FMT_RGB565: return MPP_FMT_RGB565;
+        case V4L2_PIX_FMT_RGB24: return MPP_FMT_RGB888;
+        case V4L2_PIX_FMT_NV12:
+        case V4L2_PIX_FMT_NV12M: return MPP_FMT_YUV420SP;
+        case V4L2_PIX_FMT_NV16:
+        case V4L2_PIX_FMT_NV16M: return MPP_FMT_YUV422SP;
+        case V4L2_PIX_FMT_NV24: return MPP_FMT_YUV444SP;
+        default: return MPP_FMT_YUV422_UYVY;
+    }
+}
+
+static void enc_copy_frame(mpp_encode_data *p, const us_frame_s *src, uint8_t *buf) {
+    // MPP ждет плоскости с шагом hor_stride одну за другой через hor_stride * ver_stride
+    us_frame_plane_s planes[US_FRAME_MAX_PLANES];
+    const unsigned n_planes = us_frame_get_planes_layout(src->format, p->hor_stride, p->ver_stride, planes);
+
+    if (n_planes == 0) {
+        if (src->stride == 0 || src->stride == p->hor_stride) {
+            memcpy(buf, src->data, us_min_u(src->used, p->frame_size));
+        } else {
+            const unsigned row = us_min_u(src->stride, p->hor_stride);
+            for (unsigned y = 0; y < p->height; ++y) {
+                memcpy(buf + (size_t)p->hor_stride * y, src->data + (size_t)src->stride * y, row);
+            }
+        }
+        return;
+    }
+
+    for (unsigned index = 0; index < n_planes; ++index) {
+        unsigned src_stride;
+        const uint8_t *const src_plane = us_frame_get_plane(src, index, &src_stride);
+        const unsigned rows = (index > 0 && src->format == V4L2_PIX_FMT_NV12 ? p->height / 2 : p->height);
+        if (src_stride == planes[index].stride && rows * planes[index].stride == planes[index].size) {
+            // Раскладка совпадает, копируем плоскость целиком
+            memcpy(buf + planes[index].offset, src_plane, planes[index].size);
+        } else {
+            const unsigned row = us_min_u(src_stride, planes[index].stride);
+            for (unsigned y = 0; y < rows; ++y) {
+                memcpy(buf + planes[index].offset + (size_t)planes[index].stride * y, src_plane + (size_t)src_stride * y, row);
+            }
+        }
+    }
+}
+
 static MPP_RET enc_ctx_init(mpp_encode_data *p, mpp_encode_cfg *cfg) {
     if (!p || !cfg) {
         US_LOG_ERROR("Invalid input data %p ------ cfg %p", p, cfg);
@@ -146,7 +196,7 @@ static MPP_RET mpp_enc_cfg_setup(mpp_encode_data *p) {
     MppCtx ctx = p->ctx;
     MppEncCfg cfg = p->cfg;
     MPP_RET ret;
-    MppEncRcMode rc_mode = MPP_ENC_RC_MODE_CBR;
+    MppEncRcMode rc_mode = p->rc_mode;
     RK_U32 rotation;
     RK_U32 mirroring;
     RK_U32 flip;
@@ -449,6 +499,8 @@ us_mpp_encoder_s *us_mpp_h264_encoder_init(unsigned width, unsigned height,  Mpp
         US_LOG_PERROR("Failed to calloc mpp_encode_data for instance");
         return NULL;
     }
+    enc->cfg = cfg;
+    enc->p = p;
 
     // 设置的输入帧的格式信息
     cfg->format = input_format;
@@ -458,8 +510,9 @@ us_mpp_encoder_s *us_mpp_h264_encoder_init(unsigned width, unsigned height,  Mpp
     cfg->width = width;
     cfg->height = height;
     cfg->gop_len = gop;
-    cfg->fps_in_num = gop;
-    cfg->fps_out_num = gop;
+    cfg->fps_in_num = 30; // Как и у x264, реальный FPS определяется захватом, а от этого зависит бюджет битрейта
+    cfg->fps_out_num = 30;
+    cfg->rc_mode = MPP_ENC_RC_MODE_CBR;
     cfg->hor_stride = mpi_enc_width_default_stride(cfg->width, cfg->format);
 	cfg->ver_stride = cfg->height;
 
@@ -477,18 +530,24 @@ us_mpp_encoder_s *us_mpp_h264_encoder_init(unsigned width, unsigned height,  Mpp
         return NULL;
     }
 
-    ret = mpp_buffer_get(p->buf_grp, &p->frm_buf, p->frame_size + p->header_size);
-    if (ret) {
-        US_LOG_PERROR("failed to get buffer for input frame ret %d", ret);
-        us_mpp_encoder_destory(enc);
-        return NULL;
-    }
+    enc->nal = us_nal_cache_init();
+    for (unsigned index = 0; index < US_MPP_H264_PIPELINE_DEPTH; ++index) {
+        us_mpp_encoder_slot_s *slot = &enc->slots[index];
+        slot->meta = us_frame_init();
 
-    ret = mpp_buffer_get(p->buf_grp, &p->pkt_buf, p->frame_size);
-    if (ret) {
-        US_LOG_PERROR("failed to get buffer for output packet ret %d", ret);
-        us_mpp_encoder_destory(enc);
-        return NULL;
+        ret = mpp_buffer_get(p->buf_grp, &slot->frm_buf, p->frame_size + p->header_size);
+        if (ret) {
+            US_LOG_PERROR("failed to get buffer for input frame ret %d", ret);
+            us_mpp_encoder_destory(enc);
+            return NULL;
+        }
+
+        ret = mpp_buffer_get(p->buf_grp, &slot->pkt_buf, p->frame_size);
+        if (ret) {
+            US_LOG_PERROR("failed to get buffer for output packet ret %d", ret);
+            us_mpp_encoder_destory(enc);
+            return NULL;
+        }
     }
 
     US_LOG_INFO("%p encoder start w %d h %d type %d", p->ctx, p->width, p->height, p->type);
@@ -535,20 +594,58 @@ us_mpp_encoder_s *us_mpp_h264_encoder_init(unsigned width, unsigned height,  Mpp
         us_mpp_encoder_destory(enc);
         return NULL;
     }
-    enc->gop = 30;
-    enc->cfg = cfg;
-    enc->p = p;
+    enc->gop = gop;
     return enc;
 }
 
+int us_mpp_h264_encoder_set_params(us_mpp_encoder_s *enc, unsigned bitrate, unsigned gop, unsigned min_qp, unsigned max_qp, bool cbr) {
+    mpp_encode_data *p = enc->p;
+    MppEncCfg cfg = p->cfg;
+    MPP_RET ret;
+
+    // Меняется только rc-часть конфига, MPP применяет ее со следующего кадра без пересоздания контекста
+    p->rc_mode = (cbr ? MPP_ENC_RC_MODE_CBR : MPP_ENC_RC_MODE_VBR);
+    p->bps = bitrate * 1000;
+    p->gop_len = gop;
+    mpp_enc_cfg_set_s32(cfg, "rc:mode", p->rc_mode);
+    mpp_enc_cfg_set_s32(cfg, "rc:bps_target", p->bps);
+    mpp_enc_cfg_set_s32(cfg, "rc:bps_max", p->bps * 17 / 16);
+    mpp_enc_cfg_set_s32(cfg, "rc:bps_min", p->bps * (cbr ? 15 : 1) / 16);
+    mpp_enc_cfg_set_s32(cfg, "rc:gop", p->gop_len);
+    mpp_enc_cfg_set_s32(cfg, "rc:qp_min", (min_qp ? min_qp : 10));
+    mpp_enc_cfg_set_s32(cfg, "rc:qp_min_i", (min_qp ? min_qp : 10));
+    mpp_enc_cfg_set_s32(cfg, "rc:qp_max", (max_qp ? max_qp : 51));
+    mpp_enc_cfg_set_s32(cfg, "rc:qp_max_i", (max_qp ? max_qp : 51));
+
+    ret = p->mpi->control(p->ctx, MPP_ENC_SET_CFG, cfg);
+    if (ret) {
+        US_LOG_ERROR("mpi control enc set rc cfg failed ret %d", ret);
+        return -1;
+    }
+    enc->gop = gop;
+    return 0;
+}
+
 int us_mpp_h264_encoder_compress(us_mpp_encoder_s *enc, const us_frame_s *src, us_frame_s *dest, bool force_key) {
-    if (enc == NULL && src == NULL) {
+    int ret = us_mpp_h264_encoder_submit(enc, src, force_key);
+    if (ret) {
+        return ret;
+    }
+    return us_mpp_h264_encoder_collect(enc, dest);
+}
+
+int us_mpp_h264_encoder_submit(us_mpp_encoder_s *enc, const us_frame_s *src, bool force_key) {
+    if (enc == NULL || src == NULL) {
         return -1;
     }
+    // Вызывающий отвечает за то, чтобы в VPU было не больше US_MPP_H264_PIPELINE_DEPTH кадров
+    assert(enc->n_submitted - enc->n_collected < US_MPP_H264_PIPELINE_DEPTH);
+    us_mpp_encoder_slot_s *slot = &enc->slots[enc->n_submitted % US_MPP_H264_PIPELINE_DEPTH];
 
-    us_frame_encoding_begin(src, dest, (enc->output_format == V4L2_PIX_FMT_MJPEG ? V4L2_PIX_FMT_JPEG : enc->output_format));
-    force_key = (enc->output_format == V4L2_PIX_FMT_H264 && (force_key || _RUN(last_online) != src->online));
-    US_LOG_DEBUG("Compressing new frame; force_key=%d ...", force_key);
+    us_frame_encoding_begin(src, slot->meta, V4L2_PIX_FMT_H264);
+    slot->meta->gop = enc->gop; // Запоминаем при отправке: collect() работает в другом потоке
+    force_key = (force_key || _RUN(last_online) != src->online);
+    US_LOG_DEBUG("Submitting new frame; force_key=%d ...", force_key);
 
     mpp_encode_data *p = enc->p;
     MppApi *mpi = p->mpi;
@@ -558,9 +655,8 @@ int us_mpp_h264_encoder_compress(us_mpp_encoder_s *enc, const us_frame_s *src, u
     MppMeta meta = NULL;
     MppFrame frame = NULL;
     MppPacket packet = NULL;
-    RK_U32 eoi = 1;
-    void *buf = mpp_buffer_get_ptr(p->frm_buf);
-    memcpy(buf, src->data, src->used);
+    void *buf = mpp_buffer_get_ptr(slot->frm_buf);
+    enc_copy_frame(p, src, buf);
     ret = mpp_frame_init(&frame);
     if (ret) {
         US_LOG_PERROR("MPP Frame init failed");
@@ -574,84 +670,140 @@ int us_mpp_h264_encoder_compress(us_mpp_encoder_s *enc, const us_frame_s *src, u
     mpp_frame_set_fmt(frame, p->fmt);
     mpp_frame_set_eos(frame, p->frm_eos);
 
-    mpp_frame_set_buffer(frame, p->frm_buf);
+    mpp_frame_set_buffer(frame, slot->frm_buf);
     meta = mpp_frame_get_meta(frame);
-    mpp_packet_init_with_buffer(&packet, p->pkt_buf);
+    mpp_packet_init_with_buffer(&packet, slot->pkt_buf);
 
     /* NOTE: It is important to clear output packet lenght!! */
     mpp_packet_set_length(packet, 0);
     mpp_meta_set_packet(meta, KEY_OUTPUT_PACKET, packet);
 
+    if (force_key) {
+        ret = mpi->control(ctx, MPP_ENC_SET_IDR_FRAME, NULL);
+        if (ret) {
+            US_LOG_ERROR("mpi control set idr frame failed ret %d", ret);
+        }
+    }
+
     ret = mpi->encode_put_frame(ctx, frame);
     if (ret) {
         US_LOG_PERROR("encode put frame failed!, %d", ret);
         mpp_frame_deinit(&frame);
+        mpp_packet_deinit(&packet);
         return ret;
     }
 
     mpp_frame_deinit(&frame);
+    // Этот же пакет с буфером слота потом вернет encode_get_packet()
+
+    ++enc->n_submitted;
+    _RUN(last_online) = src->online;
+    return MPP_OK;
+}
+
+int us_mpp_h264_encoder_collect(us_mpp_encoder_s *enc, us_frame_s *dest) {
+    if (enc == NULL || dest == NULL) {
+        return -1;
+    }
+    assert(enc->n_collected != enc->n_submitted);
+    // Слот освобождается только с его пакетом, при ошибке вызывающий сбрасывает весь конвейер
+    const us_mpp_encoder_slot_s *slot = &enc->slots[enc->n_collected % US_MPP_H264_PIPELINE_DEPTH];
+
+    us_frame_copy_meta(slot->meta, dest);
+    dest->used = 0;
+
+    mpp_encode_data *p = enc->p;
+    MppApi *mpi = p->mpi;
+    MppCtx ctx = p->ctx;
+    MPP_RET ret = MPP_OK;
+
+    MppMeta meta = NULL;
+    MppPacket packet = NULL;
+    RK_U32 eoi = 1;
+    unsigned n_empty = 0;
 
     do {
         ret = mpi->encode_get_packet(ctx, &packet);
         if (ret) {
-            US_LOG_PERROR("Encode get packet failed!");
-            return ret;
+            US_LOG_ERROR("Encode get packet failed ret %d", ret);
+            return -1;
         }
 
-        assert(packet);
+        if (packet == NULL) {
+            // Таймаут вывода: пакет еще может прийти, но бесконечно его не ждем
+            if (++n_empty >= _MAX_EMPTY_POLLS) {
+                US_LOG_ERROR("Encode get packet returned no packet %u times", n_empty);
+                return -1;
+            }
+            eoi = 0;
+            continue;
+        }
 
-        if (packet) {
-            // write packet to sink here
-            void *packet_data_ptr = mpp_packet_get_pos(packet);
-            size_t byteused = mpp_packet_get_length(packet);
-            p->pkt_eos = mpp_packet_get_eos(packet);
+        // write packet to sink here
+        void *packet_data_ptr = mpp_packet_get_pos(packet);
+        size_t byteused = mpp_packet_get_length(packet);
+        p->pkt_eos = mpp_packet_get_eos(packet);
+
+        if (p->frm_pkt_cnt == 0) {
+            us_frame_set_data(dest, packet_data_ptr, byteused);
+        } else {
+            us_frame_append_data(dest, packet_data_ptr, byteused);
+        }
 
-            memcpy(dest->data, packet_data_ptr, byteused);
-            dest->used = byteused;
-            dest->gop = enc->gop;
+        /* for low delay partition encoding */
+        eoi = 1;
+        if (mpp_packet_is_partition(packet)) {
+            eoi = mpp_packet_is_eoi(packet);
+            p->frm_pkt_cnt = (eoi) ? (0) : (p->frm_pkt_cnt + 1);
+        }
 
-            /* for low delay partition encoding */
-            if (mpp_packet_is_partition(packet)) {
-                eoi = mpp_packet_is_eoi(packet);
-                p->frm_pkt_cnt = (eoi) ? (0) : (p->frm_pkt_cnt + 1);
-            }
+        if (p->fp_output) {
+            fwrite(packet_data_ptr, 1, byteused, p->fp_output);
+        }
 
-            if (p->fp_output) {
-                fwrite(packet_data_ptr, 1, byteused, p->fp_output);
+        if (mpp_packet_has_meta(packet)) {
+            meta = mpp_packet_get_meta(packet);
+            RK_S32 temporal_id = 0;
+            RK_S32 lt_idx = -1;
+            RK_S32 avg_qp = -1;
+            if (MPP_OK == mpp_meta_get_s32(meta, KEY_TEMPORAL_ID, &temporal_id)) {
+                US_LOG_DEBUG("mpp get meta tid %d", temporal_id);
             }
-
-            if (mpp_packet_has_meta(packet)) {
-                meta = mpp_packet_get_meta(packet);
-                RK_S32 temporal_id = 0;
-                RK_S32 lt_idx = -1;
-                RK_S32 avg_qp = -1;
-                if (MPP_OK == mpp_meta_get_s32(meta, KEY_TEMPORAL_ID, &temporal_id)) {
-                    US_LOG_DEBUG("mpp get meta tid %d", temporal_id);
-                }
-                if (MPP_OK == mpp_meta_get_s32(meta, KEY_LONG_REF_IDX, &lt_idx)) {
-                    US_LOG_DEBUG("mpp get meta lt %d", lt_idx);
-                }
-                if (MPP_OK == mpp_meta_get_s32(meta, KEY_ENC_AVERAGE_QP, &avg_qp)) {
-                    US_LOG_DEBUG("mpp get meta qp %d", avg_qp);
-                }
+            if (MPP_OK == mpp_meta_get_s32(meta, KEY_LONG_REF_IDX, &lt_idx)) {
+                US_LOG_DEBUG("mpp get meta lt %d", lt_idx);
             }
-            
-            mpp_packet_deinit(&packet);
-            p->stream_size += byteused;
-            p->frame_count += eoi;
-            if (p->pkt_eos) {
-                US_LOG_INFO("%p found last packet", ctx);
+            if (MPP_OK == mpp_meta_get_s32(meta, KEY_ENC_AVERAGE_QP, &avg_qp)) {
+                US_LOG_DEBUG("mpp get meta qp %d", avg_qp);
             }
         }
+        
+        mpp_packet_deinit(&packet);
+        p->stream_size += byteused;
+        p->frame_count += eoi;
+        if (p->pkt_eos) {
+            US_LOG_INFO("%p found last packet", ctx);
+        }
     } while (!eoi);
+    ++enc->n_collected;
 
+    // MPP не всегда помечает IDR и кладет перед ним SPS/PPS, поэтому смотрим на сами NAL
+    us_nal_cache_process(enc->nal, dest);
     us_frame_encoding_end(dest);
-
-    _RUN(last_online) = src->online;
-
     return ret;
 }
 
+void us_mpp_h264_encoder_reset(us_mpp_encoder_s *enc) {
+    // Опоздавший пакет нельзя сопоставить со слотом, поэтому выбрасываем все кадры в VPU
+    US_LOG_INFO("Resetting MPP H264 encoder; dropped frames=%u", enc->n_submitted - enc->n_collected);
+    mpp_encode_data *p = enc->p;
+    const MPP_RET ret = p->mpi->reset(p->ctx);
+    if (ret) {
+        US_LOG_ERROR("mpi reset failed ret %d", ret);
+    }
+    p->frm_pkt_cnt = 0;
+    enc->n_collected = enc->n_submitted;
+}
+
 us_mpp_encoder_s *us_mpp_jpeg_encoder_init(unsigned width, unsigned height, MppFrameFormat input_format, unsigned gop, unsigned quality) {
     RK_S32 ret = MPP_NOK;
 	us_mpp_encoder_s *enc = NULL;
@@ -674,7 +826,11 @@ us_mpp_encoder_s *us_mpp_jpeg_encoder_init(unsigned width, unsigned height, MppF
         US_LOG_PERROR("us_mpp_jpeg_encoder_open Failed to calloc mpp_encode_data for instance");
         return NULL;
     }
+    enc->p = p;
 
+    p->width = width;
+    p->height = height;
+    p->fmt = input_format;
     p->hor_stride = MPP_ALIGN(mpi_enc_width_default_stride(width, input_format),16);
     p->ver_stride = MPP_ALIGN(height, 16);
     p->fps_in_num =30;
@@ -682,7 +838,7 @@ us_mpp_encoder_s *us_mpp_jpeg_encoder_init(unsigned width, unsigned height, MppF
 	p->fps_out_den = 1;
 	p->fps_out_num = 30;
     p->bps = width * height / 8 *  p->fps_in_num;
-    p->frame_size = MPP_ALIGN(p->hor_stride, 64) * MPP_ALIGN(p->ver_stride, 64) * 2;
+    p->frame_size = MPP_ALIGN(p->hor_stride, 64) * MPP_ALIGN(p->ver_stride, 64) * (input_format == MPP_FMT_YUV444SP ? 3 : 2);
     p->header_size = 0;
 
     ret = mpp_buffer_group_get_internal(&p->buf_grp, MPP_BUFFER_TYPE_DRM);
@@ -779,7 +935,6 @@ us_mpp_encoder_s *us_mpp_jpeg_encoder_init(unsigned width, unsigned height, MppF
     mpp_enc_cfg_deinit (cfg); 
 
     enc->gop = gop;
-    enc->p = p;
     return enc;
 
 }
@@ -805,7 +960,7 @@ int us_mpp_jpeg_encoder_compress(us_mpp_encoder_s *enc, const us_frame_s *src, u
     MppPacket packet = NULL;
     void *buf = mpp_buffer_get_ptr(p->frm_buf);
     //US_LOG_INFO("us_mpp_jpeg_encoder_compress -------> 1.2");
-    memcpy(buf, src->data, src->used);
+    enc_copy_frame(p, src, buf);
     //US_LOG_INFO("us_mpp_jpeg_encoder_compress -------> 1.3");
     ret = mpp_frame_init(&frame);
     if (ret) {
@@ -842,6 +997,7 @@ int us_mpp_jpeg_encoder_compress(us_mpp_encoder_s *enc, const us_frame_s *src, u
     if (ret) {
         US_LOG_PERROR("us_mpp_jpeg_encoder_compress encode put frame failed!, %d", ret);
         mpp_frame_deinit(&frame);
+        mpp_packet_deinit(&packet);
         return ret;
     }
 
@@ -896,27 +1052,58 @@ int us_mpp_jpeg_encoder_compress(us_mpp_encoder_s *enc, const us_frame_s *src, u
 }
 
 void us_mpp_encoder_destory(us_mpp_encoder_s *enc) {
-    enc->p->mpi->reset(enc->p->ctx);
-    if (enc->p->ctx) {
-        mpp_destroy(enc->p->ctx);
-        enc->p->ctx  = NULL;
-    }
-    
-    if (enc->p->fp_output) {
-        fclose(enc->p->fp_output);
-        enc->p->fp_output = NULL;
-    }
+    // Вызывается и из-под неудачного init, поэтому любое поле может быть еще пустым
+    mpp_encode_data *p = enc->p;
+    if (p) {
+        if (p->ctx) {
+            if (p->mpi) {
+                p->mpi->reset(p->ctx);
+            }
+            mpp_destroy(p->ctx);
+            p->ctx = NULL;
+        }
 
-    if (enc->p->cfg) {
-        mpp_enc_cfg_deinit(enc->p->cfg);
-        enc->p->cfg = NULL;
-    }
+        if (p->fp_output) {
+            fclose(p->fp_output);
+            p->fp_output = NULL;
+        }
+
+        if (p->cfg) {
+            mpp_enc_cfg_deinit(p->cfg);
+            p->cfg = NULL;
+        }
+
+        if (p->frm_buf) {
+            mpp_buffer_put(p->frm_buf);
+            p->frm_buf = NULL;
+        }
+
+        if (p->pkt_buf) {
+            mpp_buffer_put(p->pkt_buf);
+            p->pkt_buf = NULL;
+        }
 
-    if (enc->p->frm_buf) {
-        mpp_buffer_put(enc->p->frm_buf);
-        enc->p->frm_buf = NULL;
+        for (unsigned index = 0; index < US_MPP_H264_PIPELINE_DEPTH; ++index) {
+            us_mpp_encoder_slot_s *slot = &enc->slots[index];
+            if (slot->frm_buf) {
+                mpp_buffer_put(slot->frm_buf);
+            }
+            if (slot->pkt_buf) {
+                mpp_buffer_put(slot->pkt_buf);
+            }
+            US_DELETE(slot->meta, us_frame_destroy);
+        }
+        US_DELETE(enc->nal, us_nal_cache_destroy);
+
+        if (p->buf_grp) {
+            mpp_buffer_group_put(p->buf_grp);
+            p->buf_grp = NULL;
+        }
+
+        free(p);
+        enc->p = NULL;
     }
-    
+
     if (enc->cfg) {
         free(enc->cfg);
         enc->cfg = NULL;
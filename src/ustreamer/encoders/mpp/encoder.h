@@ -48,6 +48,7 @@
 
 #include "../../../libs/logging.h"
 #include "../../../libs/frame.h"
+#include "../../../libs/nal.h"
 
 typedef void *MppEncRefCfg;
 
@@ -184,6 +185,15 @@ typedef struct MpiEncArgs {
 } mpp_encode_cfg;
 
 
+// Кадров, одновременно находящихся в VPU: пока кодируется N, в соседний слот копируется N+1
+#define US_MPP_H264_PIPELINE_DEPTH 2
+
+typedef struct MppEncoderSlot {
+    MppBuffer   frm_buf;
+    MppBuffer   pkt_buf;
+    us_frame_s  *meta; // Source frame metadata for the packet
+} us_mpp_encoder_slot_s;
+
 typedef struct MppEncoder {
 	unsigned    output_format;
     int         last_online;
@@ -193,10 +203,21 @@ typedef struct MppEncoder {
 
     mpp_encode_cfg *cfg; // pointer to global command line info
     mpp_encode_data *p; // context of encoder
+
+    // H264 only; submit and collect may run in different threads
+    us_mpp_encoder_slot_s slots[US_MPP_H264_PIPELINE_DEPTH];
+    unsigned    n_submitted;
+    unsigned    n_collected;
+    us_nal_cache_s *nal; // Sets the key flag and keeps SPS/PPS for IDR frames
 } us_mpp_encoder_s;
 
+MppFrameFormat us_mpp_format_from_v4l2(unsigned format);
 us_mpp_encoder_s *us_mpp_h264_encoder_init(unsigned width, unsigned height, MppFrameFormat input_format, unsigned output_format, unsigned gop);
+int us_mpp_h264_encoder_set_params(us_mpp_encoder_s *enc, unsigned bitrate, unsigned gop, unsigned min_qp, unsigned max_qp, bool cbr);
 int us_mpp_h264_encoder_compress(us_mpp_encoder_s *enc, const us_frame_s *src, us_frame_s *dest, bool force_key);
+int us_mpp_h264_encoder_submit(us_mpp_encoder_s *enc, const us_frame_s *src, bool force_key);
+int us_mpp_h264_encoder_collect(us_mpp_encoder_s *enc, us_frame_s *dest);
+void us_mpp_h264_encoder_reset(us_mpp_encoder_s *enc);
 us_mpp_encoder_s * us_mpp_jpeg_encoder_init(unsigned width, unsigned height, MppFrameFormat input_format, unsigned gop, unsigned quality);
 int us_mpp_jpeg_encoder_compress(us_mpp_encoder_s *enc, const us_frame_s *src, us_frame_s *dest);
 void us_mpp_encoder_destory(us_mpp_encoder_s *enc);
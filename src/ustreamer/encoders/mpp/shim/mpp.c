@@ -0,0 +1,754 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#define MODULE_TAG "mpp_shim"
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pthread.h>
+#include <linux/videodev2.h>
+
+#include "rockchip/rk_type.h"
+#include "rockchip/mpp_err.h"
+#include "rockchip/mpp_log.h"
+#include "rockchip/rk_mpi.h"
+#include "rockchip/rk_venc_cmd.h"
+
+#include "../mpp_env.h"
+
+#include "../../../../libs/tools.h"
+#include "../../../../libs/threading.h"
+#include "../../../../libs/frame.h"
+#include "../../cpu/encoder.h"
+#ifdef WITH_X264
+#	include "../../x264/encoder.h"
+#endif
+
+
+#define _CFG_MAX_ITEMS	96
+#define _CFG_MAX_NAME	32
+
+#define _MAX_PACKETS	4
+
+
+typedef struct {
+	char	name[_CFG_MAX_NAME];
+	RK_S64	value;
+} _cfg_item_s;
+
+typedef struct {
+	unsigned	n_items;
+	_cfg_item_s	items[_CFG_MAX_ITEMS];
+} _cfg_s;
+
+typedef struct {
+	RK_S32	lt_cnt;
+	RK_S32	st_cnt;
+	RK_S32	n_lt;
+	RK_S32	n_st;
+} _ref_cfg_s;
+
+typedef struct {
+	MppCodingType		coding;
+	bool				inited;
+	_cfg_s				cfg;
+	MppPollType			output_timeout;
+	bool				force_idr;
+
+	us_cpu_encoder_s	*cpu;
+#	ifdef WITH_X264
+	us_x264_encoder_s	*x264;
+#	endif
+	us_frame_s			*dest;
+
+	unsigned			n_frames;
+
+	// Готовые пакеты, которые заберет encode_get_packet(), возможно из другого потока
+	pthread_mutex_t		queue_mutex;
+	MppPacket			packets[_MAX_PACKETS];
+	long double			ready_ts[_MAX_PACKETS];
+	unsigned			queue_head;
+	unsigned			queue_len;
+} _ctx_s;
+
+
+// Параметры эмуляции железа, читаются из окружения один раз, как это делает MPP:
+//   - mpp_shim_delay       - задержка выдачи пакета в миллисекундах (время работы VPU);
+//   - mpp_shim_cores       - сколько кадров может кодироваться одновременно (0 - без ограничений);
+//   - mpp_shim_fail_init   - mpp_init() всегда завершается ошибкой;
+//   - mpp_shim_fail_every  - каждый N-й кадр контекста завершается ошибкой VPU;
+//   - mpp_shim_max_contexts - сколько контекстов можно открыть одновременно (0 - без ограничений).
+static struct {
+	pthread_once_t	once;
+	RK_U32			delay;
+	RK_U32			cores;
+	RK_U32			fail_init;
+	RK_U32			fail_every;
+	RK_U32			max_contexts;
+
+	pthread_mutex_t	busy_mutex;
+	pthread_cond_t	busy_cond;
+	RK_U32			busy;
+	RK_U32			n_contexts;
+} _g = {
+	.once = PTHREAD_ONCE_INIT,
+	.busy_mutex = PTHREAD_MUTEX_INITIALIZER,
+	.busy_cond = PTHREAD_COND_INITIALIZER,
+};
+
+
+static void _read_env(void);
+static void _core_acquire(void);
+static void _core_release(void);
+
+static _cfg_item_s *_cfg_find(_cfg_s *cfg, const char *name, bool create);
+static RK_S64 _cfg_get(_cfg_s *cfg, const char *name, RK_S64 def);
+static void _cfg_merge(_cfg_s *dest, const _cfg_s *src);
+
+static MPP_RET _make_src(_ctx_s *ctx, MppFrame frame, us_frame_s *src);
+static MPP_RET _encode(_ctx_s *ctx, const us_frame_s *src);
+#ifdef WITH_X264
+static void _x264_apply_cfg(_ctx_s *ctx);
+#endif
+
+static MPP_RET _mpi_encode_put_frame(MppCtx v_ctx, MppFrame frame);
+static MPP_RET _mpi_encode_get_packet(MppCtx v_ctx, MppPacket *packet);
+static MPP_RET _mpi_encode(MppCtx v_ctx, MppFrame frame, MppPacket *packet);
+static MPP_RET _mpi_poll(MppCtx v_ctx, MppPortType type, MppPollType timeout);
+static MPP_RET _mpi_reset(MppCtx v_ctx);
+static MPP_RET _mpi_control(MppCtx v_ctx, MpiCmd cmd, MppParam param);
+
+
+static MppApi _mpi = {
+	.size = sizeof(MppApi),
+	.version = 0,
+	.encode = _mpi_encode,
+	.encode_put_frame = _mpi_encode_put_frame,
+	.encode_get_packet = _mpi_encode_get_packet,
+	.poll = _mpi_poll,
+	.reset = _mpi_reset,
+	.control = _mpi_control,
+};
+
+
+MPP_RET mpp_create(MppCtx *v_ctx, MppApi **mpi) {
+	if (v_ctx == NULL || mpi == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	pthread_once(&_g.once, _read_env);
+
+	_ctx_s *ctx;
+	if ((ctx = calloc(1, sizeof(_ctx_s))) == NULL) {
+		*v_ctx = NULL;
+		*mpi = NULL;
+		return MPP_ERR_MALLOC;
+	}
+	ctx->output_timeout = MPP_POLL_BLOCK;
+	US_MUTEX_INIT(ctx->queue_mutex);
+	*v_ctx = ctx;
+	*mpi = &_mpi;
+	return MPP_OK;
+}
+
+MPP_RET mpp_init(MppCtx v_ctx, MppCtxType type, MppCodingType coding) {
+	_ctx_s *const ctx = v_ctx;
+	if (ctx == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if (_g.fail_init) {
+		mpp_err_f("injected init failure\n");
+		return MPP_ERR_INIT;
+	}
+	if (mpp_check_support_format(type, coding) != MPP_OK) {
+		mpp_err_f("unsupported ctx type %d coding %d\n", type, coding);
+		return MPP_ERR_INIT;
+	}
+
+	US_MUTEX_LOCK(_g.busy_mutex);
+	const bool no_room = (_g.max_contexts > 0 && _g.n_contexts >= _g.max_contexts);
+	if (!no_room) {
+		++_g.n_contexts;
+	}
+	US_MUTEX_UNLOCK(_g.busy_mutex);
+	if (no_room) {
+		mpp_err_f("no free contexts, limit is %u\n", _g.max_contexts);
+		return MPP_ERR_INIT;
+	}
+
+	if (coding == MPP_VIDEO_CodingMJPEG) {
+		ctx->cpu = us_cpu_encoder_init(1);
+	}
+	ctx->dest = us_frame_init();
+	ctx->coding = coding;
+	ctx->inited = true;
+	return MPP_OK;
+}
+
+MPP_RET mpp_destroy(MppCtx v_ctx) {
+	_ctx_s *const ctx = v_ctx;
+	if (ctx == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	_mpi_reset(ctx);
+	if (ctx->inited) {
+		US_MUTEX_LOCK(_g.busy_mutex);
+		--_g.n_contexts;
+		US_MUTEX_UNLOCK(_g.busy_mutex);
+	}
+	US_DELETE(ctx->cpu, us_cpu_encoder_destroy);
+#	ifdef WITH_X264
+	US_DELETE(ctx->x264, us_x264_encoder_destroy);
+#	endif
+	US_DELETE(ctx->dest, us_frame_destroy);
+	US_MUTEX_DESTROY(ctx->queue_mutex);
+	free(ctx);
+	return MPP_OK;
+}
+
+MPP_RET mpp_check_support_format(MppCtxType type, MppCodingType coding) {
+	if (type == MPP_CTX_ENC) {
+		switch (coding) {
+			case MPP_VIDEO_CodingMJPEG: return MPP_OK;
+#			ifdef WITH_X264
+			case MPP_VIDEO_CodingAVC: return MPP_OK;
+#			endif
+			default: break;
+		}
+	}
+	return MPP_NOK;
+}
+
+void mpp_show_support_format(void) {
+	mpp_log("mpp shim coding type support list:\n");
+	mpp_log("type: enc, coding: MJPEG (libjpeg)\n");
+#	ifdef WITH_X264
+	mpp_log("type: enc, coding: AVC (x264)\n");
+#	endif
+}
+
+void mpp_show_color_format(void) {
+	mpp_log("mpp shim color support list:\n");
+	mpp_log("YUV420SP, YUV422SP, YUV444SP, YUV422_YUYV, YUV422_UYVY, RGB565, RGB888\n");
+}
+
+MPP_RET mpp_enc_cfg_init(MppEncCfg *cfg) {
+	if (cfg == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if ((*cfg = calloc(1, sizeof(_cfg_s))) == NULL) {
+		return MPP_ERR_MALLOC;
+	}
+	return MPP_OK;
+}
+
+MPP_RET mpp_enc_cfg_deinit(MppEncCfg cfg) {
+	if (cfg == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	free(cfg);
+	return MPP_OK;
+}
+
+#define _CFG_SET(x_name, x_type) \
+	MPP_RET mpp_enc_cfg_set_##x_name(MppEncCfg cfg, const char *name, x_type val) { \
+		_cfg_item_s *item; \
+		if (cfg == NULL || name == NULL) { \
+			return MPP_ERR_NULL_PTR; \
+		} \
+		if ((item = _cfg_find(cfg, name, true)) == NULL) { \
+			mpp_err_f("can't store cfg %s\n", name); \
+			return MPP_NOK; \
+		} \
+		item->value = (RK_S64)val; \
+		return MPP_OK; \
+	}
+
+#define _CFG_GET(x_name, x_type) \
+	MPP_RET mpp_enc_cfg_get_##x_name(MppEncCfg cfg, const char *name, x_type *val) { \
+		const _cfg_item_s *item; \
+		if (cfg == NULL || name == NULL || val == NULL) { \
+			return MPP_ERR_NULL_PTR; \
+		} \
+		if ((item = _cfg_find(cfg, name, false)) == NULL) { \
+			return MPP_NOK; \
+		} \
+		*val = (x_type)item->value; \
+		return MPP_OK; \
+	}
+
+_CFG_SET(s32, RK_S32)
+_CFG_SET(u32, RK_U32)
+_CFG_SET(s64, RK_S64)
+_CFG_SET(u64, RK_U64)
+_CFG_GET(s32, RK_S32)
+_CFG_GET(u32, RK_U32)
+_CFG_GET(s64, RK_S64)
+_CFG_GET(u64, RK_U64)
+
+#undef _CFG_GET
+#undef _CFG_SET
+
+void mpp_enc_cfg_show(void) {
+	mpp_log("mpp shim accepts any cfg name, max %d items\n", _CFG_MAX_ITEMS);
+}
+
+MPP_RET mpp_enc_ref_cfg_init(MppEncRefCfg *ref) {
+	if (ref == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if ((*ref = calloc(1, sizeof(_ref_cfg_s))) == NULL) {
+		return MPP_ERR_MALLOC;
+	}
+	return MPP_OK;
+}
+
+MPP_RET mpp_enc_ref_cfg_deinit(MppEncRefCfg *ref) {
+	if (ref == NULL || *ref == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	free(*ref);
+	*ref = NULL;
+	return MPP_OK;
+}
+
+MPP_RET mpp_enc_ref_cfg_reset(MppEncRefCfg ref) {
+	if (ref == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	memset(ref, 0, sizeof(_ref_cfg_s));
+	return MPP_OK;
+}
+
+MPP_RET mpp_enc_ref_cfg_set_cfg_cnt(MppEncRefCfg ref, RK_S32 lt_cnt, RK_S32 st_cnt) {
+	_ref_cfg_s *const impl = ref;
+	if (impl == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	impl->lt_cnt = lt_cnt;
+	impl->st_cnt = st_cnt;
+	impl->n_lt = 0;
+	impl->n_st = 0;
+	return MPP_OK;
+}
+
+MPP_RET mpp_enc_ref_cfg_add_lt_cfg(MppEncRefCfg ref, RK_S32 cnt, UNUSED MppEncRefLtFrmCfg *frm) {
+	_ref_cfg_s *const impl = ref;
+	if (impl == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if (impl->n_lt + cnt > impl->lt_cnt) {
+		mpp_err_f("too many lt refs %d, max %d\n", impl->n_lt + cnt, impl->lt_cnt);
+		return MPP_ERR_VALUE;
+	}
+	impl->n_lt += cnt;
+	return MPP_OK;
+}
+
+MPP_RET mpp_enc_ref_cfg_add_st_cfg(MppEncRefCfg ref, RK_S32 cnt, UNUSED MppEncRefStFrmCfg *frm) {
+	_ref_cfg_s *const impl = ref;
+	if (impl == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if (impl->n_st + cnt > impl->st_cnt) {
+		mpp_err_f("too many st refs %d, max %d\n", impl->n_st + cnt, impl->st_cnt);
+		return MPP_ERR_VALUE;
+	}
+	impl->n_st += cnt;
+	return MPP_OK;
+}
+
+MPP_RET mpp_enc_ref_cfg_check(MppEncRefCfg ref) {
+	const _ref_cfg_s *const impl = ref;
+	if (impl == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	return (impl->n_lt == impl->lt_cnt && impl->n_st == impl->st_cnt ? MPP_OK : MPP_NOK);
+}
+
+MPP_RET mpp_enc_ref_cfg_set_keep_cpb(MppEncRefCfg ref, UNUSED RK_S32 keep) {
+	return (ref != NULL ? MPP_OK : MPP_ERR_NULL_PTR);
+}
+
+static MPP_RET _mpi_encode_put_frame(MppCtx v_ctx, MppFrame frame) {
+	_ctx_s *const ctx = v_ctx;
+	if (ctx == NULL || frame == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if (!ctx->inited) {
+		return MPP_ERR_INIT;
+	}
+	US_MUTEX_LOCK(ctx->queue_mutex);
+	const bool full = (ctx->queue_len >= _MAX_PACKETS);
+	US_MUTEX_UNLOCK(ctx->queue_mutex);
+	if (full) {
+		// Как и у железа, очередь задач ограничена, пока не забраны пакеты
+		return MPP_ERR_BUFFER_FULL;
+	}
+
+	++ctx->n_frames;
+	if (_g.fail_every > 0 && ctx->n_frames % _g.fail_every == 0) {
+		mpp_err_f("injected encoding failure on frame %u\n", ctx->n_frames);
+		return MPP_ERR_VPUHW;
+	}
+
+	const long double begin_ts = us_get_now_monotonic();
+
+	us_frame_s src = {0};
+	MPP_RET ret;
+	if ((ret = _make_src(ctx, frame, &src)) != MPP_OK) {
+		return ret;
+	}
+
+	_core_acquire();
+	ret = _encode(ctx, &src);
+	_core_release();
+	if (ret != MPP_OK) {
+		return ret;
+	}
+
+	MppPacket packet = NULL;
+	if (mpp_frame_has_meta(frame)) {
+		mpp_meta_get_packet(mpp_frame_get_meta(frame), KEY_OUTPUT_PACKET, &packet);
+	}
+	if (packet == NULL) {
+		MppBuffer buf;
+		if ((ret = mpp_buffer_get(NULL, &buf, ctx->dest->used)) != MPP_OK) {
+			return ret;
+		}
+		ret = mpp_packet_init_with_buffer(&packet, buf);
+		mpp_buffer_put(buf); // Буфер теперь принадлежит пакету
+		if (ret != MPP_OK) {
+			return ret;
+		}
+	} else if (mpp_packet_get_size(packet) < ctx->dest->used) {
+		mpp_err_f("output packet is too small: %zu < %zu\n", mpp_packet_get_size(packet), ctx->dest->used);
+		return MPP_ERR_BUFFER_FULL;
+	}
+
+	memcpy(mpp_packet_get_data(packet), ctx->dest->data, ctx->dest->used);
+	mpp_packet_set_pos(packet, mpp_packet_get_data(packet));
+	mpp_packet_set_length(packet, ctx->dest->used);
+	if (mpp_frame_get_eos(frame)) {
+		mpp_packet_set_eos(packet);
+	}
+
+	MppMeta meta = mpp_packet_get_meta(packet);
+	mpp_meta_set_s32(meta, KEY_OUTPUT_INTRA, ctx->dest->key);
+	mpp_meta_set_s32(meta, KEY_TEMPORAL_ID, 0);
+
+	US_MUTEX_LOCK(ctx->queue_mutex);
+	const unsigned tail = (ctx->queue_head + ctx->queue_len) % _MAX_PACKETS;
+	ctx->packets[tail] = packet;
+	ctx->ready_ts[tail] = begin_ts + (long double)_g.delay / 1000;
+	++ctx->queue_len;
+	US_MUTEX_UNLOCK(ctx->queue_mutex);
+	return MPP_OK;
+}
+
+static MPP_RET _mpi_encode_get_packet(MppCtx v_ctx, MppPacket *packet) {
+	_ctx_s *const ctx = v_ctx;
+	if (ctx == NULL || packet == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	*packet = NULL;
+
+	US_MUTEX_LOCK(ctx->queue_mutex);
+	const unsigned queue_len = ctx->queue_len;
+	const long double ready_ts = ctx->ready_ts[ctx->queue_head];
+	US_MUTEX_UNLOCK(ctx->queue_mutex);
+
+	if (queue_len == 0) {
+		// Кадр не был принят, ждать нечего
+		return (ctx->output_timeout == MPP_POLL_NON_BLOCK ? MPP_OK : MPP_ERR_TIMEOUT);
+	}
+
+	// Пакеты забирает только один поток, поэтому голова очереди не сдвинется без нас
+	const long double wait = ready_ts - us_get_now_monotonic();
+	if (ctx->output_timeout >= 0 && wait > (long double)ctx->output_timeout / 1000) {
+		if (ctx->output_timeout > 0) {
+			usleep(ctx->output_timeout * 1000);
+		}
+		return MPP_OK;
+	}
+	if (wait > 0) {
+		usleep(wait * 1000000);
+	}
+
+	US_MUTEX_LOCK(ctx->queue_mutex);
+	*packet = ctx->packets[ctx->queue_head];
+	ctx->packets[ctx->queue_head] = NULL;
+	ctx->queue_head = (ctx->queue_head + 1) % _MAX_PACKETS;
+	--ctx->queue_len;
+	US_MUTEX_UNLOCK(ctx->queue_mutex);
+	return MPP_OK;
+}
+
+static MPP_RET _mpi_encode(MppCtx v_ctx, MppFrame frame, MppPacket *packet) {
+	const MPP_RET ret = _mpi_encode_put_frame(v_ctx, frame);
+	if (ret != MPP_OK) {
+		return ret;
+	}
+	return _mpi_encode_get_packet(v_ctx, packet);
+}
+
+static MPP_RET _mpi_poll(MppCtx v_ctx, MppPortType type, UNUSED MppPollType timeout) {
+	_ctx_s *const ctx = v_ctx;
+	if (ctx == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	US_MUTEX_LOCK(ctx->queue_mutex);
+	const unsigned queue_len = ctx->queue_len;
+	US_MUTEX_UNLOCK(ctx->queue_mutex);
+	switch (type) {
+		case MPP_PORT_INPUT: return (queue_len < _MAX_PACKETS ? MPP_OK : MPP_NOK);
+		case MPP_PORT_OUTPUT: return (queue_len > 0 ? MPP_OK : MPP_NOK);
+		default: return MPP_ERR_VALUE;
+	}
+}
+
+static MPP_RET _mpi_reset(MppCtx v_ctx) {
+	_ctx_s *const ctx = v_ctx;
+	if (ctx == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	US_MUTEX_LOCK(ctx->queue_mutex);
+	for (; ctx->queue_len > 0; --ctx->queue_len) {
+		mpp_packet_deinit(&ctx->packets[ctx->queue_head]);
+		ctx->queue_head = (ctx->queue_head + 1) % _MAX_PACKETS;
+	}
+	US_MUTEX_UNLOCK(ctx->queue_mutex);
+	return MPP_OK;
+}
+
+static MPP_RET _mpi_control(MppCtx v_ctx, MpiCmd cmd, MppParam param) {
+	_ctx_s *const ctx = v_ctx;
+	if (ctx == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+
+	switch (cmd) {
+		case MPP_SET_INPUT_TIMEOUT: return MPP_OK; // Кадр принимается сразу
+		case MPP_SET_OUTPUT_TIMEOUT:
+			if (param == NULL) {
+				return MPP_ERR_NULL_PTR;
+			}
+			ctx->output_timeout = *(MppPollType *)param;
+			return MPP_OK;
+
+		case MPP_ENC_GET_CFG:
+			if (param == NULL) {
+				return MPP_ERR_NULL_PTR;
+			}
+			memcpy(param, &ctx->cfg, sizeof(_cfg_s));
+			return MPP_OK;
+
+		case MPP_ENC_SET_CFG:
+			if (param == NULL) {
+				return MPP_ERR_NULL_PTR;
+			}
+			_cfg_merge(&ctx->cfg, param);
+#			ifdef WITH_X264
+			// Как и настоящий MPP, перенастраиваем кодер на месте, без пересоздания
+			if (ctx->x264 != NULL) {
+				_x264_apply_cfg(ctx);
+			}
+#			endif
+			return MPP_OK;
+
+		case MPP_ENC_SET_IDR_FRAME:
+			ctx->force_idr = true;
+			return MPP_OK;
+
+		case MPP_ENC_SET_HEADER_MODE: // x264 и так повторяет SPS/PPS перед каждым IDR
+		case MPP_ENC_SET_SEI_CFG:
+		case MPP_ENC_SET_REF_CFG:
+		case MPP_ENC_SET_SPLIT:
+		case MPP_ENC_SET_OSD_PLT_CFG:
+		case MPP_ENC_SET_OSD_DATA_CFG:
+		case MPP_ENC_SET_ROI_CFG:
+			return MPP_OK;
+
+		default:
+			mpp_err_f("unsupported control cmd %d\n", cmd);
+			return MPP_NOK;
+	}
+}
+
+static MPP_RET _make_src(_ctx_s *ctx, MppFrame frame, us_frame_s *src) {
+	MppBuffer buf = mpp_frame_get_buffer(frame);
+	if (buf == NULL) {
+		mpp_err_f("frame without buffer\n");
+		return MPP_ERR_NULL_PTR;
+	}
+
+	// Как и настоящий MPP, формат берется из prep-конфига, геометрия - из кадра
+	const MppFrameFormat fmt = _cfg_get(&ctx->cfg, "prep:format", mpp_frame_get_fmt(frame));
+	switch (fmt) {
+		case MPP_FMT_YUV422_YUYV: src->format = V4L2_PIX_FMT_YUYV; break;
+		case MPP_FMT_YUV422_UYVY: src->format = V4L2_PIX_FMT_UYVY; break;
+		case MPP_FMT_RGB565: src->format = V4L2_PIX_FMT_RGB565; break;
+		case MPP_FMT_RGB888: src->format = V4L2_PIX_FMT_RGB24; break;
+		case MPP_FMT_YUV420SP: src->format = V4L2_PIX_FMT_NV12; break;
+		case MPP_FMT_YUV422SP: src->format = V4L2_PIX_FMT_NV16; break;
+		case MPP_FMT_YUV444SP: src->format = V4L2_PIX_FMT_NV24; break;
+		default:
+			mpp_err_f("unsupported input format 0x%x\n", fmt);
+			return MPP_ERR_VALUE;
+	}
+
+#	define GEOMETRY(x_name) (mpp_frame_get_##x_name(frame) ? mpp_frame_get_##x_name(frame) : (RK_U32)_cfg_get(&ctx->cfg, "prep:" #x_name, 0))
+	src->width = GEOMETRY(width);
+	src->height = GEOMETRY(height);
+	src->stride = GEOMETRY(hor_stride);
+	const RK_U32 ver_stride = us_max_u(GEOMETRY(ver_stride), src->height);
+#	undef GEOMETRY
+
+	if (src->width == 0 || src->height == 0) {
+		mpp_err_f("invalid frame geometry %ux%u\n", src->width, src->height);
+		return MPP_ERR_VALUE;
+	}
+	if (src->stride == 0) {
+		src->stride = src->width * (us_is_semiplanar(src->format) ? 1 : (src->format == V4L2_PIX_FMT_RGB24 ? 3 : 2));
+	}
+
+	src->data = mpp_buffer_get_ptr(buf);
+	src->used = mpp_buffer_get_size(buf);
+	src->allocated = src->used;
+	src->dma_fd = -1;
+	src->n_planes = us_frame_get_planes_layout(src->format, src->stride, ver_stride, src->planes);
+	src->online = true;
+	if (src->n_planes > 0) {
+		const us_frame_plane_s *const last = &src->planes[src->n_planes - 1];
+		if (last->offset + last->size > src->used) {
+			mpp_err_f("frame buffer is too small: %zu\n", src->used);
+			return MPP_ERR_VALUE;
+		}
+	} else if ((size_t)src->stride * src->height > src->used) {
+		mpp_err_f("frame buffer is too small: %zu\n", src->used);
+		return MPP_ERR_VALUE;
+	}
+	return MPP_OK;
+}
+
+static MPP_RET _encode(_ctx_s *ctx, const us_frame_s *src) {
+	if (ctx->coding == MPP_VIDEO_CodingMJPEG) {
+		// jpeg:quant у MPP идет от 0 до 10, q_factor - привычное качество JPEG
+		RK_S64 quality = _cfg_get(&ctx->cfg, "jpeg:q_factor", 0);
+		if (quality <= 0) {
+			quality = _cfg_get(&ctx->cfg, "jpeg:quant", 8) * 10;
+		}
+		us_cpu_encoder_compress(ctx->cpu, src, ctx->dest, (unsigned)(quality < 1 ? 1 : (quality > 100 ? 100 : quality)));
+		ctx->dest->key = true;
+		return MPP_OK;
+	}
+
+#	ifdef WITH_X264
+	if (ctx->coding == MPP_VIDEO_CodingAVC) {
+		if (ctx->x264 == NULL) {
+			ctx->x264 = us_x264_encoder_init(5000, 30);
+			_x264_apply_cfg(ctx);
+		}
+		const bool force_key = ctx->force_idr;
+		ctx->force_idr = false;
+		if (us_x264_encoder_compress(ctx->x264, src, ctx->dest, force_key) < 0) {
+			return MPP_NOK;
+		}
+		return MPP_OK;
+	}
+#	endif
+
+	return MPP_ERR_INIT;
+}
+
+#ifdef WITH_X264
+static void _x264_apply_cfg(_ctx_s *ctx) {
+	const RK_S64 bps = _cfg_get(&ctx->cfg, "rc:bps_target", 0);
+	const RK_S64 gop = _cfg_get(&ctx->cfg, "rc:gop", 30);
+	const RK_S64 qp_min = _cfg_get(&ctx->cfg, "rc:qp_min", 0);
+	const RK_S64 qp_max = _cfg_get(&ctx->cfg, "rc:qp_max", 0);
+	const RK_S64 mode = _cfg_get(&ctx->cfg, "rc:mode", MPP_ENC_RC_MODE_CBR);
+	us_x264_encoder_set_params(ctx->x264,
+		(bps > 0 ? bps / 1000 : 5000), (gop > 0 ? gop : 30),
+		(qp_min > 0 ? qp_min : 0), (qp_max > 0 ? qp_max : 0),
+		(mode == MPP_ENC_RC_MODE_CBR));
+}
+#endif
+
+static void _read_env(void) {
+	mpp_env_get_u32("mpp_shim_delay", &_g.delay, 0);
+	mpp_env_get_u32("mpp_shim_cores", &_g.cores, 0);
+	mpp_env_get_u32("mpp_shim_fail_init", &_g.fail_init, 0);
+	mpp_env_get_u32("mpp_shim_fail_every", &_g.fail_every, 0);
+	mpp_env_get_u32("mpp_shim_max_contexts", &_g.max_contexts, 0);
+	US_LOG_INFO("MPP-SHIM: Using software MPP: delay=%ums, cores=%u, fail_init=%u, fail_every=%u, max_contexts=%u",
+		_g.delay, _g.cores, _g.fail_init, _g.fail_every, _g.max_contexts);
+}
+
+static void _core_acquire(void) {
+	if (_g.cores > 0) {
+		US_MUTEX_LOCK(_g.busy_mutex);
+		US_COND_WAIT_FOR(_g.busy < _g.cores, _g.busy_cond, _g.busy_mutex);
+		++_g.busy;
+		US_MUTEX_UNLOCK(_g.busy_mutex);
+	}
+}
+
+static void _core_release(void) {
+	if (_g.cores > 0) {
+		US_MUTEX_LOCK(_g.busy_mutex);
+		--_g.busy;
+		US_MUTEX_UNLOCK(_g.busy_mutex);
+		US_COND_SIGNAL(_g.busy_cond);
+	}
+}
+
+static _cfg_item_s *_cfg_find(_cfg_s *cfg, const char *name, bool create) {
+	for (unsigned index = 0; index < cfg->n_items; ++index) {
+		if (!strcmp(cfg->items[index].name, name)) {
+			return &cfg->items[index];
+		}
+	}
+	if (!create || cfg->n_items >= _CFG_MAX_ITEMS || strlen(name) >= _CFG_MAX_NAME) {
+		return NULL;
+	}
+	_cfg_item_s *const item = &cfg->items[cfg->n_items];
+	strcpy(item->name, name);
+	++cfg->n_items;
+	return item;
+}
+
+static RK_S64 _cfg_get(_cfg_s *cfg, const char *name, RK_S64 def) {
+	const _cfg_item_s *const item = _cfg_find(cfg, name, false);
+	return (item != NULL ? item->value : def);
+}
+
+static void _cfg_merge(_cfg_s *dest, const _cfg_s *src) {
+	for (unsigned index = 0; index < src->n_items; ++index) {
+		_cfg_item_s *const item = _cfg_find(dest, src->items[index].name, true);
+		if (item != NULL) {
+			item->value = src->items[index].value;
+		}
+	}
+}
@@ -0,0 +1,380 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "rockchip/rk_type.h"
+#include "rockchip/mpp_err.h"
+#include "rockchip/mpp_log.h"
+#include "rockchip/mpp_buffer.h"
+#include "rockchip/mpp_frame.h"
+#include "rockchip/mpp_packet.h"
+#include "rockchip/mpp_meta.h"
+
+#include "../../../../libs/tools.h"
+
+
+typedef struct {
+	MppBufferType	type;
+	MppBufferMode	mode;
+} _group_s;
+
+typedef struct {
+	atomic_uint	refs;
+	size_t		size;
+	uint8_t		*data;
+} _buffer_s;
+
+typedef struct {
+	RK_U32		mask;
+	RK_S64		nums[KEY_BUTT];
+	void		*ptrs[KEY_BUTT];
+} _meta_s;
+
+typedef struct {
+	RK_U32			width;
+	RK_U32			height;
+	RK_U32			hor_stride;
+	RK_U32			ver_stride;
+	MppFrameFormat	fmt;
+	RK_S64			pts;
+	RK_U32			eos;
+	MppBuffer		buf;
+	_meta_s			*meta;
+} _frame_s;
+
+typedef struct {
+	uint8_t		*data;
+	size_t		size;
+	uint8_t		*pos;
+	size_t		length;
+	RK_S64		pts;
+	RK_U32		eos;
+	MppBuffer	buf;
+	_meta_s		*meta;
+} _packet_s;
+
+
+MPP_RET mpp_buffer_group_get(
+	MppBufferGroup *group, MppBufferType type, MppBufferMode mode,
+	UNUSED const char *tag, UNUSED const char *caller) {
+
+	_group_s *impl;
+	if (group == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if ((impl = calloc(1, sizeof(_group_s))) == NULL) {
+		return MPP_ERR_MALLOC;
+	}
+	// DRM/ION тут нет, все типы буферов - обычная память процесса
+	impl->type = type;
+	impl->mode = mode;
+	*group = impl;
+	return MPP_OK;
+}
+
+MPP_RET mpp_buffer_group_put(MppBufferGroup group) {
+	if (group == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	free(group);
+	return MPP_OK;
+}
+
+MPP_RET mpp_buffer_get_with_tag(
+	UNUSED MppBufferGroup group, MppBuffer *buf, size_t size,
+	UNUSED const char *tag, UNUSED const char *caller) {
+
+	_buffer_s *impl;
+	if (buf == NULL || size == 0) {
+		return MPP_ERR_VALUE;
+	}
+	if ((impl = calloc(1, sizeof(_buffer_s))) == NULL) {
+		return MPP_ERR_MALLOC;
+	}
+	if ((impl->data = calloc(1, size)) == NULL) {
+		free(impl);
+		return MPP_ERR_MALLOC;
+	}
+	atomic_init(&impl->refs, 1);
+	impl->size = size;
+	*buf = impl;
+	return MPP_OK;
+}
+
+MPP_RET mpp_buffer_put_with_caller(MppBuffer buf, UNUSED const char *caller) {
+	_buffer_s *const impl = buf;
+	if (impl == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if (atomic_fetch_sub(&impl->refs, 1) == 1) {
+		free(impl->data);
+		free(impl);
+	}
+	return MPP_OK;
+}
+
+MPP_RET mpp_buffer_inc_ref_with_caller(MppBuffer buf, UNUSED const char *caller) {
+	_buffer_s *const impl = buf;
+	if (impl == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	atomic_fetch_add(&impl->refs, 1);
+	return MPP_OK;
+}
+
+void *mpp_buffer_get_ptr_with_caller(MppBuffer buf, UNUSED const char *caller) {
+	const _buffer_s *const impl = buf;
+	return (impl != NULL ? impl->data : NULL);
+}
+
+int mpp_buffer_get_fd_with_caller(UNUSED MppBuffer buf, UNUSED const char *caller) {
+	return -1;
+}
+
+size_t mpp_buffer_get_size_with_caller(MppBuffer buf, UNUSED const char *caller) {
+	const _buffer_s *const impl = buf;
+	return (impl != NULL ? impl->size : 0);
+}
+
+
+static _meta_s *_meta_get(_meta_s **meta) {
+	if (*meta == NULL) {
+		*meta = calloc(1, sizeof(_meta_s));
+	}
+	return *meta;
+}
+
+#define _META_SET(x_dest, x_value) { \
+		_meta_s *const m_impl = meta; \
+		if (m_impl == NULL) { \
+			return MPP_ERR_NULL_PTR; \
+		} else if (key >= KEY_BUTT) { \
+			return MPP_ERR_VALUE; \
+		} \
+		m_impl->x_dest[key] = x_value; \
+		m_impl->mask |= (RK_U32)1 << key; \
+		return MPP_OK; \
+	}
+
+#define _META_GET(x_src, x_type) { \
+		const _meta_s *const m_impl = meta; \
+		if (m_impl == NULL || val == NULL) { \
+			return MPP_ERR_NULL_PTR; \
+		} else if (key >= KEY_BUTT || !(m_impl->mask & ((RK_U32)1 << key))) { \
+			return MPP_NOK; \
+		} \
+		*val = (x_type)m_impl->x_src[key]; \
+		return MPP_OK; \
+	}
+
+MPP_RET mpp_meta_set_s32(MppMeta meta, MppMetaKey key, RK_S32 val)			_META_SET(nums, val)
+MPP_RET mpp_meta_set_s64(MppMeta meta, MppMetaKey key, RK_S64 val)			_META_SET(nums, val)
+MPP_RET mpp_meta_set_ptr(MppMeta meta, MppMetaKey key, void *val)			_META_SET(ptrs, val)
+MPP_RET mpp_meta_set_frame(MppMeta meta, MppMetaKey key, MppFrame val)		_META_SET(ptrs, val)
+MPP_RET mpp_meta_set_packet(MppMeta meta, MppMetaKey key, MppPacket val)	_META_SET(ptrs, val)
+MPP_RET mpp_meta_set_buffer(MppMeta meta, MppMetaKey key, MppBuffer val)	_META_SET(ptrs, val)
+
+MPP_RET mpp_meta_get_s32(MppMeta meta, MppMetaKey key, RK_S32 *val)			_META_GET(nums, RK_S32)
+MPP_RET mpp_meta_get_s64(MppMeta meta, MppMetaKey key, RK_S64 *val)			_META_GET(nums, RK_S64)
+MPP_RET mpp_meta_get_ptr(MppMeta meta, MppMetaKey key, void **val)			_META_GET(ptrs, void *)
+MPP_RET mpp_meta_get_frame(MppMeta meta, MppMetaKey key, MppFrame *val)		_META_GET(ptrs, MppFrame)
+MPP_RET mpp_meta_get_packet(MppMeta meta, MppMetaKey key, MppPacket *val)	_META_GET(ptrs, MppPacket)
+MPP_RET mpp_meta_get_buffer(MppMeta meta, MppMetaKey key, MppBuffer *val)	_META_GET(ptrs, MppBuffer)
+
+#undef _META_GET
+#undef _META_SET
+
+
+MPP_RET mpp_frame_init(MppFrame *frame) {
+	if (frame == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if ((*frame = calloc(1, sizeof(_frame_s))) == NULL) {
+		return MPP_ERR_MALLOC;
+	}
+	return MPP_OK;
+}
+
+MPP_RET mpp_frame_deinit(MppFrame *frame) {
+	if (frame == NULL || *frame == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	_frame_s *const impl = *frame;
+	if (impl->buf != NULL) {
+		mpp_buffer_put(impl->buf);
+	}
+	free(impl->meta); // Мета не владеет пакетами и буферами, на которые ссылается
+	free(impl);
+	*frame = NULL;
+	return MPP_OK;
+}
+
+#define _FRAME_FIELD(x_name, x_type) \
+	x_type mpp_frame_get_##x_name(const MppFrame frame) { \
+		return ((const _frame_s *)frame)->x_name; \
+	} \
+	void mpp_frame_set_##x_name(MppFrame frame, x_type x_name) { \
+		((_frame_s *)frame)->x_name = x_name; \
+	}
+
+_FRAME_FIELD(width, RK_U32)
+_FRAME_FIELD(height, RK_U32)
+_FRAME_FIELD(hor_stride, RK_U32)
+_FRAME_FIELD(ver_stride, RK_U32)
+_FRAME_FIELD(fmt, MppFrameFormat)
+_FRAME_FIELD(pts, RK_S64)
+_FRAME_FIELD(eos, RK_U32)
+
+#undef _FRAME_FIELD
+
+MppBuffer mpp_frame_get_buffer(const MppFrame frame) {
+	return ((const _frame_s *)frame)->buf;
+}
+
+void mpp_frame_set_buffer(MppFrame frame, MppBuffer buf) {
+	_frame_s *const impl = frame;
+	if (impl->buf != buf) {
+		if (buf != NULL) {
+			mpp_buffer_inc_ref(buf);
+		}
+		if (impl->buf != NULL) {
+			mpp_buffer_put(impl->buf);
+		}
+		impl->buf = buf;
+	}
+}
+
+int mpp_frame_has_meta(const MppFrame frame) {
+	return (((const _frame_s *)frame)->meta != NULL);
+}
+
+MppMeta mpp_frame_get_meta(const MppFrame frame) {
+	return _meta_get(&((_frame_s *)frame)->meta);
+}
+
+
+MPP_RET mpp_packet_new(MppPacket *packet) {
+	if (packet == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if ((*packet = calloc(1, sizeof(_packet_s))) == NULL) {
+		return MPP_ERR_MALLOC;
+	}
+	return MPP_OK;
+}
+
+MPP_RET mpp_packet_init(MppPacket *packet, void *data, size_t size) {
+	const MPP_RET ret = mpp_packet_new(packet);
+	if (ret == MPP_OK) {
+		_packet_s *const impl = *packet;
+		impl->data = data;
+		impl->pos = data;
+		impl->size = size;
+		impl->length = size;
+	}
+	return ret;
+}
+
+MPP_RET mpp_packet_init_with_buffer(MppPacket *packet, MppBuffer buf) {
+	if (buf == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	const MPP_RET ret = mpp_packet_init(packet, mpp_buffer_get_ptr(buf), mpp_buffer_get_size(buf));
+	if (ret == MPP_OK) {
+		mpp_buffer_inc_ref(buf);
+		((_packet_s *)*packet)->buf = buf;
+	}
+	return ret;
+}
+
+MPP_RET mpp_packet_deinit(MppPacket *packet) {
+	if (packet == NULL || *packet == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	_packet_s *const impl = *packet;
+	if (impl->buf != NULL) {
+		mpp_buffer_put(impl->buf);
+	}
+	free(impl->meta);
+	free(impl);
+	*packet = NULL;
+	return MPP_OK;
+}
+
+#define _PACKET_FIELD(x_name, x_type) \
+	x_type mpp_packet_get_##x_name(const MppPacket packet) { \
+		return ((const _packet_s *)packet)->x_name; \
+	} \
+	void mpp_packet_set_##x_name(MppPacket packet, x_type x_name) { \
+		((_packet_s *)packet)->x_name = x_name; \
+	}
+
+_PACKET_FIELD(data, void *)
+_PACKET_FIELD(size, size_t)
+_PACKET_FIELD(pos, void *)
+_PACKET_FIELD(length, size_t)
+_PACKET_FIELD(pts, RK_S64)
+
+#undef _PACKET_FIELD
+
+MppBuffer mpp_packet_get_buffer(const MppPacket packet) {
+	return ((const _packet_s *)packet)->buf;
+}
+
+RK_U32 mpp_packet_get_eos(MppPacket packet) {
+	return ((const _packet_s *)packet)->eos;
+}
+
+MPP_RET mpp_packet_set_eos(MppPacket packet) {
+	((_packet_s *)packet)->eos = 1;
+	return MPP_OK;
+}
+
+MPP_RET mpp_packet_clr_eos(MppPacket packet) {
+	((_packet_s *)packet)->eos = 0;
+	return MPP_OK;
+}
+
+// Кадр всегда кодируется целиком, без разбиения на части
+RK_U32 mpp_packet_is_partition(UNUSED const MppPacket packet) {
+	return 0;
+}
+
+RK_U32 mpp_packet_is_soi(UNUSED const MppPacket packet) {
+	return 1;
+}
+
+RK_U32 mpp_packet_is_eoi(UNUSED const MppPacket packet) {
+	return 1;
+}
+
+RK_S32 mpp_packet_has_meta(const MppPacket packet) {
+	return (((const _packet_s *)packet)->meta != NULL);
+}
+
+MppMeta mpp_packet_get_meta(const MppPacket packet) {
+	return _meta_get(&((_packet_s *)packet)->meta);
+}
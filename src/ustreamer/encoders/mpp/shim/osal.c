@@ -0,0 +1,222 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sched.h>
+
+#include "rockchip/rk_type.h"
+#include "rockchip/mpp_err.h"
+#include "rockchip/mpp_log.h"
+
+#include "../mpp_env.h"
+#include "../mpp_mem.h"
+#include "../mpp_lock.h"
+#include "../mpp_time.h"
+#include "../mpp_trie.h"
+
+#include "../../../../libs/tools.h"
+#include "../../../../libs/logging.h"
+
+
+RK_U32 mpp_debug = 0;
+
+static int _log_level = MPP_LOG_INFO;
+
+
+void _mpp_log_l(int level, const char *tag, const char *fmt, const char *func, ...) {
+	if (level > _log_level) {
+		return;
+	}
+
+	char msg[1024];
+	va_list args;
+	va_start(args, func);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+
+	// Библиотечные сообщения заканчиваются переводом строки, а наш логгер добавляет свой
+	size_t len = strlen(msg);
+	while (len > 0 && (msg[len - 1] == '\n' || msg[len - 1] == '\r')) {
+		msg[--len] = '\0';
+	}
+
+	const char *const prefix = (tag != NULL ? tag : (func != NULL ? func : "mpp"));
+	if (level <= MPP_LOG_ERROR) {
+		US_LOG_ERROR("MPP-SHIM: %s: %s", prefix, msg);
+	} else if (level <= MPP_LOG_INFO) {
+		US_LOG_VERBOSE("MPP-SHIM: %s: %s", prefix, msg);
+	} else {
+		US_LOG_DEBUG("MPP-SHIM: %s: %s", prefix, msg);
+	}
+}
+
+void mpp_set_log_level(int level) {
+	_log_level = level;
+}
+
+int mpp_get_log_level(void) {
+	return _log_level;
+}
+
+RK_S32 mpp_env_get_u32(const char *name, RK_U32 *value, RK_U32 default_value) {
+	const char *const str = getenv(name);
+	if (str == NULL || str[0] == '\0') {
+		*value = default_value;
+		return 0;
+	}
+	char *end = NULL;
+	const unsigned long long parsed = strtoull(str, &end, 0);
+	*value = (*end == '\0' ? (RK_U32)parsed : default_value);
+	return 0;
+}
+
+RK_S32 mpp_env_get_str(const char *name, const char **value, const char *default_value) {
+	const char *const str = getenv(name);
+	*value = (str != NULL ? str : default_value);
+	return 0;
+}
+
+RK_S32 mpp_env_set_u32(const char *name, RK_U32 value) {
+	char buf[16];
+	snprintf(buf, sizeof(buf), "%u", value);
+	return setenv(name, buf, 1);
+}
+
+RK_S32 mpp_env_set_str(const char *name, char *value) {
+	return setenv(name, value, 1);
+}
+
+void *mpp_osal_malloc(UNUSED const char *caller, size_t size) {
+	return malloc(size);
+}
+
+void *mpp_osal_calloc(UNUSED const char *caller, size_t size) {
+	return calloc(1, size);
+}
+
+void *mpp_osal_realloc(UNUSED const char *caller, void *ptr, size_t size) {
+	return realloc(ptr, size);
+}
+
+void mpp_osal_free(UNUSED const char *caller, void *ptr) {
+	free(ptr);
+}
+
+RK_S64 mpp_time(void) {
+	return us_get_now_monotonic_u64() / 1000; // Микросекунды, как в MPP
+}
+
+void mpp_spinlock_init(spinlock_t *lock) {
+	MPP_SYNC_CLR(&lock->lock);
+}
+
+void mpp_spinlock_lock(spinlock_t *lock) {
+	while (MPP_SYNC_TEST_SET(&lock->lock, 1)) {
+		sched_yield();
+	}
+}
+
+void mpp_spinlock_unlock(spinlock_t *lock) {
+	MPP_SYNC_CLR(&lock->lock);
+}
+
+bool mpp_spinlock_trylock(spinlock_t *lock) {
+	return !MPP_SYNC_TEST_SET(&lock->lock, 1);
+}
+
+
+// Настоящий MPP строит здесь префиксное дерево, но опций у нас пара десятков,
+// поэтому линейного поиска по именам вполне достаточно.
+typedef struct {
+	RK_S32		node_count;
+	RK_S32		info_count;
+	RK_S32		n_infos;
+	const char	***infos;
+} _trie_s;
+
+MPP_RET mpp_trie_init(MppTrie *trie, RK_S32 node_count, RK_S32 info_count) {
+	_trie_s *impl = NULL;
+	if (info_count <= 0 || (impl = calloc(1, sizeof(_trie_s))) == NULL) {
+		*trie = NULL;
+		return MPP_NOK;
+	}
+	if ((impl->infos = calloc(info_count, sizeof(const char **))) == NULL) {
+		free(impl);
+		*trie = NULL;
+		return MPP_ERR_MALLOC;
+	}
+	impl->node_count = node_count;
+	impl->info_count = info_count;
+	*trie = impl;
+	return MPP_OK;
+}
+
+MPP_RET mpp_trie_deinit(MppTrie trie) {
+	_trie_s *const impl = trie;
+	if (impl == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	free(impl->infos);
+	free(impl);
+	return MPP_OK;
+}
+
+MPP_RET mpp_trie_add_info(MppTrie trie, const char **info) {
+	_trie_s *const impl = trie;
+	if (impl == NULL || info == NULL || *info == NULL) {
+		return MPP_ERR_NULL_PTR;
+	}
+	if (impl->n_infos >= impl->info_count) {
+		mpp_err_f("too many infos, max %d\n", impl->info_count);
+		return MPP_NOK;
+	}
+	impl->infos[impl->n_infos] = info;
+	++impl->n_infos;
+	return MPP_OK;
+}
+
+RK_S32 mpp_trie_get_node_count(MppTrie trie) {
+	const _trie_s *const impl = trie;
+	return (impl != NULL ? impl->node_count : 0);
+}
+
+RK_S32 mpp_trie_get_info_count(MppTrie trie) {
+	const _trie_s *const impl = trie;
+	return (impl != NULL ? impl->n_infos : 0);
+}
+
+const char **mpp_trie_get_info(MppTrie trie, const char *name) {
+	const _trie_s *const impl = trie;
+	if (impl == NULL || name == NULL) {
+		return NULL;
+	}
+	for (RK_S32 index = 0; index < impl->n_infos; ++index) {
+		if (!strcmp(*impl->infos[index], name)) {
+			return impl->infos[index];
+		}
+	}
+	return NULL;
+}
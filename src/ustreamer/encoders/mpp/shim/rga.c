@@ -0,0 +1,165 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "rga/rga.h"
+#include "rga/RgaApi.h"
+#include "rga/RgaUtils.h"
+
+#include "../../../../libs/tools.h"
+#include "../../../../libs/logging.h"
+
+
+static void _yuv_to_bgrx(const rga_rect_t *src_rect, const uint8_t *src, uint8_t *dest, unsigned dest_stride);
+
+
+int c_RkRgaInit(void) {
+	return 0;
+}
+
+void c_RkRgaDeInit(void) {
+}
+
+int rga_set_rect(rga_rect_t *rect, int x, int y, int w, int h, int sw, int sh, int f) {
+	if (rect == NULL) {
+		return -1;
+	}
+	rect->xoffset = x;
+	rect->yoffset = y;
+	rect->width = w;
+	rect->height = h;
+	rect->wstride = sw;
+	rect->hstride = sh;
+	rect->format = f;
+	return 0;
+}
+
+float get_bpp_from_format(int format) {
+	switch (format) {
+		case RK_FORMAT_RGBA_8888:
+		case RK_FORMAT_RGBX_8888:
+		case RK_FORMAT_BGRA_8888:
+		case RK_FORMAT_BGRX_8888: return 4;
+		case RK_FORMAT_RGB_888:
+		case RK_FORMAT_BGR_888: return 3;
+		case RK_FORMAT_RGB_565:
+		case RK_FORMAT_RGBA_5551:
+		case RK_FORMAT_RGBA_4444:
+		case RK_FORMAT_YCbCr_422_SP:
+		case RK_FORMAT_YCbCr_422_P:
+		case RK_FORMAT_YCrCb_422_SP:
+		case RK_FORMAT_YCrCb_422_P:
+		case RK_FORMAT_YUYV_422:
+		case RK_FORMAT_YVYU_422:
+		case RK_FORMAT_UYVY_422:
+		case RK_FORMAT_VYUY_422: return 2;
+		case RK_FORMAT_YCbCr_420_SP:
+		case RK_FORMAT_YCbCr_420_P:
+		case RK_FORMAT_YCrCb_420_SP:
+		case RK_FORMAT_YCrCb_420_P: return 1.5;
+		default: return 0;
+	}
+}
+
+int c_RkRgaBlit(rga_info_t *src, rga_info_t *dest, UNUSED rga_info_t *src1) {
+	if (src == NULL || dest == NULL || src->virAddr == NULL || dest->virAddr == NULL) {
+		return -1;
+	}
+	const rga_rect_t *const s_rect = &src->rect;
+	const rga_rect_t *const d_rect = &dest->rect;
+	if (s_rect->width != d_rect->width || s_rect->height != d_rect->height) {
+		US_LOG_ERROR("RGA-SHIM: Scaling is not supported: %dx%d -> %dx%d",
+			s_rect->width, s_rect->height, d_rect->width, d_rect->height);
+		return -1;
+	}
+	if (d_rect->format != RK_FORMAT_BGRX_8888) {
+		US_LOG_ERROR("RGA-SHIM: Unsupported destination format %d", d_rect->format);
+		return -1;
+	}
+
+	switch (s_rect->format) {
+		case RK_FORMAT_YUYV_422:
+		case RK_FORMAT_UYVY_422:
+		case RK_FORMAT_YCbCr_420_SP:
+		case RK_FORMAT_YCbCr_422_SP:
+			_yuv_to_bgrx(s_rect, src->virAddr, dest->virAddr, d_rect->wstride * 4);
+			return 0;
+		case RK_FORMAT_BGRX_8888:
+			for (int y = 0; y < s_rect->height; ++y) {
+				memcpy(
+					(uint8_t *)dest->virAddr + (size_t)d_rect->wstride * 4 * y,
+					(const uint8_t *)src->virAddr + (size_t)s_rect->wstride * 4 * y,
+					(size_t)s_rect->width * 4);
+			}
+			return 0;
+		default:
+			US_LOG_ERROR("RGA-SHIM: Unsupported source format %d", s_rect->format);
+			return -1;
+	}
+}
+
+static void _yuv_to_bgrx(const rga_rect_t *src_rect, const uint8_t *src, uint8_t *dest, unsigned dest_stride) {
+	// BT.601, ограниченный диапазон, целочисленно
+#	define CLAMP(x_value) ((x_value) < 0 ? 0 : ((x_value) > 255 ? 255 : (x_value)))
+
+	const unsigned width = src_rect->width;
+	const unsigned height = src_rect->height;
+	const int format = src_rect->format;
+	const bool packed = (format == RK_FORMAT_YUYV_422 || format == RK_FORMAT_UYVY_422);
+	const unsigned y_off = (format == RK_FORMAT_UYVY_422 ? 1 : 0);
+	const unsigned uv_off = 1 - y_off;
+	const unsigned src_stride = src_rect->wstride * (packed ? 2 : 1);
+	const uint8_t *const chroma = src + (size_t)src_rect->wstride * src_rect->hstride;
+
+	for (unsigned y = 0; y < height; ++y) {
+		const uint8_t *const line = src + (size_t)src_stride * y;
+		const uint8_t *const uv_line = (packed ? line : chroma + (size_t)src_stride * (format == RK_FORMAT_YCbCr_420_SP ? y / 2 : y));
+		uint8_t *out = dest + (size_t)dest_stride * y;
+
+		for (unsigned x = 0; x < width; ++x) {
+			int luma, u, v;
+			if (packed) {
+				const uint8_t *const pair = line + (x & ~1U) * 2;
+				luma = line[x * 2 + y_off];
+				u = pair[uv_off];
+				v = pair[uv_off + 2];
+			} else {
+				luma = line[x];
+				u = uv_line[x & ~1U];
+				v = uv_line[(x & ~1U) + 1];
+			}
+			const int c = (luma - 16) * 298;
+			const int d = u - 128;
+			const int e = v - 128;
+			out[0] = CLAMP((c + 516 * d + 128) >> 8);
+			out[1] = CLAMP((c - 100 * d - 208 * e + 128) >> 8);
+			out[2] = CLAMP((c + 409 * e + 128) >> 8);
+			out[3] = 0xFF;
+			out += 4;
+		}
+	}
+
+#	undef CLAMP
+}
@@ -0,0 +1,74 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+
+// Программная замена librga для сборки с WITH_MPP_SHIM (см. ../rga.c).
+// Поддерживается только то, что нужно для вывода на DRM: YUV -> BGRX без масштабирования.
+
+typedef enum {
+	RK_FORMAT_RGBA_8888,
+	RK_FORMAT_RGBX_8888,
+	RK_FORMAT_RGB_888,
+	RK_FORMAT_BGRA_8888,
+	RK_FORMAT_RGB_565,
+	RK_FORMAT_RGBA_5551,
+	RK_FORMAT_RGBA_4444,
+	RK_FORMAT_BGR_888,
+	RK_FORMAT_YCbCr_422_SP,
+	RK_FORMAT_YCbCr_422_P,
+	RK_FORMAT_YCbCr_420_SP,
+	RK_FORMAT_YCbCr_420_P,
+	RK_FORMAT_YCrCb_422_SP,
+	RK_FORMAT_YCrCb_422_P,
+	RK_FORMAT_YCrCb_420_SP,
+	RK_FORMAT_YCrCb_420_P,
+	RK_FORMAT_BGRX_8888,
+	RK_FORMAT_YUYV_422,
+	RK_FORMAT_YVYU_422,
+	RK_FORMAT_UYVY_422,
+	RK_FORMAT_VYUY_422,
+	RK_FORMAT_UNKNOWN,
+} RgaSURF_FORMAT;
+
+typedef struct {
+	int	xoffset;
+	int	yoffset;
+	int	width;
+	int	height;
+	int	wstride;
+	int	hstride;
+	int	format;
+	int	size;
+} rga_rect_t;
+
+typedef struct {
+	int			fd;
+	void		*virAddr;
+	void		*phyAddr;
+	unsigned	hnd;
+	int			format;
+	rga_rect_t	rect;
+	unsigned	rotation;
+	int			blend;
+} rga_info_t;
@@ -0,0 +1,73 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "rk_type.h"
+#include "mpp_err.h"
+
+
+#ifndef MODULE_TAG
+#	define MODULE_TAG NULL
+#endif
+
+
+typedef enum {
+	MPP_BUFFER_INTERNAL,
+	MPP_BUFFER_EXTERNAL,
+	MPP_BUFFER_MODE_BUTT,
+} MppBufferMode;
+
+typedef enum {
+	MPP_BUFFER_TYPE_NORMAL,
+	MPP_BUFFER_TYPE_ION,
+	MPP_BUFFER_TYPE_EXT_DMA,
+	MPP_BUFFER_TYPE_DRM,
+	MPP_BUFFER_TYPE_DMA_HEAP,
+	MPP_BUFFER_TYPE_BUTT,
+} MppBufferType;
+
+#define mpp_buffer_get(x_group, x_buf, x_size) \
+	mpp_buffer_get_with_tag(x_group, x_buf, x_size, MODULE_TAG, __FUNCTION__)
+#define mpp_buffer_put(x_buf)		mpp_buffer_put_with_caller(x_buf, __FUNCTION__)
+#define mpp_buffer_inc_ref(x_buf)	mpp_buffer_inc_ref_with_caller(x_buf, __FUNCTION__)
+#define mpp_buffer_get_ptr(x_buf)	mpp_buffer_get_ptr_with_caller(x_buf, __FUNCTION__)
+#define mpp_buffer_get_fd(x_buf)	mpp_buffer_get_fd_with_caller(x_buf, __FUNCTION__)
+#define mpp_buffer_get_size(x_buf)	mpp_buffer_get_size_with_caller(x_buf, __FUNCTION__)
+
+#define mpp_buffer_group_get_internal(x_group, x_type) \
+	mpp_buffer_group_get(x_group, x_type, MPP_BUFFER_INTERNAL, MODULE_TAG, __FUNCTION__)
+#define mpp_buffer_group_get_external(x_group, x_type) \
+	mpp_buffer_group_get(x_group, x_type, MPP_BUFFER_EXTERNAL, MODULE_TAG, __FUNCTION__)
+
+
+MPP_RET mpp_buffer_get_with_tag(MppBufferGroup group, MppBuffer *buf, size_t size, const char *tag, const char *caller);
+MPP_RET mpp_buffer_put_with_caller(MppBuffer buf, const char *caller);
+MPP_RET mpp_buffer_inc_ref_with_caller(MppBuffer buf, const char *caller);
+void *mpp_buffer_get_ptr_with_caller(MppBuffer buf, const char *caller);
+int mpp_buffer_get_fd_with_caller(MppBuffer buf, const char *caller);
+size_t mpp_buffer_get_size_with_caller(MppBuffer buf, const char *caller);
+
+MPP_RET mpp_buffer_group_get(
+	MppBufferGroup *group, MppBufferType type, MppBufferMode mode,
+	const char *tag, const char *caller);
+MPP_RET mpp_buffer_group_put(MppBufferGroup group);
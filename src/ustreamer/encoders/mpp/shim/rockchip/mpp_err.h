@@ -0,0 +1,52 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+
+typedef enum {
+	MPP_SUCCESS				= 0,
+	MPP_OK					= 0,
+	MPP_NOK					= -1,
+	MPP_ERR_UNKNOW			= -2,
+	MPP_ERR_NULL_PTR		= -3,
+	MPP_ERR_MALLOC			= -4,
+	MPP_ERR_OPEN_FILE		= -5,
+	MPP_ERR_VALUE			= -6,
+	MPP_ERR_READ_BIT		= -7,
+	MPP_ERR_TIMEOUT			= -8,
+	MPP_ERR_PERM			= -9,
+
+	MPP_ERR_BASE			= -1000,
+	MPP_ERR_LIST_STREAM		= MPP_ERR_BASE - 1,
+	MPP_ERR_INIT			= MPP_ERR_BASE - 2,
+	MPP_ERR_VPU_CODEC_INIT	= MPP_ERR_BASE - 3,
+	MPP_ERR_STREAM			= MPP_ERR_BASE - 4,
+	MPP_ERR_FATAL_THREAD	= MPP_ERR_BASE - 5,
+	MPP_ERR_NOMEM			= MPP_ERR_BASE - 6,
+	MPP_ERR_PROTOL			= MPP_ERR_BASE - 7,
+	MPP_FAIL_SPLIT_FRAME	= MPP_ERR_BASE - 8,
+	MPP_ERR_VPUHW			= MPP_ERR_BASE - 9,
+	MPP_EOS_STREAM_REACHED	= MPP_ERR_BASE - 11,
+	MPP_ERR_BUFFER_FULL		= MPP_ERR_BASE - 12,
+	MPP_ERR_DISPLAY_FULL	= MPP_ERR_BASE - 13,
+} MPP_RET;
@@ -0,0 +1,112 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "rk_type.h"
+#include "mpp_err.h"
+#include "mpp_buffer.h"
+
+
+#define MPP_FRAME_FMT_MASK			(0x000fffff)
+#define MPP_FRAME_FMT_PROP_MASK		(0x0ff00000)
+#define MPP_FRAME_FMT_COLOR_MASK	(0x000f0000)
+#define MPP_FRAME_FMT_YUV			(0x00000000)
+#define MPP_FRAME_FMT_RGB			(0x00010000)
+
+#define MPP_FRAME_FBC_MASK			(0x00f00000)
+#define MPP_FRAME_FBC_NONE			(0x00000000)
+#define MPP_FRAME_FBC_AFBC_V1		(0x00100000)
+#define MPP_FRAME_FBC_AFBC_V2		(0x00200000)
+
+#define MPP_FRAME_FMT_LE_MASK		(0x01000000)
+
+#define MPP_FRAME_FMT_IS_YUV(x_fmt) \
+	((((x_fmt) & MPP_FRAME_FMT_COLOR_MASK) == MPP_FRAME_FMT_YUV) && (((x_fmt) & MPP_FRAME_FMT_MASK) < MPP_FMT_YUV_BUTT))
+#define MPP_FRAME_FMT_IS_RGB(x_fmt) \
+	((((x_fmt) & MPP_FRAME_FMT_COLOR_MASK) == MPP_FRAME_FMT_RGB) && (((x_fmt) & MPP_FRAME_FMT_MASK) < MPP_FMT_RGB_BUTT))
+#define MPP_FRAME_FMT_IS_FBC(x_fmt)	((x_fmt) & MPP_FRAME_FBC_MASK)
+#define MPP_FRAME_FMT_IS_LE(x_fmt)	(((x_fmt) & MPP_FRAME_FMT_LE_MASK) == MPP_FRAME_FMT_LE_MASK)
+#define MPP_FRAME_FMT_IS_BE(x_fmt)	(((x_fmt) & MPP_FRAME_FMT_LE_MASK) == 0)
+
+typedef enum {
+	MPP_FMT_YUV420SP = MPP_FRAME_FMT_YUV,
+	MPP_FMT_YUV420SP_10BIT,
+	MPP_FMT_YUV422SP,
+	MPP_FMT_YUV422SP_10BIT,
+	MPP_FMT_YUV420P,
+	MPP_FMT_YUV420SP_VU,
+	MPP_FMT_YUV422P,
+	MPP_FMT_YUV422SP_VU,
+	MPP_FMT_YUV422_YUYV,
+	MPP_FMT_YUV422_YVYU,
+	MPP_FMT_YUV422_UYVY,
+	MPP_FMT_YUV422_VYUY,
+	MPP_FMT_YUV400,
+	MPP_FMT_YUV440SP,
+	MPP_FMT_YUV411SP,
+	MPP_FMT_YUV444SP,
+	MPP_FMT_YUV444P,
+	MPP_FMT_YUV_BUTT,
+
+	MPP_FMT_RGB565 = MPP_FRAME_FMT_RGB,
+	MPP_FMT_BGR565,
+	MPP_FMT_RGB555,
+	MPP_FMT_BGR555,
+	MPP_FMT_RGB444,
+	MPP_FMT_BGR444,
+	MPP_FMT_RGB888,
+	MPP_FMT_BGR888,
+	MPP_FMT_RGB101010,
+	MPP_FMT_BGR101010,
+	MPP_FMT_ARGB8888,
+	MPP_FMT_ABGR8888,
+	MPP_FMT_BGRA8888,
+	MPP_FMT_RGBA8888,
+	MPP_FMT_RGB_BUTT,
+
+	MPP_FMT_BUTT,
+} MppFrameFormat;
+
+
+MPP_RET mpp_frame_init(MppFrame *frame);
+MPP_RET mpp_frame_deinit(MppFrame *frame);
+
+RK_U32 mpp_frame_get_width(const MppFrame frame);
+void mpp_frame_set_width(MppFrame frame, RK_U32 width);
+RK_U32 mpp_frame_get_height(const MppFrame frame);
+void mpp_frame_set_height(MppFrame frame, RK_U32 height);
+RK_U32 mpp_frame_get_hor_stride(const MppFrame frame);
+void mpp_frame_set_hor_stride(MppFrame frame, RK_U32 hor_stride);
+RK_U32 mpp_frame_get_ver_stride(const MppFrame frame);
+void mpp_frame_set_ver_stride(MppFrame frame, RK_U32 ver_stride);
+MppFrameFormat mpp_frame_get_fmt(MppFrame frame);
+void mpp_frame_set_fmt(MppFrame frame, MppFrameFormat fmt);
+RK_S64 mpp_frame_get_pts(const MppFrame frame);
+void mpp_frame_set_pts(MppFrame frame, RK_S64 pts);
+RK_U32 mpp_frame_get_eos(const MppFrame frame);
+void mpp_frame_set_eos(MppFrame frame, RK_U32 eos);
+MppBuffer mpp_frame_get_buffer(const MppFrame frame);
+void mpp_frame_set_buffer(MppFrame frame, MppBuffer buf);
+
+int mpp_frame_has_meta(const MppFrame frame);
+MppMeta mpp_frame_get_meta(const MppFrame frame);
@@ -0,0 +1,60 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "rk_type.h"
+
+
+#define MPP_LOG_UNKNOWN		0
+#define MPP_LOG_FATAL		1
+#define MPP_LOG_ERROR		2
+#define MPP_LOG_WARN		3
+#define MPP_LOG_INFO		4
+#define MPP_LOG_DEBUG		5
+#define MPP_LOG_VERBOSE		6
+#define MPP_LOG_SILENT		7
+
+#ifndef MODULE_TAG
+#	define MODULE_TAG NULL
+#endif
+
+#define mpp_logf(fmt, ...)	_mpp_log_l(MPP_LOG_FATAL, MODULE_TAG, fmt, NULL, ##__VA_ARGS__)
+#define mpp_loge(fmt, ...)	_mpp_log_l(MPP_LOG_ERROR, MODULE_TAG, fmt, NULL, ##__VA_ARGS__)
+#define mpp_logw(fmt, ...)	_mpp_log_l(MPP_LOG_WARN, MODULE_TAG, fmt, NULL, ##__VA_ARGS__)
+#define mpp_logi(fmt, ...)	_mpp_log_l(MPP_LOG_INFO, MODULE_TAG, fmt, NULL, ##__VA_ARGS__)
+#define mpp_logd(fmt, ...)	_mpp_log_l(MPP_LOG_DEBUG, MODULE_TAG, fmt, NULL, ##__VA_ARGS__)
+#define mpp_logv(fmt, ...)	_mpp_log_l(MPP_LOG_VERBOSE, MODULE_TAG, fmt, NULL, ##__VA_ARGS__)
+
+#define mpp_log(fmt, ...)	mpp_logi(fmt, ##__VA_ARGS__)
+#define mpp_err(fmt, ...)	mpp_loge(fmt, ##__VA_ARGS__)
+#define mpp_log_f(fmt, ...)	_mpp_log_l(MPP_LOG_INFO, MODULE_TAG, fmt, __FUNCTION__, ##__VA_ARGS__)
+#define mpp_err_f(fmt, ...)	_mpp_log_l(MPP_LOG_ERROR, MODULE_TAG, fmt, __FUNCTION__, ##__VA_ARGS__)
+
+#define mpp_log_c(cond, fmt, ...)	do { if (cond) { mpp_log(fmt, ##__VA_ARGS__); } } while (0)
+#define mpp_log_cf(cond, fmt, ...)	do { if (cond) { mpp_log_f(fmt, ##__VA_ARGS__); } } while (0)
+
+
+void _mpp_log_l(int level, const char *tag, const char *fmt, const char *func, ...);
+
+void mpp_set_log_level(int level);
+int mpp_get_log_level(void);
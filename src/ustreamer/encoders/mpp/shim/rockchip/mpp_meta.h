@@ -0,0 +1,72 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "rk_type.h"
+#include "mpp_err.h"
+#include "mpp_frame.h"
+#include "mpp_packet.h"
+
+
+typedef enum {
+	// frame -> packet
+	KEY_INPUT_FRAME,
+	KEY_OUTPUT_FRAME,
+	KEY_INPUT_PACKET,
+	KEY_OUTPUT_PACKET,
+	KEY_MOTION_INFO,
+	KEY_HDR_INFO,
+
+	// flags
+	KEY_OUTPUT_INTRA,
+	KEY_INPUT_BLOCK,
+	KEY_OUTPUT_BLOCK,
+	KEY_INPUT_IDR_REQ,
+
+	// encoder side
+	KEY_TEMPORAL_ID,
+	KEY_LONG_REF_IDX,
+	KEY_ENC_AVERAGE_QP,
+	KEY_ROI_DATA,
+	KEY_OSD_DATA,
+	KEY_OSD_PLT,
+	KEY_USER_DATA,
+	KEY_USER_DATAS,
+
+	KEY_BUTT,
+} MppMetaKey;
+
+
+MPP_RET mpp_meta_set_s32(MppMeta meta, MppMetaKey key, RK_S32 val);
+MPP_RET mpp_meta_set_s64(MppMeta meta, MppMetaKey key, RK_S64 val);
+MPP_RET mpp_meta_set_ptr(MppMeta meta, MppMetaKey key, void *val);
+MPP_RET mpp_meta_set_frame(MppMeta meta, MppMetaKey key, MppFrame frame);
+MPP_RET mpp_meta_set_packet(MppMeta meta, MppMetaKey key, MppPacket packet);
+MPP_RET mpp_meta_set_buffer(MppMeta meta, MppMetaKey key, MppBuffer buf);
+
+MPP_RET mpp_meta_get_s32(MppMeta meta, MppMetaKey key, RK_S32 *val);
+MPP_RET mpp_meta_get_s64(MppMeta meta, MppMetaKey key, RK_S64 *val);
+MPP_RET mpp_meta_get_ptr(MppMeta meta, MppMetaKey key, void **val);
+MPP_RET mpp_meta_get_frame(MppMeta meta, MppMetaKey key, MppFrame *frame);
+MPP_RET mpp_meta_get_packet(MppMeta meta, MppMetaKey key, MppPacket *packet);
+MPP_RET mpp_meta_get_buffer(MppMeta meta, MppMetaKey key, MppBuffer *buf);
@@ -0,0 +1,56 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "rk_type.h"
+#include "mpp_err.h"
+#include "mpp_buffer.h"
+
+
+MPP_RET mpp_packet_new(MppPacket *packet);
+MPP_RET mpp_packet_init(MppPacket *packet, void *data, size_t size);
+MPP_RET mpp_packet_init_with_buffer(MppPacket *packet, MppBuffer buf);
+MPP_RET mpp_packet_deinit(MppPacket *packet);
+
+void *mpp_packet_get_data(const MppPacket packet);
+void mpp_packet_set_data(MppPacket packet, void *data);
+size_t mpp_packet_get_size(const MppPacket packet);
+void mpp_packet_set_size(MppPacket packet, size_t size);
+void *mpp_packet_get_pos(const MppPacket packet);
+void mpp_packet_set_pos(MppPacket packet, void *pos);
+size_t mpp_packet_get_length(const MppPacket packet);
+void mpp_packet_set_length(MppPacket packet, size_t size);
+RK_S64 mpp_packet_get_pts(const MppPacket packet);
+void mpp_packet_set_pts(MppPacket packet, RK_S64 pts);
+MppBuffer mpp_packet_get_buffer(const MppPacket packet);
+
+RK_U32 mpp_packet_get_eos(MppPacket packet);
+MPP_RET mpp_packet_set_eos(MppPacket packet);
+MPP_RET mpp_packet_clr_eos(MppPacket packet);
+
+RK_U32 mpp_packet_is_partition(const MppPacket packet);
+RK_U32 mpp_packet_is_soi(const MppPacket packet);
+RK_U32 mpp_packet_is_eoi(const MppPacket packet);
+
+RK_S32 mpp_packet_has_meta(const MppPacket packet);
+MppMeta mpp_packet_get_meta(const MppPacket packet);
@@ -0,0 +1,80 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "rk_type.h"
+#include "mpp_err.h"
+#include "mpp_buffer.h"
+#include "mpp_frame.h"
+#include "mpp_packet.h"
+#include "mpp_meta.h"
+#include "rk_mpi_cmd.h"
+
+
+typedef enum {
+	MPP_PORT_INPUT,
+	MPP_PORT_OUTPUT,
+	MPP_PORT_BUTT,
+} MppPortType;
+
+typedef enum {
+	MPP_POLL_BUTT		= -2,
+	MPP_POLL_BLOCK		= -1,
+	MPP_POLL_NON_BLOCK	= 0,
+	MPP_POLL_MAX		= 8000,
+} MppPollType;
+
+typedef struct MppApi_t {
+	RK_U32	size;
+	RK_U32	version;
+
+	MPP_RET (*decode)(MppCtx ctx, MppPacket packet, MppFrame *frame);
+	MPP_RET (*decode_put_packet)(MppCtx ctx, MppPacket packet);
+	MPP_RET (*decode_get_frame)(MppCtx ctx, MppFrame *frame);
+
+	MPP_RET (*encode)(MppCtx ctx, MppFrame frame, MppPacket *packet);
+	MPP_RET (*encode_put_frame)(MppCtx ctx, MppFrame frame);
+	MPP_RET (*encode_get_packet)(MppCtx ctx, MppPacket *packet);
+
+	MPP_RET (*isp)(MppCtx ctx, MppFrame dst, MppFrame src);
+	MPP_RET (*isp_put_frame)(MppCtx ctx, MppFrame frame);
+	MPP_RET (*isp_get_frame)(MppCtx ctx, MppFrame *frame);
+
+	MPP_RET (*poll)(MppCtx ctx, MppPortType type, MppPollType timeout);
+	MPP_RET (*dequeue)(MppCtx ctx, MppPortType type, MppTask *task);
+	MPP_RET (*enqueue)(MppCtx ctx, MppPortType type, MppTask task);
+
+	MPP_RET (*reset)(MppCtx ctx);
+	MPP_RET (*control)(MppCtx ctx, MpiCmd cmd, MppParam param);
+
+	RK_U32	reserv[16];
+} MppApi;
+
+
+MPP_RET mpp_create(MppCtx *ctx, MppApi **mpi);
+MPP_RET mpp_init(MppCtx ctx, MppCtxType type, MppCodingType coding);
+MPP_RET mpp_destroy(MppCtx ctx);
+
+MPP_RET mpp_check_support_format(MppCtxType type, MppCodingType coding);
+void mpp_show_support_format(void);
+void mpp_show_color_format(void);
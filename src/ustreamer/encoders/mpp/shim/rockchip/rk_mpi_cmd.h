@@ -0,0 +1,52 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+
+typedef enum {
+	MPP_SET_INPUT_BLOCK,
+	MPP_SET_INPUT_TIMEOUT,
+	MPP_SET_OUTPUT_BLOCK,
+	MPP_SET_OUTPUT_TIMEOUT,
+
+	MPP_ENC_SET_CFG,
+	MPP_ENC_GET_CFG,
+	MPP_ENC_SET_PREP_CFG,
+	MPP_ENC_GET_PREP_CFG,
+	MPP_ENC_SET_RC_CFG,
+	MPP_ENC_GET_RC_CFG,
+	MPP_ENC_SET_CODEC_CFG,
+	MPP_ENC_GET_CODEC_CFG,
+	MPP_ENC_SET_IDR_FRAME,
+	MPP_ENC_SET_OSD_PLT_CFG,
+	MPP_ENC_SET_OSD_DATA_CFG,
+	MPP_ENC_SET_ROI_CFG,
+	MPP_ENC_SET_SEI_CFG,
+	MPP_ENC_GET_HDR_SYNC,
+	MPP_ENC_GET_EXTRA_INFO,
+	MPP_ENC_SET_HEADER_MODE,
+	MPP_ENC_SET_SPLIT,
+	MPP_ENC_SET_REF_CFG,
+
+	MPI_CMD_BUTT,
+} MpiCmd;
@@ -0,0 +1,76 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Программная замена заголовков Rockchip MPP для сборки с WITH_MPP_SHIM:
+// только то подмножество API, которое использует uStreamer. Значения констант
+// не совпадают с настоящей librockchip_mpp, смешивать их с ней нельзя.
+
+
+typedef uint8_t		RK_U8;
+typedef uint16_t	RK_U16;
+typedef uint32_t	RK_U32;
+typedef unsigned long long	RK_U64;
+typedef unsigned long	RK_ULONG;
+typedef int8_t		RK_S8;
+typedef int16_t		RK_S16;
+typedef int32_t		RK_S32;
+typedef signed long long	RK_S64;
+typedef long		RK_LONG;
+typedef float		RK_FLOAT;
+typedef double		RK_DOUBLE;
+
+typedef void *MppCtx;
+typedef void *MppParam;
+typedef void *MppFrame;
+typedef void *MppPacket;
+typedef void *MppBuffer;
+typedef void *MppBufferGroup;
+typedef void *MppMeta;
+typedef void *MppTask;
+
+typedef enum {
+	MPP_CTX_DEC,
+	MPP_CTX_ENC,
+	MPP_CTX_ISP,
+	MPP_CTX_BUTT,
+} MppCtxType;
+
+typedef enum {
+	MPP_VIDEO_CodingUnused,
+	MPP_VIDEO_CodingAutoDetect,
+	MPP_VIDEO_CodingMPEG2,
+	MPP_VIDEO_CodingH263,
+	MPP_VIDEO_CodingMPEG4,
+	MPP_VIDEO_CodingWMV,
+	MPP_VIDEO_CodingRV,
+	MPP_VIDEO_CodingAVC,
+	MPP_VIDEO_CodingMJPEG,
+	MPP_VIDEO_CodingVP8,
+	MPP_VIDEO_CodingVP9,
+	MPP_VIDEO_CodingHEVC = 0x1000004,
+} MppCodingType;
@@ -0,0 +1,172 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "rk_type.h"
+#include "mpp_frame.h"
+#include "rk_venc_cfg.h"
+#include "rk_venc_ref.h"
+
+
+typedef enum {
+	MPP_ENC_RC_MODE_VBR,
+	MPP_ENC_RC_MODE_CBR,
+	MPP_ENC_RC_MODE_FIXQP,
+	MPP_ENC_RC_MODE_AVBR,
+	MPP_ENC_RC_MODE_BUTT,
+} MppEncRcMode;
+
+typedef enum {
+	MPP_ENC_RC_DROP_FRM_DISABLED,
+	MPP_ENC_RC_DROP_FRM_NORMAL,
+	MPP_ENC_RC_DROP_FRM_PSKIP,
+	MPP_ENC_RC_DROP_FRM_BUTT,
+} MppEncRcDropFrmMode;
+
+typedef enum {
+	MPP_ENC_SEI_MODE_DISABLE,
+	MPP_ENC_SEI_MODE_ONE_SEQ,
+	MPP_ENC_SEI_MODE_ONE_FRAME,
+} MppEncSeiMode;
+
+typedef enum {
+	MPP_ENC_HEADER_MODE_DEFAULT,
+	MPP_ENC_HEADER_MODE_EACH_IDR,
+	MPP_ENC_HEADER_MODE_BUTT,
+} MppEncHeaderMode;
+
+typedef enum {
+	MPP_ENC_SPLIT_NONE,
+	MPP_ENC_SPLIT_BY_BYTE,
+	MPP_ENC_SPLIT_BY_CTU,
+} MppEncSplitMode;
+
+typedef struct {
+	RK_U32			change;
+	RK_S32			width;
+	RK_S32			height;
+	RK_S32			hor_stride;
+	RK_S32			ver_stride;
+	MppFrameFormat	format;
+	RK_S32			rotation;
+	RK_S32			mirroring;
+	RK_S32			flip;
+} MppEncPrepCfg;
+
+typedef struct {
+	RK_U32			change;
+	MppEncRcMode	rc_mode;
+	RK_S32			bps_target;
+	RK_S32			bps_max;
+	RK_S32			bps_min;
+	RK_S32			fps_in_num;
+	RK_S32			fps_in_denorm;
+	RK_S32			fps_out_num;
+	RK_S32			fps_out_denorm;
+	RK_S32			gop;
+} MppEncRcCfg;
+
+typedef struct {
+	RK_U32			change;
+	MppCodingType	coding;
+} MppEncCodecCfg;
+
+typedef struct {
+	RK_U32			change;
+	MppEncSplitMode	split_mode;
+	RK_U32			split_arg;
+} MppEncSliceSplit;
+
+typedef enum {
+	MPP_ENC_OSD_PLT_TYPE_DEFAULT,
+	MPP_ENC_OSD_PLT_TYPE_USERDEF,
+	MPP_ENC_OSD_PLT_TYPE_BUTT,
+} MppEncOSDPltType;
+
+// Цвета палитры OSD: (alpha << 24) | (V << 16) | (U << 8) | Y
+#define MPP_ENC_OSD_PLT_WHITE	((RK_U32)0xff8080eb)
+#define MPP_ENC_OSD_PLT_YELLOW	((RK_U32)0xff9210d2)
+#define MPP_ENC_OSD_PLT_CYAN	((RK_U32)0xff10a6aa)
+#define MPP_ENC_OSD_PLT_GREEN	((RK_U32)0xff223691)
+#define MPP_ENC_OSD_PLT_TRANS	((RK_U32)0x00deca6a)
+#define MPP_ENC_OSD_PLT_RED		((RK_U32)0xfff05a51)
+#define MPP_ENC_OSD_PLT_BLUE	((RK_U32)0xff6ef029)
+#define MPP_ENC_OSD_PLT_BLACK	((RK_U32)0xff808010)
+
+typedef union {
+	struct {
+		RK_U32	v : 8;
+		RK_U32	u : 8;
+		RK_U32	y : 8;
+		RK_U32	alpha : 8;
+	};
+	RK_U32	val;
+} MppEncOSDPltVal;
+
+typedef struct {
+	MppEncOSDPltVal	data[256];
+} MppEncOSDPlt;
+
+typedef struct {
+	RK_U32				change;
+	MppEncOSDPltType	type;
+	MppEncOSDPlt		*plt;
+} MppEncOSDPltCfg;
+
+typedef struct {
+	RK_U32	enable;
+	RK_U32	inverse;
+	RK_U32	start_mb_x;
+	RK_U32	start_mb_y;
+	RK_U32	num_mb_x;
+	RK_U32	num_mb_y;
+	RK_U32	buf_offset;
+} MppEncOSDRegion;
+
+typedef struct {
+	MppBuffer		buf;
+	RK_U32			num_region;
+	MppEncOSDRegion	region[8];
+} MppEncOSDData;
+
+typedef struct {
+	RK_U16	x;
+	RK_U16	y;
+	RK_U16	w;
+	RK_U16	h;
+	RK_U16	intra;
+	RK_U16	quality;
+	RK_U16	qp_area_idx;
+	RK_U8	area_map_en;
+	RK_U8	abs_qp_en;
+} MppEncROIRegion;
+
+typedef struct {
+	RK_U32			number;
+	MppEncROIRegion	*regions;
+} MppEncROICfg;
+
+typedef struct {
+	RK_U32	len;
+	void	*pdata;
+} MppEncUserData;
@@ -0,0 +1,68 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include "rk_type.h"
+#include "mpp_err.h"
+
+
+typedef void *MppEncRefCfg;
+
+typedef enum {
+	REF_TO_PREV_REF_FRM,
+	REF_TO_PREV_ST_REF,
+	REF_TO_PREV_LT_REF,
+	REF_TO_PREV_INTRA,
+	REF_TO_TEMPORAL_LAYER,
+	REF_TO_LT_REF_IDX,
+	REF_TO_ST_PREV_N_REF,
+	REF_MODE_BUTT,
+} MppEncRefMode;
+
+typedef struct {
+	RK_S32			lt_idx;
+	RK_S32			temporal_id;
+	MppEncRefMode	ref_mode;
+	RK_S32			ref_arg;
+	RK_S32			lt_gap;
+	RK_S32			lt_delay;
+} MppEncRefLtFrmCfg;
+
+typedef struct {
+	RK_S32			is_non_ref;
+	RK_S32			temporal_id;
+	MppEncRefMode	ref_mode;
+	RK_S32			ref_arg;
+	RK_S32			repeat;
+} MppEncRefStFrmCfg;
+
+
+MPP_RET mpp_enc_ref_cfg_init(MppEncRefCfg *ref);
+MPP_RET mpp_enc_ref_cfg_deinit(MppEncRefCfg *ref);
+
+MPP_RET mpp_enc_ref_cfg_reset(MppEncRefCfg ref);
+MPP_RET mpp_enc_ref_cfg_set_cfg_cnt(MppEncRefCfg ref, RK_S32 lt_cnt, RK_S32 st_cnt);
+MPP_RET mpp_enc_ref_cfg_add_lt_cfg(MppEncRefCfg ref, RK_S32 cnt, MppEncRefLtFrmCfg *frm);
+MPP_RET mpp_enc_ref_cfg_add_st_cfg(MppEncRefCfg ref, RK_S32 cnt, MppEncRefStFrmCfg *frm);
+MPP_RET mpp_enc_ref_cfg_check(MppEncRefCfg ref);
+MPP_RET mpp_enc_ref_cfg_set_keep_cpb(MppEncRefCfg ref, RK_S32 keep);
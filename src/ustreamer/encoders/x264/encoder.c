@@ -0,0 +1,322 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#include "encoder.h"
+
+
+static int _x264_encoder_prepare(us_x264_encoder_s *enc, const us_frame_s *frame);
+static void _x264_encoder_cleanup(us_x264_encoder_s *enc);
+static void _x264_encoder_set_rc(const us_x264_encoder_s *enc, x264_param_t *param);
+
+static int _x264_encoder_import(us_x264_encoder_s *enc, const us_frame_s *frame);
+static void _import_yuyv(const us_frame_s *frame, x264_image_t *img);
+static void _import_semiplanar(const us_frame_s *frame, x264_image_t *img);
+static void _import_rgb(const us_frame_s *frame, x264_image_t *img);
+
+
+#define _RUN(x_next) enc->run->x_next
+
+
+us_x264_encoder_s *us_x264_encoder_init(unsigned bitrate, unsigned gop) {
+	US_LOG_INFO("X264: Initializing encoder: bitrate=%uKbps, gop=%u ...", bitrate, gop);
+
+	us_x264_encoder_runtime_s *run;
+	US_CALLOC(run, 1);
+	run->last_online = -1;
+
+	us_x264_encoder_s *enc;
+	US_CALLOC(enc, 1);
+	enc->bitrate = bitrate;
+	enc->gop = gop;
+	enc->cbr = true;
+	enc->run = run;
+	return enc;
+}
+
+void us_x264_encoder_destroy(us_x264_encoder_s *enc) {
+	US_LOG_INFO("X264: Destroying encoder ...");
+	_x264_encoder_cleanup(enc);
+	free(enc->run);
+	free(enc);
+}
+
+int us_x264_encoder_set_params(us_x264_encoder_s *enc, unsigned bitrate, unsigned gop, unsigned min_qp, unsigned max_qp, bool cbr) {
+	const bool qp_changed = (enc->min_qp != min_qp || enc->max_qp != max_qp);
+	enc->bitrate = bitrate;
+	enc->gop = gop;
+	enc->min_qp = min_qp;
+	enc->max_qp = max_qp;
+	enc->cbr = cbr;
+
+	if (_RUN(x264) == NULL) {
+		return 0; // Применится при создании энкодера
+	}
+	if (qp_changed) {
+		// Границы QP x264_encoder_reconfig() не меняет, придется открыть энкодер заново на следующем кадре
+		US_LOG_INFO("X264: QP bounds have changed, the encoder will be reopened");
+		_x264_encoder_cleanup(enc);
+		return 0;
+	}
+
+	x264_param_t param;
+	x264_encoder_parameters(_RUN(x264), &param);
+	_x264_encoder_set_rc(enc, &param);
+	if (x264_encoder_reconfig(_RUN(x264), &param) < 0) {
+		US_LOG_ERROR("X264: Can't reconfigure the encoder");
+		return -1;
+	}
+	return 0;
+}
+
+int us_x264_encoder_compress(us_x264_encoder_s *enc, const us_frame_s *src, us_frame_s *dest, bool force_key) {
+	if (_RUN(x264) == NULL || _RUN(width) != src->width || _RUN(height) != src->height) {
+		// Энкодер создается под геометрию первого кадра и пересоздается при ее смене
+		if (_x264_encoder_prepare(enc, src) < 0) {
+			return -1;
+		}
+	}
+
+	us_frame_encoding_begin(src, dest, V4L2_PIX_FMT_H264);
+	force_key = (force_key || _RUN(last_online) != src->online);
+	US_LOG_DEBUG("X264: Compressing new frame; force_key=%d ...", force_key);
+
+	if (_x264_encoder_import(enc, src) < 0) {
+		return -1;
+	}
+	_RUN(pic.i_type) = (force_key ? X264_TYPE_IDR : X264_TYPE_AUTO);
+	_RUN(pic.i_pts) = _RUN(pts);
+	_RUN(pts) += 1;
+
+	x264_nal_t *nals;
+	int n_nals;
+	x264_picture_t pic_out;
+	const int size = x264_encoder_encode(_RUN(x264), &nals, &n_nals, &_RUN(pic), &pic_out);
+	if (size < 0) {
+		US_LOG_ERROR("X264: Can't encode the frame");
+		return -1;
+	}
+	if (size == 0) {
+		// С zerolatency задержки быть не должно, но кадр мог уйти в lookahead
+		US_LOG_VERBOSE("X264: The encoder has buffered the frame");
+		return -1;
+	}
+
+	// NAL-юниты x264 лежат подряд в одном буфере, Annex B
+	us_frame_set_data(dest, nals[0].p_payload, size);
+	dest->key = pic_out.b_keyframe;
+	dest->gop = enc->gop;
+	us_frame_encoding_end(dest);
+
+	US_LOG_VERBOSE("X264: Compressed new frame: size=%zu, time=%0.3Lf, force_key=%d",
+		dest->used, dest->encode_end_ts - dest->encode_begin_ts, force_key);
+
+	_RUN(last_online) = src->online;
+	return 0;
+}
+
+static int _x264_encoder_prepare(us_x264_encoder_s *enc, const us_frame_s *frame) {
+	_x264_encoder_cleanup(enc);
+
+	US_LOG_INFO("X264: Configuring encoder: %ux%u ...", frame->width, frame->height);
+
+	x264_param_t param;
+	if (x264_param_default_preset(&param, "ultrafast", "zerolatency") < 0) {
+		US_LOG_ERROR("X264: Can't apply the preset");
+		return -1;
+	}
+	param.i_log_level = X264_LOG_WARNING;
+	param.i_csp = X264_CSP_I420;
+	param.i_width = frame->width;
+	param.i_height = frame->height;
+	param.i_fps_num = 30; // Как и у MPP/M2M, реальный FPS определяется захватом
+	param.i_fps_den = 1;
+	param.b_vfr_input = 0;
+	param.b_repeat_headers = 1; // SPS/PPS перед каждым ключевым кадром, как у MPP
+	param.b_annexb = 1;
+	param.rc.i_rc_method = X264_RC_ABR;
+	_x264_encoder_set_rc(enc, &param);
+	if (enc->min_qp > 0) {
+		param.rc.i_qp_min = enc->min_qp;
+	}
+	if (enc->max_qp > 0) {
+		param.rc.i_qp_max = enc->max_qp;
+	}
+	if (x264_param_apply_profile(&param, "baseline") < 0) { // Для WebRTC
+		US_LOG_ERROR("X264: Can't apply the baseline profile");
+		return -1;
+	}
+
+	if ((_RUN(x264) = x264_encoder_open(&param)) == NULL) {
+		US_LOG_ERROR("X264: Can't open the encoder");
+		return -1;
+	}
+	if (x264_picture_alloc(&_RUN(pic), X264_CSP_I420, frame->width, frame->height) < 0) {
+		US_LOG_ERROR("X264: Can't allocate the picture");
+		_x264_encoder_cleanup(enc);
+		return -1;
+	}
+	_RUN(has_pic) = true;
+	_RUN(width) = frame->width;
+	_RUN(height) = frame->height;
+	_RUN(pts) = 0;
+	_RUN(last_online) = -1; // Первый кадр будет ключевым
+	return 0;
+}
+
+static void _x264_encoder_set_rc(const us_x264_encoder_s *enc, x264_param_t *param) {
+	// Только то, что x264_encoder_reconfig() умеет менять на лету
+	param->i_keyint_max = (enc->gop > 0 ? (int)enc->gop : X264_KEYINT_MAX_INFINITE);
+	param->rc.i_bitrate = enc->bitrate;
+	param->rc.i_vbv_max_bitrate = (enc->cbr ? enc->bitrate : enc->bitrate * 2);
+	param->rc.i_vbv_buffer_size = enc->bitrate;
+}
+
+static void _x264_encoder_cleanup(us_x264_encoder_s *enc) {
+	if (_RUN(has_pic)) {
+		x264_picture_clean(&_RUN(pic));
+		_RUN(has_pic) = false;
+	}
+	if (_RUN(x264) != NULL) {
+		x264_encoder_close(_RUN(x264));
+		_RUN(x264) = NULL;
+	}
+}
+
+static int _x264_encoder_import(us_x264_encoder_s *enc, const us_frame_s *frame) {
+	// Браузеры умеют только 4:2:0, поэтому все приводится к I420 здесь, а не внутри x264
+	x264_image_t *const img = &_RUN(pic.img);
+	switch (frame->format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_UYVY: _import_yuyv(frame, img); break;
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV24: _import_semiplanar(frame, img); break;
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_RGB565: _import_rgb(frame, img); break;
+		default:
+			US_LOG_ERROR("X264: Unsupported input format");
+			return -1;
+	}
+	return 0;
+}
+
+static void _import_yuyv(const us_frame_s *frame, x264_image_t *img) {
+	const unsigned y_offset = (frame->format == V4L2_PIX_FMT_YUYV ? 0 : 1);
+	const unsigned u_offset = (frame->format == V4L2_PIX_FMT_YUYV ? 1 : 0);
+	const size_t line = frame->width * 2 + us_frame_get_padding(frame);
+
+	for (unsigned y = 0; y < frame->height; ++y) {
+		const uint8_t *const src = frame->data + line * y;
+		uint8_t *const luma = img->plane[0] + (size_t)img->i_stride[0] * y;
+		for (unsigned x = 0; x < frame->width; ++x) {
+			luma[x] = src[x * 2 + y_offset];
+		}
+	}
+	for (unsigned y = 0; y < frame->height / 2; ++y) {
+		const uint8_t *const a = frame->data + line * y * 2;
+		const uint8_t *const b = a + line;
+		uint8_t *const u = img->plane[1] + (size_t)img->i_stride[1] * y;
+		uint8_t *const v = img->plane[2] + (size_t)img->i_stride[2] * y;
+		for (unsigned x = 0; x < frame->width / 2; ++x) {
+			u[x] = (a[x * 4 + u_offset] + b[x * 4 + u_offset] + 1) >> 1;
+			v[x] = (a[x * 4 + u_offset + 2] + b[x * 4 + u_offset + 2] + 1) >> 1;
+		}
+	}
+}
+
+static void _import_semiplanar(const us_frame_s *frame, x264_image_t *img) {
+	unsigned y_stride;
+	unsigned c_stride;
+	const uint8_t *const luma = us_frame_get_plane(frame, 0, &y_stride);
+	const uint8_t *const chroma = us_frame_get_plane(frame, 1, &c_stride);
+
+	for (unsigned y = 0; y < frame->height; ++y) {
+		memcpy(img->plane[0] + (size_t)img->i_stride[0] * y, luma + (size_t)y_stride * y, frame->width);
+	}
+
+	// NV12 уже 4:2:0, у NV16 прореживаются строки, у NV24 еще и столбцы
+	const unsigned c_rows = (frame->format == V4L2_PIX_FMT_NV12 ? 1 : 2);
+	const unsigned c_cols = (frame->format == V4L2_PIX_FMT_NV24 ? 2 : 1);
+	for (unsigned y = 0; y < frame->height / 2; ++y) {
+		const uint8_t *const a = chroma + (size_t)c_stride * y * c_rows;
+		const uint8_t *const b = a + (size_t)c_stride * (c_rows - 1);
+		uint8_t *const u = img->plane[1] + (size_t)img->i_stride[1] * y;
+		uint8_t *const v = img->plane[2] + (size_t)img->i_stride[2] * y;
+		for (unsigned x = 0; x < frame->width / 2; ++x) {
+			const unsigned pos = x * 2 * c_cols;
+			u[x] = (a[pos] + b[pos] + 1) >> 1;
+			v[x] = (a[pos + 1] + b[pos + 1] + 1) >> 1;
+		}
+	}
+}
+
+static void _import_rgb(const us_frame_s *frame, x264_image_t *img) {
+	// BT.601 limited range в целых числах, как в libjpeg, только без лишней точности
+	const bool rgb565 = (frame->format == V4L2_PIX_FMT_RGB565);
+	const unsigned bpp = (rgb565 ? 2 : 3);
+	const size_t line = frame->width * bpp + us_frame_get_padding(frame);
+
+#	define RGB(x_ptr, x_r, x_g, x_b) { \
+			if (rgb565) { \
+				const unsigned m_px = ((x_ptr)[1] << 8) | (x_ptr)[0]; \
+				x_r = (m_px >> 8) & 0xF8; \
+				x_g = (m_px >> 3) & 0xFC; \
+				x_b = (m_px << 3) & 0xF8; \
+			} else { \
+				x_r = (x_ptr)[0]; \
+				x_g = (x_ptr)[1]; \
+				x_b = (x_ptr)[2]; \
+			} \
+		}
+
+	for (unsigned y = 0; y < frame->height; ++y) {
+		const uint8_t *const src = frame->data + line * y;
+		uint8_t *const luma = img->plane[0] + (size_t)img->i_stride[0] * y;
+		for (unsigned x = 0; x < frame->width; ++x) {
+			int r, g, b;
+			RGB(src + x * bpp, r, g, b);
+			luma[x] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+		}
+	}
+	for (unsigned y = 0; y < frame->height / 2; ++y) {
+		const uint8_t *const src = frame->data + line * y * 2;
+		uint8_t *const u = img->plane[1] + (size_t)img->i_stride[1] * y;
+		uint8_t *const v = img->plane[2] + (size_t)img->i_stride[2] * y;
+		for (unsigned x = 0; x < frame->width / 2; ++x) {
+			int r = 0, g = 0, b = 0;
+			for (unsigned index = 0; index < 4; ++index) {
+				int pr, pg, pb;
+				RGB(src + line * (index / 2) + (x * 2 + index % 2) * bpp, pr, pg, pb);
+				r += pr;
+				g += pg;
+				b += pb;
+			}
+			r /= 4;
+			g /= 4;
+			b /= 4;
+			u[x] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+			v[x] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+		}
+	}
+
+#	undef RGB
+}
@@ -0,0 +1,65 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include <linux/videodev2.h>
+
+#include <x264.h>
+
+#include "../../../libs/tools.h"
+#include "../../../libs/logging.h"
+#include "../../../libs/frame.h"
+
+
+typedef struct {
+	x264_t			*x264;
+	x264_picture_t	pic;
+	bool			has_pic;
+	unsigned		width;
+	unsigned		height;
+	int64_t			pts;
+	int				last_online;
+} us_x264_encoder_runtime_s;
+
+typedef struct {
+	unsigned	bitrate; // Kbps
+	unsigned	gop;
+	unsigned	min_qp; // Zero for the default
+	unsigned	max_qp;
+	bool		cbr;
+
+	us_x264_encoder_runtime_s *run;
+} us_x264_encoder_s;
+
+
+us_x264_encoder_s *us_x264_encoder_init(unsigned bitrate, unsigned gop);
+void us_x264_encoder_destroy(us_x264_encoder_s *enc);
+int us_x264_encoder_set_params(us_x264_encoder_s *enc, unsigned bitrate, unsigned gop, unsigned min_qp, unsigned max_qp, bool cbr);
+
+int us_x264_encoder_compress(us_x264_encoder_s *enc, const us_frame_s *src, us_frame_s *dest, bool force_key);
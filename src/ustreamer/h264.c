@@ -23,50 +23,260 @@
 #include "h264.h"
 
 
-us_h264_stream_s *us_h264_stream_init(us_memsink_s *sink, int width, int height, unsigned gop) {
+static void *_collector_thread(void *v_h264);
+static void _sink_put(us_h264_stream_s *h264, int retval);
+
+
+static const struct {
+	const char *name;
+	const us_h264_encoder_e encoder; // cppcheck-suppress unusedStructMember
+} _ENCODERS[] = {
+	{"MPP",		US_H264_ENCODER_MPP},
+#	ifdef WITH_X264
+	{"X264",	US_H264_ENCODER_X264},
+#	endif
+};
+
+static const struct {
+	const char *name;
+	const us_h264_rc_e rc; // cppcheck-suppress unusedStructMember
+} _RCS[] = {
+	{"CBR",	US_H264_RC_CBR},
+	{"VBR",	US_H264_RC_VBR},
+};
+
+
+us_h264_encoder_e us_h264_parse_encoder(const char *str) {
+	US_ARRAY_ITERATE(_ENCODERS, 0, item, {
+		if (!strcasecmp(item->name, str)) {
+			return item->encoder;
+		}
+	});
+	return US_H264_ENCODER_UNKNOWN;
+}
+
+unsigned us_h264_parse_jpeg_downscale(const char *str) {
+	// Масштабы, которые IDCT libjpeg умеет без потерь в скорости
+	const unsigned scale = strtoul(str, NULL, 10);
+	return (scale == 1 || scale == 2 || scale == 4 ? scale : 0);
+}
+
+us_h264_rc_e us_h264_parse_rc(const char *str) {
+	US_ARRAY_ITERATE(_RCS, 0, item, {
+		if (!strcasecmp(item->name, str)) {
+			return item->rc;
+		}
+	});
+	return US_H264_RC_UNKNOWN;
+}
+
+const char *us_h264_rc_to_string(us_h264_rc_e rc) {
+	US_ARRAY_ITERATE(_RCS, 0, item, {
+		if (item->rc == rc) {
+			return item->name;
+		}
+	});
+	return _RCS[0].name;
+}
+
+bool us_h264_params_check(const us_h264_params_s *params) {
+	return (
+		params->bitrate >= 25 && params->bitrate <= 20000
+		&& params->gop <= 60
+		&& params->max_qp <= US_H264_MAX_QP
+		&& (params->min_qp <= params->max_qp || params->max_qp == 0)
+		&& params->rc != US_H264_RC_UNKNOWN
+	);
+}
+
+us_h264_stream_s *us_h264_stream_init(
+	us_memsink_s *sink, us_h264_encoder_e encoder,
+	int width, int height, unsigned format, unsigned jpeg_downscale,
+	const us_h264_params_s *params) {
+
 	us_h264_stream_s *h264;
 	US_CALLOC(h264, 1);
 	h264->sink = sink;
+	h264->width = width;
+	h264->height = height;
+	h264->format = format;
 	h264->tmp_src = us_frame_init();
 	h264->dest = us_frame_init();
+	atomic_init(&h264->key_requested, false);
 	atomic_init(&h264->online, false);
+	US_MUTEX_INIT(h264->pipeline_mutex);
+	US_COND_INIT(h264->pipeline_cond);
+	h264->encoder = encoder;
+
+	if (us_is_jpeg(format)) {
+		// Энкодер получит уже декодированный кадр, размер округляется так же, как это делает libjpeg
+		h264->unjpeg = us_unjpeg_init();
+		h264->jpeg_downscale = jpeg_downscale;
+		width = ((width + jpeg_downscale - 1) / jpeg_downscale) & ~1;
+		height = ((height + jpeg_downscale - 1) / jpeg_downscale) & ~1;
+		format = V4L2_PIX_FMT_NV12;
+		if (jpeg_downscale > 1) {
+			US_LOG_INFO("H264: Using JPEG downscaling 1/%u: %dx%d", jpeg_downscale, width, height);
+		}
+	}
 	// h264->enc = us_m2m_h264_encoder_init("H264", path, bitrate, gop);
-	h264->enc = us_mpp_h264_encoder_init(width, height, MPP_FMT_YUV422_UYVY, V4L2_PIX_FMT_H264, gop);
+#	ifdef WITH_X264
+	if (encoder == US_H264_ENCODER_X264) {
+		h264->x264 = us_x264_encoder_init(params->bitrate, params->gop);
+		us_h264_stream_set_params(h264, params);
+		return h264;
+	}
+#	endif
+	h264->enc = us_mpp_h264_encoder_init(width, height, us_mpp_format_from_v4l2(format), V4L2_PIX_FMT_H264, params->gop);
+	if (h264->enc != NULL) {
+		us_h264_stream_set_params(h264, params);
+		US_THREAD_CREATE(h264->collector_tid, _collector_thread, (void *)h264);
+	}
 	return h264;
 }
 
 void us_h264_stream_destroy(us_h264_stream_s *h264) {
 	// us_m2m_encoder_destroy(h264->enc);
-	us_mpp_encoder_destory(h264->enc);
+	if (h264->enc != NULL) {
+		US_MUTEX_LOCK(h264->pipeline_mutex);
+		h264->stop = true; // Коллектор сначала заберет все пакеты, которые еще в VPU
+		US_MUTEX_UNLOCK(h264->pipeline_mutex);
+		US_COND_BROADCAST(h264->pipeline_cond);
+		US_THREAD_JOIN(h264->collector_tid);
+	}
+	US_DELETE(h264->enc, us_mpp_encoder_destory);
+#	ifdef WITH_X264
+	US_DELETE(h264->x264, us_x264_encoder_destroy);
+#	endif
+	US_DELETE(h264->unjpeg, us_unjpeg_destroy);
 	us_frame_destroy(h264->dest);
 	us_frame_destroy(h264->tmp_src);
+	US_MUTEX_DESTROY(h264->pipeline_mutex);
+	US_COND_DESTROY(h264->pipeline_cond);
 	free(h264);
 }
 
+void us_h264_stream_set_params(us_h264_stream_s *h264, const us_h264_params_s *params) {
+	// Вызывается из того же потока, что и us_h264_stream_process(), энкодер не пересоздается
+	US_LOG_INFO("H264: Applying params: bitrate=%uKbps, gop=%u, qp=%u-%u, rc=%s",
+		params->bitrate, params->gop, params->min_qp, params->max_qp, us_h264_rc_to_string(params->rc));
+	const bool cbr = (params->rc == US_H264_RC_CBR);
+	int retval = -1;
+	switch (h264->encoder) {
+#		ifdef WITH_X264
+		case US_H264_ENCODER_X264:
+			retval = us_x264_encoder_set_params(h264->x264, params->bitrate, params->gop, params->min_qp, params->max_qp, cbr);
+			break;
+#		endif
+		default:
+			if (h264->enc != NULL) {
+				// Коллектор может ждать пакет на том же контексте, поэтому меняем конфиг, только когда VPU пуст.
+				// Новые кадры не появятся: их отправляет этот же поток.
+				US_MUTEX_LOCK(h264->pipeline_mutex);
+				US_COND_WAIT_FOR(h264->n_inflight == 0, h264->pipeline_cond, h264->pipeline_mutex);
+				retval = us_mpp_h264_encoder_set_params(h264->enc, params->bitrate, params->gop, params->min_qp, params->max_qp, cbr);
+				US_MUTEX_UNLOCK(h264->pipeline_mutex);
+			}
+	}
+	if (retval < 0) {
+		US_LOG_ERROR("H264: Can't apply params");
+	}
+}
+
 void us_h264_stream_process(us_h264_stream_s *h264, const us_frame_s *frame, bool force_key) {
-	if (!us_memsink_server_check(h264->sink, frame)) {
+	US_MUTEX_LOCK(h264->pipeline_mutex);
+	const bool need = us_memsink_server_check(h264->sink, frame);
+	US_MUTEX_UNLOCK(h264->pipeline_mutex);
+	if (!need) {
 		return;
 	}
 
 	if (us_is_jpeg(frame->format)) {
+		if (h264->unjpeg == NULL) {
+			// Энкодер настроен на сырой формат устройства, например заглушка при потере сигнала
+			US_LOG_DEBUG("H264: Ignoring JPEG frame for the raw-format stream");
+			return;
+		}
 		const long double now = us_get_now_monotonic();
 		US_LOG_DEBUG("H264: Input frame is JPEG; decoding ...");
-		if (us_unjpeg(frame, h264->tmp_src, true) < 0) {
+		if (us_unjpeg_to_nv12(h264->unjpeg, frame, h264->tmp_src, h264->jpeg_downscale) < 0) {
 			return;
 		}
 		frame = h264->tmp_src;
 		US_LOG_VERBOSE("H264: JPEG decoded; time=%.3Lf", us_get_now_monotonic() - now);
 	}
 
-	if (h264->key_requested) {
+	if (atomic_exchange(&h264->key_requested, false)) {
 		US_LOG_VERBOSE("H264: Requested keyframe by a sink client");
-		h264->key_requested = false;
 		force_key = true;
 	}
 
+	int retval = -1;
+	switch (h264->encoder) {
+#		ifdef WITH_X264
+		case US_H264_ENCODER_X264: retval = us_x264_encoder_compress(h264->x264, frame, h264->dest, force_key); break;
+#		endif
+		default:
+			if (h264->enc != NULL) {
+				// Ждем, только если VPU занят сразу двумя кадрами. Отправляем под мьютексом,
+				// чтобы коллектор не сбросил энкодер посреди отправки.
+				US_MUTEX_LOCK(h264->pipeline_mutex);
+				US_COND_WAIT_FOR(h264->n_inflight < US_MPP_H264_PIPELINE_DEPTH, h264->pipeline_cond, h264->pipeline_mutex);
+				const bool submitted = (us_mpp_h264_encoder_submit(h264->enc, frame, force_key) == 0);
+				if (submitted) {
+					++h264->n_inflight;
+				}
+				US_MUTEX_UNLOCK(h264->pipeline_mutex);
+				if (submitted) {
+					US_COND_BROADCAST(h264->pipeline_cond);
+					return; // Пакет отдаст коллектор
+				}
+			}
+	}
+	_sink_put(h264, retval);
+}
+
+static void *_collector_thread(void *v_h264) {
+	us_h264_stream_s *h264 = (us_h264_stream_s *)v_h264;
+	US_THREAD_RENAME("h264-collect");
+
+	while (true) {
+		US_MUTEX_LOCK(h264->pipeline_mutex);
+		US_COND_WAIT_FOR(h264->n_inflight > 0 || h264->stop, h264->pipeline_cond, h264->pipeline_mutex);
+		const bool stop = (h264->n_inflight == 0);
+		US_MUTEX_UNLOCK(h264->pipeline_mutex);
+		if (stop) {
+			break;
+		}
+
+		// Пока VPU отдает пакет N, захват уже копирует в соседний слот кадр N+1
+		const int retval = us_mpp_h264_encoder_collect(h264->enc, h264->dest);
+		_sink_put(h264, retval);
+
+		US_MUTEX_LOCK(h264->pipeline_mutex);
+		if (retval < 0) {
+			us_mpp_h264_encoder_reset(h264->enc);
+			h264->n_inflight = 0;
+			atomic_store(&h264->key_requested, true); // Опорные кадры потеряны
+		} else {
+			--h264->n_inflight;
+		}
+		US_MUTEX_UNLOCK(h264->pipeline_mutex);
+		US_COND_BROADCAST(h264->pipeline_cond);
+	}
+	return NULL;
+}
+
+static void _sink_put(us_h264_stream_s *h264, int retval) {
 	bool online = false;
-	if (!us_mpp_h264_encoder_compress(h264->enc, frame, h264->dest, force_key)) {
-		online = !us_memsink_server_put(h264->sink, h264->dest, &h264->key_requested);
+	if (!retval) {
+		bool key_requested = false;
+		US_MUTEX_LOCK(h264->pipeline_mutex);
+		online = !us_memsink_server_put(h264->sink, h264->dest, &key_requested);
+		US_MUTEX_UNLOCK(h264->pipeline_mutex);
+		if (key_requested) {
+			atomic_store(&h264->key_requested, true);
+		}
 	}
 	atomic_store(&h264->online, online);
 }
@@ -24,29 +24,95 @@
 
 #include <stdbool.h>
 #include <stdatomic.h>
+#include <strings.h>
 #include <assert.h>
 
+#include <pthread.h>
+
 #include "../libs/tools.h"
+#include "../libs/array.h"
 #include "../libs/logging.h"
+#include "../libs/threading.h"
 #include "../libs/frame.h"
 #include "../libs/memsink.h"
 #include "../libs/unjpeg.h"
 #include "m2m.h"
 #include "encoders/mpp/encoder.h"
+#ifdef WITH_X264
+#	include "encoders/x264/encoder.h"
+#endif
+
+
+#ifdef WITH_X264
+#	define US_H264_ENCODERS_STR "MPP, X264"
+#else
+#	define US_H264_ENCODERS_STR "MPP"
+#endif
+
+typedef enum {
+	US_H264_ENCODER_UNKNOWN, // Only for us_h264_parse_encoder()
+	US_H264_ENCODER_MPP,
+#	ifdef WITH_X264
+	US_H264_ENCODER_X264,
+#	endif
+} us_h264_encoder_e;
+
+#define US_H264_RCS_STR "CBR, VBR"
 
+typedef enum {
+	US_H264_RC_UNKNOWN, // Only for us_h264_parse_rc()
+	US_H264_RC_CBR,
+	US_H264_RC_VBR,
+} us_h264_rc_e;
+
+#define US_H264_MAX_QP 51
+
+typedef struct {
+	unsigned		bitrate; // Kbps
+	unsigned		gop;
+	unsigned		min_qp; // Zero for the encoder's default
+	unsigned		max_qp;
+	us_h264_rc_e	rc;
+} us_h264_params_s;
 
 typedef struct {
 	us_memsink_s		*sink;
-	bool				key_requested;
+	unsigned			width; // Input geometry the encoder was created for
+	unsigned			height;
+	unsigned			format;
+	atomic_bool			key_requested;
 	us_frame_s			*tmp_src;
 	us_frame_s			*dest;
 	// us_m2m_encoder_s	*enc;
 	atomic_bool			online;
+	us_unjpeg_s			*unjpeg; // For (M)JPEG input, decodes right to NV12
+	unsigned			jpeg_downscale;
+	us_h264_encoder_e	encoder;
 	us_mpp_encoder_s 	*enc;
+
+	// MPP: process() only submits frames, the collector thread puts packets to the sink
+	pthread_t			collector_tid;
+	pthread_mutex_t		pipeline_mutex; // Also guards the sink, flock() doesn't lock between threads
+	pthread_cond_t		pipeline_cond;
+	unsigned			n_inflight;
+	bool				stop;
+#	ifdef WITH_X264
+	us_x264_encoder_s	*x264;
+#	endif
 } us_h264_stream_s;
 
 
+us_h264_encoder_e us_h264_parse_encoder(const char *str);
+unsigned us_h264_parse_jpeg_downscale(const char *str);
+us_h264_rc_e us_h264_parse_rc(const char *str);
+const char *us_h264_rc_to_string(us_h264_rc_e rc);
+bool us_h264_params_check(const us_h264_params_s *params);
+
 // us_h264_stream_s *us_h264_stream_init(us_memsink_s *sink, const char *path, unsigned bitrate, unsigned gop);
-us_h264_stream_s *us_h264_stream_init(us_memsink_s *sink, int width, int height, unsigned gop);
+us_h264_stream_s *us_h264_stream_init(
+	us_memsink_s *sink, us_h264_encoder_e encoder,
+	int width, int height, unsigned format, unsigned jpeg_downscale,
+	const us_h264_params_s *params);
 void us_h264_stream_destroy(us_h264_stream_s *h264);
+void us_h264_stream_set_params(us_h264_stream_s *h264, const us_h264_params_s *params);
 void us_h264_stream_process(us_h264_stream_s *h264, const us_frame_s *frame, bool force_key);
@@ -23,6 +23,10 @@
 #include "server.h"
 
 
+static us_server_s *_server_init(us_stream_s *stream);
+static void _server_init_stream(us_server_s *server);
+static void _server_init_child(us_server_s *server, us_server_s *child);
+
 static int _http_preprocess_request(struct evhttp_request *request, us_server_s *server);
 
 static int _http_check_run_compat_action(struct evhttp_request *request, void *v_server);
@@ -31,6 +35,7 @@ static void _http_callback_root(struct evhttp_request *request, void *v_server);
 static void _http_callback_favicon(struct evhttp_request *request, void *v_server);
 static void _http_callback_static(struct evhttp_request *request, void *v_server);
 static void _http_callback_state(struct evhttp_request *request, void *v_server);
+static void _http_callback_h264(struct evhttp_request *request, void *v_server);
 static void _http_callback_snapshot(struct evhttp_request *request, void *v_server);
 
 static void _http_callback_stream(struct evhttp_request *request, void *v_server);
@@ -42,6 +47,8 @@ static void _http_refresher(int fd, short event, void *v_server);
 static void _http_queue_send_stream(us_server_s *server, bool stream_updated, bool frame_updated);
 
 static bool _expose_new_frame(us_server_s *server);
+static void _expose_add_frame_data(us_server_s *server, struct evbuffer *buf);
+static void _expose_unref_frame(const void *data, size_t size, void *v_item);
 
 static const char *_http_get_header(struct evhttp_request *request, const char *key);
 static char *_http_get_client_hostport(struct evhttp_request *request);
@@ -58,9 +65,29 @@ static char *_http_get_client_hostport(struct evhttp_request *request);
 
 
 us_server_s *us_server_init(us_stream_s *stream) {
+	us_server_s *const server = _server_init(stream);
+	assert(!evthread_use_pthreads());
+	assert((_RUN(base) = event_base_new()) != NULL);
+	assert((_RUN(http) = evhttp_new(_RUN(base))) != NULL);
+	evhttp_set_allowed_methods(_RUN(http), EVHTTP_REQ_GET|EVHTTP_REQ_HEAD|EVHTTP_REQ_OPTIONS);
+	return server;
+}
+
+void us_server_add_stream(us_server_s *server, const char *name, us_stream_s *stream) {
+	us_server_s *const child = _server_init(stream);
+	child->run->name = us_strdup(name);
+	child->run->parent = server;
+	child->run->base = _RUN(base);
+	child->run->http = _RUN(http);
+
+	US_REALLOC(_RUN(children), _RUN(n_children) + 1);
+	_RUN(children[_RUN(n_children)]) = child;
+	_RUN(n_children) += 1;
+}
+
+static us_server_s *_server_init(us_stream_s *stream) {
 	us_exposed_s *exposed;
 	US_CALLOC(exposed, 1);
-	exposed->frame = us_frame_init();
 
 	us_server_runtime_s *run;
 	US_CALLOC(run, 1);
@@ -79,15 +106,16 @@ us_server_s *us_server_init(us_stream_s *stream) {
 	server->instance_id = "";
 	server->timeout = 10;
 	server->run = run;
-
-	assert(!evthread_use_pthreads());
-	assert((run->base = event_base_new()) != NULL);
-	assert((run->http = evhttp_new(run->base)) != NULL);
-	evhttp_set_allowed_methods(run->http, EVHTTP_REQ_GET|EVHTTP_REQ_HEAD|EVHTTP_REQ_OPTIONS);
 	return server;
 }
 
 void us_server_destroy(us_server_s *server) {
+	// Дочерние серверы держат события на общем event_base, поэтому уходят первыми
+	for (unsigned index = 0; index < _RUN(n_children); ++index) {
+		us_server_destroy(_RUN(children[index]));
+	}
+	US_DELETE(_RUN(children), free);
+
 	if (_RUN(refresher) != NULL) {
 		event_del(_RUN(refresher));
 		event_free(_RUN(refresher));
@@ -98,15 +126,19 @@ void us_server_destroy(us_server_s *server) {
 		event_free(_RUN(request_watcher));
 	}
 
-	evhttp_free(_RUN(http));
-	if (_RUN(ext_fd) >= 0) {
-		close(_RUN(ext_fd));
-	}
-	event_base_free(_RUN(base));
+	if (_RUN(parent) == NULL) {
+		evhttp_free(_RUN(http));
+		if (_RUN(ext_fd) >= 0) {
+			close(_RUN(ext_fd));
+		}
+		event_base_free(_RUN(base));
 
-#	if LIBEVENT_VERSION_NUMBER >= 0x02010100
-	libevent_global_shutdown();
-#	endif
+#		if LIBEVENT_VERSION_NUMBER >= 0x02010100
+		libevent_global_shutdown();
+#		endif
+
+		US_DELETE(_RUN(auth_token), free);
+	}
 
 	US_LIST_ITERATE(_RUN(stream_clients), client, {
 		free(client->key);
@@ -114,9 +146,8 @@ void us_server_destroy(us_server_s *server) {
 		free(client);
 	});
 
-	US_DELETE(_RUN(auth_token), free);
-
-	us_frame_destroy(_EX(frame));
+	US_DELETE(_RUN(name), free);
+	US_DELETE(_EX(item), us_ring_frame_unref);
 	free(_RUN(exposed));
 	free(server->run);
 	free(server);
@@ -132,13 +163,12 @@ int us_server_listen(us_server_s *server) {
 			assert(!evhttp_set_cb(_RUN(http), "/favicon.ico", _http_callback_favicon, (void *)server));
 		}
 		assert(!evhttp_set_cb(_RUN(http), "/state", _http_callback_state, (void *)server));
+		assert(!evhttp_set_cb(_RUN(http), "/h264", _http_callback_h264, (void *)server));
 		assert(!evhttp_set_cb(_RUN(http), "/snapshot", _http_callback_snapshot, (void *)server));
 		assert(!evhttp_set_cb(_RUN(http), "/stream", _http_callback_stream, (void *)server));
 	}
 
-	us_frame_copy(_STREAM(blank), _EX(frame));
-	_EX(notify_last_width) = _EX(frame->width);
-	_EX(notify_last_height) = _EX(frame->height);
+	_server_init_stream(server);
 
 	if (server->exit_on_no_clients > 0) {
 		_RUN(last_request_ts) = us_get_now_monotonic();
@@ -148,17 +178,6 @@ int us_server_listen(us_server_s *server) {
 		assert(!event_add(_RUN(request_watcher), &interval));
 	}
 
-	{
-		struct timeval interval = {0};
-		if (_STREAM(dev->desired_fps) > 0) {
-			interval.tv_usec = 1000000 / (_STREAM(dev->desired_fps) * 2);
-		} else {
-			interval.tv_usec = 16000; // ~60fps
-		}
-		assert((_RUN(refresher) = event_new(_RUN(base), -1, EV_PERSIST, _http_refresher, server)) != NULL);
-		assert(!event_add(_RUN(refresher), &interval));
-	}
-
 	evhttp_set_timeout(_RUN(http), server->timeout);
 
 	if (server->user[0] != '\0') {
@@ -205,9 +224,52 @@ int us_server_listen(us_server_s *server) {
 		US_LOG_INFO("Listening HTTP on [%s]:%u", server->host, server->port);
 	}
 
+	for (unsigned index = 0; index < _RUN(n_children); ++index) {
+		_server_init_child(server, _RUN(children[index]));
+	}
+
 	return 0;
 }
 
+static void _server_init_stream(us_server_s *server) {
+	_EX(frame) = _STREAM(blank);
+	_EX(notify_last_width) = _EX(frame->width);
+	_EX(notify_last_height) = _EX(frame->height);
+
+	struct timeval interval = {0};
+	if (_STREAM(dev->desired_fps) > 0) {
+		interval.tv_usec = 1000000 / (_STREAM(dev->desired_fps) * 2);
+	} else {
+		interval.tv_usec = 16000; // ~60fps
+	}
+	assert((_RUN(refresher) = event_new(_RUN(base), -1, EV_PERSIST, _http_refresher, server)) != NULL);
+	assert(!event_add(_RUN(refresher), &interval));
+}
+
+static void _server_init_child(us_server_s *server, us_server_s *child) {
+	// Все настройки HTTP общие, различаются только поток и пути
+	us_server_runtime_s *const run = child->run;
+	*child = *server;
+	child->run = run;
+	run->ext_fd = _RUN(ext_fd);
+	run->auth_token = _RUN(auth_token);
+
+	char *path;
+#	define ADD_CB(x_prefix, x_cb) { \
+			US_ASPRINTF(path, x_prefix "/%s", run->name); \
+			assert(!evhttp_set_cb(_RUN(http), path, x_cb, (void *)child)); \
+			free(path); \
+		}
+	ADD_CB("/state", _http_callback_state);
+	ADD_CB("/h264", _http_callback_h264);
+	ADD_CB("/snapshot", _http_callback_snapshot);
+	ADD_CB("/stream", _http_callback_stream);
+#	undef ADD_CB
+
+	_server_init_stream(child);
+	US_LOG_INFO("Serving stream '%s' on /stream/%s", run->name, run->name);
+}
+
 void us_server_loop(us_server_s *server) {
 	US_LOG_INFO("Starting HTTP eventloop ...");
 	event_base_dispatch(_RUN(base));
@@ -425,10 +487,15 @@ static void _http_callback_state(struct evhttp_request *request, void *v_server)
 	);
 
 	if (_STREAM(run->h264) != NULL) {
+		us_h264_params_s params;
+		us_stream_get_h264_params(_RUN(stream), &params);
 		_A_EVBUFFER_ADD_PRINTF(buf,
-			" \"h264\": {\"bitrate\": %u, \"gop\": %u, \"online\": %s},",
-			_STREAM(h264_bitrate),
-			_STREAM(h264_gop),
+			" \"h264\": {\"bitrate\": %u, \"gop\": %u, \"rc\": \"%s\", \"min_qp\": %u, \"max_qp\": %u, \"online\": %s},",
+			params.bitrate,
+			params.gop,
+			us_h264_rc_to_string(params.rc),
+			params.min_qp,
+			params.max_qp,
 			us_bool_to_string(atomic_load(&_STREAM(run->h264->online)))
 		);
 	}
@@ -453,13 +520,19 @@ static void _http_callback_state(struct evhttp_request *request, void *v_server)
 
 	_A_EVBUFFER_ADD_PRINTF(buf,
 		" \"source\": {\"resolution\": {\"width\": %u, \"height\": %u},"
-		" \"online\": %s, \"desired_fps\": %u, \"captured_fps\": %u},"
+		" \"online\": %s, \"desired_fps\": %u, \"captured_fps\": %u, \"stale_fps\": %u,"
+		" \"pacing\": {\"passed\": %u, \"missed\": %u, \"jitter_avg_us\": %u, \"jitter_max_us\": %u}},"
 		" \"stream\": {\"queued_fps\": %u, \"clients\": %u, \"clients_stat\": {",
 		(server->fake_width ? server->fake_width : _EX(frame->width)),
 		(server->fake_height ? server->fake_height : _EX(frame->height)),
 		us_bool_to_string(_EX(frame->online)),
 		_STREAM(dev->desired_fps),
 		_EX(captured_fps),
+		_EX(stale_fps),
+		_EX(pacing.passed),
+		_EX(pacing.missed),
+		_EX(pacing.jitter_avg_us),
+		_EX(pacing.jitter_max_us),
 		_EX(queued_fps),
 		_RUN(stream_clients_count)
 	);
@@ -486,6 +559,77 @@ static void _http_callback_state(struct evhttp_request *request, void *v_server)
 	evbuffer_free(buf);
 }
 
+static void _http_callback_h264(struct evhttp_request *request, void *v_server) {
+	us_server_s *const server = (us_server_s *)v_server;
+
+	PREPROCESS_REQUEST;
+
+	if (_STREAM(h264_sink) == NULL) {
+		evhttp_send_error(request, HTTP_NOTFOUND, NULL);
+		return;
+	}
+
+	us_h264_params_s params;
+	us_stream_get_h264_params(_RUN(stream), &params);
+	bool changed = false;
+
+	struct evkeyvalq query;
+	evhttp_parse_query(evhttp_request_get_uri(request), &query);
+
+#	define PARSE_NUMBER(x_key) { \
+			const char *const m_value_str = evhttp_find_header(&query, #x_key); \
+			if (m_value_str != NULL) { \
+				char *m_end = NULL; \
+				errno = 0; \
+				const unsigned long m_value = strtoul(m_value_str, &m_end, 10); \
+				if (errno != 0 || m_end == m_value_str || *m_end != '\0' || m_value > UINT_MAX) { \
+					goto bad_request; \
+				} \
+				params.x_key = m_value; \
+				changed = true; \
+			} \
+		}
+	PARSE_NUMBER(bitrate);
+	PARSE_NUMBER(gop);
+	PARSE_NUMBER(min_qp);
+	PARSE_NUMBER(max_qp);
+#	undef PARSE_NUMBER
+
+	const char *const rc_str = evhttp_find_header(&query, "rc");
+	if (rc_str != NULL) {
+		params.rc = us_h264_parse_rc(rc_str);
+		changed = true;
+	}
+
+	if (!us_h264_params_check(&params)) {
+		goto bad_request;
+	}
+	if (changed) {
+		us_stream_set_h264_params(_RUN(stream), &params);
+	}
+	evhttp_clear_headers(&query);
+
+	struct evbuffer *buf;
+	_A_EVBUFFER_NEW(buf);
+	_A_EVBUFFER_ADD_PRINTF(buf,
+		"{\"ok\": true, \"result\": {"
+		"\"bitrate\": %u, \"gop\": %u, \"rc\": \"%s\", \"min_qp\": %u, \"max_qp\": %u}}",
+		params.bitrate,
+		params.gop,
+		us_h264_rc_to_string(params.rc),
+		params.min_qp,
+		params.max_qp
+	);
+	ADD_HEADER("Content-Type", "application/json");
+	evhttp_send_reply(request, HTTP_OK, "OK", buf);
+	evbuffer_free(buf);
+	return;
+
+	bad_request:
+		evhttp_clear_headers(&query);
+		evhttp_send_error(request, HTTP_BADREQUEST, NULL);
+}
+
 static void _http_callback_snapshot(struct evhttp_request *request, void *v_server) {
 	us_server_s *const server = (us_server_s *)v_server;
 
@@ -493,7 +637,7 @@ static void _http_callback_snapshot(struct evhttp_request *request, void *v_serv
 
 	struct evbuffer *buf;
 	_A_EVBUFFER_NEW(buf);
-	_A_EVBUFFER_ADD(buf, (const void *)_EX(frame->data), _EX(frame->used));
+	_expose_add_frame_data(server, buf);
 
 	ADD_HEADER("Cache-Control", "no-store, no-cache, must-revalidate, proxy-revalidate, pre-check=0, post-check=0, max-age=0");
 	ADD_HEADER("Pragma", "no-cache");
@@ -575,7 +719,9 @@ static void _http_callback_stream(struct evhttp_request *request, void *v_server
 		if (_RUN(stream_clients_count) == 1) {
 			atomic_store(&_VID(has_clients), true);
 #			ifdef WITH_GPIO
-			us_gpio_set_has_http_clients(true);
+			if (_RUN(parent) == NULL) {
+				us_gpio_set_has_http_clients(true);
+			}
 #			endif
 		}
 
@@ -727,7 +873,7 @@ static void _http_callback_stream_write(struct bufferevent *buf_event, void *v_c
 	}
 
 	if (!client->zero_data) {
-		_A_EVBUFFER_ADD(buf, (void *)_EX(frame->data), _EX(frame->used));
+		_expose_add_frame_data(server, buf);
 	}
 	_A_EVBUFFER_ADD_PRINTF(buf, RN "--" BOUNDARY RN);
 
@@ -754,7 +900,9 @@ static void _http_callback_stream_error(UNUSED struct bufferevent *buf_event, UN
 	if (_RUN(stream_clients_count) == 0) {
 		atomic_store(&_VID(has_clients), false);
 #		ifdef WITH_GPIO
-		us_gpio_set_has_http_clients(false);
+		if (_RUN(parent) == NULL) {
+			us_gpio_set_has_http_clients(false);
+		}
 #		endif
 	}
 
@@ -809,15 +957,13 @@ static void _http_queue_send_stream(us_server_s *server, bool stream_updated, bo
 	});
 
 	if (queued) {
-		static unsigned queued_fps_accum = 0;
-		static long long queued_fps_second = 0;
 		const long long now = us_floor_ms(us_get_now_monotonic());
-		if (now != queued_fps_second) {
-			_EX(queued_fps) = queued_fps_accum;
-			queued_fps_accum = 0;
-			queued_fps_second = now;
+		if (now != _EX(queued_fps_second)) {
+			_EX(queued_fps) = _EX(queued_fps_accum);
+			_EX(queued_fps_accum) = 0;
+			_EX(queued_fps_second) = now;
 		}
-		queued_fps_accum += 1;
+		_EX(queued_fps_accum) += 1;
 	} else if (!has_clients) {
 		_EX(queued_fps) = 0;
 	}
@@ -827,7 +973,16 @@ static void _http_request_watcher(UNUSED int fd, UNUSED short what, void *v_serv
 	us_server_s *server = (us_server_s *)v_server;
 	const long double now = us_get_now_monotonic();
 
-	if (us_stream_has_clients(_RUN(stream))) {
+	bool has_clients = us_stream_has_clients(_RUN(stream));
+	for (unsigned index = 0; index < _RUN(n_children); ++index) {
+		us_server_s *const child = _RUN(children[index]);
+		has_clients = (has_clients || us_stream_has_clients(child->run->stream));
+		if (child->run->last_request_ts > _RUN(last_request_ts)) {
+			_RUN(last_request_ts) = child->run->last_request_ts;
+		}
+	}
+
+	if (has_clients) {
 		_RUN(last_request_ts) = now;
 	} else if (_RUN(last_request_ts) + server->exit_on_no_clients < now) {
 		US_LOG_INFO("HTTP: No requests or HTTP/sink clients found in last %u seconds, exiting ...",
@@ -880,6 +1035,8 @@ static bool _expose_new_frame(us_server_s *server) {
 	US_LOG_DEBUG("HTTP: Updating exposed frame (online=%d) ...", _VID(frame->online));
 
 	_EX(captured_fps) = _VID(captured_fps);
+	_EX(stale_fps) = _VID(stale_fps);
+	_EX(pacing) = _VID(pacing);
 	_EX(expose_begin_ts) = us_get_now_monotonic();
 
 	if (server->drop_same_frames && _VID(frame->online)) {
@@ -902,7 +1059,13 @@ static bool _expose_new_frame(us_server_s *server) {
 		}
 	}
 
-	us_frame_copy(_VID(frame), _EX(frame));
+	// Кадр в video неизменяем, поэтому достаточно взять на него ссылку
+	us_ring_frame_s *const prev = _EX(item);
+	_EX(item) = us_ring_frame_ref(_VID(item));
+	_EX(frame) = _EX(item)->frame;
+	if (prev != NULL) {
+		us_ring_frame_unref(prev);
+	}
 
 	_EX(dropped) = 0;
 	_EX(expose_cmp_ts) = _EX(expose_begin_ts);
@@ -918,6 +1081,32 @@ static bool _expose_new_frame(us_server_s *server) {
 		return updated;
 }
 
+static void _expose_add_frame_data(us_server_s *server, struct evbuffer *buf) {
+	// Данные уходят в сокет прямо из кадра, ссылка держится, пока libevent их не отправит
+	if (_EX(frame->used) == 0) {
+		return;
+	}
+	if (_EX(item) != NULL && _EX(frame->n_iov) > 0) {
+		// Passthrough: каждый кусок держит свою ссылку, буфер устройства вернется после последнего
+		for (unsigned index = 0; index < _EX(frame->n_iov); ++index) {
+			assert(!evbuffer_add_reference(buf,
+				_EX(frame->iov[index].iov_base), _EX(frame->iov[index].iov_len),
+				_expose_unref_frame, us_ring_frame_ref(_EX(item))));
+		}
+	} else if (_EX(item) != NULL) {
+		assert(!evbuffer_add_reference(buf,
+			_EX(frame->data), _EX(frame->used),
+			_expose_unref_frame, us_ring_frame_ref(_EX(item))));
+	} else {
+		// Blank живет дольше сервера
+		assert(!evbuffer_add_reference(buf, _EX(frame->data), _EX(frame->used), NULL, NULL));
+	}
+}
+
+static void _expose_unref_frame(UNUSED const void *data, UNUSED size_t size, void *v_item) {
+	us_ring_frame_unref((us_ring_frame_s *)v_item);
+}
+
 static const char *_http_get_header(struct evhttp_request *request, const char *key) {
 	return evhttp_find_header(evhttp_request_get_input_headers(request), key);
 }
@@ -29,6 +29,8 @@
 #include <stdatomic.h>
 #include <string.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <assert.h>
@@ -59,6 +61,7 @@
 #include "../../libs/frame.h"
 #include "../../libs/base64.h"
 #include "../../libs/list.h"
+#include "../../libs/ring.h"
 #include "../data/index_html.h"
 #include "../data/favicon_ico.h"
 #include "../encoder.h"
@@ -100,9 +103,14 @@ typedef struct us_stream_client_sx {
 } us_stream_client_s;
 
 typedef struct {
-	us_frame_s		*frame;
+	us_ring_frame_s	*item; // NULL while the blank frame is exposed
+	us_frame_s		*frame; // Never written: item->frame or the stream blank
 	unsigned		captured_fps;
+	unsigned		stale_fps;
+	us_pacer_stat_s	pacing;
 	unsigned		queued_fps;
+	unsigned		queued_fps_accum;
+	long long		queued_fps_second;
 	unsigned		dropped;
 	long double		expose_begin_ts;
 	long double		expose_cmp_ts;
@@ -129,6 +137,12 @@ typedef struct {
 
 	us_stream_client_s	*stream_clients;
 	unsigned			stream_clients_count;
+
+	// Дополнительные потоки живут на том же event_base и evhttp, что и основной
+	char				*name;
+	struct us_server_sx	*parent;
+	struct us_server_sx	**children;
+	unsigned			n_children;
 } us_server_runtime_s;
 
 typedef struct us_server_sx {
@@ -166,6 +180,8 @@ typedef struct us_server_sx {
 us_server_s *us_server_init(us_stream_s *stream);
 void us_server_destroy(us_server_s *server);
 
+void us_server_add_stream(us_server_s *server, const char *name, us_stream_s *stream);
+
 int us_server_listen(us_server_s *server);
 void us_server_loop(us_server_s *server);
 void us_server_loop_break(us_server_s *server);
@@ -40,6 +40,7 @@
 #endif
 
 
+static us_options_s	*_g_options = NULL;
 static us_stream_s	*_g_stream = NULL;
 static us_server_s	*_g_server = NULL;
 
@@ -49,13 +50,19 @@ static void _block_thread_signals(void) {
 	assert(!sigemptyset(&mask));
 	assert(!sigaddset(&mask, SIGINT));
 	assert(!sigaddset(&mask, SIGTERM));
+	assert(!sigaddset(&mask, SIGHUP));
 	assert(!pthread_sigmask(SIG_BLOCK, &mask, NULL));
 }
 
-static void *_stream_loop_thread(UNUSED void *arg) {
-	US_THREAD_RENAME("stream");
+static void *_stream_loop_thread(void *v_stream) {
+	us_stream_s *const stream = (us_stream_s *)v_stream;
+	if (stream->name != NULL) {
+		US_THREAD_RENAME("stream-%s", stream->name);
+	} else {
+		US_THREAD_RENAME("stream");
+	}
 	_block_thread_signals();
-	us_stream_loop(_g_stream);
+	us_stream_loop(stream);
 	return NULL;
 }
 
@@ -71,9 +78,22 @@ static void _signal_handler(int signum) {
 	US_LOG_INFO_NOLOCK("===== Stopping by %s =====", name);
 	free(name);
 	us_stream_loop_break(_g_stream);
+	for (unsigned index = 0; index < _g_options->n_extras; ++index) {
+		us_stream_loop_break(_g_options->extras[index].stream);
+	}
 	us_server_loop_break(_g_server);
 }
 
+static void _restart_handler(int signum) {
+	char *const name = us_signum_to_string(signum);
+	US_LOG_INFO_NOLOCK("===== Restarting stream by %s =====", name);
+	free(name);
+	us_stream_loop_restart(_g_stream);
+	for (unsigned index = 0; index < _g_options->n_extras; ++index) {
+		us_stream_loop_restart(_g_options->extras[index].stream);
+	}
+}
+
 static void _install_signal_handlers(void) {
 	struct sigaction sig_act = {0};
 
@@ -88,6 +108,10 @@ static void _install_signal_handlers(void) {
 	US_LOG_DEBUG("Installing SIGTERM handler ...");
 	assert(!sigaction(SIGTERM, &sig_act, NULL));
 
+	sig_act.sa_handler = _restart_handler;
+	US_LOG_DEBUG("Installing SIGHUP handler ...");
+	assert(!sigaction(SIGHUP, &sig_act, NULL));
+
 	US_LOG_DEBUG("Ignoring SIGPIPE ...");
 	assert(signal(SIGPIPE, SIG_IGN) != SIG_ERR);
 }
@@ -99,7 +123,7 @@ int main(int argc, char *argv[]) {
 	US_LOGGING_INIT;
 	US_THREAD_RENAME("main");
 
-	us_options_s *options = us_options_init(argc, argv);
+	us_options_s *options = _g_options = us_options_init(argc, argv);
 	us_device_s *dev = us_device_init();
 	us_encoder_s *enc = us_encoder_init();
 	_g_stream = us_stream_init(dev, enc);
@@ -118,10 +142,17 @@ int main(int argc, char *argv[]) {
 #			endif
 
 			pthread_t stream_loop_tid;
+			pthread_t extra_loop_tids[US_MAX_EXTRA_STREAMS];
 			pthread_t server_loop_tid;
-			US_THREAD_CREATE(stream_loop_tid, _stream_loop_thread, NULL);
+			US_THREAD_CREATE(stream_loop_tid, _stream_loop_thread, (void *)_g_stream);
+			for (unsigned index = 0; index < options->n_extras; ++index) {
+				US_THREAD_CREATE(extra_loop_tids[index], _stream_loop_thread, (void *)options->extras[index].stream);
+			}
 			US_THREAD_CREATE(server_loop_tid, _server_loop_thread, NULL);
 			US_THREAD_JOIN(server_loop_tid);
+			for (unsigned index = 0; index < options->n_extras; ++index) {
+				US_THREAD_JOIN(extra_loop_tids[index]);
+			}
 			US_THREAD_JOIN(stream_loop_tid);
 		}
 
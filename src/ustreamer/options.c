@@ -62,6 +62,13 @@ enum _US_OPT_VALUES {
 	_O_DEVICE_TIMEOUT = 10000,
 	_O_DEVICE_ERROR_DELAY,
 	_O_M2M_DEVICE,
+	_O_ENCODER_STRIPS,
+	_O_TEST_PATTERN,
+	_O_REPLAY,
+	_O_ADAPTIVE_BUFFERS,
+	_O_DROP_STALE_FRAMES,
+	_O_MJPEG_PASSTHROUGH,
+	_O_EXTRA_DEVICE,
 
 	_O_IMAGE_DEFAULT,
 	_O_BRIGHTNESS,
@@ -95,8 +102,13 @@ enum _US_OPT_VALUES {
 	ADD_SINK(SINK)
 	ADD_SINK(RAW_SINK)
 	ADD_SINK(H264_SINK)
+	_O_H264_ENCODER,
+	_O_H264_JPEG_DOWNSCALE,
 	_O_H264_BITRATE,
 	_O_H264_GOP,
+	_O_H264_RC,
+	_O_H264_MIN_QP,
+	_O_H264_MAX_QP,
 	_O_H264_M2M_DEVICE,
 #	undef ADD_SINK
 
@@ -149,6 +161,13 @@ static const struct option _LONG_OPTS[] = {
 	{"device-timeout",			required_argument,	NULL,	_O_DEVICE_TIMEOUT},
 	{"device-error-delay",		required_argument,	NULL,	_O_DEVICE_ERROR_DELAY},
 	{"m2m-device",				required_argument,	NULL,	_O_M2M_DEVICE},
+	{"encoder-strips",			required_argument,	NULL,	_O_ENCODER_STRIPS},
+	{"test-pattern",			no_argument,		NULL,	_O_TEST_PATTERN},
+	{"replay",					required_argument,	NULL,	_O_REPLAY},
+	{"adaptive-buffers",		no_argument,		NULL,	_O_ADAPTIVE_BUFFERS},
+	{"drop-stale-frames",		no_argument,		NULL,	_O_DROP_STALE_FRAMES},
+	{"mjpeg-passthrough",		no_argument,		NULL,	_O_MJPEG_PASSTHROUGH},
+	{"extra-device",			required_argument,	NULL,	_O_EXTRA_DEVICE},
 
 	{"image-default",			no_argument,		NULL,	_O_IMAGE_DEFAULT},
 	{"brightness",				required_argument,	NULL,	_O_BRIGHTNESS},
@@ -192,8 +211,13 @@ static const struct option _LONG_OPTS[] = {
 	ADD_SINK("", SINK)
 	ADD_SINK("raw-", RAW_SINK)
 	ADD_SINK("h264-", H264_SINK)
+	{"h264-encoder",			required_argument,	NULL,	_O_H264_ENCODER},
+	{"h264-jpeg-downscale",		required_argument,	NULL,	_O_H264_JPEG_DOWNSCALE},
 	{"h264-bitrate",			required_argument,	NULL,	_O_H264_BITRATE},
 	{"h264-gop",				required_argument,	NULL,	_O_H264_GOP},
+	{"h264-rc",					required_argument,	NULL,	_O_H264_RC},
+	{"h264-min-qp",				required_argument,	NULL,	_O_H264_MIN_QP},
+	{"h264-max-qp",				required_argument,	NULL,	_O_H264_MAX_QP},
 	{"h264-m2m-device",			required_argument,	NULL,	_O_H264_M2M_DEVICE},
 #	undef ADD_SINK
 
@@ -231,6 +255,10 @@ static const struct option _LONG_OPTS[] = {
 
 static int _parse_resolution(const char *str, unsigned *width, unsigned *height, bool limited);
 static int _check_instance_id(const char *str);
+static int _check_stream_name(const char *str);
+static int _add_extra_stream(
+	us_options_s *options, const char *spec,
+	us_device_s *dev, us_encoder_s *enc, us_stream_s *stream, us_server_s *server);
 
 static void _features(void);
 static void _help(FILE *fp, us_device_s *dev, us_encoder_s *enc, us_stream_s *stream, us_server_s *server);
@@ -250,6 +278,21 @@ us_options_s *us_options_init(unsigned argc, char *argv[]) {
 }
 
 void us_options_destroy(us_options_s *options) {
+	for (unsigned index = 0; index < options->n_extras; ++index) {
+		us_extra_stream_s *const extra = &options->extras[index];
+		us_stream_destroy(extra->stream);
+		us_encoder_destroy(extra->enc);
+		us_device_destroy(extra->dev);
+		US_DELETE(extra->sink, us_memsink_destroy);
+		US_DELETE(extra->raw_sink, us_memsink_destroy);
+		US_DELETE(extra->h264_sink, us_memsink_destroy);
+		US_DELETE(extra->sink_obj, free);
+		US_DELETE(extra->raw_sink_obj, free);
+		US_DELETE(extra->h264_sink_obj, free);
+		free(extra->name);
+	}
+	US_DELETE(options->extras, free);
+
 	US_DELETE(options->sink, us_memsink_destroy);
 	US_DELETE(options->raw_sink, us_memsink_destroy);
 	US_DELETE(options->h264_sink, us_memsink_destroy);
@@ -333,6 +376,8 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 		}
 
 	char *blank_path = NULL;
+	const char *extra_specs[US_MAX_EXTRA_STREAMS];
+	unsigned n_extra_specs = 0;
 
 #	define ADD_SINK(x_prefix) \
 		char *x_prefix##_name = NULL; \
@@ -375,9 +420,23 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 			case _O_BLANK:				OPT_SET(blank_path, optarg);
 			case _O_LAST_AS_BLANK:		OPT_NUMBER("--last-as-blank", stream->last_as_blank, 0, 86400, 0);
 			case _O_SLOWDOWN:			OPT_SET(stream->slowdown, true);
+			case _O_DROP_STALE_FRAMES:	OPT_SET(stream->drop_stale_frames, true);
+			case _O_MJPEG_PASSTHROUGH:	OPT_SET(stream->mjpeg_passthrough, true);
 			case _O_DEVICE_TIMEOUT:		OPT_NUMBER("--device-timeout", dev->timeout, 1, 60, 0);
 			case _O_DEVICE_ERROR_DELAY:	OPT_NUMBER("--device-error-delay", stream->error_delay, 1, 60, 0);
 			case _O_M2M_DEVICE:			OPT_SET(enc->m2m_path, optarg);
+			case _O_ENCODER_STRIPS:		OPT_NUMBER("--encoder-strips", enc->n_strips, 1, US_CPU_ENCODER_MAX_STRIPS, 0);
+			case _O_TEST_PATTERN:		OPT_SET(dev->test_pattern, true);
+			case _O_REPLAY:				OPT_SET(dev->replay_path, optarg);
+			case _O_ADAPTIVE_BUFFERS:	OPT_SET(dev->adaptive_bufs, true);
+			case _O_EXTRA_DEVICE:
+				if (n_extra_specs >= US_MAX_EXTRA_STREAMS) {
+					printf("Too many extra devices, max=%u\n", US_MAX_EXTRA_STREAMS);
+					return -1;
+				}
+				extra_specs[n_extra_specs] = optarg;
+				++n_extra_specs;
+				break;
 
 			case _O_IMAGE_DEFAULT:
 				OPT_CTL_DEFAULT_NOBREAK(brightness);
@@ -441,8 +500,13 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 			ADD_SINK("", sink, SINK)
 			ADD_SINK("raw-", raw_sink, RAW_SINK)
 			ADD_SINK("h264-", h264_sink, H264_SINK)
-			case _O_H264_BITRATE:			OPT_NUMBER("--h264-bitrate", stream->h264_bitrate, 25, 20000, 0);
-			case _O_H264_GOP:				OPT_NUMBER("--h264-gop", stream->h264_gop, 0, 60, 0);
+			case _O_H264_ENCODER:			OPT_PARSE("H264 encoder type", stream->h264_encoder, us_h264_parse_encoder, US_H264_ENCODER_UNKNOWN, US_H264_ENCODERS_STR);
+			case _O_H264_JPEG_DOWNSCALE:	OPT_PARSE("H264 JPEG downscale", stream->h264_jpeg_downscale, us_h264_parse_jpeg_downscale, 0, "1, 2, 4");
+			case _O_H264_BITRATE:			OPT_NUMBER("--h264-bitrate", stream->h264_params.bitrate, 25, 20000, 0);
+			case _O_H264_GOP:				OPT_NUMBER("--h264-gop", stream->h264_params.gop, 0, 60, 0);
+			case _O_H264_RC:				OPT_PARSE("H264 rate control", stream->h264_params.rc, us_h264_parse_rc, US_H264_RC_UNKNOWN, US_H264_RCS_STR);
+			case _O_H264_MIN_QP:			OPT_NUMBER("--h264-min-qp", stream->h264_params.min_qp, 0, US_H264_MAX_QP, 0);
+			case _O_H264_MAX_QP:			OPT_NUMBER("--h264-max-qp", stream->h264_params.max_qp, 0, US_H264_MAX_QP, 0);
 			case _O_H264_M2M_DEVICE:		OPT_SET(stream->h264_m2m_path, optarg);
 #			undef ADD_SINK
 
@@ -483,6 +547,11 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 		}
 	}
 
+	if (!us_h264_params_check(&stream->h264_params)) {
+		printf("Invalid H264 params: --h264-min-qp can't be greater than --h264-max-qp\n");
+		return -1;
+	}
+
 	US_LOG_INFO("Starting PiKVM uStreamer %s ...", US_VERSION);
 
 	options->blank = us_blank_frame_init(blank_path);
@@ -507,6 +576,20 @@ int options_parse(us_options_s *options, us_device_s *dev, us_encoder_s *enc, us
 	ADD_SINK("H264", h264_sink);
 #	undef ADD_SINK
 
+	stream->drop_same_frames = server->drop_same_frames;
+	stream->held_timeout = server->timeout;
+
+	if (n_extra_specs > 0) {
+		// Ядра делятся между всеми потоками, а не выделяются каждому заново
+		enc->n_workers = us_max_u(enc->n_workers / (n_extra_specs + 1), 1);
+		US_CALLOC(options->extras, n_extra_specs);
+		for (unsigned index = 0; index < n_extra_specs; ++index) {
+			if (_add_extra_stream(options, extra_specs[index], dev, enc, stream, server) < 0) {
+				return -1;
+			}
+		}
+	}
+
 #	ifdef WITH_SETPROCTITLE
 	if (process_name_prefix != NULL) {
 		us_process_set_name_prefix(options->argc, options->argv, process_name_prefix);
@@ -554,6 +637,93 @@ static int _check_instance_id(const char *str) {
 	return 0;
 }
 
+static int _check_stream_name(const char *str) {
+	if (*str == '\0') {
+		return -1;
+	}
+	for (const char *ptr = str; *ptr; ++ptr) {
+		if (!(isascii(*ptr) && (isalpha(*ptr) || isdigit(*ptr) || *ptr == '_' || *ptr == '-'))) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int _add_extra_stream(
+	us_options_s *options, const char *spec,
+	us_device_s *dev, us_encoder_s *enc, us_stream_s *stream, us_server_s *server) {
+
+	const char *const path = strchr(spec, ':');
+	if (path == NULL || path[1] == '\0') {
+		printf("Invalid value for '--extra-device=%s': should be like <name>:</dev/path>\n", spec);
+		return -1;
+	}
+
+	us_extra_stream_s *const extra = &options->extras[options->n_extras];
+	assert((extra->name = strndup(spec, path - spec)) != NULL);
+	++options->n_extras; // Для us_options_destroy() даже при ошибке ниже
+
+	if (_check_stream_name(extra->name) != 0) {
+		printf("Invalid extra device name '%s', it should be like: ^[a-zA-Z0-9_-]+$\n", extra->name);
+		return -1;
+	}
+	for (unsigned index = 0; index + 1 < options->n_extras; ++index) {
+		if (!strcmp(options->extras[index].name, extra->name)) {
+			printf("Duplicate extra device name: %s\n", extra->name);
+			return -1;
+		}
+	}
+
+	// Дополнительные потоки наследуют все настройки основного, кроме пути к устройству
+#	define INHERIT(x_run_type, x_dest, x_src) { \
+			x_run_type *const m_run = (x_dest)->run; \
+			*(x_dest) = *(x_src); \
+			(x_dest)->run = m_run; \
+		}
+
+	extra->dev = us_device_init();
+	INHERIT(us_device_runtime_s, extra->dev, dev);
+	extra->dev->path = (char *)path + 1;
+	extra->dev->test_pattern = false;
+	extra->dev->replay_path = NULL;
+
+	extra->enc = us_encoder_init();
+	INHERIT(us_encoder_runtime_s, extra->enc, enc);
+
+	extra->stream = us_stream_init(extra->dev, extra->enc);
+	INHERIT(us_stream_runtime_s, extra->stream, stream);
+	extra->stream->name = extra->name;
+	extra->stream->dev = extra->dev;
+	extra->stream->enc = extra->enc;
+
+#	undef INHERIT
+
+#	define ADD_SINK(x_label, x_prefix) { \
+			extra->x_prefix = NULL; \
+			if (stream->x_prefix != NULL) { \
+				US_ASPRINTF(extra->x_prefix##_obj, "%s-%s", stream->x_prefix->obj, extra->name); \
+				extra->x_prefix = us_memsink_init( \
+					x_label, \
+					extra->x_prefix##_obj, \
+					true, \
+					stream->x_prefix->mode, \
+					stream->x_prefix->rm, \
+					stream->x_prefix->client_ttl, \
+					stream->x_prefix->timeout \
+				); \
+			} \
+			extra->stream->x_prefix = extra->x_prefix; \
+		}
+	ADD_SINK("JPEG", sink);
+	ADD_SINK("RAW", raw_sink);
+	ADD_SINK("H264", h264_sink);
+#	undef ADD_SINK
+
+	us_server_add_stream(server, extra->name, extra->stream);
+	US_LOG_INFO("Using extra device '%s': %s", extra->name, extra->dev->path);
+	return 0;
+}
+
 static void _features(void) {
 #	ifdef WITH_GPIO
 	puts("+ WITH_GPIO");
@@ -579,6 +749,12 @@ static void _features(void) {
 	puts("- WITH_SETPROCTITLE");
 #	endif
 
+#	ifdef WITH_MPP_SHIM
+	puts("+ WITH_MPP_SHIM");
+#	else
+	puts("- WITH_MPP_SHIM");
+#	endif
+
 #	ifdef HAS_PDEATHSIG
 	puts("+ HAS_PDEATHSIG");
 #	else
@@ -603,6 +779,8 @@ static void _help(FILE *fp, us_device_s *dev, us_encoder_s *enc, us_stream_s *st
 	SAY("                                           Available: %s; default: disabled.\n", US_STANDARDS_STR);
 	SAY("    -I|--io-method <method>  ───────────── Set V4L2 IO method (see kernel documentation).");
 	SAY("                                           Changing of this parameter may increase the performance. Or not.");
+	SAY("                                           DMABUF allocates buffers from the DMA heap (or udmabuf)");
+	SAY("                                           and passes them to the hardware encoders without copying.");
 	SAY("                                           Available: %s; default: MMAP.\n", US_IO_METHODS_STR);
 	SAY("    -f|--desired-fps <N>  ──────────────── Desired FPS. Default: maximum possible.\n");
 	SAY("    -z|--min-frame-size <N>  ───────────── Drop frames smaller then this limit. Useful if the device");
@@ -639,10 +817,36 @@ static void _help(FILE *fp, us_device_s *dev, us_encoder_s *enc, us_stream_s *st
 	SAY("                                           Note: currently this option has no effect on memory sinks.\n");
 	SAY("    -l|--slowdown  ─────────────────────── Slowdown capturing to 1 FPS or less when no stream or sink clients");
 	SAY("                                           are connected. Useful to reduce CPU consumption. Default: disabled.\n");
+	SAY("    --drop-stale-frames  ───────────────── Drain all buffers that are already filled by the device and encode");
+	SAY("                                           only the newest one. Reduces latency when encoding is slower");
+	SAY("                                           than capturing. Default: disabled.\n");
 	SAY("    --device-timeout <sec>  ────────────── Timeout for device querying. Default: %u.\n", dev->timeout);
 	SAY("    --device-error-delay <sec>  ────────── Delay before trying to connect to the device again");
 	SAY("                                           after an error (timeout for example). Default: %u.\n", stream->error_delay);
+	SAY("    --extra-device <name>:</dev/path>  ─── Capture one more device in the same process. It inherits");
+	SAY("                                           all capturing, encoding and sink options of the main device");
+	SAY("                                           and is served on /stream/<name>, /snapshot/<name> and");
+	SAY("                                           /state/<name>. Sinks get the '-<name>' suffix. Encoder workers");
+	SAY("                                           are split between all devices. Can be used up to %u times.\n", US_MAX_EXTRA_STREAMS);
 	SAY("    --m2m-device </dev/path>  ──────────── Path to V4L2 M2M encoder device. Default: auto select.\n");
+	SAY("    --mjpeg-passthrough  ───────────────── Send (M)JPEG frames to HTTP clients right from the device buffers");
+	SAY("                                           without copying. Up to half of --buffers may be held by slow");
+	SAY("                                           clients, the rest are used for capturing. On restart they are");
+	SAY("                                           waited for up to --server-timeout, then copied. Default: disabled.\n");
+	SAY("    --encoder-strips <N>  ──────────────── Split each frame into N horizontal strips and encode them");
+	SAY("                                           in parallel, CPU encoder only. Reduces the encoding latency");
+	SAY("                                           of a single frame; the strips are encoded by a thread pool");
+	SAY("                                           shared by all workers. Default: %u.\n", enc->n_strips);
+	SAY("    --test-pattern  ────────────────────── Generate moving color bars instead of capturing from the device.");
+	SAY("                                           Uses --resolution, --format (YUYV, UYVY, RGB565, RGB24)");
+	SAY("                                           and --desired-fps (%u if not set). Default: disabled.\n", US_SYNTH_DEFAULT_FPS);
+	SAY("    --replay <path>  ───────────────────── Replay frames from a file instead of capturing from the device.");
+	SAY("                                           The file should contain raw frames of --resolution and --format");
+	SAY("                                           or concatenated JPEGs for MJPEG/JPEG. Frames are looped");
+	SAY("                                           at exactly --desired-fps (%u if not set). Default: disabled.\n", US_SYNTH_DEFAULT_FPS);
+	SAY("    --adaptive-buffers  ────────────────── Measure how long the buffers are held by the pipeline and grow");
+	SAY("                                           or shrink their number on the next device init. --buffers sets");
+	SAY("                                           the initial number. Default: disabled.\n");
 	SAY("Image control options:");
 	SAY("══════════════════════");
 	SAY("    --image-default  ────────────────────── Reset all image settings below to default. Default: no change.\n");
@@ -674,10 +878,11 @@ static void _help(FILE *fp, us_device_s *dev, us_encoder_s *enc, us_stream_s *st
 	SAY("    --passwd <str>  ───────────── HTTP basic auth passwd. Default: empty.\n");
 	SAY("    --static <path> ───────────── Path to dir with static files instead of embedded root index page.");
 	SAY("                                  Symlinks are not supported for security reasons. Default: disabled.\n");
-	SAY("    -e|--drop-same-frames <N>  ── Don't send identical frames to clients, but no more than specified number.");
-	SAY("                                  It can significantly reduce the outgoing traffic, but will increase");
-	SAY("                                  the CPU loading. Don't use this option with analog signal sources");
-	SAY("                                  or webcams, it's useless. Default: disabled.\n");
+	SAY("    -e|--drop-same-frames <N>  ── Don't encode and send identical frames to clients, but no more than");
+	SAY("                                  specified number. Frames are compared by a hash of the captured image,");
+	SAY("                                  so it reduces both the outgoing traffic and the encoding CPU loading.");
+	SAY("                                  Don't use this option with analog signal sources or webcams,");
+	SAY("                                  it's useless. Default: disabled.\n");
 	SAY("    -R|--fake-resolution <WxH>  ─ Override image resolution for the /state. Default: disabled.\n");
 	SAY("    --tcp-nodelay  ────────────── Set TCP_NODELAY flag to the client /stream socket. Only for TCP socket.");
 	SAY("                                  Default: disabled.\n");
@@ -696,8 +901,16 @@ static void _help(FILE *fp, us_device_s *dev, us_encoder_s *enc, us_stream_s *st
 	ADD_SINK("JPEG", "")
 	ADD_SINK("RAW", "raw-")
 	ADD_SINK("H264", "h264-")
-	SAY("    --h264-bitrate <kbps>  ───────── H264 bitrate in Kbps. Default: %u.\n", stream->h264_bitrate);
-	SAY("    --h264-gop <N>  ──────────────── Intarval between keyframes. Default: %u.\n", stream->h264_gop);
+	SAY("    --h264-encoder <type>  ───────── H264 encoder backend. Available: %s. Default: MPP.\n", US_H264_ENCODERS_STR);
+	SAY("    --h264-jpeg-downscale <N>  ───── Decode (M)JPEG input for H264 at 1/N of the size using libjpeg");
+	SAY("                                     DCT scaling, N is 1, 2 or 4. Default: %u.\n", stream->h264_jpeg_downscale);
+	SAY("    --h264-bitrate <kbps>  ───────── H264 bitrate in Kbps. Default: %u.\n", stream->h264_params.bitrate);
+	SAY("    --h264-gop <N>  ──────────────── Intarval between keyframes. Default: %u.\n", stream->h264_params.gop);
+	SAY("    --h264-rc <mode>  ────────────── H264 rate control: %s. Default: %s.\n", US_H264_RCS_STR, us_h264_rc_to_string(stream->h264_params.rc));
+	SAY("    --h264-min-qp <N>  ───────────── Lower bound of H264 QP, 0 for the encoder default. Default: %u.\n", stream->h264_params.min_qp);
+	SAY("    --h264-max-qp <N>  ───────────── Upper bound of H264 QP, 0 for the encoder default. Default: %u.\n", stream->h264_params.max_qp);
+	SAY("                                     The bitrate, GOP, rate control and QP bounds can be changed on the fly\n");
+	SAY("                                     using /h264?bitrate=...&gop=...&rc=...&min_qp=...&max_qp=...\n");
 	SAY("    --h264-m2m-device </dev/path>  ─ Path to V4L2 M2M encoder device. Default: auto select.\n");
 #	undef ADD_SINK
 #	ifdef WITH_GPIO
@@ -49,6 +49,23 @@
 #endif
 
 
+#define US_MAX_EXTRA_STREAMS ((unsigned)16)
+
+
+typedef struct {
+	char			*name;
+	us_device_s		*dev;
+	us_encoder_s	*enc;
+	us_stream_s		*stream;
+
+	char			*sink_obj;
+	char			*raw_sink_obj;
+	char			*h264_sink_obj;
+	us_memsink_s	*sink;
+	us_memsink_s	*raw_sink;
+	us_memsink_s	*h264_sink;
+} us_extra_stream_s;
+
 typedef struct {
 	unsigned		argc;
 	char			**argv;
@@ -57,6 +74,9 @@ typedef struct {
 	us_memsink_s	*sink;
 	us_memsink_s	*raw_sink;
 	us_memsink_s	*h264_sink;
+
+	us_extra_stream_s	*extras;
+	unsigned			n_extras;
 } us_options_s;
 
 
@@ -0,0 +1,110 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "pacer.h"
+
+
+static uint64_t _pacer_get_now_ns(void);
+
+
+us_pacer_s *us_pacer_init(unsigned fps, unsigned hw_fps) {
+	us_pacer_s *pacer;
+	US_CALLOC(pacer, 1);
+	pacer->interval_ns = (fps > 0 ? 1000000000 / fps : 0);
+	// Без --desired-fps дедлайны и джиттер считаются по частоте устройства
+	pacer->period_ns = (pacer->interval_ns > 0 ? pacer->interval_ns : (hw_fps > 0 ? 1000000000 / hw_fps : 0));
+	return pacer;
+}
+
+void us_pacer_destroy(us_pacer_s *pacer) {
+	free(pacer);
+}
+
+void us_pacer_reset(us_pacer_s *pacer) {
+	pacer->deadline_ns = 0;
+	pacer->throttle_ns = 0;
+	pacer->last_ts_ns = 0;
+}
+
+bool us_pacer_is_due(us_pacer_s *pacer) {
+	const uint64_t now_ns = _pacer_get_now_ns();
+	if (
+		now_ns < pacer->throttle_ns
+		// Кадр может прийти чуть раньше дедлайна из-за джиттера захвата,
+		// поэтому принимаем его с запасом в четверть периода
+		|| (pacer->interval_ns > 0 && now_ns + pacer->interval_ns / 4 < pacer->deadline_ns)
+	) {
+		pacer->stat.passed += 1;
+		return false;
+	}
+	return true;
+}
+
+void us_pacer_commit(us_pacer_s *pacer, long double min_interval) {
+	const uint64_t now_ns = _pacer_get_now_ns();
+
+	// Ограничение по загрузке воркеров не влияет на дедлайны и статистику
+	pacer->throttle_ns = (min_interval > 0 ? now_ns + (uint64_t)(min_interval * 1000000000) : 0);
+
+	const uint64_t period_ns = pacer->period_ns;
+	if (period_ns == 0) {
+		pacer->stat.accepted += 1;
+		return;
+	}
+
+	if (pacer->last_ts_ns > 0) {
+		const uint64_t real_ns = now_ns - pacer->last_ts_ns;
+		const uint64_t jitter_us = (real_ns > period_ns ? real_ns - period_ns : period_ns - real_ns) / 1000;
+		pacer->jitter_sum_us += jitter_us;
+		pacer->jitter_count += 1;
+		if (jitter_us > pacer->stat.jitter_max_us) {
+			pacer->stat.jitter_max_us = jitter_us;
+		}
+	}
+	pacer->last_ts_ns = now_ns;
+	pacer->stat.accepted += 1;
+
+	// Дедлайны абсолютные: следующий отсчитывается от предыдущего, а не от момента захвата,
+	// поэтому ошибка не накапливается. Если отстали больше чем на период - синхронизируемся заново.
+	if (pacer->deadline_ns == 0 || now_ns >= pacer->deadline_ns + period_ns) {
+		if (pacer->deadline_ns > 0) {
+			pacer->stat.missed += (now_ns - pacer->deadline_ns) / period_ns;
+		}
+		pacer->deadline_ns = now_ns;
+	}
+	pacer->deadline_ns += period_ns;
+}
+
+void us_pacer_get_stat(us_pacer_s *pacer, us_pacer_stat_s *stat) {
+	pacer->stat.jitter_avg_us = (pacer->jitter_count > 0 ? pacer->jitter_sum_us / pacer->jitter_count : 0);
+	*stat = pacer->stat;
+	memset(&pacer->stat, 0, sizeof(pacer->stat));
+	pacer->jitter_sum_us = 0;
+	pacer->jitter_count = 0;
+}
+
+static uint64_t _pacer_get_now_ns(void) {
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &ts));
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
@@ -0,0 +1,64 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+
+#include "../libs/tools.h"
+#include "../libs/logging.h"
+
+
+typedef struct {
+	unsigned	accepted;
+	unsigned	passed; // Frames skipped to keep the cadence
+	unsigned	missed; // Deadlines without any captured frame
+	unsigned	jitter_avg_us;
+	unsigned	jitter_max_us;
+} us_pacer_stat_s;
+
+typedef struct {
+	uint64_t	interval_ns; // Desired FPS period, zero for no pacing
+	uint64_t	period_ns; // Reference period for deadlines and jitter: desired or hardware FPS
+	uint64_t	deadline_ns; // Absolute CLOCK_MONOTONIC deadline of the next output frame
+	uint64_t	throttle_ns; // Workers load limit, see us_workers_pool_get_min_interval()
+	uint64_t	last_ts_ns;
+
+	us_pacer_stat_s	stat;
+	uint64_t		jitter_sum_us;
+	unsigned		jitter_count;
+} us_pacer_s;
+
+
+us_pacer_s *us_pacer_init(unsigned fps, unsigned hw_fps);
+void us_pacer_destroy(us_pacer_s *pacer);
+
+void us_pacer_reset(us_pacer_s *pacer);
+bool us_pacer_is_due(us_pacer_s *pacer);
+void us_pacer_commit(us_pacer_s *pacer, long double min_interval);
+void us_pacer_get_stat(us_pacer_s *pacer, us_pacer_stat_s *stat);
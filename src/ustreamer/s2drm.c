@@ -42,9 +42,28 @@
 rga_info_t src, dst;
 
 static void uyvy_rga_copy(us_drm_s *drm, const us_frame_s *frame) {
+    // RGA берет хрому сразу за hstride строк яркости, поэтому шаги считаются от первой плоскости
+    int format = RK_FORMAT_UYVY_422;
+    unsigned wstride = drm->width;
+    unsigned hstride = drm->height;
+    if (frame->format == V4L2_PIX_FMT_NV24) {
+        US_LOG_DEBUG("DRM: NV24 is not supported by RGA, frame skipped");
+        return;
+    } else if (us_is_semiplanar(frame->format)) {
+        unsigned stride;
+        us_frame_get_plane(frame, 0, &stride);
+        wstride = stride;
+        if (frame->n_planes > 1 && stride > 0) {
+            hstride = frame->planes[1].offset / stride;
+        }
+        format = (frame->format == V4L2_PIX_FMT_NV12 ? RK_FORMAT_YCbCr_420_SP : RK_FORMAT_YCbCr_422_SP);
+    } else if (frame->format == V4L2_PIX_FMT_YUYV) {
+        format = RK_FORMAT_YUYV_422;
+    }
+
     src.virAddr = frame->data;
     dst.virAddr = drm->vaddr;
-    rga_set_rect(&src.rect, 0, 0, drm->width, drm->height, drm->width, drm->height, RK_FORMAT_UYVY_422);
+    rga_set_rect(&src.rect, 0, 0, drm->width, drm->height, wstride, hstride, format);
     rga_set_rect(&dst.rect, 0, 0, drm->width, drm->height, drm->width, drm->height, RK_FORMAT_BGRX_8888);
 
     c_RkRgaBlit(&src, &dst, NULL);
@@ -131,7 +150,7 @@ us_drm_s *us_drm_init(int width, int height)
     {
         errno = -ret;
         US_LOG_PERROR("DRM init failed error %d", errno);
-        exit(-1);
+        return NULL;
     }
     us_drm_s *drm;
     US_CALLOC(drm, 1);
@@ -151,7 +170,8 @@ us_drm_s *us_drm_init(int width, int height)
     {
         US_LOG_PERROR("Failed to set client cap");
         DRM_US_DELETE(drm);
-        exit(-1);
+        close(fd);
+        return NULL;
     }
 
     plane_res = drmModeGetPlaneResources(fd);
@@ -165,7 +185,8 @@ us_drm_s *us_drm_init(int width, int height)
     {
         US_LOG_PERROR("drmCreateFD err");
         DRM_US_DELETE(drm);
-        exit(-1);
+        close(fd);
+        return NULL;
     }
     /*
     id      encoder status          name            size (mm)       modes   encoders
@@ -206,7 +227,8 @@ us_drm_s *us_drm_init(int width, int height)
             {
                 US_LOG_PERROR("drmModeSetCrtc err");
                 DRM_US_DELETE(drm);
-                exit(-1);
+                close(fd);
+                return NULL;
             }
             break;
         }
@@ -226,7 +248,8 @@ us_drm_s *us_drm_init(int width, int height)
     {
         US_LOG_PERROR("drmModeSetPlane err");
         DRM_US_DELETE(drm);
-        exit(-1);
+        close(fd);
+        return NULL;
     }
 
     return drm;
@@ -25,7 +25,17 @@
 
 static us_workers_pool_s *_stream_init_loop(us_stream_s *stream);
 static us_workers_pool_s *_stream_init_one(us_stream_s *stream);
-static void _stream_expose_frame(us_stream_s *stream, us_frame_s *frame, unsigned captured_fps);
+static bool _stream_need_dma(us_stream_s *stream);
+static int _stream_reconfigure(us_stream_s *stream, us_workers_pool_s *pool);
+static void _stream_update_h264(us_stream_s *stream);
+static bool _stream_is_same_raw(us_stream_s *stream, us_frame_s *raw, uint64_t *last_hash, unsigned *n_same);
+static us_ring_frame_s *_stream_ring_acquire(us_stream_s *stream);
+static int _stream_release_held(us_stream_s *stream);
+static void _stream_drain_held(us_stream_s *stream);
+static void _stream_free_orphans(us_stream_s *stream, bool force);
+static void _stream_expose_frame(
+	us_stream_s *stream, us_ring_frame_s *item,
+	unsigned captured_fps, unsigned stale_fps, const us_pacer_stat_s *pacing);
 
 
 #define _RUN(x_next) stream->run->x_next
@@ -42,23 +52,44 @@ static void _stream_expose_frame(us_stream_s *stream, us_frame_s *frame, unsigne
 
 #define _H264_PUT(x_frame, x_force_key) { \
 		if (_RUN(h264)) { \
+			if (atomic_exchange(&_RUN(h264_params_updated), false)) { \
+				us_h264_params_s m_params; \
+				us_stream_get_h264_params(stream, &m_params); \
+				us_h264_stream_set_params(_RUN(h264), &m_params); \
+			} \
 			us_h264_stream_process(_RUN(h264), x_frame, x_force_key); \
 		} \
 	}
 
 #define _DRM_PUT(drm, x_frame) { \
-		us_drm_draw(drm, x_frame); \
-		US_LOG_DEBUG("Complete put data to DRM device...");\
+		if (drm != NULL) { \
+			us_drm_draw(drm, x_frame); \
+			US_LOG_DEBUG("Complete put data to DRM device...");\
+		} \
+	}
+
+#ifdef WITH_GPIO
+// GPIO и DRM один на процесс, ими управляет только основной поток
+#	define _GPIO_SET_STREAM_ONLINE(x_online) { \
+		if (stream->name == NULL) { \
+			us_gpio_set_stream_online(x_online); \
+		} \
 	}
+#endif
 
 us_stream_s *us_stream_init(us_device_s *dev, us_encoder_s *enc) {
 	us_stream_runtime_s *run;
 	US_CALLOC(run, 1);
 	atomic_init(&run->stop, false);
+	atomic_init(&run->restart, false);
+	US_MUTEX_INIT(run->h264_params_mutex);
+	atomic_init(&run->h264_params_updated, false);
+	run->ring = us_ring_init("JPEG", 4);
 
 	us_video_s *video;
 	US_CALLOC(video, 1);
-	video->frame = us_frame_init();
+	video->item = us_ring_acquire(run->ring);
+	video->frame = video->item->frame;
 	atomic_init(&video->updated, false);
 	US_MUTEX_INIT(video->mutex);
 	atomic_init(&video->has_clients, false);
@@ -69,17 +100,23 @@ us_stream_s *us_stream_init(us_device_s *dev, us_encoder_s *enc) {
 	stream->dev = dev;
 	stream->enc = enc;
 	stream->last_as_blank = -1;
+	stream->held_timeout = 10;
 	stream->error_delay = 1;
-	stream->h264_bitrate = 5000; // Kbps
-	stream->h264_gop = 30;
+	stream->h264_encoder = US_H264_ENCODER_MPP;
+	stream->h264_jpeg_downscale = 1;
+	stream->h264_params.bitrate = 5000; // Kbps
+	stream->h264_params.gop = 30;
+	stream->h264_params.rc = US_H264_RC_CBR;
 	stream->run = run;
 	return stream;
 }
 
 void us_stream_destroy(us_stream_s *stream) {
+	_stream_free_orphans(stream, true); // HTTP-сервер уже уничтожен, ссылок на копии больше нет
+	US_MUTEX_DESTROY(_RUN(h264_params_mutex));
 	US_MUTEX_DESTROY(_RUN(video->mutex));
-	us_frame_destroy(_RUN(video->frame));
 	free(_RUN(video));
+	us_ring_destroy(_RUN(ring));
 	free(stream->run);
 	free(stream);
 }
@@ -87,39 +124,78 @@ void us_stream_destroy(us_stream_s *stream) {
 void us_stream_loop(us_stream_s *stream) {
 	assert(stream->blank != NULL);
 
-	US_LOG_INFO("Using V4L2 device: %s", stream->dev->path);
+	if (stream->dev->test_pattern) {
+		US_LOG_INFO("Using test pattern instead of V4L2 device");
+	} else if (stream->dev->replay_path != NULL) {
+		US_LOG_INFO("Using replay file instead of V4L2 device: %s", stream->dev->replay_path);
+	} else {
+		US_LOG_INFO("Using V4L2 device: %s", stream->dev->path);
+	}
 	US_LOG_INFO("Using desired FPS: %u", stream->dev->desired_fps);
 
 	if (stream->h264_sink != NULL) {
-		_RUN(h264) = us_h264_stream_init(stream->h264_sink, stream->dev->width, stream->dev->height, stream->h264_gop);
+		us_h264_params_s params;
+		us_stream_get_h264_params(stream, &params);
+		_RUN(h264) = us_h264_stream_init(
+			stream->h264_sink, stream->h264_encoder,
+			stream->dev->width, stream->dev->height, stream->dev->format, stream->h264_jpeg_downscale,
+			&params);
 	}
 	
-	us_drm_s *const drm = us_drm_init(stream->dev->width, stream->dev->height);
+	us_drm_s *const drm = (stream->name == NULL ? us_drm_init(stream->dev->width, stream->dev->height) : NULL);
+	if (drm == NULL && stream->name == NULL) {
+		US_LOG_INFO("DRM output is unavailable, continuing without it");
+	}
 	for (us_workers_pool_s *pool; (pool = _stream_init_loop(stream)) != NULL;) {
-		long double grab_after = 0;
-		unsigned fluency_passed = 0;
+		_stream_update_h264(stream);
+		const unsigned hw_fps = stream->dev->run->hw_fps;
+		const unsigned desired_fps = stream->dev->desired_fps;
+		us_pacer_s *const pacer = us_pacer_init(
+			desired_fps > 0 && (desired_fps < hw_fps || hw_fps == 0)
+			? desired_fps : 0,
+			hw_fps
+		);
+		us_pacer_stat_s pacing = {0};
 		unsigned captured_fps = 0;
 		unsigned captured_fps_accum = 0;
 		long long captured_fps_second = 0;
+		unsigned stale_fps = 0;
+		unsigned stale_fps_accum = 0;
+		uint64_t last_raw_hash = 0;
+		unsigned n_same_raw = 0;
 
 		US_LOG_INFO("Capturing ...");
 
-		while (!atomic_load(&_RUN(stop))) {
+		while (!atomic_load(&_RUN(stop)) && !atomic_load(&_RUN(restart))) {
 			US_SEP_DEBUG('-');
 			US_LOG_DEBUG("Waiting for worker ...");
 
 			us_worker_s *const ready_wr = us_workers_pool_wait(pool);
 			us_encoder_job_s *const ready_job = (us_encoder_job_s *)(ready_wr->job);
 
+			if (_stream_release_held(stream) < 0) {
+				break;
+			}
+
 			if (ready_job->hw != NULL) {
-				if (us_device_release_buffer(stream->dev, ready_job->hw) < 0) {
+				if (
+					!ready_wr->job_failed && ready_wr->job_timely
+					&& ready_job->dest->n_iov > 0 && ready_job->dest->used > 0
+				) {
+					// Кадр ссылается прямо на буфер устройства: вернем его, когда кадр никто не будет читать
+					ready_job->dest_ref->opaque = ready_job->hw;
+					_RUN(n_held) += 1;
+				} else if (us_device_release_buffer(stream->dev, ready_job->hw) < 0) {
 					ready_wr->job_failed = true;
 				}
 				ready_job->hw = NULL;
 
 				if (!ready_wr->job_failed) {
 					if (ready_wr->job_timely) {
-						_stream_expose_frame(stream, ready_job->dest, captured_fps);
+						// Ссылка на кадр переходит к video, воркер получит новый
+						_stream_expose_frame(stream, ready_job->dest_ref, captured_fps, stale_fps, &pacing);
+						ready_job->dest_ref = NULL;
+						ready_job->dest = NULL;
 						US_LOG_PERF("##### Encoded frame exposed; worker=%s", ready_wr->name);
 					} else {
 						US_LOG_PERF("----- Encoded frame dropped; worker=%s", ready_wr->name);
@@ -133,13 +209,15 @@ void us_stream_loop(us_stream_s *stream) {
 			if (stream->slowdown) {
 				unsigned slc = 0;
 				for (; slc < 10 && !atomic_load(&_RUN(stop)) && !us_stream_has_clients(stream); ++slc) {
-					usleep(100000);
+					if (us_device_sleep(stream->dev, 0.1)) {
+						break;
+					}
 					++slc;
 				}
 				h264_force_key = (slc == 10);
 			}
 
-			if (atomic_load(&_RUN(stop))) {
+			if (atomic_load(&_RUN(stop)) || atomic_load(&_RUN(restart))) {
 				break;
 			}
 
@@ -155,52 +233,76 @@ void us_stream_loop(us_stream_s *stream) {
 				}
 			} else if (selected == 0) { // Persistent timeout
 #				ifdef WITH_GPIO
-				us_gpio_set_stream_online(false);
+				_GPIO_SET_STREAM_ONLINE(false);
 #				endif
 			} else {
 				if (has_read) {
 					US_LOG_DEBUG("Frame is ready");
 
 #					ifdef WITH_GPIO
-					us_gpio_set_stream_online(true);
+					_GPIO_SET_STREAM_ONLINE(true);
 #					endif
 
 					const long double now = us_get_now_monotonic();
 					const long long now_second = us_floor_ms(now);
 
 					us_hw_buffer_s *hw;
-					const int buf_index = us_device_grab_buffer(stream->dev, &hw);
+					unsigned n_stale = 0;
+					const int buf_index = (stream->drop_stale_frames
+						? us_device_grab_latest_buffer(stream->dev, &hw, &n_stale)
+						: us_device_grab_buffer(stream->dev, &hw)
+					);
+					stale_fps_accum += n_stale;
 
 					if (buf_index >= 0) {
-						if (now < grab_after) {
-							fluency_passed += 1;
-							US_LOG_VERBOSE("Passed %u frames for fluency: now=%.03Lf, grab_after=%.03Lf",
-								fluency_passed, now, grab_after);
+						if (!us_pacer_is_due(pacer)) {
+							US_LOG_VERBOSE("Passed frame for pacing: buffer=%d", buf_index);
 							if (us_device_release_buffer(stream->dev, hw) < 0) {
 								break;
 							}
 						} else {
-							fluency_passed = 0;
-
 							if (now_second != captured_fps_second) {
 								captured_fps = captured_fps_accum;
 								captured_fps_accum = 0;
 								captured_fps_second = now_second;
-								US_LOG_PERF_FPS("A new second has come; captured_fps=%u", captured_fps);
+								stale_fps = stale_fps_accum;
+								stale_fps_accum = 0;
+								us_pacer_get_stat(pacer, &pacing);
+								US_LOG_PERF_FPS("A new second has come; captured_fps=%u, stale_fps=%u", captured_fps, stale_fps);
+								US_LOG_VERBOSE("Pacing: passed=%u, missed=%u, jitter_avg=%uus, jitter_max=%uus",
+									pacing.passed, pacing.missed, pacing.jitter_avg_us, pacing.jitter_max_us);
 							}
 							captured_fps_accum += 1;
 
-							const long double fluency_delay = us_workers_pool_get_fluency_delay(pool, ready_wr);
-							grab_after = now + fluency_delay;
-							US_LOG_VERBOSE("Fluency: delay=%.03Lf, grab_after=%.03Lf", fluency_delay, grab_after);
-
-							ready_job->hw = hw;
-							us_workers_pool_assign(pool, ready_wr);
-							US_LOG_DEBUG("Assigned new frame in buffer=%d to worker=%s", buf_index, ready_wr->name);
+							const bool same = _stream_is_same_raw(stream, &hw->raw, &last_raw_hash, &n_same_raw);
+							if (same) {
+								US_LOG_VERBOSE("Skipped encoding of the same frame number %u: buffer=%d", n_same_raw, buf_index);
+							} else {
+								const long double min_interval = us_workers_pool_get_min_interval(pool, ready_wr);
+								us_pacer_commit(pacer, min_interval);
+
+								ready_job->hw = hw;
+								if (ready_job->dest_ref == NULL) {
+									ready_job->dest_ref = _stream_ring_acquire(stream);
+									ready_job->dest = ready_job->dest_ref->frame;
+								}
+								// Хотя бы половина буферов должна оставаться у устройства для захвата
+								ready_job->zero_copy = (
+									stream->mjpeg_passthrough
+									&& us_is_jpeg(stream->dev->run->format)
+									&& _RUN(n_held) < stream->dev->run->n_bufs / 2
+								);
+								us_workers_pool_assign(pool, ready_wr);
+								US_LOG_DEBUG("Assigned new frame in buffer=%d to worker=%s", buf_index, ready_wr->name);
+							}
 
 							_DRM_PUT(drm, &hw->raw);
 							_SINK_PUT(raw_sink, &hw->raw);
 							_H264_PUT(&hw->raw, h264_force_key);
+
+							if (same && us_device_release_buffer(stream->dev, hw) < 0) {
+								break;
+							}
 						}
 					} else if (buf_index != -2) { // -2 for broken frame
 						break;
@@ -214,27 +316,48 @@ void us_stream_loop(us_stream_s *stream) {
 
 				if (has_error) {
 					US_LOG_INFO("Got V4L2 event");
-					if (us_device_consume_event(stream->dev) < 0) {
+					const int event = us_device_consume_event(stream->dev);
+					if (event < 0) {
 						break;
+					} else if (event > 0) {
+						if (_stream_reconfigure(stream, pool) < 0) {
+							US_LOG_INFO("Can't reconfigure the device on the fly, restarting the stream ...");
+							break;
+						}
+						us_pacer_reset(pacer);
+						last_raw_hash = 0;
 					}
 				}
 			}
 		}
+		us_pacer_destroy(pacer);
+		us_workers_pool_wait_idle(pool);
+		_stream_drain_held(stream);
 		us_workers_pool_destroy(pool);
 		us_device_switch_capturing(stream->dev, false);
 		us_device_close(stream->dev);
 
+		if (atomic_exchange(&_RUN(restart), false)) {
+			US_LOG_INFO("Stream restart requested, reopening the device ...");
+		}
+
 #		ifdef WITH_GPIO
-		us_gpio_set_stream_online(false);
+		_GPIO_SET_STREAM_ONLINE(false);
 #		endif
 	}
-	us_drm_destroy(drm);
+	US_DELETE(drm, us_drm_destroy);
 
 	US_DELETE(_RUN(h264), us_h264_stream_destroy);
 }
 
 void us_stream_loop_break(us_stream_s *stream) {
 	atomic_store(&_RUN(stop), true);
+	us_device_wakeup(stream->dev);
+}
+
+void us_stream_loop_restart(us_stream_s *stream) {
+	atomic_store(&_RUN(restart), true);
+	us_device_wakeup(stream->dev);
 }
 
 bool us_stream_has_clients(us_stream_s *stream) {
@@ -246,6 +369,20 @@ bool us_stream_has_clients(us_stream_s *stream) {
 	);
 }
 
+void us_stream_get_h264_params(us_stream_s *stream, us_h264_params_s *params) {
+	US_MUTEX_LOCK(_RUN(h264_params_mutex));
+	*params = stream->h264_params;
+	US_MUTEX_UNLOCK(_RUN(h264_params_mutex));
+}
+
+void us_stream_set_h264_params(us_stream_s *stream, const us_h264_params_s *params) {
+	// Применяется потоком стрима перед следующим кадром, а новый энкодер сразу получит новые параметры
+	US_MUTEX_LOCK(_RUN(h264_params_mutex));
+	stream->h264_params = *params;
+	US_MUTEX_UNLOCK(_RUN(h264_params_mutex));
+	atomic_store(&_RUN(h264_params_updated), true);
+}
+
 static us_workers_pool_s *_stream_init_loop(us_stream_s *stream) {
 
 	us_workers_pool_s *pool = NULL;
@@ -254,16 +391,26 @@ static us_workers_pool_s *_stream_init_loop(us_stream_s *stream) {
 	US_LOG_DEBUG("%s: stream->run->stop=%d", __FUNCTION__, atomic_load(&_RUN(stop)));
 
 	while (!atomic_load(&_RUN(stop))) {
-		_stream_expose_frame(stream, NULL, 0);
+		// Мы и так переинициализируемся, повторный рестарт не нужен
+		atomic_store(&_RUN(restart), false);
 
-		if (access(stream->dev->path, R_OK|W_OK) < 0) {
+		_stream_expose_frame(stream, NULL, 0, 0, NULL);
+
+		if (
+			(stream->dev->replay_path != NULL && access(stream->dev->replay_path, R_OK) < 0)
+			|| (!stream->dev->test_pattern && stream->dev->replay_path == NULL && access(stream->dev->path, R_OK|W_OK) < 0)
+		) {
 			if (access_error != errno) {
 				US_SEP_INFO('=');
 				US_LOG_PERROR("Can't access device");
 				US_LOG_INFO("Waiting for the device access ...");
 				access_error = errno;
 			}
-			sleep(stream->error_delay);
+			if (stream->dev->replay_path != NULL) {
+				us_device_wait_path(stream->dev, stream->dev->replay_path, R_OK, stream->error_delay);
+			} else {
+				us_device_wait_path(stream->dev, stream->dev->path, R_OK|W_OK, stream->error_delay);
+			}
 			continue;
 		} else {
 			US_SEP_INFO('=');
@@ -272,7 +419,7 @@ static us_workers_pool_s *_stream_init_loop(us_stream_s *stream) {
 
 		if ((pool = _stream_init_one(stream)) == NULL) {
 			US_LOG_INFO("Sleeping %u seconds before new stream init ...", stream->error_delay);
-			sleep(stream->error_delay);
+			us_device_sleep(stream->dev, stream->error_delay);
 		} else {
 			break;
 		}
@@ -284,11 +431,7 @@ static us_workers_pool_s *_stream_init_one(us_stream_s *stream) {
 	if (us_device_open(stream->dev) < 0) {
 		goto error;
 	}
-	if (
-		stream->enc->type == US_ENCODER_TYPE_M2M_VIDEO
-		|| stream->enc->type == US_ENCODER_TYPE_M2M_IMAGE
-		|| (_RUN(h264) && !us_is_jpeg(stream->dev->run->format))
-	) {
+	if (_stream_need_dma(stream)) {
 		us_device_export_to_dma(stream->dev);
 	}
 	if (us_device_switch_capturing(stream->dev, true) < 0) {
@@ -300,15 +443,196 @@ static us_workers_pool_s *_stream_init_one(us_stream_s *stream) {
 		return NULL;
 }
 
-static void _stream_expose_frame(us_stream_s *stream, us_frame_s *frame, unsigned captured_fps) {
+static bool _stream_need_dma(us_stream_s *stream) {
+	return (
+		us_encoder_get_backend(stream->enc->type)->need_dma
+		|| (_RUN(h264) && !us_is_jpeg(stream->dev->run->format))
+	);
+}
+
+static int _stream_reconfigure(us_stream_s *stream, us_workers_pool_s *pool) {
+#	define DR(x_next) stream->dev->run->x_next
+
+	// Воркеры, HTTP-клиенты и энкодеры остаются жить, меняются только формат и буферы устройства.
+	// Перед этим все буферы должны вернуться от воркеров, иначе их нельзя будет освободить.
+	us_workers_pool_wait_idle(pool);
+	for (unsigned number = 0; number < pool->n_workers; ++number) {
+		us_encoder_job_s *const job = (us_encoder_job_s *)(pool->workers[number].job);
+		if (job->hw != NULL) {
+			us_device_release_buffer(stream->dev, job->hw);
+			job->hw = NULL;
+		}
+	}
+	_stream_drain_held(stream);
+
+	const unsigned old_width = DR(width);
+	const unsigned old_height = DR(height);
+	const unsigned old_format = DR(format);
+
+	// При полном перезапуске энкодеры и H264 подстроятся под новую геометрию сами:
+	// prepare() пересоздает контексты другого размера, а цикл стрима - H264.
+	if (us_device_reconfigure(stream->dev) < 0) {
+		return -1;
+	}
+	if (us_is_jpeg(DR(format)) != us_is_jpeg(old_format) || DR(n_bufs) < pool->n_workers) {
+		// Нужен другой тип энкодера или меньше воркеров - тут поможет только полный перезапуск
+		return -1;
+	}
+	if (_stream_need_dma(stream)) {
+		us_device_export_to_dma(stream->dev);
+	}
+
+	if (DR(width) != old_width || DR(height) != old_height || DR(format) != old_format) {
+		if (us_encoder_resize(stream->enc, stream->dev) < 0) {
+			return -1;
+		}
+		_stream_update_h264(stream);
+	}
+
+	return us_device_switch_capturing(stream->dev, true);
+
+#	undef DR
+}
+
+static void _stream_update_h264(us_stream_s *stream) {
+#	define DR(x_next) stream->dev->run->x_next
+
+	// До первого открытия устройства H264 создается под геометрию из опций,
+	// а здесь приводится к фактической, в том числе после полного перезапуска
+	if (
+		_RUN(h264) == NULL
+		|| (_RUN(h264->width) == DR(width) && _RUN(h264->height) == DR(height) && _RUN(h264->format) == DR(format))
+	) {
+		return;
+	}
+	US_LOG_INFO("H264: Recreating the encoder for %ux%u ...", DR(width), DR(height));
+	us_h264_params_s params;
+	us_stream_get_h264_params(stream, &params);
+	us_h264_stream_destroy(_RUN(h264));
+	_RUN(h264) = us_h264_stream_init(
+		stream->h264_sink, stream->h264_encoder,
+		DR(width), DR(height), DR(format), stream->h264_jpeg_downscale,
+		&params);
+
+#	undef DR
+}
+
+static bool _stream_is_same_raw(us_stream_s *stream, us_frame_s *raw, uint64_t *last_hash, unsigned *n_same) {
+	// Рабочий стол KVM почти всегда статичен: одинаковый сырой кадр не нужно даже кодировать.
+	// Хеш переезжает в JPEG, и сервер сравнивает кадры за O(1) вместо memcmp().
+	if (stream->drop_same_frames == 0) {
+		return false;
+	}
+	raw->hash = us_hash64(raw->data, raw->used);
+	if (raw->hash == *last_hash && *n_same < stream->drop_same_frames) {
+		*n_same += 1;
+		return true;
+	}
+	*last_hash = raw->hash;
+	*n_same = 0;
+	return false;
+}
+
+static us_ring_frame_s *_stream_ring_acquire(us_stream_s *stream) {
+	us_ring_frame_s *const item = us_ring_acquire(_RUN(ring));
+	if (item->opaque != NULL) {
+		// Кадр больше никем не читается, а до очередного прохода цикла буфер еще не вернули
+		us_device_release_buffer(stream->dev, (us_hw_buffer_s *)item->opaque);
+		item->opaque = NULL;
+		_RUN(n_held) -= 1;
+	}
+	return item;
+}
+
+static int _stream_release_held(us_stream_s *stream) {
+	// Буферы освобождает только поток стрима, а HTTP-клиенты и воркеры просто отпускают ссылки
+	_stream_free_orphans(stream, false);
+	int retval = 0;
+	for (unsigned index = 0; index < _RUN(ring->n_items) && _RUN(n_held) > 0; ++index) {
+		us_ring_frame_s *const item = _RUN(ring->items[index]);
+		if (item->opaque != NULL && atomic_load(&item->refs) == 0) {
+			if (us_device_release_buffer(stream->dev, (us_hw_buffer_s *)item->opaque) < 0) {
+				retval = -1;
+			}
+			item->opaque = NULL;
+			_RUN(n_held) -= 1;
+		}
+	}
+	return retval;
+}
+
+static void _stream_drain_held(us_stream_s *stream) {
+	// Перед освобождением буферов устройства опубликованный кадр заменяется копией
+	if (_RUN(n_held) == 0) {
+		return;
+	}
+	_stream_expose_frame(stream, NULL, 0, 0, NULL);
+	_stream_release_held(stream);
+	if (_RUN(n_held) == 0) {
+		return;
+	}
+
+	// При остановке HTTP-сервер уже не отпустит ссылки, поэтому ждем недолго.
+	// Медленный клиент может держать кадр сколько угодно, сбрасывая таймаут записи,
+	// так что дольше таймаута сервера захват не держим и забираем у них буферы.
+	const unsigned timeout = (atomic_load(&_RUN(stop)) ? 1 : stream->held_timeout);
+	US_LOG_INFO("Waiting up to %u seconds for %u held device buffers ...", timeout, _RUN(n_held));
+	for (unsigned count = 0; _RUN(n_held) > 0 && count < timeout * 100; ++count) {
+		usleep(10000);
+		_stream_release_held(stream);
+	}
+	if (_RUN(n_held) == 0) {
+		return;
+	}
+
+	US_LOG_INFO("Clients are still sending %u held device buffers, detaching them", _RUN(n_held));
+	for (unsigned index = 0; index < _RUN(ring->n_items); ++index) {
+		us_ring_frame_s *const item = _RUN(ring->items[index]);
+		if (item->opaque == NULL) {
+			continue;
+		}
+		us_stream_orphan_s orphan = {.item = item};
+		if (us_device_detach_buffer(stream->dev, (us_hw_buffer_s *)item->opaque, &orphan.mem) < 0) {
+			US_LOG_ERROR("Can't detach held device buffer, dropping it");
+		} else {
+			US_REALLOC(_RUN(orphans), _RUN(n_orphans) + 1);
+			_RUN(orphans[_RUN(n_orphans)]) = orphan;
+			_RUN(n_orphans) += 1;
+		}
+		item->opaque = NULL;
+		_RUN(n_held) -= 1;
+	}
+}
+
+static void _stream_free_orphans(us_stream_s *stream, bool force) {
+	// Копия живет, пока ее кадр не отпустит последний клиент
+	for (unsigned index = 0; index < _RUN(n_orphans);) {
+		us_stream_orphan_s *const orphan = &_RUN(orphans[index]);
+		if (force || atomic_load(&orphan->item->refs) == 0) {
+			us_device_free_orphan(&orphan->mem);
+			_RUN(n_orphans) -= 1;
+			_RUN(orphans[index]) = _RUN(orphans[_RUN(n_orphans)]);
+		} else {
+			++index;
+		}
+	}
+	if (_RUN(n_orphans) == 0) {
+		free(_RUN(orphans));
+		_RUN(orphans) = NULL;
+	}
+}
+
+static void _stream_expose_frame(
+	us_stream_s *stream, us_ring_frame_s *item,
+	unsigned captured_fps, unsigned stale_fps, const us_pacer_stat_s *pacing) {
 #	define VID(x_next) _RUN(video->x_next)
 
+	const bool alive = (item != NULL);
 	us_frame_s *new = NULL;
 
 	US_MUTEX_LOCK(VID(mutex));
 
-	if (frame != NULL) {
-		new = frame;
+	if (alive) {
 		_RUN(last_as_blank_ts) = 0; // Останавливаем таймер
 		US_LOG_DEBUG("Exposed ALIVE video frame");
 
@@ -344,19 +668,34 @@ static void _stream_expose_frame(us_stream_s *stream, us_frame_s *frame, unsigne
 		}
 	}
 
-	if (new != NULL) {
-		us_frame_copy(new, VID(frame));
+	if (alive) {
+		item->frame->online = true;
+	} else if (new != NULL || VID(frame->online)) {
+		// Опубликованный кадр могут читать HTTP-клиенты, поэтому для офлайна берем новый
+		item = _stream_ring_acquire(stream);
+		us_frame_copy((new != NULL ? new : VID(frame)), item->frame);
+		item->frame->online = false;
+	}
+	if (item != NULL) {
+		us_ring_frame_unref(VID(item));
+		VID(item) = item;
+		VID(frame) = item->frame;
 	}
-	VID(frame->online) = (frame != NULL);
 	VID(captured_fps) = captured_fps;
+	VID(stale_fps) = stale_fps;
+	if (pacing != NULL) {
+		VID(pacing) = *pacing;
+	} else {
+		memset(&VID(pacing), 0, sizeof(VID(pacing)));
+	}
 	atomic_store(&VID(updated), true);
 
 	US_MUTEX_UNLOCK(VID(mutex));
 
-	new = (frame ? frame : stream->blank);
+	new = (alive ? item->frame : stream->blank);
 	_SINK_PUT(sink, new);
 
-	if (frame == NULL) {
+	if (!alive) {
 		_SINK_PUT(raw_sink, stream->blank);
 		_H264_PUT(stream->blank, false);
 	}
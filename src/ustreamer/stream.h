@@ -37,11 +37,14 @@
 #include "../libs/logging.h"
 #include "../libs/frame.h"
 #include "../libs/memsink.h"
+#include "../libs/ring.h"
+#include "../libs/hash.h"
 
 #include "blank.h"
 #include "device.h"
 #include "encoder.h"
 #include "workers.h"
+#include "pacer.h"
 #include "h264.h"
 #include "s2drm.h"
 #ifdef WITH_GPIO
@@ -50,8 +53,11 @@
 
 
 typedef struct {
-	us_frame_s		*frame;
+	us_ring_frame_s	*item;
+	us_frame_s		*frame; // item->frame, immutable while published
 	unsigned		captured_fps;
+	unsigned		stale_fps;
+	us_pacer_stat_s	pacing;
 	atomic_bool		updated;
 	pthread_mutex_t	mutex;
 
@@ -59,29 +65,48 @@ typedef struct {
 } us_video_s;
 
 typedef struct {
+	us_ring_frame_s	*item;
+	us_hw_orphan_s	mem;
+} us_stream_orphan_s;
+
+typedef struct {
+	us_ring_s		*ring; // Encoded frames, used only by the stream thread
 	us_video_s		*video;
 	long double		last_as_blank_ts;
 
 	us_h264_stream_s	*h264;
+	pthread_mutex_t		h264_params_mutex; // Guards us_stream_s.h264_params, see us_stream_set_h264_params()
+	atomic_bool			h264_params_updated;
+
+	unsigned		n_held; // Device buffers referred by the ring frames, see --mjpeg-passthrough
+	us_stream_orphan_s	*orphans; // Detached copies of the held buffers which slow clients are still sending
+	unsigned			n_orphans;
 
 	atomic_bool		stop;
+	atomic_bool		restart;
 } us_stream_runtime_s;
 
 typedef struct {
+	char			*name; // NULL for the main stream
 	us_device_s		*dev;
 	us_encoder_s	*enc;
 
 	us_frame_s		*blank;
 	int				last_as_blank;
 	bool			slowdown;
+	bool			drop_stale_frames;
+	unsigned		drop_same_frames;
+	bool			mjpeg_passthrough;
+	unsigned		held_timeout; // Seconds to wait for the clients before detaching the held buffers
 	unsigned		error_delay;
 
 	us_memsink_s	*sink;
 	us_memsink_s	*raw_sink;
 
 	us_memsink_s	*h264_sink;
-	unsigned		h264_bitrate;
-	unsigned		h264_gop;
+	us_h264_encoder_e	h264_encoder;
+	unsigned		h264_jpeg_downscale;
+	us_h264_params_s	h264_params;
 	char			*h264_m2m_path;
 
 	us_stream_runtime_s	*run;
@@ -93,5 +118,9 @@ void us_stream_destroy(us_stream_s *stream);
 
 void us_stream_loop(us_stream_s *stream);
 void us_stream_loop_break(us_stream_s *stream);
+void us_stream_loop_restart(us_stream_s *stream);
 
 bool us_stream_has_clients(us_stream_s *stream);
+
+void us_stream_get_h264_params(us_stream_s *stream, us_h264_params_s *params);
+void us_stream_set_h264_params(us_stream_s *stream, const us_h264_params_s *params);
@@ -0,0 +1,384 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#include "synth.h"
+
+
+static const struct {
+	uint8_t y, u, v;
+	uint8_t r, g, b;
+} _BARS[] = {
+	{235, 128, 128,	255, 255, 255}, // White
+	{210,  16, 146,	255, 255,   0}, // Yellow
+	{170, 166,  16,	  0, 255, 255}, // Cyan
+	{145,  54,  34,	  0, 255,   0}, // Green
+	{106, 202, 222,	255,   0, 255}, // Magenta
+	{ 81,  90, 240,	255,   0,   0}, // Red
+	{ 41, 240, 110,	  0,   0, 255}, // Blue
+	{ 16, 128, 128,	  0,   0,   0}, // Black
+};
+
+
+static int _synth_init_replay(us_synth_s *synth, const char *path);
+static void _synth_init_pattern(us_synth_s *synth);
+static void _synth_draw_row(const us_synth_s *synth, uint8_t *row, bool gray);
+static void _synth_draw_chroma_row(const us_synth_s *synth, uint8_t *row, bool gray);
+static void _synth_draw_band(const us_synth_s *synth, uint8_t *data, unsigned band_y);
+static int _synth_arm_timer(us_synth_s *synth);
+static uint64_t _synth_get_deadline_ns(const us_synth_s *synth, uint64_t number);
+static uint64_t _synth_get_now_ns(void);
+static unsigned _synth_get_bytes_per_pixel(unsigned format);
+
+
+us_synth_s *us_synth_init(const char *replay_path, unsigned format, unsigned width, unsigned height, unsigned fps) {
+	us_synth_s *synth;
+	US_CALLOC(synth, 1);
+	synth->fd = -1;
+	// В файле плоскости все равно лежат подряд, поэтому M-форматы ничем не отличаются от обычных
+	switch (format) {
+		case V4L2_PIX_FMT_NV12M: synth->format = V4L2_PIX_FMT_NV12; break;
+		case V4L2_PIX_FMT_NV16M: synth->format = V4L2_PIX_FMT_NV16; break;
+		default: synth->format = format;
+	}
+	synth->width = width;
+	synth->height = height;
+	synth->stride = width * _synth_get_bytes_per_pixel(synth->format);
+	synth->frame_size = (size_t)synth->stride * height;
+	if (us_is_semiplanar(synth->format)) {
+		us_frame_plane_s planes[US_FRAME_MAX_PLANES];
+		assert(us_frame_get_planes_layout(synth->format, synth->stride, height, planes) == 2);
+		synth->chroma = planes[1];
+		synth->frame_size = planes[1].offset + planes[1].size;
+	}
+	synth->fps = (fps == 0 ? US_SYNTH_DEFAULT_FPS : fps);
+
+	if (replay_path != NULL) {
+		if (_synth_init_replay(synth, replay_path) < 0) {
+			goto error;
+		}
+	} else {
+		if (synth->stride == 0) {
+			US_LOG_ERROR("Test pattern can't be generated in the JPEG format");
+			goto error;
+		}
+		_synth_init_pattern(synth);
+	}
+
+	if ((synth->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+		US_LOG_PERROR("Can't create synthetic source timer");
+		goto error;
+	}
+
+	US_LOG_INFO("Using synthetic source: %ux%u, %u fps", synth->width, synth->height, synth->fps);
+	return synth;
+
+	error:
+		us_synth_destroy(synth);
+		return NULL;
+}
+
+void us_synth_destroy(us_synth_s *synth) {
+	if (synth->fd >= 0) {
+		close(synth->fd);
+	}
+	if (synth->map != NULL) {
+		munmap(synth->map, synth->map_size);
+	}
+	US_DELETE(synth->frames, free);
+	US_DELETE(synth->pattern, free);
+	free(synth);
+}
+
+int us_synth_start(us_synth_s *synth) {
+	synth->start_ns = _synth_get_now_ns();
+	synth->number = 0;
+	return _synth_arm_timer(synth);
+}
+
+int us_synth_consume(us_synth_s *synth, uint64_t *number, unsigned *skipped) {
+	uint64_t expired;
+	if (read(synth->fd, &expired, sizeof(expired)) < 0) {
+		if (errno == EAGAIN) {
+			return -2;
+		}
+		US_LOG_PERROR("Can't read synthetic source timer");
+		return -1;
+	}
+
+	// Кадры, которые мы не успели забрать, пропадают так же, как у настоящей камеры
+	const uint64_t elapsed = _synth_get_now_ns() - synth->start_ns;
+	uint64_t due = (elapsed / 1000000000) * synth->fps + (elapsed % 1000000000) * synth->fps / 1000000000;
+	if (due < synth->number) {
+		due = synth->number;
+	}
+	*skipped = due - synth->number;
+	*number = due;
+
+	synth->number = due + 1;
+	return _synth_arm_timer(synth);
+}
+
+void us_synth_fill(us_synth_s *synth, uint64_t number, us_frame_s *frame) {
+	assert(frame->allocated >= synth->max_frame_size);
+
+	if (synth->frames != NULL) {
+		const us_synth_frame_s *const item = &synth->frames[number % synth->n_frames];
+		memcpy(frame->data, synth->map + item->offset, item->size);
+		frame->used = item->size;
+
+	} else {
+		frame->used = synth->frame_size;
+		memcpy(frame->data, synth->pattern, frame->used);
+
+		const unsigned step = us_max_u(synth->height / 90, 1);
+		const unsigned band_y = (number * step) % (synth->height - synth->band_height + 1);
+		_synth_draw_band(synth, frame->data, band_y);
+	}
+}
+
+static int _synth_init_replay(us_synth_s *synth, const char *path) {
+	int fd = -1;
+	struct stat st;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+		US_LOG_PERROR("Can't open replay file %s", path);
+		goto error;
+	}
+	if (fstat(fd, &st) < 0) {
+		US_LOG_PERROR("Can't stat replay file %s", path);
+		goto error;
+	}
+	if (st.st_size <= 0) {
+		US_LOG_ERROR("Replay file %s is empty", path);
+		goto error;
+	}
+	synth->map_size = st.st_size;
+	if ((synth->map = mmap(NULL, synth->map_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		synth->map = NULL;
+		US_LOG_PERROR("Can't map replay file %s", path);
+		goto error;
+	}
+	close(fd);
+	fd = -1;
+
+	if (synth->stride > 0) {
+		const size_t frame_size = synth->frame_size;
+		synth->n_frames = synth->map_size / frame_size;
+		if (synth->n_frames == 0) {
+			US_LOG_ERROR("Replay file %s is smaller than a single %ux%u frame", path, synth->width, synth->height);
+			goto error;
+		}
+		if (synth->map_size % frame_size != 0) {
+			US_LOG_ERROR("Replay file %s has %zu trailing bytes; ignored", path, synth->map_size % frame_size);
+		}
+		US_CALLOC(synth->frames, synth->n_frames);
+		for (unsigned index = 0; index < synth->n_frames; ++index) {
+			synth->frames[index].offset = index * frame_size;
+			synth->frames[index].size = frame_size;
+		}
+		synth->max_frame_size = frame_size;
+
+	} else {
+		// MJPEG: просто склеенные JPEG-файлы, режем по SOI
+		static const uint8_t soi[] = {0xFF, 0xD8, 0xFF};
+		const uint8_t *const end = synth->map + synth->map_size;
+		const uint8_t *begin = memmem(synth->map, synth->map_size, soi, sizeof(soi));
+		unsigned capacity = 0;
+
+		while (begin != NULL) {
+			const uint8_t *next = memmem(begin + sizeof(soi), end - begin - sizeof(soi), soi, sizeof(soi));
+			const size_t size = (next != NULL ? next : end) - begin;
+
+			if (synth->n_frames == capacity) {
+				capacity = us_max_u(capacity * 2, 64);
+				US_REALLOC(synth->frames, capacity);
+			}
+			synth->frames[synth->n_frames].offset = begin - synth->map;
+			synth->frames[synth->n_frames].size = size;
+			synth->max_frame_size = (size > synth->max_frame_size ? size : synth->max_frame_size);
+			++synth->n_frames;
+
+			begin = next;
+		}
+		if (synth->n_frames == 0) {
+			US_LOG_ERROR("Replay file %s doesn't contain any JPEG frames", path);
+			goto error;
+		}
+	}
+
+	US_LOG_INFO("Replaying %u frames from %s", synth->n_frames, path);
+	return 0;
+
+	error:
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+}
+
+static void _synth_init_pattern(us_synth_s *synth) {
+	synth->max_frame_size = synth->frame_size;
+	US_CALLOC(synth->pattern, synth->max_frame_size);
+	synth->band_height = us_max_u(synth->height / 16, 2);
+
+	_synth_draw_row(synth, synth->pattern, false);
+	for (unsigned y = 1; y < synth->height; ++y) {
+		memcpy(synth->pattern + y * synth->stride, synth->pattern, synth->stride);
+	}
+
+	if (synth->chroma.size > 0) {
+		uint8_t *const chroma = synth->pattern + synth->chroma.offset;
+		_synth_draw_chroma_row(synth, chroma, false);
+		for (size_t offset = synth->chroma.stride; offset < synth->chroma.size; offset += synth->chroma.stride) {
+			memcpy(chroma + offset, chroma, synth->chroma.stride);
+		}
+	}
+}
+
+static void _synth_draw_band(const us_synth_s *synth, uint8_t *data, unsigned band_y) {
+	for (unsigned y = band_y; y < band_y + synth->band_height; ++y) {
+		_synth_draw_row(synth, data + y * synth->stride, true);
+	}
+
+	if (synth->chroma.size > 0) {
+		// Строк цветности может быть меньше, чем яркости (NV12)
+		const unsigned chroma_height = synth->chroma.size / synth->chroma.stride;
+		const unsigned begin = band_y * chroma_height / synth->height;
+		const unsigned end = (band_y + synth->band_height) * chroma_height / synth->height;
+		for (unsigned y = begin; y < end; ++y) {
+			_synth_draw_chroma_row(synth, data + synth->chroma.offset + y * synth->chroma.stride, true);
+		}
+	}
+}
+
+static void _synth_draw_row(const us_synth_s *synth, uint8_t *row, bool gray) {
+	// Цветные полосы по ширине кадра или сплошная серая строка для бегущей полосы
+#	define BAR(x_x) (gray ? 0 : (x_x) * US_ARRAY_LEN(_BARS) / synth->width)
+#	define GRAY(x_c) (gray ? 128 : (x_c))
+
+	switch (synth->format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_UYVY: {
+			const bool uyvy = (synth->format == V4L2_PIX_FMT_UYVY);
+			for (unsigned x = 0; x + 1 < synth->width; x += 2) {
+				const unsigned index = BAR(x);
+				uint8_t *const ptr = row + x * 2;
+				const uint8_t y = GRAY(_BARS[index].y);
+				ptr[uyvy ? 1 : 0] = y;
+				ptr[uyvy ? 3 : 2] = y;
+				ptr[uyvy ? 0 : 1] = GRAY(_BARS[index].u);
+				ptr[uyvy ? 2 : 3] = GRAY(_BARS[index].v);
+			}
+			break;
+		}
+
+		case V4L2_PIX_FMT_RGB24:
+			for (unsigned x = 0; x < synth->width; ++x) {
+				const unsigned index = BAR(x);
+				uint8_t *const ptr = row + x * 3;
+				ptr[0] = GRAY(_BARS[index].r);
+				ptr[1] = GRAY(_BARS[index].g);
+				ptr[2] = GRAY(_BARS[index].b);
+			}
+			break;
+
+		case V4L2_PIX_FMT_RGB565:
+			for (unsigned x = 0; x < synth->width; ++x) {
+				const unsigned index = BAR(x);
+				const uint16_t pixel = (
+					((GRAY(_BARS[index].r) >> 3) << 11)
+					| ((GRAY(_BARS[index].g) >> 2) << 5)
+					| (GRAY(_BARS[index].b) >> 3)
+				);
+				row[x * 2] = pixel & 0xFF;
+				row[x * 2 + 1] = pixel >> 8;
+			}
+			break;
+
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV24: // Only the luma plane, see _synth_draw_chroma_row()
+			for (unsigned x = 0; x < synth->width; ++x) {
+				row[x] = GRAY(_BARS[BAR(x)].y);
+			}
+			break;
+
+		default: assert(0 && "Unsupported format");
+	}
+
+#	undef GRAY
+#	undef BAR
+}
+
+static void _synth_draw_chroma_row(const us_synth_s *synth, uint8_t *row, bool gray) {
+	// Чередующиеся U и V: по паре на два пикселя в NV12/NV16 и на каждый в NV24
+#	define BAR(x_x) (gray ? 0 : (x_x) * US_ARRAY_LEN(_BARS) / synth->width)
+#	define GRAY(x_c) (gray ? 128 : (x_c))
+
+	const unsigned step = (synth->format == V4L2_PIX_FMT_NV24 ? 1 : 2);
+	for (unsigned x = 0; x + step <= synth->width; x += step) {
+		const unsigned index = BAR(x);
+		uint8_t *const ptr = row + (x / step) * 2;
+		ptr[0] = GRAY(_BARS[index].u);
+		ptr[1] = GRAY(_BARS[index].v);
+	}
+
+#	undef GRAY
+#	undef BAR
+}
+
+static int _synth_arm_timer(us_synth_s *synth) {
+	const uint64_t deadline = _synth_get_deadline_ns(synth, synth->number);
+	struct itimerspec its = {0};
+	its.it_value.tv_sec = deadline / 1000000000;
+	its.it_value.tv_nsec = deadline % 1000000000;
+	if (timerfd_settime(synth->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+		US_LOG_PERROR("Can't arm synthetic source timer");
+		return -1;
+	}
+	return 0;
+}
+
+static uint64_t _synth_get_deadline_ns(const us_synth_s *synth, uint64_t number) {
+	// Считаем от старта, а не от предыдущего кадра, чтобы не накапливать ошибку
+	return synth->start_ns + (number / synth->fps) * 1000000000 + (number % synth->fps) * 1000000000 / synth->fps;
+}
+
+static uint64_t _synth_get_now_ns(void) {
+	struct timespec ts;
+	assert(!clock_gettime(CLOCK_MONOTONIC, &ts));
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static unsigned _synth_get_bytes_per_pixel(unsigned format) {
+	switch (format) {
+		case V4L2_PIX_FMT_YUYV:
+		case V4L2_PIX_FMT_UYVY:
+		case V4L2_PIX_FMT_RGB565: return 2;
+		case V4L2_PIX_FMT_RGB24: return 3;
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV24: return 1; // Luma plane
+		default: return 0; // MJPEG, JPEG
+	}
+}
@@ -0,0 +1,84 @@
+/*****************************************************************************
+#                                                                            #
+#    uStreamer - Lightweight and fast MJPEG-HTTP streamer.                   #
+#                                                                            #
+#    Copyright (C) 2018-2022  Maxim Devaev <mdevaev@gmail.com>               #
+#                                                                            #
+#    This program is free software: you can redistribute it and/or modify    #
+#    it under the terms of the GNU General Public License as published by    #
+#    the Free Software Foundation, either version 3 of the License, or       #
+#    (at your option) any later version.                                     #
+#                                                                            #
+#    This program is distributed in the hope that it will be useful,         #
+#    but WITHOUT ANY WARRANTY; without even the implied warranty of          #
+#    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the           #
+#    GNU General Public License for more details.                            #
+#                                                                            #
+#    You should have received a copy of the GNU General Public License       #
+#    along with this program.  If not, see <https://www.gnu.org/licenses/>.  #
+#                                                                            #
+*****************************************************************************/
+
+
+
+#pragma once
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <assert.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include <linux/videodev2.h>
+
+#include "../libs/tools.h"
+#include "../libs/array.h"
+#include "../libs/logging.h"
+#include "../libs/frame.h"
+
+
+#define US_SYNTH_DEFAULT_FPS	((unsigned)30)
+
+
+typedef struct {
+	size_t	offset;
+	size_t	size;
+} us_synth_frame_s;
+
+typedef struct {
+	int					fd; // timerfd, readable when the next frame is due
+	unsigned			format;
+	unsigned			width;
+	unsigned			height;
+	unsigned			stride; // Of the luma plane for the semi-planar formats
+	us_frame_plane_s	chroma; // Semi-planar formats only, zero size otherwise
+	size_t				frame_size; // Raw formats only
+	unsigned			fps;
+	size_t				max_frame_size;
+
+	uint8_t				*map; // Replay file
+	size_t				map_size;
+	us_synth_frame_s	*frames;
+	unsigned			n_frames;
+
+	uint8_t				*pattern; // Color bars
+	unsigned			band_height;
+
+	uint64_t			start_ns;
+	uint64_t			number;
+} us_synth_s;
+
+
+us_synth_s *us_synth_init(const char *replay_path, unsigned format, unsigned width, unsigned height, unsigned fps);
+void us_synth_destroy(us_synth_s *synth);
+
+int us_synth_start(us_synth_s *synth);
+int us_synth_consume(us_synth_s *synth, uint64_t *number, unsigned *skipped);
+void us_synth_fill(us_synth_s *synth, uint64_t number, us_frame_s *frame);
@@ -27,7 +27,7 @@ static void *_worker_thread(void *v_worker);
 
 
 us_workers_pool_s *us_workers_pool_init(
-	const char *name, const char *wr_prefix, unsigned n_workers, long double desired_interval,
+	const char *name, const char *wr_prefix, unsigned n_workers,
 	us_workers_pool_job_init_f job_init, void *job_init_arg,
 	us_workers_pool_job_destroy_f job_destroy,
 	us_workers_pool_run_job_f run_job) {
@@ -37,7 +37,6 @@ us_workers_pool_s *us_workers_pool_init(
 	us_workers_pool_s *pool;
 	US_CALLOC(pool, 1);
 	pool->name = name;
-	pool->desired_interval = desired_interval;
 	pool->job_destroy = job_destroy;
 	pool->run_job = run_job;
 
@@ -129,6 +128,12 @@ us_worker_s *us_workers_pool_wait(us_workers_pool_s *pool) {
 	return ready_wr;
 }
 
+void us_workers_pool_wait_idle(us_workers_pool_s *pool) {
+	US_MUTEX_LOCK(pool->free_workers_mutex);
+	US_COND_WAIT_FOR(pool->free_workers == pool->n_workers, pool->free_workers_cond, pool->free_workers_mutex);
+	US_MUTEX_UNLOCK(pool->free_workers_mutex);
+}
+
 void us_workers_pool_assign(us_workers_pool_s *pool, us_worker_s *ready_wr/*, void *job*/) {
 	if (pool->oldest_wr == NULL) {
 		pool->oldest_wr = ready_wr;
@@ -157,7 +162,7 @@ void us_workers_pool_assign(us_workers_pool_s *pool, us_worker_s *ready_wr/*, vo
 	US_MUTEX_UNLOCK(pool->free_workers_mutex);
 }
 
-long double us_workers_pool_get_fluency_delay(us_workers_pool_s *pool, us_worker_s *ready_wr) {
+long double us_workers_pool_get_min_interval(us_workers_pool_s *pool, us_worker_s *ready_wr) {
 	const long double approx_job_time = pool->approx_job_time * 0.9 + ready_wr->last_job_time * 0.1;
 
 	US_LOG_VERBOSE("Correcting pool's %s approx_job_time: %.3Lf -> %.3Lf (last_job_time=%.3Lf)",
@@ -165,14 +170,8 @@ long double us_workers_pool_get_fluency_delay(us_workers_pool_s *pool, us_worker
 
 	pool->approx_job_time = approx_job_time;
 
-	const long double min_delay = pool->approx_job_time / pool->n_workers; // Среднее время работы размазывается на N воркеров
-
-	if (pool->desired_interval > 0 && min_delay > 0 && pool->desired_interval > min_delay) {
-		// Искусственное время задержки на основе желаемого FPS, если включен --desired-fps
-		// и аппаратный fps не попадает точно в желаемое значение
-		return pool->desired_interval;
-	}
-	return min_delay;
+	// Среднее время работы размазывается на N воркеров, желаемый FPS учитывает пейсер
+	return pool->approx_job_time / pool->n_workers;
 }
 
 static void *_worker_thread(void *v_worker) {